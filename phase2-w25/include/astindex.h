@@ -0,0 +1,58 @@
+/* astindex.h */
+#ifndef ASTINDEX_H
+#define ASTINDEX_H
+
+#include "parser.h"
+#include "intern.h"
+
+// Side index of the AST, built by the parser as it creates nodes
+// (parser_set_index).  Every node is linked into the list of its type, and
+// identifiers and function calls also into the list of uses of their name,
+// in the order they were created.  Queries then cost the matches rather
+// than a walk of the tree.
+//
+// The lists run through ASTNode.by_type and ASTNode.by_name and are
+// circular around heads in the index, so a node leaves them in O(1)
+// without the index: free_ast, recycle_ast and the parser's own discards
+// unlink what they release, and ast_set_type moves a node the optimizer
+// rewrites.  An index in use must not be moved.
+
+#define AST_NODE_TYPE_COUNT (AST_FUNCTION_DECL + 1)
+
+typedef struct ASTIndex {
+    ASTLink types[AST_NODE_TYPE_COUNT];
+    ASTLink **names;            // Heads of the uses of each symbol, NULL if none yet
+    uint32_t name_capacity;
+} ASTIndex;
+
+// Index functions.  ast_index_free unlinks the nodes still indexed, which
+// may outlive it.  Iterate with
+//   for (ASTNode *n = ast_index_first(index, AST_WHILE); n; n = ast_index_next(index, n))
+// and likewise over ast_index_first_use/ast_index_next_use for the
+// identifiers and calls naming one symbol.
+void ast_index_init(ASTIndex *index);
+void ast_index_free(ASTIndex *index);
+void ast_index_add(ASTIndex *index, ASTNode *node);
+void ast_index_add_use(ASTIndex *index, ASTNode *node);
+void ast_index_retype(ASTIndex *index, ASTNode *node, ASTNodeType type);
+ASTNode *ast_index_first(const ASTIndex *index, ASTNodeType type);
+ASTNode *ast_index_next(const ASTIndex *index, const ASTNode *node);
+ASTNode *ast_index_first_use(const ASTIndex *index, SymbolId name);
+ASTNode *ast_index_next_use(const ASTIndex *index, const ASTNode *node);
+
+static inline void ast_link_remove(ASTLink *link) {
+    if (link->next) {
+        link->next->prev = link->prev;
+        link->prev->next = link->next;
+        link->next = NULL;
+        link->prev = NULL;
+    }
+}
+
+// Take a node out of every index list it is in
+static inline void ast_index_remove(ASTNode *node) {
+    ast_link_remove(&node->by_type);
+    ast_link_remove(&node->by_name);
+}
+
+#endif /* ASTINDEX_H */
@@ -0,0 +1,75 @@
+/* batch.h */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "parser.h"
+#include "writer.h"
+
+// Batch evaluation of one integer function over columns of arguments.
+// The function body (declarations, assignments, fi/esle, nruter and
+// integer expressions) is flattened into a kernel: a straight-line list
+// of operations on registers of BATCH_LANES rows each, with branches
+// turned into lane masks.  Rows run in chunks of BATCH_LANES.
+
+#define BATCH_LANES 256
+
+typedef enum {
+    BATCH_CONST,            // dest = imm, in every chunk
+    BATCH_ADD, BATCH_SUB, BATCH_MUL,
+    BATCH_DIV,              // Lanes in 'mask' with b == 0 fail
+    BATCH_LT, BATCH_GT, BATCH_LE, BATCH_GE, BATCH_EQ, BATCH_NE,     // imm where true, else 0
+    BATCH_FACTORIAL,        // Lanes in 'mask' that overflow fail
+    BATCH_TEST,             // Mask: all ones where a != 0
+    BATCH_AND,              // Bitwise, for masks
+    BATCH_AND_NOT,          // a & ~b
+    BATCH_OR,
+    BATCH_BIT,              // 1 where mask a is set, else 0
+    BATCH_SELECT            // dest = mask ? a : b
+} BatchOp;
+
+typedef struct {
+    unsigned char op;       // BatchOp
+    int dest;
+    int a;
+    int b;
+    int mask;               // Register of lanes that may fail, or condition of SELECT
+    long long imm;
+} BatchInstr;
+
+// Instruction sets the kernel loop can be built for
+typedef enum {
+    BATCH_ISA_GENERIC,      // Portable vector code for the build target (SSE2 on x86-64)
+    BATCH_ISA_SSE42,
+    BATCH_ISA_AVX2,
+    BATCH_ISA_COUNT
+} BatchIsa;
+
+typedef struct {
+    int params;             // Registers 0..params-1 hold the argument columns
+    int rows_register;      // Mask of the rows present in the chunk
+    int result;             // Register holding each row's return value
+    int register_count;
+    BatchInstr *instrs;
+    int instr_count;
+    int instr_capacity;
+} BatchKernel;
+
+// Batch functions.  batch_compile returns the number of errors, reported to
+// 'errors' for each construct a kernel cannot express (loops, calls,
+// printing, globals, taolf); the kernel must be freed either way.
+// batch_run evaluates rows [0, rows) and stores each result, or 0 for rows
+// that stop with a runtime error (division by zero or lairotcaf overflow)
+// and get failed[row] set.  It returns the number of failed rows.
+int batch_compile(ASTNode *function, BatchKernel *kernel, Writer *errors);
+size_t batch_run(const BatchKernel *kernel, BatchIsa isa, const long long *const *columns,
+                 size_t rows, long long *results, unsigned char *failed);
+void batch_free(BatchKernel *kernel);
+
+// Instruction set support: the best one for this CPU, whether one can run
+// here, and its name
+BatchIsa batch_best_isa(void);
+int batch_isa_supported(BatchIsa isa);
+const char *batch_isa_name(BatchIsa isa);
+
+#endif /* BATCH_H */
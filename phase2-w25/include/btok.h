@@ -0,0 +1,73 @@
+/* btok.h */
+#ifndef BTOK_H
+#define BTOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tokens.h"
+#include "writer.h"
+
+// Binary token stream format (.btok)
+//
+//   header   BtokHeader, in the writer's byte order (checked through
+//            byte_order; a file from another byte order is refused)
+//   records  one per token, all fields varint encoded:
+//              (type << 1 | has_error), [error], offset delta from the end
+//              of the previous token, length, line delta, column,
+//              [string index when BTOK_FLAG_STRINGS is set]
+//   strings  optional: uint32 offsets[string_count], then NUL-terminated
+//            lexemes (deduplicated) that the offsets point into
+#define BTOK_MAGIC "BTOK"
+#define BTOK_VERSION 2
+#define BTOK_BYTE_ORDER 0x01020304u     // Reads back swapped on another byte order
+#define BTOK_FLAG_STRINGS 0x1
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t byte_order;
+    uint32_t token_count;
+    uint32_t source_size;
+    uint32_t records_size;
+    uint32_t string_count;
+    uint32_t strings_size;
+} BtokHeader;
+
+// Decoded token; lexeme points into the mapped file (NULL without strings
+// or when the record's string index is out of range)
+typedef struct {
+    TokenType type;
+    ErrorType error;
+    int offset;
+    int length;
+    int line;
+    int column;
+    const char *lexeme;
+} BtokToken;
+
+// Zero-copy reader over an mmap'd .btok file
+typedef struct {
+    const unsigned char *base;
+    size_t size;
+    const BtokHeader *header;
+    const unsigned char *cursor;
+    const unsigned char *end;
+    const uint32_t *string_offsets;
+    const char *strings;
+    uint32_t remaining;
+    int prev_end;
+    int prev_line;
+} BtokReader;
+
+// Binary token stream functions.  btok_encode appends the stream to 'out'
+// (the strings stay 4-byte aligned if 'out' starts so) and returns the
+// number of tokens with a lexical error, or -1.
+int btok_encode(const char *input, Writer *out, int flags);
+int btok_write_file(const char *input, const char *path, int flags);
+int btok_open(BtokReader *reader, const char *path);
+int btok_next(BtokReader *reader, BtokToken *token);
+void btok_close(BtokReader *reader);
+int btok_check(const char *input, const char *path);
+
+#endif /* BTOK_H */
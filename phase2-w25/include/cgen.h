@@ -0,0 +1,26 @@
+/* cgen.h */
+#ifndef CGEN_H
+#define CGEN_H
+
+#include "parser.h"
+#include "writer.h"
+
+// C compiler used to build generated code when $CC is not set
+#define CGEN_DEFAULT_CC "cc"
+
+// Seconds a program built by cgen_build_and_run may run
+#define CGEN_RUN_TIMEOUT 60
+
+// Translation of a resolved program to a standalone C file.  The generated
+// code follows the bytecode VM's semantics: tni and rahc are int64 with
+// wrapping arithmetic (build with -fwrapv), taolf and elbuod are double,
+// and runtime errors are reported the same way.
+
+// C backend functions.  cgen_emit returns the number of errors, which are
+// reported to 'errors'; 'source_name' is used for #line directives and
+// 'output_name' for the lines after the translated source.
+int cgen_emit(ASTNode *root, const char *source_name, const char *output_name,
+              Writer *out, Writer *errors);
+int cgen_build_and_run(const char *c_path, Writer *out, Writer *errors);
+
+#endif /* CGEN_H */
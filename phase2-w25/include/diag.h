@@ -0,0 +1,88 @@
+/* diag.h */
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdint.h>
+#include "tokens.h"
+#include "writer.h"
+
+// Structured diagnostics.  The lexer and parser record each error as a
+// compact record in a per-thread buffer instead of printing it, and
+// nothing is formatted until someone renders the buffer, so a parse whose
+// errors are only counted never formats them.  The buffer, its lexemes and
+// the table that deduplicates reports are reused from one parse to the
+// next, so recording allocates nothing once they have grown.
+//
+// A report is dropped when one from the same source (lexer or parser) was
+// already made at the same token, found by hashing its byte offset.  Of
+// the rest, at most DiagLimits.per_file are kept per parse and at most
+// DiagLimits.per_code of each code; the others are only counted, and
+// rendering ends with a note for each code that had some held back.
+typedef enum {
+    DIAG_LEXER,
+    DIAG_PARSER
+} DiagSource;
+
+// Numbered as LSP numbers them
+typedef enum {
+    DIAG_ERROR = 1,
+    DIAG_WARNING = 2
+} DiagSeverity;
+
+typedef struct {
+    int32_t line;
+    int32_t column;
+    uint32_t offset;            // Byte range of the token in the source
+    uint32_t length;
+    uint32_t lexeme;            // Offset of the token's lexeme in diag_lexeme's storage
+    uint8_t source;             // DiagSource
+    uint8_t code;               // ErrorType or ParseError, by source
+    uint8_t severity;           // DiagSeverity
+    uint8_t token_type;         // TokenType of the token reported at
+} Diagnostic;
+
+#define DIAG_DEFAULT_PER_FILE 100
+#define DIAG_DEFAULT_PER_CODE 25
+
+typedef struct {
+    int per_file;               // 0 for no limit
+    int per_code;
+} DiagLimits;
+
+// Recording functions.  diag_reset starts a new parse (reset_lexer calls
+// it).  diag_report records an error at 'token', using its line, column,
+// offset, length, type and lexeme; it returns 1 for a new error, kept or
+// only counted, and 0 for a repeat.  diag_mark makes later reports at an
+// offset repeats, and diag_reported says whether one was made.
+void diag_set_limits(const DiagLimits *limits);
+void diag_get_limits(DiagLimits *limits);
+void diag_reset(void);
+int diag_report(DiagSource source, int code, const Token *token);
+void diag_mark(DiagSource source, int offset);
+int diag_reported(DiagSource source, int offset);
+void diag_free(void);
+
+// Reading functions.  diag_count is the number of records kept, in the
+// order they were reported; diag_total counts every new error from a
+// source and diag_omitted those not kept.
+int diag_count(void);
+const Diagnostic *diag_get(int index);
+long diag_total(DiagSource source);
+long diag_omitted(void);
+const char *diag_lexeme(const Diagnostic *diagnostic);
+const char *diag_code_name(const Diagnostic *diagnostic);
+
+// Rendering functions.  diag_position finds the 1-based line and byte
+// column of a record's offset in 'source' (NUL-terminated), or gives the
+// lexer's own count without a source.  diag_message writes the message
+// alone and diag_write_report the report line, "Parse Error at line 3,
+// column 5: Missing semicolon after 'x'".  diag_render writes the records
+// from 'first' on: each report line and, with 'snippets', the line of
+// 'source' it points into with a caret under the token.  With 'notes' it
+// ends with how many errors of each code were held back.
+void diag_position(const char *source, const Diagnostic *diagnostic, int *line, int *column);
+void diag_message(Writer *out, const Diagnostic *diagnostic);
+void diag_write_report(Writer *out, const char *source, const Diagnostic *diagnostic);
+void diag_render(Writer *out, const char *source, int first, int snippets, int notes);
+
+#endif /* DIAG_H */
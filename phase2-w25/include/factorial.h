@@ -0,0 +1,19 @@
+/* factorial.h */
+#ifndef FACTORIAL_H
+#define FACTORIAL_H
+
+// Largest n whose factorial fits in a signed 64-bit integer
+#define FACTORIAL_MAX_INT64 20
+
+typedef enum {
+    FACTORIAL_OK,
+    FACTORIAL_NEGATIVE,     // n < 0
+    FACTORIAL_OVERFLOW      // n > FACTORIAL_MAX_INT64
+} FactorialStatus;
+
+// Factorial functions
+FactorialStatus factorial_int64(long long n, long long *result);
+const char *factorial_status_message(FactorialStatus status);
+char *factorial_decimal(unsigned long n);
+
+#endif /* FACTORIAL_H */
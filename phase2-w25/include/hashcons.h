@@ -0,0 +1,42 @@
+/* hashcons.h */
+#ifndef HASHCONS_H
+#define HASHCONS_H
+
+#include <stddef.h>
+#include "parser.h"
+#include "writer.h"
+
+// Hash-consing of pure expressions (--hashcons).  Numbers, variables and
+// the operators that cannot fail or have side effects (all but '/') are
+// kept once per distinct (node type, operator or literal text, variable
+// binding, operand ids), so repeats of a subexpression share one node and
+// the AST becomes a DAG.
+//
+// Each shared node has an id, numbered from 1 in order of creation, in
+// ASTNode.id; unshared nodes have 0.  Equal ids mean structurally equal
+// expressions, so a common-subexpression pass can key on them directly,
+// bearing in mind that the value also depends on the variables read
+// being unchanged in between.  Shared nodes belong to the table: free_ast
+// and recycle_ast leave them alone, and they are freed with it.  A shared
+// node keeps the source position of its first occurrence.
+
+typedef struct {
+    ASTNode **slots;            // Open-addressed by structure, NULL if empty
+    int capacity;
+    int count;                  // Shared nodes, the highest id
+    long lookups;               // Expression nodes offered to the table
+    long hits;                  // Of those, duplicates replaced by a shared node
+} HashconsTable;
+
+// Hash-consing functions.  hashcons_intern returns the shared node equal
+// to 'node', which the caller then frees, or 'node' itself: newly shared
+// if its operands are shared, otherwise left unshared.  hashcons_ast
+// shares the expressions of a whole tree bottom-up, freeing duplicates,
+// and returns its root.  hashcons_free frees the shared nodes and returns
+// how many there were.
+ASTNode *hashcons_intern(HashconsTable *table, ASTNode *node);
+ASTNode *hashcons_ast(HashconsTable *table, ASTNode *root);
+int hashcons_free(HashconsTable *table);
+void hashcons_report(Writer *out, const HashconsTable *table);
+
+#endif /* HASHCONS_H */
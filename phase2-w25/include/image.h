@@ -0,0 +1,76 @@
+/* image.h */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+#include "writer.h"
+
+// Bytecode image format (.bci): a compiled program laid out so it runs
+// straight from the mapped file.  Sections start 8-byte aligned at the
+// offsets the header gives and hold the program's arrays in native byte
+// order; only the function table is copied, to intern the names.
+//
+//   header     ImageHeader
+//   functions  ImageFunction[function_count]
+//   constants  Value[constant_count]
+//   code       int32 code[code_length]
+//   lines      int32 line of each code word
+//   strings    NUL-terminated strings addressed by PRINT_STR
+//   names      NUL-terminated function names
+#define IMAGE_MAGIC "BCIM"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304u    // Reads back swapped on another byte order
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t opcode_count;      // OP_COUNT of the writer
+    uint32_t byte_order;
+    uint32_t checksum;          // FNV-1a of everything after the header
+    uint32_t size;              // Whole file
+    int32_t global_count;
+    int32_t max_stack;
+    uint32_t function_count;
+    uint32_t constant_count;
+    uint32_t code_length;
+    uint32_t strings_size;
+    uint32_t names_size;
+    uint32_t functions_offset;
+    uint32_t constants_offset;
+    uint32_t code_offset;
+    uint32_t lines_offset;
+    uint32_t strings_offset;
+    uint32_t names_offset;
+} ImageHeader;
+
+typedef struct {
+    uint32_t name;              // Offset into the names section
+    int32_t entry;
+    int32_t params;
+    int32_t frame_size;
+    int32_t max_stack;
+} ImageFunction;
+
+// A loaded image.  'program' points into the image data, so it stays
+// valid until image_close and must not be passed to vm_program_free.
+typedef struct {
+    const void *base;
+    size_t size;
+    int mapped;                 // base was mapped by image_open
+    BytecodeProgram program;
+} BytecodeImage;
+
+// Image functions.  image_write saves a program compiled without
+// VM_PROFILE.  image_load checks the header, the checksum and, with
+// vm_verify, the code of an image at an 8-byte aligned address; it and
+// image_open return 0 on success, otherwise report to 'errors' under
+// 'name' and return -1.  image_close is safe after a failed load.
+int image_is_image(const void *data, size_t size);
+int image_write(const BytecodeProgram *program, const char *path, Writer *errors);
+int image_load(BytecodeImage *image, const void *data, size_t size, const char *name, Writer *errors);
+int image_open(BytecodeImage *image, const char *path, Writer *errors);
+void image_close(BytecodeImage *image);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,38 @@
+/* intern.h */
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dense symbol IDs for interned identifiers and string literals.
+// ID 0 is never assigned, so it can mean "no symbol".
+typedef uint32_t SymbolId;
+#define SYMBOL_NONE 0
+
+// FNV-1a, so callers can hash while they scan
+#define INTERN_HASH_INIT 2166136261u
+static inline uint32_t intern_hash_step(uint32_t hash, unsigned char c) {
+    return (hash ^ c) * 16777619u;
+}
+
+// Intern table functions.  With 'shared' set, the table is split into
+// locked shards so several threads can intern into it at once.  intern
+// returns SYMBOL_NONE once every ID is taken.
+//
+// Long-running servers keep the table from growing without bound with
+// intern_mark and intern_release: intern_release(mark) forgets every
+// symbol interned after intern_mark returned 'mark', and their IDs are
+// handed out again.  No other thread may use the table meanwhile.
+void intern_init(int shared);
+void intern_free(void);
+SymbolId intern_mark(void);
+void intern_release(SymbolId mark);
+uint32_t intern_hash(const char *text, size_t length);
+SymbolId intern(const char *text, size_t length, uint32_t hash);
+SymbolId intern_cstr(const char *text);
+const char *symbol_name(SymbolId id);
+size_t symbol_length(SymbolId id);
+uint32_t symbol_count(void);
+
+#endif /* INTERN_H */
@@ -0,0 +1,48 @@
+/* jit.h */
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "vm.h"
+
+// Tier-up thresholds
+#define JIT_CALL_THRESHOLD 50       // Calls before a function is compiled
+#define JIT_LOOP_THRESHOLD 1000     // Backward branches before a function is compiled
+
+// Native calls nested deeper than this run interpreted, so recursion is
+// limited by the VM stack rather than the C stack
+#define JIT_MAX_NATIVE_DEPTH 4096
+
+// Compiled function.  'resume' is NULL to start at the entry, or the
+// native address of a loop head to continue a running interpreted call.
+typedef long long (*JitFunction)(Value *frame, VM *vm, const void *resume);
+
+typedef enum {
+    JIT_PENDING,            // Interpreted, not yet hot
+    JIT_COMPILED,
+    JIT_UNSUPPORTED         // Uses constructs the compiler does not handle
+} JitState;
+
+// Per-run JIT state, indexed by function
+typedef struct Jit {
+    int function_count;
+    JitFunction *native;            // NULL until compiled
+    unsigned char *state;           // JitState
+    int *calls;                     // Tier-up counters
+    int *loops;
+    int call_threshold;
+    int loop_threshold;
+    int **resume;                   // Native offset per bytecode offset in the function, -1 if none
+    void **memory;                  // Executable mapping of each function
+    size_t *memory_size;
+    int compiled;                   // Functions compiled
+    int unsupported;                // Functions left to the interpreter
+} Jit;
+
+// JIT functions
+int jit_init(Jit *jit, const BytecodeProgram *program, int threshold);
+void jit_free(Jit *jit);
+int jit_compile(Jit *jit, VM *vm, int function);
+const void *jit_resume(const Jit *jit, const BytecodeProgram *program, int function, int offset);
+
+#endif /* JIT_H */
@@ -3,12 +3,26 @@
 #define LEXER_H
 
 #include "tokens.h"
+#include "writer.h"
+
+// Lexer state between tokens, saved and restored by incremental parsing
+typedef struct {
+    int line;
+    int column;
+    char last_token_type;
+    int in_error_recovery;
+} LexerState;
 
 // Lexer functions that need to be visible to other files
 Token get_next_token(const char* input, int* pos);
 void print_token(Token token);
+void write_token(Writer* out, Token token);
+const char* token_type_name(TokenType type);
 void print_error(ErrorType error, int line, const char* lexeme);
 void reset_lexer(void);
 void clear_error_state(void);
+int lexer_error_count(void);
+void lexer_save(LexerState* state);
+void lexer_restore(const LexerState* state);
 
 #endif /* LEXER_H */
\ No newline at end of file
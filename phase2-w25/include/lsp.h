@@ -0,0 +1,30 @@
+/* lsp.h */
+#ifndef LSP_H
+#define LSP_H
+
+#include "writer.h"
+
+// Language server (--lsp): JSON-RPC with Content-Length framing on stdin
+// and stdout, as the Language Server Protocol specifies.  Documents are
+// kept in memory and synced incrementally (textDocument/didChange with
+// ranges); each change reparses only the top-level items from the first
+// one the edit can affect up to where the parse lines up with the old one
+// again, and publishes the document's diagnostics.  Changes that arrive
+// before a document is parsed again are coalesced into one parse.
+typedef struct {
+    int debounce_ms;            // Quiet time after a change before parsing
+    int check;                  // Compare every incremental parse with a full one
+    const char *record_path;    // Append each message received, for lsp_replay
+} LspOptions;
+
+// lsp_serve answers on 'in_fd' and 'out_fd' until the exit notification
+// or the end of the input, returning 0 after a shutdown request, else 1.
+// lsp_replay runs a server with 'server_argv' and sends it the messages
+// of a session recorded by --lsp-record, one per line after the time in
+// milliseconds it was received at, paced by the recorded times divided
+// by 'speed' (0 sends them as fast as possible).  It reports to 'out' the
+// latency from each change to the first diagnostics published for it.
+int lsp_serve(int in_fd, int out_fd, const LspOptions *options);
+int lsp_replay(const char *session, char *const server_argv[], double speed, Writer *out);
+
+#endif /* LSP_H */
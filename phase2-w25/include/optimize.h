@@ -0,0 +1,33 @@
+/* optimize.h */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "parser.h"
+#include "writer.h"
+
+// Optimization passes, combined as a bit mask
+#define OPT_FOLD            0x1     // Evaluate operators over numeric literals
+#define OPT_IDENTITIES      0x2     // x+0, x-0, x*1, x/1, x*0
+#define OPT_SHORT_CIRCUIT   0x4     // && and || with a constant operand
+#define OPT_DEAD_BRANCHES   0x8     // if/while/repeat with a constant condition
+#define OPT_ALL             0xf
+
+// Default limit on pipeline iterations when running to a fixed point
+#define OPT_MAX_ITERATIONS 16
+
+// Counts of what the pipeline changed
+typedef struct {
+    int folded;             // Constant operators evaluated
+    int identities;         // Algebraic identities applied
+    int short_circuits;     // Logical operators simplified
+    int dead_branches;      // Branches and loops removed or unrolled
+    int nodes_removed;      // AST nodes freed
+    int iterations;         // Pipeline runs, including the final no-op run
+} OptimizeStats;
+
+// Optimizer functions.  The result replaces 'root' (which may be freed);
+// it is NULL only when 'root' is a single statement that was removed.
+ASTNode *optimize_ast(ASTNode *root, int passes, int max_iterations, OptimizeStats *stats);
+void optimize_report(Writer *out, const OptimizeStats *stats);
+
+#endif /* OPTIMIZE_H */
@@ -3,6 +3,8 @@
 #define PARSER_H
 
 #include "tokens.h"
+#include "lexer.h"
+#include "writer.h"
 
 // Basic node types for AST
 typedef enum {
@@ -37,24 +39,82 @@ typedef enum {
     PARSE_ERROR_BLOCK_BRACES, 
     PARSE_ERROR_INVALID_OPERATOR,
     PARSE_ERROR_INVALID_FUNCTION_CALL, 
-    PARSE_ERROR_INVALID_EXPRESSION
+    PARSE_ERROR_INVALID_EXPRESSION,
+    PARSE_ERROR_UNDECLARED_IDENTIFIER,
+    PARSE_ERROR_DUPLICATE_DECLARATION
 } ParseError;
 
+// Link in one of the lists of an AST index (astindex.h)
+typedef struct ASTLink {
+    struct ASTLink *next;       // NULL when the node is not in a list
+    struct ASTLink *prev;
+} ASTLink;
+
 // AST Node structure
 typedef struct ASTNode {
     ASTNodeType type;           // Type of node
     Token token;               // Token associated with this node
     struct ASTNode* left;      // Left child
     struct ASTNode* right;     // Right child
+    int scope_depth;           // Depth of the declaring scope (0 = global), -1 if unresolved
+    int slot;                  // Frame slot of the variable, or frame size of a function
+    TokenType decl_type;       // Declared type of the variable
+    int id;                    // Id of a shared expression (hashcons.h), 0 if unshared
+    ASTLink by_type;           // Index list of the node's type
+    ASTLink by_name;           // Index list of the uses of an identifier's name
     // TODO: Add more fields if needed
 } ASTNode;
 
+// Returned by a streaming callback: keep the item (the caller frees it with
+// free_ast) or hand its nodes back to the parser for reuse
+typedef enum {
+    PARSE_ITEM_RECYCLE,
+    PARSE_ITEM_KEEP
+} ParseItemAction;
+
+typedef ParseItemAction (*ParseItemCallback)(ASTNode* item, void* user);
+
+// Parser state between two top-level items.  parser_resume continues
+// from it on any source whose text from 'position' on is the same, with
+// the same results.  The lexer has read nothing past 'read_extent', so an
+// edit after it leaves everything up to the checkpoint as it was.
+typedef struct {
+    Token token;                // The next token, already read
+    int position;
+    int read_extent;
+    int token_reported;         // A parse error was reported at 'token'
+    LexerState lexer;
+} ParseCheckpoint;
+
+struct ASTIndex;
+
 // Parser functions
 void parser_init(const char* input);
 ASTNode* parse(void);
+ASTNode* parse_next_item(void);
+int parse_program_streaming(ParseItemCallback callback, void* user);
+void parser_checkpoint(ParseCheckpoint* checkpoint);
+void parser_resume(const char* input, const ParseCheckpoint* checkpoint);
 void print_ast(ASTNode* node, int level);
+void write_ast(Writer* out, ASTNode* node, int level);
 void free_ast(ASTNode* node);
-void print_token_stream(const char* input);
+void recycle_ast(ASTNode* node);
+void parser_release_nodes(void);
+long parser_peak_nodes(void);
+void parser_set_index(struct ASTIndex* index);
+void ast_set_type(ASTNode* node, ASTNodeType type);
+int print_token_stream(const char* input);
+int count_ast_nodes(ASTNode* node);
 void proc_test_file(const char* filename);
+void parser_reset(void);
+int parser_error_count(void);
+ASTNode* parser_optimize(ASTNode* ast);
+
+// Map a source file read-only with a NUL terminator after the last byte;
+// NULL if it cannot be opened.  unmap_file releases it.  read_file reads
+// one into a NUL-terminated buffer the caller frees.
+char* map_file(const char* filename, size_t* length);
+void unmap_file(char* base, size_t length);
+char* read_file(const char* filename, long* length);
 
 #endif /* PARSER_H */
\ No newline at end of file
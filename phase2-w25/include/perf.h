@@ -0,0 +1,31 @@
+/* perf.h */
+#ifndef PERF_H
+#define PERF_H
+
+// Phases of a file run that can be instrumented
+typedef enum {
+    PERF_PHASE_LEX,     // Token stream generation
+    PERF_PHASE_PARSE,   // AST construction
+    PERF_PHASE_PRINT,   // AST printing
+    PERF_PHASE_COUNT
+} PerfPhase;
+
+// Hardware events opened through perf_event_open
+typedef enum {
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_EVENT_L1D_MISSES,
+    PERF_EVENT_LLC_MISSES,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+// Performance counter functions
+int perf_init(void);
+void perf_shutdown(void);
+void perf_reset(void);
+void perf_begin(PerfPhase phase);
+void perf_end(PerfPhase phase);
+void perf_report(int token_count, int node_count);
+
+#endif /* PERF_H */
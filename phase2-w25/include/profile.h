@@ -0,0 +1,83 @@
+/* profile.h */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vm.h"
+#include "writer.h"
+
+// Statement-level profiling of programs compiled with VM_PROFILE.  Each
+// statement marker counts a hit and records the statement running at the
+// current call depth; a SIGPROF timer on the process CPU clock samples
+// those statements as a stack.
+// Self time is the samples a statement was innermost in, total time the
+// samples it or a statement nested in it was running at any depth.
+
+#define PROFILE_DEFAULT_HZ 1000
+#define PROFILE_MAX_DEPTH 256           // Innermost call depths kept per sample
+#define PROFILE_BUFFER_WORDS (1 << 22)  // Sample storage; later samples are dropped
+
+// Calls from one statement into one function
+typedef struct {
+    int site;                   // Calling statement
+    int function;               // Callee
+    unsigned long long calls;
+    unsigned long long samples; // Samples with this call on the stack
+    size_t seen;                // Last sample counted
+} ProfileCall;
+
+typedef struct Profile {
+    const BytecodeProgram *program;
+    unsigned long long *hits;       // Times each statement started
+    volatile int *sites;            // Statement running at each call depth
+    volatile int *volatile depth;   // Call depth of the running VM, NULL when none runs
+    int interval_us;
+    int timer_running;
+
+    // Samples: a word holding the number of statements (negated when
+    // outer frames were cut off), then the statements outermost first
+    int *samples;
+    volatile size_t sample_words;
+    volatile size_t sample_count;
+    volatile size_t dropped;
+
+    ProfileCall *calls;             // Open-addressed by (site, function)
+    int call_count;
+    int call_capacity;
+
+    uint64_t cpu_ns;                // Process CPU time the run took, once stopped
+
+    // Filled by profile_stop
+    unsigned long long *self;       // Samples per statement
+    unsigned long long *total;
+} Profile;
+
+// Profiler functions.  profile_init returns -1 if 'hz' is out of range;
+// profile_start arms the timer and returns -1 if it could not, leaving
+// only hits to count.  Only one profile runs at a time.  The writers name
+// frames after 'source'.
+int profile_init(Profile *profile, const BytecodeProgram *program, int hz);
+int profile_start(Profile *profile);
+void profile_stop(Profile *profile);
+void profile_free(Profile *profile);
+void profile_count_call(Profile *profile, int site, int function);
+void profile_report(Writer *out, const Profile *profile, const char *source, int rows);
+void profile_write_folded(Writer *out, const Profile *profile, const char *source);
+void profile_write_callgrind(Writer *out, const Profile *profile, const char *source);
+
+// Called by the VM for OP_STATEMENT and OP_ENTER at call depth 'depth'
+static inline void profile_statement(Profile *profile, int depth, int statement) {
+    profile->sites[depth] = statement;
+    profile->hits[statement]++;
+}
+
+static inline void profile_enter(Profile *profile, int depth, int statement) {
+    if (depth > 0) {
+        profile_count_call(profile, profile->sites[depth - 1],
+                           profile->program->statements[statement].function);
+    }
+    profile_statement(profile, depth, statement);
+}
+
+#endif /* PROFILE_H */
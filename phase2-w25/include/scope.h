@@ -0,0 +1,24 @@
+/* scope.h */
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include "parser.h"
+
+// Optional name resolution run by the parser as it goes.  Declarations get
+// a slot in the enclosing frame (the global frame outside functions, the
+// function's frame inside one) and identifier uses are annotated with the
+// declaring scope depth and slot.  Depth 0 is the global frame.
+
+// Scope functions
+void scope_begin(void);
+void scope_end(void);
+int scope_active(void);
+void scope_enter(void);
+void scope_leave(void);
+void scope_enter_function(void);
+int scope_leave_function(void);
+int scope_declare(ASTNode *node, TokenType type);
+int scope_resolve(ASTNode *node);
+int scope_global_count(void);
+
+#endif /* SCOPE_H */
@@ -0,0 +1,24 @@
+/* serialize.h */
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "parser.h"
+#include "writer.h"
+
+// Machine-readable AST output formats
+typedef enum {
+    SERIALIZE_JSON,     // {"type":"BinaryOp","value":"+","line":9,"column":12,...}
+    SERIALIZE_SEXPR,    // (BinaryOp "+" @9:12 ...)
+    SERIALIZE_BINARY    // Preorder LEB128 records, one per node:
+                        //   type << 2 | has left << 1 | has right, token type,
+                        //   line, column, [value length, value bytes]
+                        // then the left and the right subtree; nothing for NULL
+} SerializeFormat;
+
+// AST serializer functions.  serialize_string writes a quoted, escaped
+// string as the (text) format does.
+const char* ast_node_type_name(ASTNodeType type);
+void serialize_ast(Writer* out, ASTNode* node, SerializeFormat format);
+void serialize_string(Writer* out, const char* text, SerializeFormat format);
+
+#endif /* SERIALIZE_H */
@@ -0,0 +1,109 @@
+/* server.h */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "writer.h"
+
+// Parse server protocol (--serve).  Requests and responses are frames on
+// a Unix domain stream socket: a fixed header in native byte order, then
+// 'size' bytes of payload.  A connection carries any number of requests,
+// answered in order; a malformed frame gets a SERVE_BAD_REQUEST response
+// and the connection is closed.
+//
+// Response bodies:
+//   tokenize  binary: a .btok stream with strings (btok.h)
+//             JSON:   {"tokens":[{"type","value","line","column"},...],"errors":N,
+//                      "diagnostics":[...],"omitted":N}, with "error":true on
+//                      invalid tokens
+//   parse     binary: uint32 node count, uint32 length, diagnostics text: the
+//                      report lines, the notes on errors held back (diag.h)
+//                      and any optimizer warnings
+//             JSON:   {"errors":N,"nodes":N,"diagnostics":[...],"omitted":N}
+//
+// A JSON diagnostic is {"source","code","severity","line","column","offset",
+// "length","message"}, "source" being "lexer" or "parser"; optimizer
+// warnings have only "source":"optimizer", "severity" and "message".
+//   dump      binary: as parse, then the AST as SERIALIZE_BINARY records
+//             JSON:   as parse, with "ast" as --json writes it
+// Failed requests carry a message as the body.
+#define SERVE_MAX_PAYLOAD (64u << 20)
+
+typedef enum {
+    SERVE_TOKENIZE = 1,
+    SERVE_PARSE,
+    SERVE_DUMP
+} ServeOp;
+
+#define SERVE_FLAG_PATH 0x1     // The payload is a path to read, not the source
+#define SERVE_FLAG_JSON 0x2     // JSON results rather than binary
+
+typedef enum {
+    SERVE_OK,
+    SERVE_BAD_REQUEST,
+    SERVE_NO_FILE
+} ServeStatus;
+
+typedef struct {
+    uint32_t size;              // Payload bytes after the header
+    uint32_t id;                // Echoed in the response
+    uint8_t op;                 // ServeOp
+    uint8_t flags;
+    uint16_t reserved;
+} ServeRequest;
+
+typedef struct {
+    uint32_t size;              // Body bytes after the header
+    uint32_t id;
+    uint32_t errors;            // Lexical or parse errors in the source
+    uint8_t status;             // ServeStatus
+    uint8_t reserved[3];
+} ServeResponse;
+
+// Called on a worker thread for each request, with the payload
+// NUL-terminated; appends the body and sets 'errors'.  'worker_exit'
+// runs on each worker thread before it ends.
+typedef struct {
+    ServeStatus (*handle)(const ServeRequest *request, const char *payload, Writer *body, uint32_t *errors);
+    void (*worker_exit)(void);
+} ServeHandler;
+
+// A load to generate: 'requests' in total over 'clients' connections,
+// each on its own thread, cycling through the payloads
+typedef struct {
+    int clients;
+    long requests;
+    int op;
+    int flags;
+    char **payloads;
+    size_t *sizes;
+    int payload_count;
+} ServeLoad;
+
+// Server functions.  serve listens on 'path' (mode 0600, replacing a
+// stale socket) and answers on 'workers' threads, each serving one
+// connection at a time, until SIGINT or SIGTERM; returns 0, or -1 if it
+// could not listen.  serve_connect returns a connected socket or -1, and
+// serve_call sends one request and reads its response into 'body',
+// returning 0 or -1 on a broken connection.  serve_loadgen reports the
+// throughput and latency percentiles of a load to 'out'.
+int serve(const char *path, int workers, const ServeHandler *handler);
+int serve_connect(const char *path);
+int serve_call(int fd, const ServeRequest *request, const void *payload, ServeResponse *response, Writer *body);
+int serve_loadgen(const char *path, const ServeLoad *load, Writer *out);
+
+// The parser behind the protocol.  serve_parser answers requests with the
+// lexer and parser (optimizing with --optimize) on 'workers' threads, as
+// serve does.  serve_send_files sends each file as one request and
+// prints the responses, and serve_load_files runs serve_loadgen over the
+// files; both send sources, or paths with SERVE_FLAG_PATH, and report to
+// the output writer.  serve_op_named maps "tokenize", "parse" or "dump"
+// to its ServeOp, or returns -1.
+int serve_parser(const char *path, int workers);
+void serve_send_files(const char *path, char **files, int file_count, int op, int flags);
+void serve_load_files(const char *path, char **files, int file_count, int op, int flags,
+                      int clients, long requests);
+int serve_op_named(const char *name);
+
+#endif /* SERVER_H */
@@ -0,0 +1,124 @@
+/* ssa.h */
+#ifndef SSA_H
+#define SSA_H
+
+#include "parser.h"
+#include "writer.h"
+#include "vm.h"
+
+// SSA form of a resolved program.  Each function is a control flow graph
+// of basic blocks whose instructions define typed values; a value is the
+// index of the instruction that defines it.  Local variables become values
+// joined by phi instructions, while globals stay in memory.
+
+typedef enum {
+    SSA_VOID,
+    SSA_INT,
+    SSA_FLOAT
+} SsaType;
+
+typedef enum {
+    SSA_CONST,              // imm
+    SSA_PARAM,              // index: parameter number
+    SSA_PHI,                // One operand per predecessor, in predecessor order
+    SSA_ADD, SSA_SUB, SSA_MUL, SSA_DIV, SSA_MOD,
+    SSA_LT, SSA_GT, SSA_LE, SSA_GE, SSA_EQ, SSA_NE,     // Int result
+    SSA_I2F,
+    SSA_F2I,
+    SSA_BOOL,               // 1 if the operand is non-zero, else 0
+    SSA_LOAD_GLOBAL,        // index: global slot
+    SSA_STORE_GLOBAL,       // index: global slot; operand: value
+    SSA_CALL,               // index: function; operands: arguments
+    SSA_FACTORIAL,
+    SSA_PRINT,
+    SSA_PRINT_STRING,       // index: string offset
+    SSA_PRINT_FACTORIAL,
+    // Terminators, last in every block
+    SSA_JUMP,               // To successor 0
+    SSA_BRANCH,             // Operand: condition; successor 0 if non-zero, else 1
+    SSA_RETURN,
+    SSA_HALT,
+    SSA_OP_COUNT
+} SsaOp;
+
+typedef struct {
+    unsigned char op;       // SsaOp
+    unsigned char type;     // SsaType of the result
+    int block;              // Containing block, -1 once removed
+    int line;               // Source line, for runtime errors
+    int index;
+    Value imm;
+    int operand_count;
+    int operand_capacity;
+    int *operands;
+} SsaInstr;
+
+typedef struct {
+    int *instrs;            // Phis first, terminator last
+    int instr_count;
+    int instr_capacity;
+    int *preds;
+    int pred_count;
+    int pred_capacity;
+    int succs[2];
+    int succ_count;
+    int removed;            // Unreachable and emptied
+} SsaBlock;
+
+typedef struct {
+    SymbolId name;          // SYMBOL_NONE for the top-level code
+    int params;
+    SsaType return_type;
+    SsaInstr *instrs;
+    int instr_count;
+    int instr_capacity;
+    SsaBlock *blocks;       // Block 0 is the entry
+    int block_count;
+    int block_capacity;
+} SsaFunction;
+
+typedef struct {
+    SsaFunction top;        // Top-level statements, then the call of niam
+    SsaFunction *functions;
+    int function_count;
+    int global_count;
+    char *strings;          // NUL-terminated strings, addressed by offset
+    int strings_length;
+    int strings_capacity;
+} SsaProgram;
+
+// Operation properties
+int ssa_is_terminator(SsaOp op);
+int ssa_is_pure(const SsaInstr *instr);
+const char *ssa_op_name(SsaOp op);
+
+// Construction and editing
+int ssa_add_block(SsaFunction *f);
+int ssa_add_instr(SsaFunction *f, int block, SsaOp op, SsaType type, int line);
+void ssa_add_operand(SsaFunction *f, int value, int operand);
+void ssa_add_edge(SsaFunction *f, int from, int to);
+void ssa_remove_instr(SsaFunction *f, int value);
+void ssa_move_before_terminator(SsaFunction *f, int value, int block);
+void ssa_remove_pred(SsaFunction *f, int block, int pred);
+void ssa_apply_replacements(SsaFunction *f, int *replace);
+int ssa_remove_unreachable(SsaFunction *f);
+void ssa_remove_trivial_phis(SsaFunction *f);
+void ssa_split_critical_edges(SsaFunction *f);
+
+// Analysis.  ssa_reverse_postorder returns reachable blocks in reverse
+// postorder (caller frees); ssa_dominators gives each block's immediate
+// dominator, -1 for the entry and unreachable blocks.
+int *ssa_reverse_postorder(const SsaFunction *f, int *count);
+int *ssa_dominators(const SsaFunction *f, const int *rpo, int count);
+int ssa_dominates(const int *idom, int a, int b);
+
+// Lowering, checking, printing and bytecode generation.  ssa_lower returns
+// the number of compile errors, reported to 'errors' as vm_compile does;
+// ssa_verify returns the number of problems found.
+int ssa_lower(ASTNode *root, int flags, SsaProgram *program, Writer *errors);
+int ssa_verify(const SsaProgram *program, Writer *errors);
+void ssa_dump(Writer *out, const SsaProgram *program);
+void ssa_codegen(SsaProgram *program, BytecodeProgram *bytecode);
+void ssa_program_free(SsaProgram *program);
+
+#endif /* SSA_H */
@@ -0,0 +1,33 @@
+/* ssaopt.h */
+#ifndef SSAOPT_H
+#define SSAOPT_H
+
+#include "ssa.h"
+#include "writer.h"
+
+// SSA optimization passes, combined as a bit mask and run in this order
+#define SSA_PASS_SCCP   0x1     // Sparse conditional constant propagation
+#define SSA_PASS_GVN    0x2     // Global value numbering over the dominator tree
+#define SSA_PASS_LICM   0x4     // Loop-invariant code motion into preheaders
+#define SSA_PASS_DCE    0x8     // Dead code elimination
+#define SSA_PASS_ALL    0xf
+
+// Counts of what the passes changed
+typedef struct {
+    int folded;             // Values found constant (SCCP)
+    int branches;           // Branches on constants made jumps (SCCP)
+    int blocks_removed;     // Blocks found unreachable (SCCP)
+    int merged;             // Values replaced by an equal dominating value (GVN)
+    int hoisted;            // Instructions moved out of loops (LICM)
+    int removed;            // Instructions with no effect or use deleted (DCE)
+} SsaStats;
+
+// Optimizer functions.  ssa_parse_passes reads a comma-separated list of
+// pass names, or "all" or "none", and returns -1 for an unknown name.
+// ssa_optimize verifies the program after each pass when 'errors' is set,
+// and returns the number of problems found.
+int ssa_parse_passes(const char *list, unsigned *passes);
+int ssa_optimize(SsaProgram *program, unsigned passes, SsaStats *stats, Writer *errors);
+void ssa_report(Writer *out, const SsaStats *stats);
+
+#endif /* SSAOPT_H */
@@ -0,0 +1,53 @@
+/* superop.h */
+#ifndef SUPEROP_H
+#define SUPEROP_H
+
+#include <stdint.h>
+#include "vm.h"
+#include "writer.h"
+
+// Profile-guided superinstructions.  A training run records each stretch
+// of instructions it executed by falling through from one to the next,
+// ending at a jump, call, return or halt, with how often it ran.
+// superop_write_header then picks, one at a time, the run of 2 to
+// SUPEROP_MAX_LENGTH instructions whose superinstruction saves the most
+// dispatches over those stretches, and writes the runs as
+// include/superops.h, from which the VM builds one fused handler each.
+
+#define SUPEROP_MAX_LENGTH 4
+#define SUPEROP_MAX_STRETCH 64          // Longer stretches are split
+#define SUPEROP_DEFAULT_COUNT 24        // Superinstructions generated
+
+// A stretch of opcodes executed back to back
+typedef struct {
+    uint32_t hash;
+    int length;                         // 0 for an empty slot
+    int start;                          // Index of its opcodes in VMCounts.ops
+    unsigned long long count;
+} SuperopStretch;
+
+// Counts of one or more runs of the VM (VMOptions.counts)
+typedef struct VMCounts {
+    unsigned long long dispatches;      // Instructions dispatched, fused or not
+    int stretches_enabled;              // Also record stretches (unfused code only)
+    SuperopStretch *stretches;          // Open-addressed by opcodes
+    int stretch_count;
+    int stretch_capacity;
+    unsigned char *ops;                 // Opcodes of every stretch
+    int ops_length;
+    int ops_capacity;
+    unsigned char current[SUPEROP_MAX_STRETCH];     // Stretch being executed
+    int current_length;
+    int next_offset;                    // Where the last instruction falls through to
+} VMCounts;
+
+// Superinstruction functions.  superop_record is called by the VM for each
+// instruction dispatched while recording stretches.  superop_write_header
+// writes at most 'max_count' superinstructions, lists them to 'report'
+// and returns the number written.
+void superop_counts_init(VMCounts *counts, int stretches);
+void superop_counts_free(VMCounts *counts);
+void superop_record(VMCounts *counts, int op, int offset, int length);
+int superop_write_header(Writer *out, Writer *report, VMCounts *counts, int max_count);
+
+#endif /* SUPEROP_H */
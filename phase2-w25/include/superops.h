@@ -0,0 +1,19 @@
+/* superops.h */
+#ifndef SUPEROPS_H
+#define SUPEROPS_H
+
+// Superinstructions built into the interpreter, generated by
+// `parser --superops-train` (make superops) from a training run.
+// X(name, instructions...) fuses a run of instructions into one
+// dispatch; the comment gives the dispatches it saved in training.
+#define SUPEROPS_4(X) \
+    X(LOAD_CONST_ADD_I_STORE, LOAD, CONST, ADD_I, STORE) /* 5999943 */ \
+    X(STORE_LOAD_CONST_GT_I, STORE, LOAD, CONST, GT_I) /* 4999981 */ \
+    X(STORE_LOAD_CONST_SUB_I, STORE, LOAD, CONST, SUB_I) /* 3000000 */ \
+    X(LOAD_CONST_LT_I_JUMP_IF_FALSE, LOAD, CONST, LT_I, JUMP_IF_FALSE) /* 65673 */
+#define SUPEROPS_3(X) \
+    X(STORE_LOAD_CONST, STORE, LOAD, CONST) /* 15999966 */ \
+    X(LOAD_LOAD_ADD_I, LOAD, LOAD, ADD_I) /* 9999964 */
+#define SUPEROPS_2(X)
+
+#endif /* SUPEROPS_H */
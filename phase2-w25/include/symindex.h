@@ -0,0 +1,166 @@
+/* symindex.h */
+#ifndef SYMINDEX_H
+#define SYMINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+#include "intern.h"
+#include "writer.h"
+
+// Workspace symbol index (.bsi): the function declarations and call sites
+// of a set of source files, laid out to be queried straight from the
+// mapped file.  Sections start 8-byte aligned at the offsets the header
+// gives and hold native byte order:
+//
+//   header   SymIndexHeader
+//   files    SymIndexFile[file_count], sorted by path
+//   names    SymIndexName[name_count], sorted by name
+//   buckets  uint32 buckets[bucket_count]: 1 + the index of a name, or 0,
+//            open-addressed by intern_hash of the name
+//   decls    SymIndexSite[decl_count], grouped by name, then by file and position
+//   calls    SymIndexSite[call_count], likewise
+//   strings  NUL-terminated paths, names and signatures; offset 0 is ""
+//
+// Every file records its mtime, size and a 64-bit FNV-1a hash of its
+// contents, so an update parses only the files whose contents changed.
+// The layout depends only on the files, so an updated index is
+// byte-identical to one built from scratch.
+#define SYMINDEX_MAGIC "BSIX"
+#define SYMINDEX_VERSION 1
+#define SYMINDEX_BYTE_ORDER 0x01020304u    // Reads back swapped on another byte order
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t byte_order;
+    uint32_t checksum;          // FNV-1a of everything after the header
+    uint32_t size;              // Whole file
+    uint32_t file_count;
+    uint32_t name_count;
+    uint32_t bucket_count;      // A power of two
+    uint32_t decl_count;
+    uint32_t call_count;
+    uint32_t strings_size;
+    uint32_t files_offset;
+    uint32_t names_offset;
+    uint32_t buckets_offset;
+    uint32_t decls_offset;
+    uint32_t calls_offset;
+    uint32_t strings_offset;
+} SymIndexHeader;
+
+typedef struct {
+    uint32_t path;              // Offset into the strings
+    uint32_t errors;            // Parse errors in the file
+    uint32_t decl_count;
+    uint32_t call_count;
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t hash;              // FNV-1a of the contents
+} SymIndexFile;
+
+typedef struct {
+    uint32_t name;              // Offset into the strings
+    uint32_t hash;              // intern_hash of the name
+    uint32_t first_decl;
+    uint32_t decl_count;
+    uint32_t first_call;
+    uint32_t call_count;
+} SymIndexName;
+
+typedef struct {
+    uint32_t file;              // Index into the files
+    int32_t line;
+    int32_t column;
+    uint32_t text;              // Declarations: the signature; calls: the
+                                // calling function, "" at the top level
+} SymIndexSite;
+
+// An opened index.  The pointers go into the mapped file.
+typedef struct {
+    const void *base;
+    size_t size;
+    const SymIndexHeader *header;
+    const SymIndexFile *files;
+    const SymIndexName *names;
+    const uint32_t *buckets;
+    const SymIndexSite *decls;
+    const SymIndexSite *calls;
+    const char *strings;
+} SymIndex;
+
+// An index being built.  Files are added in path order, each either
+// parsed (symindex_build_item on its top-level items) or carried over
+// from the previous index.
+typedef struct {
+    SymbolId name;
+    uint32_t file;
+    int32_t line;
+    int32_t column;
+    SymbolId text;
+} SymIndexEntry;
+
+typedef struct {
+    SymbolId path;
+    uint32_t errors;
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t hash;
+} SymIndexBuildFile;
+
+typedef struct {
+    SymIndexBuildFile *files;
+    int file_count;
+    int file_capacity;
+    SymIndexEntry *decls;
+    int decl_count;
+    int decl_capacity;
+    SymIndexEntry *calls;
+    int call_count;
+    int call_capacity;
+} SymIndexBuild;
+
+// Index functions.  symindex_open maps an index and checks its header and
+// that every section lies in the file, which costs O(1); with 'verify' it
+// also checks the checksum and every offset in it.  It returns 0 on
+// success, otherwise reports to 'errors' and returns -1.  symindex_find
+// looks a name up in the hash table and returns NULL when it was neither
+// declared nor called; the sites of a name found lie within their
+// sections.  symindex_string returns "" for an offset outside the strings,
+// so an unverified index that is damaged gives wrong answers rather than
+// reads outside the file.  symindex_file_named returns the index of a
+// file, or -1.
+int symindex_open(SymIndex *index, const char *path, int verify, Writer *errors);
+void symindex_close(SymIndex *index);
+const SymIndexName *symindex_find(const SymIndex *index, const char *name);
+const char *symindex_string(const SymIndex *index, uint32_t offset);
+int symindex_file_named(const SymIndex *index, const char *path);
+uint64_t symindex_hash_bytes(const void *data, size_t len);
+
+// Building functions.  symindex_build_reuse copies the sites of every old
+// file whose entry in 'file_map' is a file of the build (-1 for the files
+// that were dropped or parsed again).  symindex_build_write lays the index
+// out into 'out', and symindex_build_save writes it to 'path' through a
+// temporary file, so readers see the old index or the new one.
+void symindex_build_init(SymIndexBuild *build);
+void symindex_build_free(SymIndexBuild *build);
+uint32_t symindex_build_file(SymIndexBuild *build, const char *path, int64_t mtime_ns, int64_t size,
+                             uint64_t hash, uint32_t errors);
+void symindex_build_item(SymIndexBuild *build, uint32_t file, const ASTNode *item);
+void symindex_build_reuse(SymIndexBuild *build, const SymIndex *old, const int *file_map);
+void symindex_build_write(SymIndexBuild *build, Writer *out);
+int symindex_build_save(SymIndexBuild *build, const char *path, Writer *errors);
+
+// The --symindex command.  With files named, or with nothing to look up,
+// brings the index at 'index_path' up to date: a listed file whose mtime
+// and size are unchanged keeps its sites, one whose contents changed is
+// parsed again, and files that are gone are dropped.  Then it lists the
+// declarations of 'find_decl' and the calls of 'find_calls' (either may be
+// NULL), and with 'check' verifies the index against a full rebuild and
+// times a lookup of every name.  Reports go to the output writer.
+void symindex_run(const char *index_path, char **files, int file_count,
+                  const char *find_decl, const char *find_calls, int check);
+
+#endif /* SYMINDEX_H */
@@ -83,7 +83,8 @@ typedef enum {
     ERROR_MULTI_CHAR_LITERAL,
     ERROR_INVALID_FLOAT,
     ERROR_RECOVERY_MODE,
-    ERROR_UNEXPECTED_TOKEN
+    ERROR_UNEXPECTED_TOKEN,
+    ERROR_NUMBER_OVERFLOW
 } ErrorType;
 
 /* Error recovery modes */
@@ -102,6 +103,11 @@ typedef struct {
     int column;             // Column number in source file 
     ErrorType error;        // Error type if any
     RecoveryMode recovery;  // Recovery mode if error 
+    int offset;             // Byte offset of the token in the source
+    int length;             // Number of source bytes the token spans
+    long long int_value;    // Decoded value of a TOKEN_NUMBER
+    double float_value;     // Decoded value of a TOKEN_FLOAT
+    unsigned int sym;       // Interned ID of an identifier or string, 0 if none
 } Token;
 
 #endif /* TOKENS_H */
\ No newline at end of file
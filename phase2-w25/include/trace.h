@@ -0,0 +1,16 @@
+/* trace.h */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Trace recording functions (Chrome trace-event JSON output)
+int trace_init(const char *path);
+int trace_enabled(void);
+uint64_t trace_clock(void);
+void trace_thread_name(const char *name);
+void trace_span(const char *name, const char *detail, uint64_t start,
+                long bytes, long tokens, long errors);
+int trace_finish(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,165 @@
+/* vm.h */
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <setjmp.h>
+#include "parser.h"
+#include "writer.h"
+#include "intern.h"
+
+// Instructions.  Each is one 32-bit opcode word followed by its operands;
+// the _I and _F forms operate on int64 and double values respectively.
+typedef enum {
+    OP_CONST,               // k: push constant k
+    OP_LOAD,                // s: push local slot s
+    OP_STORE,               // s: pop into local slot s
+    OP_LOAD_GLOBAL,         // g: push global g
+    OP_STORE_GLOBAL,        // g: pop into global g
+    OP_POP,
+    OP_ADD_I, OP_SUB_I, OP_MUL_I, OP_DIV_I, OP_MOD_I,
+    OP_LT_I, OP_GT_I, OP_LE_I, OP_GE_I, OP_EQ_I, OP_NE_I,
+    OP_ADD_F, OP_SUB_F, OP_MUL_F, OP_DIV_F,
+    OP_LT_F, OP_GT_F, OP_LE_F, OP_GE_F, OP_EQ_F, OP_NE_F,
+    OP_I2F,                 // Convert the top of the stack
+    OP_F2I,
+    OP_BOOL_I,              // Replace the top with 1 if it is non-zero, else 0
+    OP_BOOL_F,
+    OP_JUMP,                // t: continue at code offset t
+    OP_JUMP_IF_FALSE,       // t: pop, jump if zero
+    OP_JUMP_IF_TRUE,        // t: pop, jump if non-zero
+    OP_CALL,                // f n: call function f with n arguments
+    OP_RETURN,              // Pop the result, leave the frame, push the result
+    OP_FACTORIAL,           // Replace n with n! (int64)
+    OP_PRINT_I,
+    OP_PRINT_F,
+    OP_PRINT_STR,           // o: print the string at offset o
+    OP_PRINT_FACTORIAL,     // Pop n, print n! exactly (--bigint)
+    OP_STATEMENT,           // s: statement s starts running (VM_PROFILE)
+    OP_ENTER,               // s: a call entered the function of statement s (VM_PROFILE)
+    OP_HALT,                // Pop the program's result and stop
+    OP_COUNT
+} Opcode;
+
+typedef union {
+    long long i;
+    double f;
+} Value;
+
+typedef struct {
+    SymbolId name;
+    int entry;              // Code offset of the first instruction
+    int params;             // Parameters, in slots 0..params-1
+    int frame_size;         // Slots for parameters and locals
+    int max_stack;          // Operand stack depth needed above the frame
+} VMFunction;
+
+// A statement marked for the profiler
+typedef struct {
+    int line;
+    int column;
+    int function;           // Function index, -1 for top-level code
+    int parent;             // Enclosing statement, -1 for a function's entry
+    int kind;               // ASTNodeType; AST_FUNCTION_DECL and AST_PROGRAM mark entries
+} VMStatement;
+
+// A compiled program: one code array holding the top-level statements
+// (from offset 0) followed by every function body
+typedef struct {
+    int32_t *code;
+    int *lines;             // Source line of each code word
+    int code_length;
+    int code_capacity;
+    Value *constants;
+    int constant_count;
+    int constant_capacity;
+    char *strings;          // NUL-terminated strings, addressed by offset
+    int strings_length;
+    int strings_capacity;
+    VMFunction *functions;
+    int function_count;
+    int function_capacity;
+    int global_count;
+    int max_stack;          // Operand stack depth of the top-level code
+    VMStatement *statements;    // Statements marked with VM_PROFILE
+    int statement_count;
+    int statement_capacity;
+} BytecodeProgram;
+
+// Compile flags
+#define VM_BIGINT 0x1       // Print lairotcaf(n) exactly when n! overflows int64
+#define VM_PROFILE 0x2      // Mark each statement for the profiler (--profile)
+
+// Limits
+#define VM_STACK_SIZE (1 << 20)     // Values
+#define VM_MAX_FRAMES (1 << 16)     // Nested calls
+
+typedef enum {
+    VM_OK,
+    VM_RUNTIME_ERROR
+} VMStatus;
+
+struct Profile;
+struct VMCounts;
+
+// Run options
+typedef struct {
+    int jit;                // Compile hot functions to native code
+    int jit_threshold;      // Calls before compiling, 0 for the default
+    int *jit_compiled;      // If set, receives the number of functions compiled
+    struct Profile *profile;    // Counts statements of VM_PROFILE code, if set
+    int no_fuse;            // Interpret without superinstructions
+    struct VMCounts *counts;    // Counts dispatches (and runs, see superop.h), if set
+} VMOptions;
+
+// A call in progress
+typedef struct {
+    const int32_t *return_pc;
+    Value *base;
+    int function;           // Index of the caller, -1 for top-level code
+} VMFrame;
+
+struct Jit;
+
+// State of one run, shared by the interpreter and native code
+typedef struct VM {
+    const BytecodeProgram *program;
+    const int32_t *code;    // Code interpreted: the program's, or with superinstructions
+    Writer *out;
+    Writer *errors;
+    Value *stack;
+    Value *stack_limit;
+    Value *globals;
+    VMFrame *frames;
+    int frame_count;        // Calls in progress, interpreted or native
+    int native_depth;       // Native calls in progress on the C stack
+    struct Jit *jit;        // NULL when running interpreted only
+    struct Profile *profile;
+    struct VMCounts *counts;
+    jmp_buf failure;        // Where runtime errors unwind to
+} VM;
+
+// VM functions.  vm_compile returns the number of compile errors, which
+// are reported to 'errors'; the program must be freed either way.
+// vm_verify checks a program that did not come from vm_compile.
+int vm_compile(ASTNode *root, int flags, BytecodeProgram *program, Writer *errors);
+void vm_program_free(BytecodeProgram *program);
+VMStatus vm_run(const BytecodeProgram *program, const VMOptions *options,
+                Writer *out, Writer *errors, long long *result);
+size_t vm_call_rows(const BytecodeProgram *program, const VMOptions *options, int function,
+                    const long long *const *columns, size_t rows,
+                    long long *results, unsigned char *failed, Writer *errors);
+int vm_verify(const BytecodeProgram *program, Writer *errors);
+void vm_disassemble(Writer *out, const BytecodeProgram *program);
+const char *vm_opcode_name(int op);
+
+// Runtime support called from native code
+long long vm_call(VM *vm, int function, Value *base, int argc, int line);
+long long vm_factorial(VM *vm, long long n, int line);
+void vm_print_int(VM *vm, long long value);
+void vm_print_string(VM *vm, const char *text);
+void vm_print_factorial(VM *vm, long long n, int line);
+void vm_fail(VM *vm, int line, const char *format, ...)
+    __attribute__((noreturn, format(printf, 3, 4)));
+
+#endif /* VM_H */
@@ -0,0 +1,62 @@
+/* writer.h */
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <string.h>
+
+// Size of the reusable buffer used for file descriptor targets
+#define WRITER_BUFFER_SIZE (64 * 1024)
+
+// Buffered output writer.  Output goes either to a file descriptor
+// (one write(2) per flush) or to a growable memory buffer.
+typedef struct {
+    char *data;     // Buffer storage
+    size_t len;     // Bytes currently buffered
+    size_t cap;     // Buffer capacity
+    int fd;         // Target file descriptor, -1 for memory
+    int failed;     // Set when a write or allocation failed
+} Writer;
+
+// Writer functions
+void writer_init_fd(Writer *w, int fd);
+void writer_init_memory(Writer *w);
+void writer_free(Writer *w);
+int writer_flush(Writer *w);
+void writer_reset(Writer *w);
+void writer_grow(Writer *w, size_t needed);
+void wr_printf(Writer *w, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void wr_int(Writer *w, long long value);
+void wr_indent(Writer *w, int level);
+
+// Per-thread output writer used by all printing functions
+Writer *output_writer(void);
+void set_output_writer(Writer *w);
+
+// Make room for n more bytes
+static inline void wr_reserve(Writer *w, size_t n) {
+    if (w->len + n > w->cap) {
+        writer_grow(w, n);
+    }
+}
+
+static inline void wr_bytes(Writer *w, const char *bytes, size_t n) {
+    wr_reserve(w, n);
+    if (w->len + n <= w->cap) {
+        memcpy(w->data + w->len, bytes, n);
+        w->len += n;
+    }
+}
+
+static inline void wr_str(Writer *w, const char *text) {
+    wr_bytes(w, text, strlen(text));
+}
+
+static inline void wr_char(Writer *w, char c) {
+    wr_reserve(w, 1);
+    if (w->len < w->cap) {
+        w->data[w->len++] = c;
+    }
+}
+
+#endif /* WRITER_H */
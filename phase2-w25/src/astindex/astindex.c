@@ -0,0 +1,135 @@
+/* astindex.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "../../include/astindex.h"
+
+static ASTNode *node_of_type_link(const ASTLink *link) {
+    return (ASTNode *)((const char *)link - offsetof(ASTNode, by_type));
+}
+
+static ASTNode *node_of_name_link(const ASTLink *link) {
+    return (ASTNode *)((const char *)link - offsetof(ASTNode, by_name));
+}
+
+static void link_empty(ASTLink *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void link_append(ASTLink *head, ASTLink *link) {
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+// Unlink every node of a list, leaving it empty
+static void link_clear(ASTLink *head) {
+    ASTLink *link = head->next;
+    while (link != head) {
+        ASTLink *next = link->next;
+        link->next = NULL;
+        link->prev = NULL;
+        link = next;
+    }
+    link_empty(head);
+}
+
+void ast_index_init(ASTIndex *index) {
+    memset(index, 0, sizeof(*index));
+    for (int i = 0; i < AST_NODE_TYPE_COUNT; i++) {
+        link_empty(&index->types[i]);
+    }
+}
+
+void ast_index_free(ASTIndex *index) {
+    for (int i = 0; i < AST_NODE_TYPE_COUNT; i++) {
+        link_clear(&index->types[i]);
+    }
+    for (uint32_t i = 0; i < index->name_capacity; i++) {
+        if (index->names[i]) {
+            link_clear(index->names[i]);
+            free(index->names[i]);
+        }
+    }
+    free(index->names);
+    ast_index_init(index);
+}
+
+void ast_index_add(ASTIndex *index, ASTNode *node) {
+    if ((unsigned)node->type < AST_NODE_TYPE_COUNT) {
+        link_append(&index->types[node->type], &node->by_type);
+    }
+}
+
+// The heads are allocated one by one, so growing the table moves none
+void ast_index_add_use(ASTIndex *index, ASTNode *node) {
+    SymbolId name = node->token.sym;
+    if (name == SYMBOL_NONE) {
+        return;
+    }
+    if (name >= index->name_capacity) {
+        uint32_t capacity = index->name_capacity ? index->name_capacity : 256;
+        while (capacity <= name) {
+            capacity *= 2;
+        }
+        ASTLink **names = realloc(index->names, capacity * sizeof(ASTLink *));
+        if (!names) {
+            fprintf(stderr, "Error: Memory allocation failed for AST index\n");
+            exit(1);
+        }
+        memset(names + index->name_capacity, 0, (capacity - index->name_capacity) * sizeof(ASTLink *));
+        index->names = names;
+        index->name_capacity = capacity;
+    }
+    if (!index->names[name]) {
+        index->names[name] = malloc(sizeof(ASTLink));
+        if (!index->names[name]) {
+            fprintf(stderr, "Error: Memory allocation failed for AST index\n");
+            exit(1);
+        }
+        link_empty(index->names[name]);
+    }
+    ast_link_remove(&node->by_name);
+    link_append(index->names[name], &node->by_name);
+}
+
+void ast_index_retype(ASTIndex *index, ASTNode *node, ASTNodeType type) {
+    int indexed = node->by_type.next != NULL;
+    ast_link_remove(&node->by_type);
+    node->type = type;
+    if (indexed) {
+        ast_index_add(index, node);
+    }
+}
+
+static ASTNode *type_node(const ASTIndex *index, ASTNodeType type, const ASTLink *link) {
+    return link == &index->types[type] ? NULL : node_of_type_link(link);
+}
+
+ASTNode *ast_index_first(const ASTIndex *index, ASTNodeType type) {
+    if ((unsigned)type >= AST_NODE_TYPE_COUNT) {
+        return NULL;
+    }
+    return type_node(index, type, index->types[type].next);
+}
+
+ASTNode *ast_index_next(const ASTIndex *index, const ASTNode *node) {
+    return type_node(index, node->type, node->by_type.next);
+}
+
+ASTNode *ast_index_first_use(const ASTIndex *index, SymbolId name) {
+    if (name >= index->name_capacity || !index->names[name] ||
+        index->names[name]->next == index->names[name]) {
+        return NULL;
+    }
+    return node_of_name_link(index->names[name]->next);
+}
+
+ASTNode *ast_index_next_use(const ASTIndex *index, const ASTNode *node) {
+    const ASTLink *next = node->by_name.next;
+    return next == index->names[node->token.sym] ? NULL : node_of_name_link(next);
+}
@@ -0,0 +1,683 @@
+/* batch.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+
+#include "../../include/batch.h"
+#include "../../include/factorial.h"
+
+// Register alignment, enough for the widest vector loads
+#define BATCH_ALIGNMENT 64
+
+// Compilation.  Every expression gets a fresh register, and a register
+// returns to the free list once no variable or pending operand uses it, so
+// the kernel needs about as many registers as the body has live values.
+// A branch runs both sides for all lanes: each side sees the lanes that
+// take it as its 'live' mask, and variables assigned differently on the
+// two sides are merged with a select on the condition.  nruter stores the
+// value into the result for the live lanes and ends the path.
+
+typedef struct {
+    BatchKernel *kernel;
+    Writer *errors;
+    int error_count;
+    int *refs;                  // Variables and pending operands using each register
+    int ref_capacity;
+    int *free_registers;
+    int free_count;
+    int *slots;                 // Register bound to each local slot, -1 if none
+    int slot_count;
+    int live;                   // Mask of the lanes running the current statement
+    int returned;               // Every lane on the current path has returned
+    int result;
+} BatchCompiler;
+
+static const struct {
+    const char *lexeme;
+    BatchOp op;
+} binary_ops[] = {
+    {"+", BATCH_ADD},
+    {"-", BATCH_SUB},
+    {"*", BATCH_MUL},
+    {"/", BATCH_DIV},
+    {"<", BATCH_LT},
+    {">", BATCH_GT},
+    {"<=", BATCH_LE},
+    {">=", BATCH_GE},
+    {"==", BATCH_EQ},
+    {"!=", BATCH_NE}
+};
+
+static void *grow_array(void *data, int *capacity, size_t element) {
+    int size = *capacity ? *capacity * 2 : 16;
+    void *resized = realloc(data, size * element);
+    if (!resized) {
+        fprintf(stderr, "Error: Memory allocation failed for batch kernel\n");
+        exit(1);
+    }
+    *capacity = size;
+    return resized;
+}
+
+static void batch_error(BatchCompiler *c, ASTNode *node, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(c->errors, "Batch error at line %d, column %d: %s\n",
+              node ? node->token.line : 0, node ? node->token.column : 0, message);
+    c->error_count++;
+}
+
+static int is_float_type(TokenType type) {
+    return type == TOKEN_FLOAT_KEY || type == TOKEN_DOUBLE;
+}
+
+// Registers up to rows_register hold inputs, and constants keep theirs
+static int is_permanent(const BatchCompiler *c, int reg) {
+    return reg <= c->kernel->rows_register || c->refs[reg] == INT_MAX;
+}
+
+static void retain(BatchCompiler *c, int reg) {
+    if (reg >= 0 && !is_permanent(c, reg)) {
+        c->refs[reg]++;
+    }
+}
+
+static void release(BatchCompiler *c, int reg) {
+    if (reg >= 0 && !is_permanent(c, reg) && --c->refs[reg] == 0) {
+        c->free_registers[c->free_count++] = reg;
+    }
+}
+
+static int new_register(BatchCompiler *c, int fresh) {
+    BatchKernel *k = c->kernel;
+    int reg;
+    if (c->free_count > 0 && !fresh) {
+        reg = c->free_registers[--c->free_count];
+    } else {
+        if (k->register_count == c->ref_capacity) {
+            int capacity = c->ref_capacity;
+            c->refs = grow_array(c->refs, &c->ref_capacity, sizeof(int));
+            c->free_registers = grow_array(c->free_registers, &capacity, sizeof(int));
+        }
+        reg = k->register_count++;
+    }
+    c->refs[reg] = 1;
+    return reg;
+}
+
+// Append an instruction writing a new register, which the caller owns
+static int emit(BatchCompiler *c, BatchOp op, int a, int b, int mask, long long imm) {
+    BatchKernel *k = c->kernel;
+    if (k->instr_count == k->instr_capacity) {
+        k->instrs = grow_array(k->instrs, &k->instr_capacity, sizeof(BatchInstr));
+    }
+    // Constants are filled before any chunk runs, so no earlier
+    // instruction may have written their register
+    int dest = new_register(c, op == BATCH_CONST);
+    k->instrs[k->instr_count++] = (BatchInstr){op, dest, a, b, mask, imm};
+    return dest;
+}
+
+// Constants get registers of their own, shared and filled once per run
+static int emit_const(BatchCompiler *c, long long value) {
+    const BatchKernel *k = c->kernel;
+    for (int i = 0; i < k->instr_count; i++) {
+        if (k->instrs[i].op == BATCH_CONST && k->instrs[i].imm == value) {
+            return k->instrs[i].dest;
+        }
+    }
+    int reg = emit(c, BATCH_CONST, -1, -1, -1, value);
+    c->refs[reg] = INT_MAX;
+    return reg;
+}
+
+// Emit op(a, b) and release the operands
+static int emit_consume(BatchCompiler *c, BatchOp op, int a, int b, int mask) {
+    int dest = emit(c, op, a, b, mask, 0);
+    release(c, a);
+    release(c, b);
+    return dest;
+}
+
+// Bind a slot to a register the caller owned
+static void bind(BatchCompiler *c, int slot, int reg) {
+    release(c, c->slots[slot]);
+    c->slots[slot] = reg;
+}
+
+static int *save_slots(BatchCompiler *c) {
+    int *saved = malloc(c->slot_count * sizeof(int));
+    if (!saved) {
+        fprintf(stderr, "Error: Memory allocation failed for batch kernel\n");
+        exit(1);
+    }
+    for (int i = 0; i < c->slot_count; i++) {
+        saved[i] = c->slots[i];
+        retain(c, saved[i]);
+    }
+    return saved;
+}
+
+// Whether a variable can live in a kernel register; reports it if not
+static int check_local(BatchCompiler *c, ASTNode *node) {
+    if (node->scope_depth < 0 || node->slot < 0 || node->slot >= c->slot_count) {
+        batch_error(c, node, "Unresolved identifier '%s'", node->token.lexeme);
+        return 0;
+    }
+    if (node->scope_depth == 0) {
+        batch_error(c, node, "Global '%s' cannot be used in a batch kernel", node->token.lexeme);
+        return 0;
+    }
+    if (is_float_type(node->decl_type)) {
+        batch_error(c, node, "taolf variable '%s' cannot be used in a batch kernel", node->token.lexeme);
+        return 0;
+    }
+    return 1;
+}
+
+static int compile_expression(BatchCompiler *c, ASTNode *node, int mask);
+static int compile_condition(BatchCompiler *c, ASTNode *node, int mask);
+
+static int is_comparison(BatchOp op) {
+    return op >= BATCH_LT && op <= BATCH_NE;
+}
+
+// && and || evaluate their right operand only for the lanes that need it;
+// the result is a mask, or 0 or 1 for 'as_value'
+static int compile_logical(BatchCompiler *c, ASTNode *node, int mask, int as_value) {
+    int is_and = node->token.lexeme[0] == '&';
+    int left = compile_condition(c, node->left, mask);
+    int right_mask = emit(c, is_and ? BATCH_AND : BATCH_AND_NOT, mask, left, -1, 0);
+    int right = compile_condition(c, node->right, right_mask);
+    release(c, right_mask);
+    int both = emit_consume(c, is_and ? BATCH_AND : BATCH_OR, left, right, -1);
+    return as_value ? emit_consume(c, BATCH_BIT, both, -1, -1) : both;
+}
+
+// Comparisons store 'truth' where they hold: 1 for a value, -1 for a mask
+static int compile_binary(BatchCompiler *c, ASTNode *node, int mask, long long truth) {
+    if (strcmp(node->token.lexeme, "&&") == 0 || strcmp(node->token.lexeme, "||") == 0) {
+        return compile_logical(c, node, mask, truth == 1);
+    }
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (strcmp(node->token.lexeme, binary_ops[i].lexeme) == 0) {
+            BatchOp op = binary_ops[i].op;
+            int left = compile_expression(c, node->left, mask);
+            int right = compile_expression(c, node->right, mask);
+            int dest = emit(c, op, left, right, op == BATCH_DIV ? mask : -1, is_comparison(op) ? truth : 0);
+            release(c, left);
+            release(c, right);
+            return dest;
+        }
+    }
+    batch_error(c, node, "Unsupported operator '%s'", node->token.lexeme);
+    return emit_const(c, 0);
+}
+
+// Mask of the lanes where a condition holds
+static int compile_condition(BatchCompiler *c, ASTNode *node, int mask) {
+    if (node && node->type == AST_BINOP) {
+        int value = compile_binary(c, node, mask, -1);
+        const BatchInstr *last = &c->kernel->instrs[c->kernel->instr_count - 1];
+        if (last->dest == value && (is_comparison(last->op) || last->op == BATCH_AND || last->op == BATCH_OR)) {
+            return value;
+        }
+        return emit_consume(c, BATCH_TEST, value, -1, -1);
+    }
+    return emit_consume(c, BATCH_TEST, compile_expression(c, node, mask), -1, -1);
+}
+
+// Lanes outside 'mask' may compute anything but must not fail
+static int compile_expression(BatchCompiler *c, ASTNode *node, int mask) {
+    if (!node) {
+        return emit_const(c, 0);
+    }
+    switch (node->type) {
+        case AST_NUMBER:
+            if (node->token.type == TOKEN_FLOAT) {
+                batch_error(c, node, "taolf literal %s cannot be used in a batch kernel",
+                            node->token.lexeme);
+                return emit_const(c, 0);
+            }
+            return emit_const(c, node->token.int_value);
+        case AST_IDENTIFIER:
+            if (!check_local(c, node) || c->slots[node->slot] < 0) {
+                return emit_const(c, 0);
+            }
+            retain(c, c->slots[node->slot]);
+            return c->slots[node->slot];
+        case AST_BINOP:
+            return compile_binary(c, node, mask, 1);
+        case AST_FACTORIAL:
+            return emit_consume(c, BATCH_FACTORIAL, compile_expression(c, node->left, mask), -1, mask);
+        case AST_FUNCTION_CALL:
+            batch_error(c, node, "Call to '%s' cannot be used in a batch kernel", node->token.lexeme);
+            return emit_const(c, 0);
+        case AST_STRING:
+            batch_error(c, node, "String literals can only be printed");
+            return emit_const(c, 0);
+        default:
+            batch_error(c, node, "Unsupported expression");
+            return emit_const(c, 0);
+    }
+}
+
+static void compile_statement(BatchCompiler *c, ASTNode *node);
+
+static void compile_if(BatchCompiler *c, ASTNode *node) {
+    ASTNode *then_branch = node->right;
+    ASTNode *else_branch = NULL;
+    if (then_branch && then_branch->type == AST_ELSE) {
+        else_branch = then_branch->right;
+        then_branch = then_branch->left;
+    }
+
+    int condition = compile_condition(c, node->left, c->live);
+    int live = c->live;
+    int then_live = emit(c, BATCH_AND, live, condition, -1, 0);
+    int else_live = emit(c, BATCH_AND_NOT, live, condition, -1, 0);
+    // Held until the join, so a side that narrows 'live' cannot end with a
+    // reused register of the same number
+    retain(c, then_live);
+    retain(c, else_live);
+    int *before = save_slots(c);
+
+    c->live = then_live;
+    compile_statement(c, then_branch);
+    int then_returned = c->returned;
+    int then_end = c->live;
+    int *after_then = save_slots(c);
+    for (int i = 0; i < c->slot_count; i++) {
+        retain(c, before[i]);
+        bind(c, i, before[i]);
+    }
+
+    c->live = else_live;
+    c->returned = 0;
+    compile_statement(c, else_branch);
+    int else_returned = c->returned;
+    int else_end = c->live;
+
+    // Join: a side that returned contributes no lanes
+    c->returned = then_returned && else_returned;
+    if (c->returned) {
+        c->live = live;
+        release(c, then_end);
+        release(c, else_end);
+    } else if (then_returned) {
+        c->live = else_end;
+        release(c, then_end);
+    } else if (else_returned) {
+        c->live = then_end;
+        release(c, else_end);
+        for (int i = 0; i < c->slot_count; i++) {
+            retain(c, after_then[i]);
+            bind(c, i, after_then[i]);
+        }
+    } else {
+        for (int i = 0; i < c->slot_count; i++) {
+            int then_value = after_then[i];
+            int else_value = c->slots[i];
+            if (then_value == else_value) {
+                continue;
+            }
+            // A slot bound on one side only belongs to a scope that ended
+            int merged = then_value < 0 || else_value < 0 ? -1
+                       : emit(c, BATCH_SELECT, then_value, else_value, condition, 0);
+            bind(c, i, merged);
+        }
+        if (then_end == then_live && else_end == else_live) {
+            c->live = live;     // No lanes returned on either side
+            release(c, then_end);
+            release(c, else_end);
+        } else {
+            c->live = emit_consume(c, BATCH_OR, then_end, else_end, -1);
+            release(c, live);
+        }
+        live = -1;
+    }
+    if (live >= 0 && live != c->live) {
+        release(c, live);
+    }
+
+    for (int i = 0; i < c->slot_count; i++) {
+        release(c, before[i]);
+        release(c, after_then[i]);
+    }
+    free(before);
+    free(after_then);
+    release(c, then_live);
+    release(c, else_live);
+    release(c, condition);
+}
+
+static void compile_statement(BatchCompiler *c, ASTNode *node) {
+    if (!node || c->returned) {
+        return;
+    }
+    switch (node->type) {
+        case AST_BLOCK:
+            // Statements after every lane returned never run
+            for (ASTNode *link = node; link && link->type == AST_BLOCK && !c->returned; link = link->right) {
+                compile_statement(c, link->left);
+            }
+            break;
+        case AST_VARDECL:
+            if (check_local(c, node)) {
+                bind(c, node->slot, node->right ? compile_expression(c, node->right, c->live)
+                                                : emit_const(c, 0));
+            }
+            break;
+        case AST_ASSIGN:
+            if (node->left && check_local(c, node->left)) {
+                bind(c, node->left->slot, compile_expression(c, node->right, c->live));
+            }
+            break;
+        case AST_RETURN: {
+            int value = compile_expression(c, node->left, c->live);
+            int result = emit(c, BATCH_SELECT, value, c->result, c->live, 0);
+            release(c, value);
+            release(c, c->result);
+            c->result = result;
+            c->returned = 1;
+            break;
+        }
+        case AST_IF:
+            compile_if(c, node);
+            break;
+        case AST_WHILE:
+        case AST_FOR:
+            batch_error(c, node, "Loops cannot be used in a batch kernel");
+            break;
+        case AST_PRINT:
+            batch_error(c, node, "tnirp cannot be used in a batch kernel");
+            break;
+        case AST_FUNCTION_DECL:
+            batch_error(c, node, "Nested function '%s' is not supported", node->token.lexeme);
+            break;
+        default:
+            // Expression statement, kept for its runtime errors
+            release(c, compile_expression(c, node, c->live));
+            break;
+    }
+}
+
+int batch_compile(ASTNode *function, BatchKernel *kernel, Writer *errors) {
+    memset(kernel, 0, sizeof(*kernel));
+    BatchCompiler c = {0};
+    c.kernel = kernel;
+    c.errors = errors;
+    if (!function || function->type != AST_FUNCTION_DECL) {
+        batch_error(&c, function, "Not a function declaration");
+        return c.error_count;
+    }
+    if (function->slot < 0) {
+        batch_error(&c, function, "Function '%s' was not resolved", function->token.lexeme);
+        return c.error_count;
+    }
+    if (is_float_type(function->decl_type)) {
+        batch_error(&c, function, "Function '%s' returns taolf; batch kernels compute tni",
+                    function->token.lexeme);
+    }
+
+    int params = 0;
+    for (ASTNode *param = function->left; param; param = param->right) {
+        params++;
+    }
+    kernel->params = params;
+    kernel->rows_register = params;
+    kernel->register_count = params + 1;
+    c.ref_capacity = 0;
+    while (c.ref_capacity < kernel->register_count) {
+        c.refs = grow_array(c.refs, &c.ref_capacity, sizeof(int));
+    }
+    c.free_registers = calloc(c.ref_capacity, sizeof(int));
+    c.slot_count = function->slot > params ? function->slot : params;
+    c.slots = malloc((c.slot_count + 1) * sizeof(int));
+    if (!c.free_registers || !c.slots) {
+        fprintf(stderr, "Error: Memory allocation failed for batch kernel\n");
+        exit(1);
+    }
+    for (int i = 0; i < c.slot_count; i++) {
+        c.slots[i] = -1;
+    }
+    int index = 0;
+    for (ASTNode *param = function->left; param; param = param->right, index++) {
+        if (check_local(&c, param)) {
+            c.slots[param->slot] = index;
+        }
+    }
+
+    c.live = kernel->rows_register;
+    c.result = emit_const(&c, 0);  // Falling off the end returns 0
+    compile_statement(&c, function->right);
+    kernel->result = c.result;
+
+    free(c.refs);
+    free(c.free_registers);
+    free(c.slots);
+    return c.error_count;
+}
+
+void batch_free(BatchKernel *kernel) {
+    free(kernel->instrs);
+    memset(kernel, 0, sizeof(*kernel));
+}
+
+// Execution.  Registers are arrays of BATCH_LANES values.  Each operation
+// is a loop over the lanes of registers that cannot overlap, which the
+// compiler vectorizes for the instruction set of the function it is
+// inlined into: one built for AVX2, one for SSE4.2 (SSE2 has no 64-bit
+// compare) and one for the build target.  Division and lairotcaf have no
+// vector instructions and run lane by lane.
+
+// n! for every n lairotcaf accepts, filled by batch_run
+static long long factorials[FACTORIAL_MAX_INT64 + 1];
+
+static inline __attribute__((always_inline))
+void run_instr(const BatchInstr *instr, long long *restrict d, const long long *restrict a,
+               const long long *restrict b, const long long *restrict m, long long *restrict fail) {
+    const unsigned long long *ua = (const unsigned long long *)a;
+    const unsigned long long *ub = (const unsigned long long *)b;
+    long long truth = instr->imm;
+    switch ((BatchOp)instr->op) {
+        case BATCH_CONST:
+            break;      // Filled before the first chunk
+        case BATCH_ADD:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = (long long)(ua[l] + ub[l]);
+            break;
+        case BATCH_SUB:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = (long long)(ua[l] - ub[l]);
+            break;
+        case BATCH_MUL:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = (long long)(ua[l] * ub[l]);
+            break;
+        case BATCH_LT:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] < b[l]);
+            break;
+        case BATCH_GT:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] > b[l]);
+            break;
+        case BATCH_LE:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] <= b[l]);
+            break;
+        case BATCH_GE:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] >= b[l]);
+            break;
+        case BATCH_EQ:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] == b[l]);
+            break;
+        case BATCH_NE:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = truth & -(long long)(a[l] != b[l]);
+            break;
+        case BATCH_TEST:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = -(long long)(a[l] != 0);
+            break;
+        case BATCH_AND:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = a[l] & b[l];
+            break;
+        case BATCH_AND_NOT:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = a[l] & ~b[l];
+            break;
+        case BATCH_OR:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = a[l] | b[l];
+            break;
+        case BATCH_BIT:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = a[l] & 1;
+            break;
+        case BATCH_SELECT:
+            for (int l = 0; l < BATCH_LANES; l++) d[l] = (a[l] & m[l]) | (b[l] & ~m[l]);
+            break;
+        case BATCH_DIV:
+            // Lanes that do not run are skipped; -1 wraps like the VM
+            for (int l = 0; l < BATCH_LANES; l++) {
+                long long divisor = b[l];
+                if (!m[l]) {
+                    d[l] = 0;
+                } else if (divisor == 0) {
+                    fail[l] = -1;
+                    d[l] = 0;
+                } else if (divisor == -1) {
+                    d[l] = (long long)(0 - ua[l]);
+                } else {
+                    d[l] = a[l] / divisor;
+                }
+            }
+            break;
+        case BATCH_FACTORIAL:
+            for (int l = 0; l < BATCH_LANES; l++) {
+                int fits = a[l] >= 0 && a[l] <= FACTORIAL_MAX_INT64;
+                d[l] = fits ? factorials[a[l]] : 0;
+                fail[l] |= m[l] & -(long long)!fits;
+            }
+            break;
+    }
+}
+
+static inline __attribute__((always_inline))
+void run_chunk(const BatchKernel *kernel, long long *registers, long long *fail) {
+    for (int i = 0; i < kernel->instr_count; i++) {
+        const BatchInstr *instr = &kernel->instrs[i];
+        // Unused operands read register 0; the destination is never an operand
+        run_instr(instr, registers + (size_t)instr->dest * BATCH_LANES,
+                  registers + (size_t)(instr->a < 0 ? 0 : instr->a) * BATCH_LANES,
+                  registers + (size_t)(instr->b < 0 ? 0 : instr->b) * BATCH_LANES,
+                  registers + (size_t)(instr->mask < 0 ? 0 : instr->mask) * BATCH_LANES, fail);
+    }
+}
+
+static void run_chunk_generic(const BatchKernel *kernel, long long *registers, long long *fail) {
+    run_chunk(kernel, registers, fail);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static void run_chunk_sse42(const BatchKernel *kernel, long long *registers, long long *fail) {
+    run_chunk(kernel, registers, fail);
+}
+
+__attribute__((target("avx2")))
+static void run_chunk_avx2(const BatchKernel *kernel, long long *registers, long long *fail) {
+    run_chunk(kernel, registers, fail);
+}
+#endif
+
+BatchIsa batch_best_isa(void) {
+    BatchIsa best = BATCH_ISA_GENERIC;
+    for (BatchIsa isa = 0; isa < BATCH_ISA_COUNT; isa++) {
+        if (batch_isa_supported(isa)) {
+            best = isa;
+        }
+    }
+    return best;
+}
+
+int batch_isa_supported(BatchIsa isa) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (isa == BATCH_ISA_SSE42) {
+        return __builtin_cpu_supports("sse4.2");
+    }
+    if (isa == BATCH_ISA_AVX2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return isa == BATCH_ISA_GENERIC;
+}
+
+const char *batch_isa_name(BatchIsa isa) {
+    if (isa == BATCH_ISA_AVX2) {
+        return "avx2";
+    }
+    if (isa == BATCH_ISA_SSE42) {
+        return "sse4.2";
+    }
+#if defined(__x86_64__)
+    return "sse2";
+#else
+    return "generic";
+#endif
+}
+
+size_t batch_run(const BatchKernel *kernel, BatchIsa isa, const long long *const *columns,
+                 size_t rows, long long *results, unsigned char *failed) {
+    void (*run)(const BatchKernel *, long long *, long long *) = run_chunk_generic;
+#if defined(__x86_64__)
+    if (batch_isa_supported(isa)) {
+        run = isa == BATCH_ISA_AVX2 ? run_chunk_avx2 : isa == BATCH_ISA_SSE42 ? run_chunk_sse42 : run;
+    }
+#endif
+    for (int n = 0; n <= FACTORIAL_MAX_INT64; n++) {
+        factorial_int64(n, &factorials[n]);
+    }
+
+    size_t bytes = (size_t)kernel->register_count * BATCH_LANES * sizeof(long long);
+    long long *registers = aligned_alloc(BATCH_ALIGNMENT, bytes);
+    long long *fail = aligned_alloc(BATCH_ALIGNMENT, BATCH_LANES * sizeof(long long));
+    if (!registers || !fail) {
+        fprintf(stderr, "Error: Memory allocation failed for batch kernel\n");
+        exit(1);
+    }
+    memset(registers, 0, bytes);
+    for (int i = 0; i < kernel->instr_count; i++) {
+        const BatchInstr *instr = &kernel->instrs[i];
+        if (instr->op == BATCH_CONST) {
+            for (int l = 0; l < BATCH_LANES; l++) {
+                registers[(size_t)instr->dest * BATCH_LANES + l] = instr->imm;
+            }
+        }
+    }
+
+    size_t failures = 0;
+    for (size_t start = 0; start < rows; start += BATCH_LANES) {
+        size_t count = rows - start < BATCH_LANES ? rows - start : BATCH_LANES;
+        for (int p = 0; p < kernel->params; p++) {
+            long long *column = registers + (size_t)p * BATCH_LANES;
+            memcpy(column, columns[p] + start, count * sizeof(long long));
+            memset(column + count, 0, (BATCH_LANES - count) * sizeof(long long));
+        }
+        long long *present = registers + (size_t)kernel->rows_register * BATCH_LANES;
+        for (size_t l = 0; l < BATCH_LANES; l++) {
+            present[l] = l < count ? -1 : 0;
+        }
+        memset(fail, 0, BATCH_LANES * sizeof(long long));
+
+        run(kernel, registers, fail);
+
+        const long long *result = registers + (size_t)kernel->result * BATCH_LANES;
+        for (size_t l = 0; l < count; l++) {
+            results[start + l] = fail[l] ? 0 : result[l];
+            if (failed) failed[start + l] = fail[l] != 0;
+            failures += fail[l] != 0;
+        }
+    }
+
+    free(registers);
+    free(fail);
+    return failures;
+}
@@ -0,0 +1,439 @@
+/* btok.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/btok.h"
+#include "../../include/lexer.h"
+#include "../../include/writer.h"
+
+// Deduplicating string table used while writing
+typedef struct {
+    uint32_t *slots;        // Hash slots holding string index + 1 (0 = empty)
+    uint32_t slot_mask;
+    uint32_t *offsets;      // Offset of each string in 'bytes'
+    uint32_t count;
+    uint32_t capacity;
+    Writer bytes;           // NUL-terminated strings
+} StringTable;
+
+static uint32_t hash_string(const char *text, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int string_table_init(StringTable *table) {
+    table->slot_mask = 1024 - 1;
+    table->slots = calloc(table->slot_mask + 1, sizeof(uint32_t));
+    table->capacity = 512;
+    table->offsets = malloc(table->capacity * sizeof(uint32_t));
+    table->count = 0;
+    writer_init_memory(&table->bytes);
+    return table->slots && table->offsets && !table->bytes.failed;
+}
+
+static void string_table_free(StringTable *table) {
+    free(table->slots);
+    free(table->offsets);
+    writer_free(&table->bytes);
+}
+
+// Double the hash slots when the table is half full
+static int string_table_rehash(StringTable *table) {
+    uint32_t mask = table->slot_mask * 2 + 1;
+    uint32_t *slots = calloc(mask + 1, sizeof(uint32_t));
+    if (!slots) return 0;
+
+    for (uint32_t i = 0; i < table->count; i++) {
+        const char *text = table->bytes.data + table->offsets[i];
+        uint32_t slot = hash_string(text, strlen(text)) & mask;
+        while (slots[slot]) slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_mask = mask;
+    return 1;
+}
+
+// Get the index of a string, adding it if it is new
+static int string_table_intern(StringTable *table, const char *text) {
+    size_t len = strlen(text);
+    uint32_t slot = hash_string(text, len) & table->slot_mask;
+
+    while (table->slots[slot]) {
+        uint32_t index = table->slots[slot] - 1;
+        if (strcmp(table->bytes.data + table->offsets[index], text) == 0) {
+            return (int)index;
+        }
+        slot = (slot + 1) & table->slot_mask;
+    }
+
+    if (table->count == table->capacity) {
+        uint32_t *offsets = realloc(table->offsets, table->capacity * 2 * sizeof(uint32_t));
+        if (!offsets) return -1;
+        table->offsets = offsets;
+        table->capacity *= 2;
+    }
+
+    uint32_t index = table->count++;
+    table->offsets[index] = (uint32_t)table->bytes.len;
+    wr_bytes(&table->bytes, text, len + 1);
+    table->slots[slot] = index + 1;
+
+    if (table->count * 2 > table->slot_mask) {
+        string_table_rehash(table);
+    }
+    return (int)index;
+}
+
+// LEB128 varint encoding
+static void write_varint(Writer *w, uint32_t value) {
+    wr_reserve(w, 5);
+    while (value >= 0x80) {
+        w->data[w->len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    w->data[w->len++] = (char)value;
+}
+
+static inline uint32_t read_varint(const unsigned char **cursor, const unsigned char *end) {
+    // Most fields fit in one byte
+    if (*cursor < end && **cursor < 0x80) {
+        return *(*cursor)++;
+    }
+
+    uint32_t value = 0;
+    int shift = 0;
+    while (*cursor < end) {
+        unsigned char byte = *(*cursor)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+        shift += 7;
+    }
+    return value;
+}
+
+// Write all bytes to a file descriptor
+static int write_all(int fd, const void *data, size_t len) {
+    const char *bytes = data;
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) return -1;
+        bytes += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Lex the input and append it to 'out' in .btok format
+int btok_encode(const char *input, Writer *out, int flags) {
+    int errors = 0;
+    Writer records;
+    StringTable strings;
+    BtokHeader header;
+    Token token;
+    int position = 0;
+    int prev_end = 0;
+    int prev_line = 1;
+
+    writer_init_memory(&records);
+    if ((flags & BTOK_FLAG_STRINGS) && !string_table_init(&strings)) {
+        writer_free(&records);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BTOK_MAGIC, 4);
+    header.version = BTOK_VERSION;
+    header.flags = (uint16_t)flags;
+    header.byte_order = BTOK_BYTE_ORDER;
+
+    reset_lexer();
+    do {
+        token = get_next_token(input, &position);
+
+        write_varint(&records, ((uint32_t)token.type << 1) | (token.error != ERROR_NONE));
+        if (token.error != ERROR_NONE) {
+            write_varint(&records, token.error);
+            errors++;
+        }
+        write_varint(&records, (uint32_t)(token.offset - prev_end));
+        write_varint(&records, (uint32_t)token.length);
+        write_varint(&records, (uint32_t)(token.line - prev_line));
+        write_varint(&records, (uint32_t)token.column);
+        if (flags & BTOK_FLAG_STRINGS) {
+            write_varint(&records, (uint32_t)string_table_intern(&strings, token.lexeme));
+        }
+
+        prev_end = token.offset + token.length;
+        prev_line = token.line;
+        header.token_count++;
+    } while (token.type != TOKEN_EOF);
+
+    header.source_size = (uint32_t)position;
+    header.records_size = (uint32_t)records.len;
+    if (flags & BTOK_FLAG_STRINGS) {
+        header.string_count = strings.count;
+        header.strings_size = (uint32_t)strings.bytes.len;
+    }
+
+    wr_bytes(out, (const char *)&header, sizeof(header));
+    wr_bytes(out, records.data, records.len);
+    if (flags & BTOK_FLAG_STRINGS) {
+        // Pad so the offsets array is 4-byte aligned in the mapping
+        static const char padding[4] = {0};
+        wr_bytes(out, padding, (4 - (sizeof(header) + records.len) % 4) % 4);
+        wr_bytes(out, (const char *)strings.offsets, strings.count * sizeof(uint32_t));
+        wr_bytes(out, strings.bytes.data, strings.bytes.len);
+    }
+    int result = records.failed || out->failed ? -1 : errors;
+
+    writer_free(&records);
+    if (flags & BTOK_FLAG_STRINGS) {
+        string_table_free(&strings);
+    }
+    return result;
+}
+
+// Lex the input and write it as a .btok file
+int btok_write_file(const char *input, const char *path, int flags) {
+    Writer encoded;
+    writer_init_memory(&encoded);
+    int result = btok_encode(input, &encoded, flags);
+    if (result >= 0) {
+        result = -1;
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            result = write_all(fd, encoded.data, encoded.len);
+            close(fd);
+        }
+    }
+    writer_free(&encoded);
+    return result;
+}
+
+// Map a .btok file and validate its header.  With strings, every offset
+// must fall inside the strings section and the section must end in a NUL,
+// so each lexeme pointer btok_next hands out is a C string in the mapping.
+int btok_open(BtokReader *reader, const char *path) {
+    struct stat st;
+    memset(reader, 0, sizeof(*reader));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(BtokHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    reader->base = base;
+    reader->size = st.st_size;
+    reader->header = base;
+
+    const BtokHeader *header = reader->header;
+    size_t records_end = sizeof(BtokHeader) + header->records_size;
+    if (memcmp(header->magic, BTOK_MAGIC, 4) != 0 || header->version != BTOK_VERSION ||
+        header->byte_order != BTOK_BYTE_ORDER || records_end > reader->size) {
+        btok_close(reader);
+        return -1;
+    }
+
+    reader->cursor = reader->base + sizeof(BtokHeader);
+    reader->end = reader->base + records_end;
+    reader->remaining = header->token_count;
+    reader->prev_line = 1;
+
+    if (header->flags & BTOK_FLAG_STRINGS) {
+        size_t table = records_end + (4 - records_end % 4) % 4;
+        size_t bytes = table + header->string_count * sizeof(uint32_t);
+        if (bytes + header->strings_size > reader->size) {
+            btok_close(reader);
+            return -1;
+        }
+        reader->string_offsets = (const uint32_t *)(reader->base + table);
+        reader->strings = (const char *)reader->base + bytes;
+
+        if (header->strings_size > 0 && reader->strings[header->strings_size - 1] != '\0') {
+            btok_close(reader);
+            return -1;
+        }
+        for (uint32_t i = 0; i < header->string_count; i++) {
+            if (reader->string_offsets[i] >= header->strings_size) {
+                btok_close(reader);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Decode the next token; returns 0 at the end of the stream
+int btok_next(BtokReader *reader, BtokToken *token) {
+    if (reader->remaining == 0 || reader->cursor >= reader->end) {
+        return 0;
+    }
+
+    uint32_t type = read_varint(&reader->cursor, reader->end);
+    token->type = (TokenType)(type >> 1);
+    token->error = (type & 1) ? (ErrorType)read_varint(&reader->cursor, reader->end) : ERROR_NONE;
+    token->offset = reader->prev_end + (int)read_varint(&reader->cursor, reader->end);
+    token->length = (int)read_varint(&reader->cursor, reader->end);
+    token->line = reader->prev_line + (int)read_varint(&reader->cursor, reader->end);
+    token->column = (int)read_varint(&reader->cursor, reader->end);
+    token->lexeme = NULL;
+    if (reader->strings) {
+        uint32_t index = read_varint(&reader->cursor, reader->end);
+        if (index < reader->header->string_count) {
+            token->lexeme = reader->strings + reader->string_offsets[index];
+        }
+    }
+
+    reader->prev_end = token->offset + token->length;
+    reader->prev_line = token->line;
+    reader->remaining--;
+    return 1;
+}
+
+// Unmap the file
+void btok_close(BtokReader *reader) {
+    if (reader->base) {
+        munmap((void *)reader->base, reader->size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+static double elapsed_ms(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Keeps the timed consume loops from being optimized away
+static volatile long consume_sink;
+
+// Consume the textual token stream the way downstream tools did:
+// recover line and column from every "Token: ..." line
+static long consume_text(const char *text, size_t len) {
+    long checksum = 0;
+    const char *end = text + len;
+    while (text < end) {
+        const char *eol = memchr(text, '\n', end - text);
+        if (!eol) eol = end;
+        if (strncmp(text, "Token: ", 7) == 0) {
+            const char *line = NULL;
+            for (const char *c = eol - 1; c > text; c--) {
+                if (*c == 'L' && strncmp(c, "Line: ", 6) == 0) {
+                    line = c;
+                    break;
+                }
+            }
+            if (line) {
+                checksum += strtol(line + 6, NULL, 10);
+                const char *column = strstr(line, "Column: ");
+                if (column) checksum += strtol(column + 8, NULL, 10);
+            }
+        }
+        text = eol + 1;
+    }
+    return checksum;
+}
+
+// Round-trip check: write the input as .btok, read it back through the
+// mmap reader and compare every token with a fresh lex of the input.
+// Also reports size and consume time against the textual token stream.
+int btok_check(const char *input, const char *path) {
+    Writer *out = output_writer();
+    Writer text;
+    BtokReader reader;
+    BtokToken decoded;
+    Token token;
+    int position = 0;
+    int mismatches = 0;
+    int count = 0;
+
+    // Lexical errors are reported while writing; keep them out of the report
+    Writer scratch;
+    writer_init_memory(&scratch);
+    set_output_writer(&scratch);
+    int written = btok_write_file(input, path, BTOK_FLAG_STRINGS);
+
+    // Re-lex into the textual format for comparison
+    writer_init_memory(&text);
+    reset_lexer();
+    set_output_writer(&text);
+    if (written == 0 && btok_open(&reader, path) == 0) {
+        do {
+            token = get_next_token(input, &position);
+            write_token(&text, token);
+            count++;
+            if (!btok_next(&reader, &decoded) ||
+                decoded.type != token.type || decoded.error != token.error ||
+                decoded.offset != token.offset || decoded.length != token.length ||
+                decoded.line != token.line || decoded.column != token.column ||
+                !decoded.lexeme || strcmp(decoded.lexeme, token.lexeme) != 0) {
+                mismatches++;
+            }
+        } while (token.type != TOKEN_EOF);
+        if (btok_next(&reader, &decoded)) {
+            mismatches++;
+        }
+    } else {
+        written = -1;
+    }
+    set_output_writer(out);
+    writer_free(&scratch);
+
+    if (written != 0) {
+        wr_printf(out, "BTOK CHECK: could not write or map %s\n", path);
+        writer_free(&text);
+        return -1;
+    }
+
+    // Time consuming both formats
+    const int rounds = 1000;
+    struct timespec start;
+    long checksum = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        checksum += consume_text(text.data, text.len);
+    }
+    double text_ms = elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        BtokReader again = reader;
+        again.cursor = reader.base + sizeof(BtokHeader);
+        again.remaining = reader.header->token_count;
+        again.prev_end = 0;
+        again.prev_line = 1;
+        while (btok_next(&again, &decoded)) {
+            checksum -= decoded.line + decoded.column;
+        }
+    }
+    double btok_ms = elapsed_ms(&start);
+
+    wr_printf(out, "BTOK CHECK: %d tokens, %d mismatches (%s)\n", count, mismatches,
+              mismatches ? "FAILED" : "round trip OK");
+    wr_printf(out, "  text stream: %zu bytes, %.3f us to consume\n", text.len, text_ms * 1000 / rounds);
+    wr_printf(out, "  btok stream: %zu bytes (%zu records + strings), %.3f us to consume\n",
+              reader.size, (size_t)reader.header->records_size, btok_ms * 1000 / rounds);
+    consume_sink = checksum;
+
+    btok_close(&reader);
+    writer_free(&text);
+    return mismatches ? -1 : 0;
+}
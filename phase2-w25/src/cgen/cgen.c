@@ -0,0 +1,943 @@
+/* cgen.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../include/cgen.h"
+#include "../../include/intern.h"
+#include "../../include/factorial.h"
+
+// Static types of expressions, as in the VM
+typedef enum {
+    TYPE_INT,
+    TYPE_FLOAT
+} ValueType;
+
+// Runtime helpers, emitted only when used
+#define HELPER_FAIL 0x1
+#define HELPER_DIV 0x2
+#define HELPER_MOD 0x4
+#define HELPER_FACTORIAL 0x8
+#define HELPER_PRINT_INT 0x10
+#define HELPER_PRINT_FLOAT 0x20
+#define HELPER_PRINT_STRING 0x40
+
+// Variable names of one frame (the globals, or the current function).  A
+// name declared with more than one slot gets the slot appended in C.
+typedef struct {
+    int *slot;                  // First slot seen, by symbol
+    int *stamp;                 // Frame that set 'slot', by symbol
+    unsigned char *clash;
+    int frame;
+} NameTable;
+
+typedef struct {
+    Writer *out;                // Function definitions and top-level code
+    Writer *errors;
+    int error_count;
+    const char *source;         // Source file name, escaped for #line
+    uint32_t symbol_limit;
+    NameTable globals;
+    NameTable locals;
+    int *function_index;        // Function per symbol ID, -1 if none
+    ASTNode **functions;
+    int function_count;
+    int function_capacity;
+    int in_function;
+    int indent;
+    int temp_count;             // Temporaries for ordered operand evaluation
+    int bare;                   // Next binary operation needs no parentheses
+    unsigned helpers;
+} CGen;
+
+// Identifiers that generated code cannot use as they are
+static const char *const reserved_names[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline",
+    "int", "long", "register", "restrict", "return", "short", "signed", "sizeof",
+    "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+    "volatile", "while", "alignas", "alignof", "bool", "constexpr", "false",
+    "nullptr", "static_assert", "thread_local", "true", "typeof", "typeof_unqual",
+    "asm", "main",
+    // Object-like macros from <stdio.h>, <stdlib.h> and <math.h>
+    "EOF", "NULL", "stdin", "stdout", "stderr", "BUFSIZ", "FILENAME_MAX",
+    "FOPEN_MAX", "TMP_MAX", "L_tmpnam", "P_tmpdir", "SEEK_SET", "SEEK_CUR",
+    "SEEK_END", "EXIT_SUCCESS", "EXIT_FAILURE", "RAND_MAX", "MB_CUR_MAX",
+    "HUGE_VAL", "INFINITY", "NAN"
+};
+
+static void cgen_error(CGen *g, ASTNode *node, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(g->errors, "Compile error at line %d, column %d: %s\n",
+              node ? node->token.line : 0, node ? node->token.column : 0, message);
+    g->error_count++;
+}
+
+static void *cgen_alloc(size_t count, size_t size) {
+    void *memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Error: Memory allocation failed for C output\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// Names
+
+static void names_init(NameTable *names, uint32_t limit) {
+    names->slot = cgen_alloc(limit, sizeof(int));
+    names->stamp = cgen_alloc(limit, sizeof(int));
+    names->clash = cgen_alloc(limit, 1);
+    names->frame = 0;
+}
+
+static void names_free(NameTable *names) {
+    free(names->slot);
+    free(names->stamp);
+    free(names->clash);
+}
+
+static void names_add(CGen *g, NameTable *names, ASTNode *decl) {
+    SymbolId sym = decl->token.sym;
+    if (sym >= g->symbol_limit) {
+        return;
+    }
+    if (names->stamp[sym] != names->frame) {
+        names->stamp[sym] = names->frame;
+        names->slot[sym] = decl->slot;
+        names->clash[sym] = 0;
+    } else if (names->slot[sym] != decl->slot) {
+        names->clash[sym] = 1;
+    }
+}
+
+static int names_clash(const NameTable *names, SymbolId sym) {
+    return names->stamp[sym] == names->frame && names->clash[sym];
+}
+
+// Visit every variable declared in 'node' and the blocks under it, in
+// program order, not counting nested functions
+static void walk_declarations(CGen *g, ASTNode *node, void (*visit)(CGen *, ASTNode *)) {
+    for (; node; node = node->right) {
+        switch (node->type) {
+            case AST_VARDECL:
+                visit(g, node);
+                return;
+            case AST_FUNCTION_DECL:
+                return;
+            case AST_PROGRAM:
+            case AST_BLOCK:
+            case AST_ELSE:
+                walk_declarations(g, node->left, visit);
+                break; // Continue along the chain
+            case AST_IF:
+            case AST_WHILE:
+                break;
+            case AST_FOR:
+                walk_declarations(g, node->left, visit);
+                return;
+            default:
+                return;
+        }
+    }
+}
+
+static int is_reserved(const char *name) {
+    for (size_t i = 0; i < sizeof(reserved_names) / sizeof(reserved_names[0]); i++) {
+        if (strcmp(name, reserved_names[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// C name of a variable.  Globals are prefixed with g_ and functions with
+// fn_; locals keep their name unless it is reserved or could be taken for
+// one of the prefixed names, in which case they get l_.
+static void write_variable(CGen *g, ASTNode *node) {
+    const char *name = node->token.lexeme;
+    SymbolId sym = node->token.sym;
+    int global = node->scope_depth == 0;
+    const NameTable *names = global ? &g->globals : &g->locals;
+    if (global) {
+        wr_str(g->out, "g_");
+    } else if (is_reserved(name) || strncmp(name, "g_", 2) == 0 || strncmp(name, "fn_", 3) == 0 ||
+               strncmp(name, "bc_", 3) == 0 || strncmp(name, "l_", 2) == 0) {
+        wr_str(g->out, "l_");
+    }
+    wr_str(g->out, name);
+    if (sym < g->symbol_limit && names_clash(names, sym)) {
+        wr_printf(g->out, "_%d", node->slot);
+    }
+}
+
+static const char *c_type(TokenType type) {
+    return type == TOKEN_FLOAT_KEY || type == TOKEN_DOUBLE ? "double" : "long long";
+}
+
+static void add_global(CGen *g, ASTNode *decl) {
+    if (decl->scope_depth == 0) names_add(g, &g->globals, decl);
+}
+
+static void add_local(CGen *g, ASTNode *decl) {
+    names_add(g, &g->locals, decl);
+}
+
+// File-scope definition; a slot declared twice is a repeated tentative
+// definition, which C allows
+static void write_global(CGen *g, ASTNode *decl) {
+    if (decl->scope_depth != 0) {
+        return;
+    }
+    wr_printf(g->out, "static %s ", c_type(decl->decl_type));
+    write_variable(g, decl);
+    wr_str(g->out, ";\n");
+}
+
+static ValueType declared_type(TokenType type) {
+    return type == TOKEN_FLOAT_KEY || type == TOKEN_DOUBLE ? TYPE_FLOAT : TYPE_INT;
+}
+
+static int function_of(CGen *g, SymbolId sym) {
+    return sym < g->symbol_limit ? g->function_index[sym] : -1;
+}
+
+// Output helpers
+
+static void write_indent(CGen *g) {
+    for (int i = 0; i < g->indent; i++) {
+        wr_str(g->out, "    ");
+    }
+}
+
+static void write_line_directive(CGen *g, ASTNode *node) {
+    wr_printf(g->out, "#line %d \"%s\"\n", node->token.line, g->source);
+}
+
+// C string literal for 'text'; octal escapes are always three digits so a
+// following digit cannot extend them
+static void write_string_literal(Writer *out, const char *text) {
+    wr_char(out, '"');
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            wr_char(out, '\\');
+            wr_char(out, (char)*p);
+        } else if (*p < 0x20 || *p >= 0x7f || *p == '?') {
+            wr_printf(out, "\\%03o", *p);
+        } else {
+            wr_char(out, (char)*p);
+        }
+    }
+    wr_char(out, '"');
+}
+
+static void write_int_literal(Writer *out, long long value) {
+    if (value == (-9223372036854775807LL - 1)) {
+        wr_str(out, "(-9223372036854775807LL - 1)");
+    } else if (value < 0) {
+        wr_printf(out, "(%lldLL)", value);
+    } else if (value > 2147483647LL) {
+        wr_printf(out, "%lldLL", value);
+    } else {
+        wr_printf(out, "%lld", value);
+    }
+}
+
+// Shortest double literal that reads back as 'value'
+static void write_float_literal(Writer *out, double value) {
+    if (isnan(value)) {
+        wr_str(out, "(0.0 / 0.0)");
+        return;
+    }
+    if (isinf(value)) {
+        wr_str(out, value > 0 ? "(1.0 / 0.0)" : "(-1.0 / 0.0)");
+        return;
+    }
+    char text[40];
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    if (!strpbrk(text, ".e")) {
+        strcat(text, ".0");
+    }
+    wr_str(out, value < 0 || (value == 0 && signbit(value)) ? "(" : "");
+    wr_str(out, text);
+    wr_str(out, value < 0 || (value == 0 && signbit(value)) ? ")" : "");
+}
+
+// Expressions
+
+static int is_logical(ASTNode *node) {
+    return node->type == AST_BINOP &&
+           (strcmp(node->token.lexeme, "&&") == 0 || strcmp(node->token.lexeme, "||") == 0);
+}
+
+static int is_comparison(ASTNode *node) {
+    const char *op = node->token.lexeme;
+    return node->type == AST_BINOP &&
+           (strcmp(op, "<") == 0 || strcmp(op, ">") == 0 || strcmp(op, "<=") == 0 ||
+            strcmp(op, ">=") == 0 || strcmp(op, "==") == 0 || strcmp(op, "!=") == 0);
+}
+
+static ValueType expression_type(CGen *g, ASTNode *node) {
+    if (!node) {
+        return TYPE_INT;
+    }
+    switch (node->type) {
+        case AST_NUMBER:
+            return node->token.type == TOKEN_FLOAT ? TYPE_FLOAT : TYPE_INT;
+        case AST_IDENTIFIER:
+            return declared_type(node->decl_type);
+        case AST_BINOP:
+            if (is_logical(node) || is_comparison(node)) {
+                return TYPE_INT;
+            }
+            if (expression_type(g, node->left) == TYPE_FLOAT) {
+                return TYPE_FLOAT;
+            }
+            return expression_type(g, node->right);
+        case AST_FUNCTION_CALL: {
+            int index = function_of(g, node->token.sym);
+            return index >= 0 ? declared_type(g->functions[index]->decl_type) : TYPE_INT;
+        }
+        default:
+            return TYPE_INT;
+    }
+}
+
+// Whether evaluating 'node' can print or fail, so operand order matters
+static int has_effects(ASTNode *node) {
+    if (!node) {
+        return 0;
+    }
+    if (node->type == AST_FUNCTION_CALL || node->type == AST_FACTORIAL) {
+        return 1;
+    }
+    if (node->type != AST_BINOP) {
+        return 0;
+    }
+    const char *op = node->token.lexeme;
+    return op[0] == '/' || op[0] == '%' || has_effects(node->left) || has_effects(node->right);
+}
+
+// Source line the VM reports for an error raised right after evaluating
+// 'node': that of the last expression node it compiles
+static int final_line(ASTNode *node) {
+    switch (node->type) {
+        case AST_BINOP:
+            return node->right ? final_line(node->right) : node->token.line;
+        case AST_FUNCTION_CALL:
+            return node->left ? final_line(node->left) : node->token.line;
+        default:
+            return node->token.line;
+    }
+}
+
+static void write_expression(CGen *g, ASTNode *node);
+
+static void write_binary(CGen *g, ASTNode *node) {
+    const char *op = node->token.lexeme;
+    int bare = g->bare;
+    g->bare = 0;
+    if (is_logical(node)) {
+        if (!bare) wr_char(g->out, '(');
+        write_expression(g, node->left);
+        wr_printf(g->out, " %s ", op);
+        write_expression(g, node->right);
+        if (!bare) wr_char(g->out, ')');
+        return;
+    }
+    if (!strchr("+-*/%<>=!", op[0])) {
+        cgen_error(g, node, "Unsupported operator '%s'", op);
+        wr_char(g->out, '0');
+        return;
+    }
+
+    ValueType type = expression_type(g, node->left) == TYPE_FLOAT ||
+                     expression_type(g, node->right) == TYPE_FLOAT ? TYPE_FLOAT : TYPE_INT;
+    int division = type == TYPE_INT && (op[0] == '/' || op[0] == '%') && op[1] == '\0';
+    if (op[0] == '%' && type == TYPE_FLOAT) {
+        cgen_error(g, node, "Operator '%s' needs integer operands", op);
+    }
+
+    // C leaves operand order open; keep the VM's left-to-right order when
+    // both sides can print or fail
+    int ordered = has_effects(node->left) && has_effects(node->right);
+    int temp = g->temp_count;
+    if (ordered) {
+        g->temp_count++;
+        wr_printf(g->out, "({ %s bc_t%d = ", expression_type(g, node->left) == TYPE_FLOAT
+                                                    ? "double" : "long long", temp);
+        write_expression(g, node->left);
+        wr_str(g->out, "; ");
+    }
+    if (division) {
+        g->helpers |= HELPER_FAIL | (op[0] == '/' ? HELPER_DIV : HELPER_MOD);
+        wr_str(g->out, op[0] == '/' ? "bc_div(" : "bc_mod(");
+    } else if (!ordered && !bare) {
+        wr_char(g->out, '(');
+    }
+    if (ordered) {
+        wr_printf(g->out, "bc_t%d", temp);
+    } else {
+        write_expression(g, node->left);
+    }
+    if (division) {
+        wr_str(g->out, ", ");
+        write_expression(g, node->right);
+        wr_printf(g->out, ", %d)", final_line(node->right ? node->right : node));
+    } else {
+        wr_printf(g->out, " %s ", op);
+        write_expression(g, node->right);
+        if (!ordered && !bare) wr_char(g->out, ')');
+    }
+    if (ordered) {
+        wr_str(g->out, "; })");
+    }
+}
+
+static void write_call(CGen *g, ASTNode *node) {
+    int index = function_of(g, node->token.sym);
+    if (index < 0) {
+        cgen_error(g, node, "Call to undefined function '%s'", node->token.lexeme);
+        wr_char(g->out, '0');
+        return;
+    }
+
+    // Missing arguments are zero, as in the VM
+    ASTNode *decl = g->functions[index];
+    wr_printf(g->out, "fn_%s(", decl->token.lexeme);
+    int position = 0;
+    for (ASTNode *param = decl->left; param; param = param->right, position++) {
+        if (position > 0) {
+            wr_str(g->out, ", ");
+        }
+        if (position == 0 && node->left) {
+            write_expression(g, node->left);
+        } else {
+            wr_str(g->out, declared_type(param->decl_type) == TYPE_FLOAT ? "0.0" : "0");
+        }
+    }
+    if (node->left && !decl->left) {
+        cgen_error(g, node, "Too many arguments to '%s'", node->token.lexeme);
+    }
+    wr_char(g->out, ')');
+}
+
+static void write_expression(CGen *g, ASTNode *node) {
+    if (!node) {
+        wr_char(g->out, '0');
+        return;
+    }
+    switch (node->type) {
+        case AST_NUMBER:
+            if (node->token.type == TOKEN_FLOAT) {
+                write_float_literal(g->out, node->token.float_value);
+            } else {
+                write_int_literal(g->out, node->token.int_value);
+            }
+            break;
+        case AST_IDENTIFIER:
+            if (node->scope_depth < 0) {
+                cgen_error(g, node, "Unresolved identifier '%s'", node->token.lexeme);
+                wr_char(g->out, '0');
+            } else {
+                write_variable(g, node);
+            }
+            break;
+        case AST_BINOP:
+            write_binary(g, node);
+            break;
+        case AST_FACTORIAL:
+            g->helpers |= HELPER_FAIL | HELPER_FACTORIAL;
+            wr_str(g->out, "bc_factorial(");
+            write_expression(g, node->left);
+            wr_printf(g->out, ", %d)", node->token.line);
+            break;
+        case AST_FUNCTION_CALL:
+            write_call(g, node);
+            break;
+        case AST_STRING:
+            cgen_error(g, node, "String literals can only be printed");
+            wr_char(g->out, '0');
+            break;
+        default:
+            cgen_error(g, node, "Unsupported expression");
+            wr_char(g->out, '0');
+            break;
+    }
+}
+
+// An expression that is a whole statement part, with no parentheses of
+// its own
+static void write_full_expression(CGen *g, ASTNode *node) {
+    g->bare = 1;
+    write_expression(g, node);
+    g->bare = 0;
+}
+
+// Statements
+
+static void write_statement(CGen *g, ASTNode *node);
+
+// Statements of a Block chain, or a single statement, inside braces
+static void write_body(CGen *g, ASTNode *node) {
+    wr_str(g->out, "{\n");
+    g->indent++;
+    if (node && node->type == AST_BLOCK) {
+        for (ASTNode *link = node; link && link->type == AST_BLOCK; link = link->right) {
+            write_statement(g, link->left);
+        }
+    } else {
+        write_statement(g, node);
+    }
+    g->indent--;
+    write_indent(g);
+    wr_char(g->out, '}');
+}
+
+static void write_print(CGen *g, ASTNode *node) {
+    ASTNode *value = node->left;
+    if (value && value->type == AST_STRING) {
+        g->helpers |= HELPER_PRINT_STRING;
+        wr_str(g->out, "bc_print_string(");
+        write_string_literal(g->out, value->token.lexeme);
+    } else if (expression_type(g, value) == TYPE_FLOAT) {
+        g->helpers |= HELPER_PRINT_FLOAT;
+        wr_str(g->out, "bc_print_float(");
+        write_full_expression(g, value);
+    } else {
+        g->helpers |= HELPER_PRINT_INT;
+        wr_str(g->out, "bc_print_int(");
+        write_full_expression(g, value);
+    }
+    wr_str(g->out, ");\n");
+}
+
+static void write_statement(CGen *g, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    if (node->type == AST_BLOCK) {
+        write_indent(g);
+        write_body(g, node);
+        wr_char(g->out, '\n');
+        return;
+    }
+    if (node->type == AST_FUNCTION_DECL) {
+        if (g->in_function) {
+            cgen_error(g, node, "Nested function '%s' is not supported", node->token.lexeme);
+        }
+        return; // Top-level functions are written separately
+    }
+
+    write_line_directive(g, node);
+    write_indent(g);
+    switch (node->type) {
+        case AST_VARDECL:
+            if (node->scope_depth != 0) {
+                wr_printf(g->out, "%s ", c_type(node->decl_type));
+            }
+            write_variable(g, node);
+            wr_str(g->out, " = ");
+            if (node->right) {
+                write_full_expression(g, node->right);
+            } else {
+                // The VM zeroes every declaration, slots being reused
+                wr_char(g->out, '0');
+            }
+            wr_str(g->out, ";\n");
+            break;
+        case AST_ASSIGN:
+            if (!node->left || node->left->scope_depth < 0) {
+                cgen_error(g, node->left ? node->left : node, "Unresolved identifier '%s'",
+                           node->left ? node->left->token.lexeme : "");
+                wr_str(g->out, "(void)");
+            } else {
+                write_variable(g, node->left);
+                wr_str(g->out, " = ");
+            }
+            write_full_expression(g, node->right);
+            wr_str(g->out, ";\n");
+            break;
+        case AST_PRINT:
+            write_print(g, node);
+            break;
+        case AST_RETURN:
+            wr_str(g->out, "return ");
+            write_full_expression(g, node->left);
+            wr_str(g->out, ";\n");
+            break;
+        case AST_IF: {
+            ASTNode *then_branch = node->right;
+            ASTNode *else_branch = NULL;
+            if (then_branch && then_branch->type == AST_ELSE) {
+                else_branch = then_branch->right;
+                then_branch = then_branch->left;
+            }
+            wr_str(g->out, "if (");
+            write_full_expression(g, node->left);
+            wr_str(g->out, ") ");
+            write_body(g, then_branch);
+            if (else_branch) {
+                wr_str(g->out, " else ");
+                write_body(g, else_branch);
+            }
+            wr_char(g->out, '\n');
+            break;
+        }
+        case AST_WHILE:
+            wr_str(g->out, "while (");
+            write_full_expression(g, node->left);
+            wr_str(g->out, ") ");
+            write_body(g, node->right);
+            wr_char(g->out, '\n');
+            break;
+        case AST_FOR:
+            // taeper { body } litnu (condition): loop until the condition holds
+            wr_str(g->out, "do ");
+            write_body(g, node->left);
+            wr_str(g->out, " while (!");
+            write_expression(g, node->right);
+            wr_str(g->out, ");\n");
+            break;
+        default:
+            wr_str(g->out, "(void)");
+            write_expression(g, node);
+            wr_str(g->out, ";\n");
+            break;
+    }
+}
+
+// Functions
+
+static void write_signature(CGen *g, ASTNode *decl) {
+    wr_printf(g->out, "static %s fn_%s(", c_type(decl->decl_type), decl->token.lexeme);
+    if (!decl->left) {
+        wr_str(g->out, "void");
+    }
+    for (ASTNode *param = decl->left; param; param = param->right) {
+        wr_printf(g->out, "%s ", c_type(param->decl_type));
+        write_variable(g, param);
+        if (param->right) {
+            wr_str(g->out, ", ");
+        }
+    }
+    wr_char(g->out, ')');
+}
+
+static void write_function(CGen *g, ASTNode *decl) {
+    g->locals.frame++;
+    for (ASTNode *param = decl->left; param; param = param->right) {
+        names_add(g, &g->locals, param);
+    }
+    walk_declarations(g, decl->right, add_local);
+
+    g->in_function = 1;
+    wr_char(g->out, '\n');
+    write_line_directive(g, decl);
+    write_signature(g, decl);
+    wr_str(g->out, " {\n");
+    g->indent = 1;
+    ASTNode *last = NULL;
+    for (ASTNode *link = decl->right; link && link->type == AST_BLOCK; link = link->right) {
+        write_statement(g, link->left);
+        last = link->left;
+    }
+    if (!last || last->type != AST_RETURN) {
+        wr_str(g->out, "    return 0; // Falling off the end returns 0\n");
+    }
+    wr_str(g->out, "}\n");
+    g->indent = 0;
+    g->in_function = 0;
+}
+
+// Register every top-level function so calls can precede declarations
+static void declare_functions(CGen *g, ASTNode *root) {
+    for (ASTNode *link = root; link && link->type == AST_PROGRAM; link = link->right) {
+        ASTNode *decl = link->left;
+        if (!decl || decl->type != AST_FUNCTION_DECL) {
+            continue;
+        }
+        if (decl->slot < 0 || decl->token.sym >= g->symbol_limit) {
+            cgen_error(g, decl, "Function '%s' was not resolved", decl->token.lexeme);
+            continue;
+        }
+        if (function_of(g, decl->token.sym) >= 0) {
+            cgen_error(g, decl, "Duplicate function '%s'", decl->token.lexeme);
+            continue;
+        }
+        if (g->function_count == g->function_capacity) {
+            g->function_capacity = g->function_capacity ? g->function_capacity * 2 : 16;
+            g->functions = realloc(g->functions, g->function_capacity * sizeof(ASTNode *));
+            if (!g->functions) {
+                fprintf(stderr, "Error: Memory allocation failed for C output\n");
+                exit(1);
+            }
+        }
+        g->function_index[decl->token.sym] = g->function_count;
+        g->functions[g->function_count++] = decl;
+    }
+}
+
+// Runtime support, written ahead of the translated code
+static void write_helpers(Writer *out, unsigned helpers) {
+    if (helpers & HELPER_FAIL) {
+        wr_str(out,
+            "static void bc_fail(int line, const char *message) {\n"
+            "    fflush(stdout);\n"
+            "    fprintf(stderr, \"Runtime error at line %d: %s\\n\", line, message);\n"
+            "    exit(1);\n"
+            "}\n\n");
+    }
+    if (helpers & HELPER_DIV) {
+        wr_str(out,
+            "static inline long long bc_div(long long a, long long b, int line) {\n"
+            "    if (b == 0) bc_fail(line, \"division by zero\");\n"
+            "    return b == -1 ? (long long)(0 - (unsigned long long)a) : a / b;\n"
+            "}\n\n");
+    }
+    if (helpers & HELPER_MOD) {
+        wr_str(out,
+            "static inline long long bc_mod(long long a, long long b, int line) {\n"
+            "    if (b == 0) bc_fail(line, \"division by zero\");\n"
+            "    return b == -1 ? 0 : a % b;\n"
+            "}\n\n");
+    }
+    if (helpers & HELPER_FACTORIAL) {
+        wr_str(out, "static inline long long bc_factorial(long long n, int line) {\n");
+        wr_printf(out, "    static const long long table[%d] = {", FACTORIAL_MAX_INT64 + 1);
+        for (int n = 0; n <= FACTORIAL_MAX_INT64; n++) {
+            long long value = 0;
+            factorial_int64(n, &value);
+            wr_printf(out, "%s%s%lldLL", n ? "," : "", n % 4 == 0 ? "\n        " : " ", value);
+        }
+        wr_str(out, "\n    };\n");
+        wr_printf(out,
+            "    char message[96];\n"
+            "    if (n < 0 || n > %d) {\n"
+            "        snprintf(message, sizeof(message), \"lairotcaf(%%lld) %%s\", n,\n"
+            "                 n < 0 ? \"%s\" : \"%s\");\n"
+            "        bc_fail(line, message);\n"
+            "    }\n"
+            "    return table[n];\n"
+            "}\n\n",
+            FACTORIAL_MAX_INT64, factorial_status_message(FACTORIAL_NEGATIVE),
+            factorial_status_message(FACTORIAL_OVERFLOW));
+    }
+    if (helpers & HELPER_PRINT_INT) {
+        wr_str(out,
+            "static void bc_print_int(long long value) {\n"
+            "    printf(\"%lld\\n\", value);\n"
+            "}\n\n");
+    }
+    if (helpers & HELPER_PRINT_FLOAT) {
+        wr_str(out,
+            "// Fewest significant digits (15 to 17) that read back as the same value\n"
+            "static void bc_print_float(double value) {\n"
+            "    char text[32];\n"
+            "    for (int precision = 15; precision <= 17; precision++) {\n"
+            "        snprintf(text, sizeof(text), \"%.*g\", precision, value);\n"
+            "        if (strtod(text, NULL) == value) break;\n"
+            "    }\n"
+            "    puts(text);\n"
+            "}\n\n");
+    }
+    if (helpers & HELPER_PRINT_STRING) {
+        wr_str(out,
+            "static void bc_print_string(const char *text) {\n"
+            "    puts(text);\n"
+            "}\n\n");
+    }
+}
+
+static int count_lines(const Writer *w) {
+    int lines = 0;
+    for (size_t i = 0; i < w->len; i++) {
+        lines += w->data[i] == '\n';
+    }
+    return lines;
+}
+
+// Translate a parsed program.  Identifiers must have been resolved
+// (--resolve) so that every variable has a scope depth and a slot.
+int cgen_emit(ASTNode *root, const char *source_name, const char *output_name,
+              Writer *out, Writer *errors) {
+    CGen g = {0};
+    Writer body;
+    writer_init_memory(&body);
+    g.out = &body;
+    g.errors = errors;
+    g.symbol_limit = symbol_count() + 1;
+    g.function_index = cgen_alloc(g.symbol_limit, sizeof(int));
+    memset(g.function_index, 0xff, g.symbol_limit * sizeof(int));
+    names_init(&g.globals, g.symbol_limit);
+    names_init(&g.locals, g.symbol_limit);
+
+    // #line takes a string literal
+    Writer escaped;
+    writer_init_memory(&escaped);
+    for (const char *p = source_name; *p; p++) {
+        if (*p == '"' || *p == '\\') wr_char(&escaped, '\\');
+        wr_char(&escaped, *p);
+    }
+    wr_char(&escaped, '\0');
+    g.source = escaped.data;
+
+    g.globals.frame = 1;
+    if (root && root->type == AST_PROGRAM) {
+        declare_functions(&g, root);
+    }
+    walk_declarations(&g, root, add_global);
+
+    // Globals start at zero; their declarations assign them in bc_program
+    Writer globals;
+    writer_init_memory(&globals);
+    g.out = &globals;
+    walk_declarations(&g, root, write_global);
+
+    // Functions, then the top-level statements
+    g.out = &body;
+    for (int i = 0; i < g.function_count; i++) {
+        write_function(&g, g.functions[i]);
+    }
+    wr_str(&body, "\n// Top-level statements, then niam()\n");
+    wr_str(&body, "static long long bc_program(void) {\n");
+    g.indent = 1;
+    for (ASTNode *link = root; link && link->type == AST_PROGRAM; link = link->right) {
+        write_statement(&g, link->left);
+    }
+    if (root && root->type != AST_PROGRAM) {
+        write_statement(&g, root);
+    }
+    int entry = function_of(&g, intern_cstr("niam"));
+    if (entry >= 0) {
+        wr_str(&body, "    return fn_niam();\n");
+    } else {
+        wr_str(&body, "    return 0;\n");
+    }
+    wr_str(&body, "}\n");
+
+    // Header and helpers, then the translated code
+    Writer file;
+    writer_init_memory(&file);
+    wr_printf(&file, "/* Generated from %s by the Backwards-C compiler.\n", source_name);
+    wr_str(&file, "   Build with: cc -O2 -fwrapv (tni arithmetic wraps around as in the VM) */\n");
+    wr_str(&file, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+    write_helpers(&file, g.helpers);
+    if (globals.len > 0) {
+        wr_bytes(&file, globals.data, globals.len);
+        wr_char(&file, '\n');
+    }
+    g.out = &file;
+    for (int i = 0; i < g.function_count; i++) {
+        write_signature(&g, g.functions[i]);
+        wr_str(&file, ";\n");
+    }
+    wr_bytes(&file, body.data, body.len);
+
+    // Back to the generated file's own line numbers for main()
+    wr_printf(&file, "#line %d \"%s\"\n", count_lines(&file) + 2, output_name);
+    wr_str(&file,
+        "int main(void) {\n"
+        "    static char buffer[1 << 16];\n"
+        "    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));\n"
+        "    bc_program();\n"
+        "    return 0;\n"
+        "}\n");
+    wr_bytes(out, file.data, file.len);
+
+    names_free(&g.globals);
+    names_free(&g.locals);
+    free(g.function_index);
+    free(g.functions);
+    writer_free(&escaped);
+    writer_free(&globals);
+    writer_free(&body);
+    writer_free(&file);
+    return g.error_count;
+}
+
+// Run 'argv' to completion, or for at most 'timeout' seconds if that is
+// non-zero, with its standard output and error captured into 'out' and
+// 'errors'.  Returns its exit status, or 128 plus the signal that ended it.
+static int run_process(char *const argv[], unsigned timeout, Writer *out, Writer *errors) {
+    FILE *captured[2] = {tmpfile(), tmpfile()};
+    Writer *targets[2] = {out, errors};
+    int status = -1;
+    if (!captured[0] || !captured[1]) {
+        goto done;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(captured[0]), STDOUT_FILENO);
+        dup2(fileno(captured[1]), STDERR_FILENO);
+        alarm(timeout);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        status = -1;
+        goto done;
+    }
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    for (int i = 0; i < 2; i++) {
+        char chunk[4096];
+        size_t n;
+        rewind(captured[i]);
+        while ((n = fread(chunk, 1, sizeof(chunk), captured[i])) > 0) {
+            wr_bytes(targets[i], chunk, n);
+        }
+    }
+
+done:
+    for (int i = 0; i < 2; i++) {
+        if (captured[i]) fclose(captured[i]);
+    }
+    return status;
+}
+
+// Build the C file at 'c_path' with $CC (default cc) and run it, capturing
+// its output.  Returns the program's exit status (128 plus the signal if it
+// was killed, including by the CGEN_RUN_TIMEOUT alarm), or -1 if it could
+// not be built, in which case the compiler's messages are in 'errors'.
+int cgen_build_and_run(const char *c_path, Writer *out, Writer *errors) {
+    char program[4096];
+    snprintf(program, sizeof(program), "%s.bin", c_path);
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) {
+        cc = CGEN_DEFAULT_CC;
+    }
+
+    // Compiler warnings are only of interest when the build fails
+    Writer diagnostics;
+    writer_init_memory(&diagnostics);
+    char *build[] = {(char *)cc, "-O2", "-fwrapv", "-o", program, (char *)c_path, NULL};
+    int status = run_process(build, 0, &diagnostics, &diagnostics);
+    if (status != 0) {
+        wr_bytes(errors, diagnostics.data, diagnostics.len);
+        writer_free(&diagnostics);
+        unlink(program);
+        return -1;
+    }
+    writer_free(&diagnostics);
+
+    char *run[] = {program, NULL};
+    status = run_process(run, CGEN_RUN_TIMEOUT, out, errors);
+    unlink(program);
+    return status;
+}
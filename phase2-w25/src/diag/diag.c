@@ -0,0 +1,451 @@
+/* diag.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/diag.h"
+#include "../../include/parser.h"
+
+#define DIAG_CODES 32           // Past the last ErrorType and ParseError
+#define SNIPPET_WIDTH 100       // Longest stretch of a line quoted
+
+// A report already made: the source and offset it was made at, valid in
+// the generation it was added in
+typedef struct {
+    uint64_t key;
+    uint32_t generation;
+} DiagSlot;
+
+// Recorded state of the current parse on this thread
+typedef struct {
+    Diagnostic *list;
+    int count;
+    int capacity;
+    Writer lexemes;             // NUL-terminated, from offset 1
+    DiagSlot *slots;            // Open-addressed, a power of two
+    uint32_t slot_count;
+    uint32_t slots_used;
+    uint32_t generation;
+    long totals[2];
+    int per_code[2][DIAG_CODES];
+    long omitted[2][DIAG_CODES];
+    long omitted_total;
+
+    // Line starts of the source last rendered, found up to 'scanned'
+    const char *lines_source;
+    int *lines;
+    int line_count;
+    int line_capacity;
+    int scanned;
+    int scan_done;
+} DiagState;
+
+static _Thread_local DiagState state;
+
+static DiagLimits limits = {DIAG_DEFAULT_PER_FILE, DIAG_DEFAULT_PER_CODE};
+
+// Messages by code; "%s" stands for the lexeme
+static const char *const lexer_messages[DIAG_CODES] = {
+    [ERROR_INVALID_CHAR] = "Invalid token '%s'",
+    [ERROR_INVALID_NUMBER] = "Invalid number format",
+    [ERROR_CONSECUTIVE_OPERATORS] = "Consecutive operators not allowed",
+    [ERROR_UNTERMINATED_STRING] = "Unterminated string literal",
+    [ERROR_UNTERMINATED_CHAR] = "Unterminated character literal",
+    [ERROR_INVALID_IDENTIFIER] = "Invalid identifier",
+    [ERROR_STRING_TOO_LONG] = "String literal too long",
+    [ERROR_INVALID_ESCAPE_SEQUENCE] = "Invalid escape sequence",
+    [ERROR_EMPTY_CHAR_LITERAL] = "Empty character literal",
+    [ERROR_MULTI_CHAR_LITERAL] = "Multi-character literal not allowed",
+    [ERROR_INVALID_FLOAT] = "Invalid float format",
+    [ERROR_UNEXPECTED_TOKEN] = "Unexpected token '%s'",
+    [ERROR_NUMBER_OVERFLOW] = "Integer literal out of range '%s'"
+};
+
+static const char *const parser_messages[DIAG_CODES] = {
+    [PARSE_ERROR_UNEXPECTED_TOKEN] = "Unexpected token '%s'",
+    [PARSE_ERROR_MISSING_SEMICOLON] = "Missing semicolon after '%s'",
+    [PARSE_ERROR_MISSING_IDENTIFIER] = "Expected identifier after '%s'",
+    [PARSE_ERROR_MISSING_EQUALS] = "Expected '=' after '%s'",
+    [PARSE_ERROR_MISSING_PARENTHESES] = "Missing parenthesis in expression",
+    [PARSE_ERROR_MISSING_CONDITION] = "Expected condition after '%s'",
+    [PARSE_ERROR_BLOCK_BRACES] = "Missing brace for block statement",
+    [PARSE_ERROR_INVALID_OPERATOR] = "Invalid operator '%s'",
+    [PARSE_ERROR_INVALID_FUNCTION_CALL] = "Invalid function call to '%s'",
+    [PARSE_ERROR_INVALID_EXPRESSION] = "Invalid expression after '%s'",
+    [PARSE_ERROR_UNDECLARED_IDENTIFIER] = "Undeclared identifier '%s'",
+    [PARSE_ERROR_DUPLICATE_DECLARATION] = "Duplicate declaration of '%s'"
+};
+
+// Code names, as LSP clients show them
+static const char *const lexer_codes[DIAG_CODES] = {
+    [ERROR_INVALID_CHAR] = "invalid-token",
+    [ERROR_INVALID_NUMBER] = "invalid-number",
+    [ERROR_CONSECUTIVE_OPERATORS] = "consecutive-operators",
+    [ERROR_UNTERMINATED_STRING] = "unterminated-string",
+    [ERROR_UNTERMINATED_CHAR] = "unterminated-char",
+    [ERROR_INVALID_IDENTIFIER] = "invalid-identifier",
+    [ERROR_STRING_TOO_LONG] = "string-too-long",
+    [ERROR_INVALID_ESCAPE_SEQUENCE] = "invalid-escape",
+    [ERROR_EMPTY_CHAR_LITERAL] = "empty-char",
+    [ERROR_MULTI_CHAR_LITERAL] = "multi-char",
+    [ERROR_INVALID_FLOAT] = "invalid-float",
+    [ERROR_UNEXPECTED_TOKEN] = "unexpected-token",
+    [ERROR_NUMBER_OVERFLOW] = "number-overflow"
+};
+
+static const char *const parser_codes[DIAG_CODES] = {
+    [PARSE_ERROR_UNEXPECTED_TOKEN] = "unexpected-token",
+    [PARSE_ERROR_MISSING_SEMICOLON] = "missing-semicolon",
+    [PARSE_ERROR_MISSING_IDENTIFIER] = "missing-identifier",
+    [PARSE_ERROR_MISSING_EQUALS] = "missing-equals",
+    [PARSE_ERROR_MISSING_PARENTHESES] = "missing-parenthesis",
+    [PARSE_ERROR_MISSING_CONDITION] = "missing-condition",
+    [PARSE_ERROR_BLOCK_BRACES] = "missing-brace",
+    [PARSE_ERROR_INVALID_OPERATOR] = "invalid-operator",
+    [PARSE_ERROR_INVALID_FUNCTION_CALL] = "invalid-call",
+    [PARSE_ERROR_INVALID_EXPRESSION] = "invalid-expression",
+    [PARSE_ERROR_UNDECLARED_IDENTIFIER] = "undeclared-identifier",
+    [PARSE_ERROR_DUPLICATE_DECLARATION] = "duplicate-declaration"
+};
+
+static void *grow_array(void *array, size_t size, const char *what) {
+    void *grown = realloc(array, size);
+    if (!grown) {
+        fprintf(stderr, "Error: Memory allocation failed for %s\n", what);
+        exit(1);
+    }
+    return grown;
+}
+
+void diag_set_limits(const DiagLimits *new_limits) {
+    limits = *new_limits;
+}
+
+void diag_get_limits(DiagLimits *current) {
+    *current = limits;
+}
+
+// Start a new parse.  Old table entries go stale with the generation.
+void diag_reset(void) {
+    state.count = 0;
+    if (state.lexemes.data) {
+        writer_reset(&state.lexemes);
+        wr_char(&state.lexemes, '\0');
+    }
+    state.slots_used = 0;
+    if (++state.generation == 0) {
+        if (state.slots) {
+            memset(state.slots, 0, state.slot_count * sizeof(DiagSlot));
+        }
+        state.generation = 1;
+    }
+    state.totals[0] = state.totals[1] = 0;
+    memset(state.per_code, 0, sizeof(state.per_code));
+    memset(state.omitted, 0, sizeof(state.omitted));
+    state.omitted_total = 0;
+    state.lines_source = NULL;
+}
+
+static uint32_t slot_of(uint64_t key, uint32_t mask) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static void grow_slots(void) {
+    uint32_t count = state.slot_count ? state.slot_count * 2 : 1024;
+    DiagSlot *slots = calloc(count, sizeof(DiagSlot));
+    if (!slots) {
+        fprintf(stderr, "Error: Memory allocation failed for diagnostics\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < state.slot_count; i++) {
+        if (state.slots[i].generation != state.generation) continue;
+        uint32_t slot = slot_of(state.slots[i].key, count - 1);
+        while (slots[slot].generation == state.generation) {
+            slot = (slot + 1) & (count - 1);
+        }
+        slots[slot] = state.slots[i];
+    }
+    free(state.slots);
+    state.slots = slots;
+    state.slot_count = count;
+}
+
+// Add a key to the table, returning 0 if it was there
+static int add_key(uint64_t key) {
+    if (state.generation == 0) {
+        state.generation = 1;
+    }
+    if ((state.slots_used + 1) * 2 > state.slot_count) {
+        grow_slots();
+    }
+    uint32_t mask = state.slot_count - 1;
+    uint32_t slot = slot_of(key, mask);
+    while (state.slots[slot].generation == state.generation) {
+        if (state.slots[slot].key == key) {
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+    state.slots[slot].key = key;
+    state.slots[slot].generation = state.generation;
+    state.slots_used++;
+    return 1;
+}
+
+static uint64_t key_of(DiagSource source, int offset) {
+    return ((uint64_t)(uint32_t)offset << 1) | (uint64_t)source;
+}
+
+void diag_mark(DiagSource source, int offset) {
+    add_key(key_of(source, offset));
+}
+
+int diag_reported(DiagSource source, int offset) {
+    if (!state.slots || state.generation == 0) {
+        return 0;
+    }
+    uint64_t key = key_of(source, offset);
+    uint32_t mask = state.slot_count - 1;
+    for (uint32_t slot = slot_of(key, mask); state.slots[slot].generation == state.generation;
+         slot = (slot + 1) & mask) {
+        if (state.slots[slot].key == key) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int diag_report(DiagSource source, int code, const Token *token) {
+    if (!add_key(key_of(source, token->offset))) {
+        return 0;
+    }
+    int index = (unsigned)code < DIAG_CODES ? code : 0;
+    state.totals[source]++;
+    if ((limits.per_file > 0 && state.count >= limits.per_file) ||
+        (limits.per_code > 0 && state.per_code[source][index] >= limits.per_code)) {
+        state.omitted[source][index]++;
+        state.omitted_total++;
+        return 1;
+    }
+    state.per_code[source][index]++;
+
+    if (state.count == state.capacity) {
+        state.capacity = state.capacity ? state.capacity * 2 : 64;
+        state.list = grow_array(state.list, state.capacity * sizeof(Diagnostic), "diagnostics");
+    }
+    if (!state.lexemes.data) {
+        writer_init_memory(&state.lexemes);
+        wr_char(&state.lexemes, '\0');
+    }
+    Diagnostic *diagnostic = &state.list[state.count++];
+    diagnostic->line = token->line;
+    diagnostic->column = token->column;
+    diagnostic->offset = (uint32_t)token->offset;
+    diagnostic->length = (uint32_t)token->length;
+    diagnostic->lexeme = 0;
+    if (token->lexeme[0]) {
+        diagnostic->lexeme = (uint32_t)state.lexemes.len;
+        wr_str(&state.lexemes, token->lexeme);
+        wr_char(&state.lexemes, '\0');
+    }
+    diagnostic->source = (uint8_t)source;
+    diagnostic->code = (uint8_t)index;
+    diagnostic->severity = DIAG_ERROR;
+    diagnostic->token_type = (uint8_t)token->type;
+    return 1;
+}
+
+void diag_free(void) {
+    free(state.list);
+    writer_free(&state.lexemes);
+    free(state.slots);
+    free(state.lines);
+    memset(&state, 0, sizeof(state));
+}
+
+int diag_count(void) {
+    return state.count;
+}
+
+const Diagnostic *diag_get(int index) {
+    return &state.list[index];
+}
+
+long diag_total(DiagSource source) {
+    return state.totals[source];
+}
+
+long diag_omitted(void) {
+    return state.omitted_total;
+}
+
+const char *diag_lexeme(const Diagnostic *diagnostic) {
+    if (!state.lexemes.data || diagnostic->lexeme >= state.lexemes.len) {
+        return "";
+    }
+    return state.lexemes.data + diagnostic->lexeme;
+}
+
+const char *diag_code_name(const Diagnostic *diagnostic) {
+    const char *const *names = diagnostic->source == DIAG_LEXER ? lexer_codes : parser_codes;
+    const char *name = diagnostic->code < DIAG_CODES ? names[diagnostic->code] : NULL;
+    return name ? name : "unknown";
+}
+
+void diag_message(Writer *out, const Diagnostic *diagnostic) {
+    const char *const *messages = diagnostic->source == DIAG_LEXER ? lexer_messages : parser_messages;
+    const char *message = diagnostic->code < DIAG_CODES ? messages[diagnostic->code] : NULL;
+    if (!message) {
+        wr_str(out, "Unknown error");
+        return;
+    }
+    const char *hole = strstr(message, "%s");
+    if (!hole) {
+        wr_str(out, message);
+        return;
+    }
+    wr_bytes(out, message, (size_t)(hole - message));
+    wr_str(out, diag_lexeme(diagnostic));
+    wr_str(out, hole + 2);
+}
+
+// Index the line starts of 'source' up to 'offset', or to its end; the
+// scan resumes where the last one stopped, since reports mostly come in
+// source order
+static void index_lines_to(const char *source, int offset) {
+    if (state.lines_source != source) {
+        state.lines_source = source;
+        state.line_count = 0;
+        state.scanned = 0;
+        state.scan_done = 0;
+    }
+    if (state.line_count == 0) {
+        if (state.line_capacity == 0) {
+            state.line_capacity = 256;
+            state.lines = grow_array(state.lines, state.line_capacity * sizeof(int), "line index");
+        }
+        state.lines[state.line_count++] = 0;
+    }
+    while (!state.scan_done && state.scanned <= offset) {
+        const char *end = strchr(source + state.scanned, '\n');
+        if (!end) {
+            state.scanned += (int)strlen(source + state.scanned);
+            state.scan_done = 1;
+            break;
+        }
+        if (state.line_count == state.line_capacity) {
+            state.line_capacity *= 2;
+            state.lines = grow_array(state.lines, state.line_capacity * sizeof(int), "line index");
+        }
+        state.scanned = (int)(end - source) + 1;
+        state.lines[state.line_count++] = state.scanned;
+    }
+}
+
+// Index of the line holding 'offset', or -1 past the end of 'source'
+static int find_line(const char *source, int offset) {
+    index_lines_to(source, offset);
+    if (offset > state.scanned) {
+        return -1;
+    }
+    int low = 0;
+    int high = state.line_count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (state.lines[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+// Positions come from the offset, since the lexer's line and column
+// counts drift after some malformed input
+void diag_position(const char *source, const Diagnostic *diagnostic, int *line, int *column) {
+    int index = source ? find_line(source, (int)diagnostic->offset) : -1;
+    if (index < 0) {
+        *line = diagnostic->line;
+        *column = diagnostic->column;
+        return;
+    }
+    *line = index + 1;
+    *column = (int)diagnostic->offset - state.lines[index] + 1;
+}
+
+void diag_write_report(Writer *out, const char *source, const Diagnostic *diagnostic) {
+    int line;
+    int column;
+    diag_position(source, diagnostic, &line, &column);
+    wr_str(out, diagnostic->source == DIAG_LEXER ? "Lexical " : "Parse ");
+    wr_str(out, diagnostic->severity == DIAG_WARNING ? "Warning at line " : "Error at line ");
+    wr_int(out, line);
+    wr_str(out, ", column ");
+    wr_int(out, column);
+    wr_str(out, ": ");
+    diag_message(out, diagnostic);
+    wr_char(out, '\n');
+}
+
+// The source line holding 'offset', quoted under the report with a caret
+// under the token.  Long lines are cut to the stretch around the token.
+static void write_snippet(Writer *out, const char *source, const Diagnostic *diagnostic) {
+    int offset = (int)diagnostic->offset;
+    int low = find_line(source, offset);
+    if (low < 0) {
+        return;
+    }
+    int start = state.lines[low];
+    const char *line = source + start;
+    const char *newline = strchr(line, '\n');
+    int end = newline ? (int)(newline - source) : state.scanned;
+    if (end > start && source[end - 1] == '\r') {
+        end--;
+    }
+
+    int from = start;
+    int to = end;
+    if (to - from > SNIPPET_WIDTH) {
+        from = offset - SNIPPET_WIDTH / 2 > start ? offset - SNIPPET_WIDTH / 2 : start;
+        to = from + SNIPPET_WIDTH < end ? from + SNIPPET_WIDTH : end;
+    }
+    wr_printf(out, "%5d | %s", low + 1, from > start ? "..." : "");
+    wr_bytes(out, source + from, (size_t)(to - from));
+    wr_str(out, to < end ? "...\n" : "\n");
+
+    // Tabs are copied so the caret lines up under them
+    wr_str(out, "      | ");
+    if (from > start) wr_str(out, "   ");
+    for (int i = from; i < offset && i < to; i++) {
+        wr_char(out, source[i] == '\t' ? '\t' : ' ');
+    }
+    wr_char(out, '^');
+    int length = (int)diagnostic->length;
+    for (int i = offset + 1; i < offset + length && i < to; i++) {
+        wr_char(out, '~');
+    }
+    wr_char(out, '\n');
+}
+
+void diag_render(Writer *out, const char *source, int first, int snippets, int notes) {
+    for (int i = first; i < state.count; i++) {
+        diag_write_report(out, source, &state.list[i]);
+        if (snippets && source) {
+            write_snippet(out, source, &state.list[i]);
+        }
+    }
+    if (!notes || state.omitted_total == 0) {
+        return;
+    }
+    for (int source_kind = DIAG_LEXER; source_kind <= DIAG_PARSER; source_kind++) {
+        for (int code = 0; code < DIAG_CODES; code++) {
+            if (state.omitted[source_kind][code] == 0) continue;
+            Diagnostic named = {0};
+            named.source = (uint8_t)source_kind;
+            named.code = (uint8_t)code;
+            wr_printf(out, "Note: %ld more %s errors (%s) not shown\n", state.omitted[source_kind][code],
+                      source_kind == DIAG_LEXER ? "lexical" : "parse", diag_code_name(&named));
+        }
+    }
+}
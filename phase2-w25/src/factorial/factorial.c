@@ -0,0 +1,234 @@
+/* factorial.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../../include/factorial.h"
+
+// n! for every n whose result fits in int64
+static const long long factorial_table[FACTORIAL_MAX_INT64 + 1] = {
+    1LL, 1LL, 2LL, 6LL, 24LL, 120LL, 720LL, 5040LL, 40320LL, 362880LL,
+    3628800LL, 39916800LL, 479001600LL, 6227020800LL, 87178291200LL,
+    1307674368000LL, 20922789888000LL, 355687428096000LL,
+    6402373705728000LL, 121645100408832000LL, 2432902008176640000LL
+};
+
+// Factorial by table lookup.  'result' is only set when the status is
+// FACTORIAL_OK.
+FactorialStatus factorial_int64(long long n, long long *result) {
+    if (n < 0) {
+        return FACTORIAL_NEGATIVE;
+    }
+    if (n > FACTORIAL_MAX_INT64) {
+        return FACTORIAL_OVERFLOW;
+    }
+    *result = factorial_table[n];
+    return FACTORIAL_OK;
+}
+
+const char *factorial_status_message(FactorialStatus status) {
+    switch (status) {
+        case FACTORIAL_OK: return "ok";
+        case FACTORIAL_NEGATIVE: return "is undefined for negative arguments";
+        case FACTORIAL_OVERFLOW: return "overflows a 64-bit integer";
+        default: return "unknown error";
+    }
+}
+
+// Arbitrary precision unsigned integer, little-endian base 10^9 limbs.
+// Working in a decimal base makes the final conversion to text linear.
+#define BIG_BASE 1000000000u
+
+typedef struct {
+    uint32_t *limbs;
+    size_t len;
+} BigNum;
+
+static int big_alloc(BigNum *n, size_t capacity) {
+    n->limbs = calloc(capacity ? capacity : 1, sizeof(uint32_t));
+    n->len = 0;
+    return n->limbs != NULL;
+}
+
+// n *= factor, assuming n has room for two more limbs
+static void big_mul_small(BigNum *n, uint32_t factor) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < n->len; i++) {
+        uint64_t t = (uint64_t)n->limbs[i] * factor + carry;
+        n->limbs[i] = (uint32_t)(t % BIG_BASE);
+        carry = t / BIG_BASE;
+    }
+    while (carry) {
+        n->limbs[n->len++] = (uint32_t)(carry % BIG_BASE);
+        carry /= BIG_BASE;
+    }
+}
+
+// r[0..rn) += t[0..tn); the sum must fit in rn limbs
+static void limbs_add(uint32_t *r, size_t rn, const uint32_t *t, size_t tn) {
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < tn && i < rn; i++) {
+        uint32_t sum = r[i] + t[i] + carry;
+        carry = sum >= BIG_BASE;
+        r[i] = carry ? sum - BIG_BASE : sum;
+    }
+    for (; carry && i < rn; i++) {
+        carry = ++r[i] == BIG_BASE;
+        if (carry) r[i] = 0;
+    }
+}
+
+// r[0..rn) -= t[0..tn); the difference must not be negative
+static void limbs_sub(uint32_t *r, size_t rn, const uint32_t *t, size_t tn) {
+    uint32_t borrow = 0;
+    size_t i = 0;
+    for (; i < tn && i < rn; i++) {
+        uint32_t sub = t[i] + borrow;
+        borrow = r[i] < sub;
+        r[i] = borrow ? r[i] + BIG_BASE - sub : r[i] - sub;
+    }
+    for (; borrow && i < rn; i++) {
+        borrow = r[i] == 0;
+        r[i] = borrow ? BIG_BASE - 1 : r[i] - 1;
+    }
+}
+
+// Below this many limbs the schoolbook product beats Karatsuba
+#define KARATSUBA_THRESHOLD 40
+
+// r[0..an+bn) = a * b.  Karatsuba above the threshold, so the top levels of
+// the product tree cost O(n^1.585) instead of O(n^2).
+static int limbs_mul(const uint32_t *a, size_t an, const uint32_t *b, size_t bn,
+                     uint32_t *r) {
+    if (an < bn) {
+        const uint32_t *swap = a; a = b; b = swap;
+        size_t swap_len = an; an = bn; bn = swap_len;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        memset(r, 0, (an + bn) * sizeof(uint32_t));
+        for (size_t i = 0; i < bn; i++) {
+            uint64_t carry = 0;
+            uint64_t bi = b[i];
+            for (size_t j = 0; j < an; j++) {
+                uint64_t t = bi * a[j] + r[i + j] + carry;
+                r[i + j] = (uint32_t)(t % BIG_BASE);
+                carry = t / BIG_BASE;
+            }
+            r[i + an] = (uint32_t)carry;
+        }
+        return 1;
+    }
+
+    size_t m = (an + 1) / 2;
+    if (bn <= m) {
+        // b is too short to split: a0 * b + (a1 * b) * B^m
+        uint32_t *high = malloc((an - m + bn) * sizeof(uint32_t));
+        if (!high || !limbs_mul(a, m, b, bn, r) ||
+            !limbs_mul(a + m, an - m, b, bn, high)) {
+            free(high);
+            return 0;
+        }
+        memset(r + m + bn, 0, (an - m) * sizeof(uint32_t));
+        limbs_add(r + m, an + bn - m, high, an - m + bn);
+        free(high);
+        return 1;
+    }
+
+    // z0 = a0 * b0 and z2 = a1 * b1 go straight into r; then
+    // z1 = (a0 + a1) * (b0 + b1) - z0 - z2 is added in at B^m
+    size_t sum_len = m + 1;
+    uint32_t *scratch = calloc(4 * sum_len, sizeof(uint32_t));
+    if (!scratch) {
+        return 0;
+    }
+    uint32_t *sa = scratch, *sb = scratch + sum_len, *z1 = scratch + 2 * sum_len;
+    memcpy(sa, a, m * sizeof(uint32_t));
+    limbs_add(sa, sum_len, a + m, an - m);
+    memcpy(sb, b, m * sizeof(uint32_t));
+    limbs_add(sb, sum_len, b + m, bn - m);
+
+    int ok = limbs_mul(a, m, b, m, r) &&
+             limbs_mul(a + m, an - m, b + m, bn - m, r + 2 * m) &&
+             limbs_mul(sa, sum_len, sb, sum_len, z1);
+    if (ok) {
+        limbs_sub(z1, 2 * sum_len, r, 2 * m);
+        limbs_sub(z1, 2 * sum_len, r + 2 * m, an + bn - 2 * m);
+        limbs_add(r + m, an + bn - m, z1, 2 * sum_len);
+    }
+    free(scratch);
+    return ok;
+}
+
+static int big_mul(const BigNum *a, const BigNum *b, BigNum *result) {
+    if (!big_alloc(result, a->len + b->len) ||
+        !limbs_mul(a->limbs, a->len, b->limbs, b->len, result->limbs)) {
+        free(result->limbs);
+        return 0;
+    }
+    result->len = a->len + b->len;
+    while (result->len > 1 && result->limbs[result->len - 1] == 0) {
+        result->len--;
+    }
+    return 1;
+}
+
+// lo * (lo + 1) * ... * hi by binary splitting
+static int product(uint32_t lo, uint32_t hi, BigNum *result) {
+    if (hi - lo < 16) {
+        if (!big_alloc(result, 2 * (hi - lo + 1) + 1)) {
+            return 0;
+        }
+        result->limbs[0] = 1;
+        result->len = 1;
+        for (uint64_t k = lo; k <= hi; k++) {
+            big_mul_small(result, (uint32_t)k);
+        }
+        return 1;
+    }
+
+    uint32_t mid = lo + (hi - lo) / 2;
+    BigNum left, right;
+    if (!product(lo, mid, &left)) {
+        return 0;
+    }
+    if (!product(mid + 1, hi, &right)) {
+        free(left.limbs);
+        return 0;
+    }
+    int ok = big_mul(&left, &right, result);
+    free(left.limbs);
+    free(right.limbs);
+    return ok;
+}
+
+// Exact n! as a decimal string (caller frees), or NULL on failure
+char *factorial_decimal(unsigned long n) {
+    if (n > UINT32_MAX) {
+        return NULL;
+    }
+
+    BigNum value;
+    if (n < 2) {
+        if (!big_alloc(&value, 1)) return NULL;
+        value.limbs[0] = 1;
+        value.len = 1;
+    } else if (!product(2, (uint32_t)n, &value)) {
+        return NULL;
+    }
+
+    // Each limb is already nine decimal digits
+    char *text = malloc(value.len * 9 + 1);
+    if (!text) {
+        free(value.limbs);
+        return NULL;
+    }
+    int length = sprintf(text, "%u", value.limbs[value.len - 1]);
+    for (size_t i = value.len - 1; i-- > 0;) {
+        length += sprintf(text + length, "%09u", value.limbs[i]);
+    }
+
+    free(value.limbs);
+    return text;
+}
@@ -0,0 +1,156 @@
+/* hashcons.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../../include/hashcons.h"
+#include "../../include/astindex.h"
+
+// Operators that always produce a value: '/' can fail on zero, and the
+// rest are not valid operators
+static int is_pure_operator(const char *lexeme) {
+    static const char *const pure[] = {"+", "-", "*", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); i++) {
+        if (strcmp(lexeme, pure[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int can_share(const ASTNode *node) {
+    switch (node->type) {
+        case AST_NUMBER:
+        case AST_IDENTIFIER:
+            return !node->left && !node->right;
+        case AST_BINOP:
+            return node->left && node->left->id && node->right && node->right->id &&
+                   is_pure_operator(node->token.lexeme);
+        default:
+            return 0;
+    }
+}
+
+static uint32_t mix(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619u;
+}
+
+static uint32_t hash_node(const ASTNode *node) {
+    uint32_t hash = mix(2166136261u, node->type);
+    hash = mix(hash, node->token.type);
+    if (node->type == AST_IDENTIFIER) {
+        hash = mix(hash, node->token.sym);
+        hash = mix(hash, (uint32_t)node->scope_depth);
+        hash = mix(hash, (uint32_t)node->slot);
+    } else {
+        for (const char *c = node->token.lexeme; *c; c++) {
+            hash = mix(hash, (unsigned char)*c);
+        }
+    }
+    hash = mix(hash, node->left ? (uint32_t)node->left->id : 0);
+    hash = mix(hash, node->right ? (uint32_t)node->right->id : 0);
+    return hash;
+}
+
+// Operands are shared already, so they are equal when they are the same node
+static int same_node(const ASTNode *a, const ASTNode *b) {
+    if (a->type != b->type || a->token.type != b->token.type ||
+        a->left != b->left || a->right != b->right) {
+        return 0;
+    }
+    if (a->type == AST_IDENTIFIER) {
+        return a->token.sym == b->token.sym && a->scope_depth == b->scope_depth &&
+               a->slot == b->slot && a->decl_type == b->decl_type &&
+               strcmp(a->token.lexeme, b->token.lexeme) == 0;
+    }
+    return a->token.error == b->token.error && strcmp(a->token.lexeme, b->token.lexeme) == 0;
+}
+
+static ASTNode **find_slot(const HashconsTable *table, const ASTNode *node, uint32_t hash) {
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        ASTNode **entry = &table->slots[slot];
+        if (!*entry || same_node(*entry, node)) {
+            return entry;
+        }
+    }
+}
+
+static void grow_table(HashconsTable *table) {
+    ASTNode **old = table->slots;
+    int old_capacity = table->capacity;
+    table->capacity = old_capacity ? old_capacity * 2 : 256;
+    table->slots = calloc(table->capacity, sizeof(ASTNode *));
+    if (!table->slots) {
+        fprintf(stderr, "Error: Memory allocation failed for shared expressions\n");
+        exit(1);
+    }
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i]) {
+            *find_slot(table, old[i], hash_node(old[i])) = old[i];
+        }
+    }
+    free(old);
+}
+
+ASTNode *hashcons_intern(HashconsTable *table, ASTNode *node) {
+    if (!node || node->id || !can_share(node)) {
+        return node;
+    }
+    table->lookups++;
+    if (2 * (table->count + 1) > table->capacity) {
+        grow_table(table);
+    }
+    ASTNode **entry = find_slot(table, node, hash_node(node));
+    if (*entry) {
+        table->hits++;
+        return *entry;
+    }
+    node->id = ++table->count;
+    *entry = node;
+    return node;
+}
+
+// Statement chains grow to the right, so they are followed iteratively;
+// only operators recurse on both sides
+ASTNode *hashcons_ast(HashconsTable *table, ASTNode *root) {
+    ASTNode **link = &root;
+    while (*link && !(*link)->id) {
+        ASTNode *node = *link;
+        node->left = hashcons_ast(table, node->left);
+        if (node->type == AST_BINOP) {
+            node->right = hashcons_ast(table, node->right);
+            if (!can_share(node)) break;
+        } else if (!can_share(node)) {
+            link = &node->right;
+            continue;
+        }
+        ASTNode *shared = hashcons_intern(table, node);
+        if (shared != node) {
+            free_ast(node);     // Its operands are shared, so only it goes
+            *link = shared;
+        }
+        break;
+    }
+    return root;
+}
+
+int hashcons_free(HashconsTable *table) {
+    int count = table->count;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->slots[i]) {
+            ast_index_remove(table->slots[i]);
+            free(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+    return count;
+}
+
+void hashcons_report(Writer *out, const HashconsTable *table) {
+    size_t saved = (size_t)table->hits * sizeof(ASTNode);
+    size_t overhead = (size_t)table->capacity * sizeof(ASTNode *);
+    wr_printf(out, "Shared expressions: %ld expression nodes held in %d (%ld duplicates, %zu bytes saved, "
+                   "%zu bytes of table)\n",
+              table->lookups, table->count, table->hits, saved, overhead);
+}
@@ -0,0 +1,237 @@
+/* image.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/image.h"
+#include "../../include/intern.h"
+
+static uint32_t checksum(const unsigned char *bytes, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Append a section 8-byte aligned and return its offset
+static uint32_t write_section(Writer *w, const void *data, size_t len) {
+    static const char padding[8] = {0};
+    wr_bytes(w, padding, (8 - w->len % 8) % 8);
+    uint32_t offset = (uint32_t)w->len;
+    if (len > 0) {
+        wr_bytes(w, data, len);
+    }
+    return offset;
+}
+
+// Write all bytes to a file descriptor
+static int write_all(int fd, const void *data, size_t len) {
+    const char *bytes = data;
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) return -1;
+        bytes += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int image_is_image(const void *data, size_t size) {
+    return size >= sizeof(ImageHeader) && memcmp(data, IMAGE_MAGIC, 4) == 0;
+}
+
+// Lay the program out as an image in memory, then write it in one go
+int image_write(const BytecodeProgram *program, const char *path, Writer *errors) {
+    if (program->statement_count > 0) {
+        wr_printf(errors, "Error: Could not write %s, profiled code is not saved\n", path);
+        return -1;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, 4);
+    header.version = IMAGE_VERSION;
+    header.opcode_count = OP_COUNT;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.global_count = program->global_count;
+    header.max_stack = program->max_stack;
+    header.function_count = (uint32_t)program->function_count;
+    header.constant_count = (uint32_t)program->constant_count;
+    header.code_length = (uint32_t)program->code_length;
+    header.strings_size = (uint32_t)program->strings_length;
+
+    Writer names;
+    writer_init_memory(&names);
+    ImageFunction *functions = calloc(program->function_count + 1, sizeof(ImageFunction));
+    if (!functions) {
+        fprintf(stderr, "Error: Memory allocation failed for image\n");
+        exit(1);
+    }
+    for (int i = 0; i < program->function_count; i++) {
+        const VMFunction *f = &program->functions[i];
+        functions[i].name = (uint32_t)names.len;
+        functions[i].entry = f->entry;
+        functions[i].params = f->params;
+        functions[i].frame_size = f->frame_size;
+        functions[i].max_stack = f->max_stack;
+        wr_bytes(&names, symbol_name(f->name), symbol_length(f->name) + 1);
+    }
+    header.names_size = (uint32_t)names.len;
+
+    Writer image;
+    writer_init_memory(&image);
+    wr_bytes(&image, (const char *)&header, sizeof(header));
+    header.functions_offset = write_section(&image, functions, program->function_count * sizeof(ImageFunction));
+    header.constants_offset = write_section(&image, program->constants, program->constant_count * sizeof(Value));
+    header.code_offset = write_section(&image, program->code, program->code_length * sizeof(int32_t));
+    header.lines_offset = write_section(&image, program->lines, program->code_length * sizeof(int32_t));
+    header.strings_offset = write_section(&image, program->strings, program->strings_length);
+    header.names_offset = write_section(&image, names.data, names.len);
+    header.size = (uint32_t)image.len;
+    free(functions);
+    writer_free(&names);
+
+    int result = -1;
+    if (!image.failed) {
+        header.checksum = checksum((const unsigned char *)image.data + sizeof(header),
+                                   image.len - sizeof(header));
+        memcpy(image.data, &header, sizeof(header));
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            result = write_all(fd, image.data, image.len);
+            close(fd);
+        }
+    }
+    if (result != 0) {
+        wr_printf(errors, "Error: Could not write %s\n", path);
+    }
+    writer_free(&image);
+    return result;
+}
+
+// Whether 'count' items of 'item_size' bytes at 'offset' lie within the
+// image and are aligned for any of the program's arrays
+static int section_fits(const ImageHeader *header, uint32_t offset, uint32_t count, size_t item_size) {
+    return offset % 8 == 0 && offset >= sizeof(ImageHeader) &&
+           (uint64_t)offset + (uint64_t)count * item_size <= header->size;
+}
+
+static int load_error(BytecodeImage *image, const char *name, const char *reason, Writer *errors) {
+    wr_printf(errors, "%s: invalid bytecode image: %s\n", name, reason);
+    image_close(image);
+    return -1;
+}
+
+int image_load(BytecodeImage *image, const void *data, size_t size, const char *name, Writer *errors) {
+    memset(image, 0, sizeof(*image));
+    image->base = data;
+    image->size = size;
+
+    const ImageHeader *header = data;
+    const unsigned char *bytes = data;
+    if (!image_is_image(data, size)) {
+        return load_error(image, name, "no image header", errors);
+    }
+    if (header->byte_order != IMAGE_BYTE_ORDER) {
+        return load_error(image, name, "written on a machine with another byte order", errors);
+    }
+    if (header->version != IMAGE_VERSION || header->opcode_count != OP_COUNT) {
+        return load_error(image, name, "written by another version", errors);
+    }
+    if (header->size != size) {
+        return load_error(image, name, "size does not match the header (truncated?)", errors);
+    }
+    if ((uintptr_t)data % 8 != 0) {
+        return load_error(image, name, "not loaded at an 8-byte aligned address", errors);
+    }
+    if (checksum(bytes + sizeof(ImageHeader), size - sizeof(ImageHeader)) != header->checksum) {
+        return load_error(image, name, "checksum mismatch", errors);
+    }
+    if (header->function_count > INT32_MAX || header->constant_count > INT32_MAX ||
+        header->code_length > INT32_MAX || header->strings_size > INT32_MAX ||
+        !section_fits(header, header->functions_offset, header->function_count, sizeof(ImageFunction)) ||
+        !section_fits(header, header->constants_offset, header->constant_count, sizeof(Value)) ||
+        !section_fits(header, header->code_offset, header->code_length, sizeof(int32_t)) ||
+        !section_fits(header, header->lines_offset, header->code_length, sizeof(int32_t)) ||
+        !section_fits(header, header->strings_offset, header->strings_size, 1) ||
+        !section_fits(header, header->names_offset, header->names_size, 1)) {
+        return load_error(image, name, "section outside the file", errors);
+    }
+
+    const char *names = (const char *)bytes + header->names_offset;
+    if (header->function_count > 0 && (header->names_size == 0 || names[header->names_size - 1] != '\0')) {
+        return load_error(image, name, "unterminated function names", errors);
+    }
+
+    // The arrays stay in the image; the VM only reads them
+    BytecodeProgram *program = &image->program;
+    program->code = (int32_t *)(bytes + header->code_offset);
+    program->lines = (int *)(bytes + header->lines_offset);
+    program->code_length = (int)header->code_length;
+    program->constants = (Value *)(bytes + header->constants_offset);
+    program->constant_count = (int)header->constant_count;
+    program->strings = (char *)bytes + header->strings_offset;
+    program->strings_length = (int)header->strings_size;
+    program->global_count = header->global_count;
+    program->max_stack = header->max_stack;
+
+    const ImageFunction *functions = (const ImageFunction *)(bytes + header->functions_offset);
+    program->functions = malloc((header->function_count + 1) * sizeof(VMFunction));
+    if (!program->functions) {
+        fprintf(stderr, "Error: Memory allocation failed for image\n");
+        exit(1);
+    }
+    program->function_count = (int)header->function_count;
+    for (int i = 0; i < program->function_count; i++) {
+        if (functions[i].name >= header->names_size) {
+            return load_error(image, name, "function name outside the file", errors);
+        }
+        VMFunction *f = &program->functions[i];
+        f->name = intern_cstr(names + functions[i].name);
+        f->entry = functions[i].entry;
+        f->params = functions[i].params;
+        f->frame_size = functions[i].frame_size;
+        f->max_stack = functions[i].max_stack;
+    }
+
+    if (vm_verify(program, errors) > 0) {
+        return load_error(image, name, "code does not verify", errors);
+    }
+    return 0;
+}
+
+int image_open(BytecodeImage *image, const char *path, Writer *errors) {
+    memset(image, 0, sizeof(*image));
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        wr_printf(errors, "Error: Could not open file %s\n", path);
+        return -1;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        wr_printf(errors, "Error: Could not open file %s\n", path);
+        return -1;
+    }
+    if (image_load(image, base, (size_t)st.st_size, path, errors) != 0) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+    image->mapped = 1;
+    return 0;
+}
+
+void image_close(BytecodeImage *image) {
+    free(image->program.functions);
+    if (image->mapped) {
+        munmap((void *)image->base, image->size);
+    }
+    memset(image, 0, sizeof(*image));
+}
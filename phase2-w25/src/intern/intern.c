@@ -0,0 +1,308 @@
+/* intern.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "../../include/intern.h"
+
+// Table layout: the top hash bits pick a shard, the low bits a slot in that
+// shard's open-addressing table.  Symbol records live in fixed-size pages
+// indexed by ID, so lookups by ID never take a lock.
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_PAGE_BITS 12
+#define INTERN_PAGE_SIZE (1 << INTERN_PAGE_BITS)
+#define INTERN_MAX_PAGES (1 << 16)
+#define INTERN_ARENA_SIZE (64 * 1024)
+#define INTERN_MIN_CAPACITY 256
+
+typedef struct {
+    const char *name;
+    uint32_t length;
+} Symbol;
+
+// Hash slot; id 0 marks an empty slot
+typedef struct {
+    uint32_t hash;
+    SymbolId id;
+} Slot;
+
+// Arena chunk holding NUL-terminated symbol names
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Slot *slots;
+    uint32_t capacity;      // Power of two
+    uint32_t count;
+    ArenaChunk *arena;
+} Shard;
+
+static Shard shards[INTERN_SHARDS];
+static Symbol *_Atomic pages[INTERN_MAX_PAGES];
+static atomic_uint next_id = 1;
+static int shared_mode = 0;
+static int initialized = 0;
+
+// Initialize the table; 'shared' enables per-shard locking
+void intern_init(int shared) {
+    if (initialized) {
+        intern_free();
+    }
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        memset(&shards[i], 0, sizeof(Shard));
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+    atomic_store(&next_id, 1);
+    shared_mode = shared;
+    initialized = 1;
+}
+
+// Release all symbols; IDs handed out before this are no longer valid
+void intern_free(void) {
+    if (!initialized) {
+        return;
+    }
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        Shard *shard = &shards[i];
+        ArenaChunk *chunk = shard->arena;
+        while (chunk) {
+            ArenaChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        free(shard->slots);
+        pthread_mutex_destroy(&shard->lock);
+        memset(shard, 0, sizeof(Shard));
+    }
+    for (int i = 0; i < INTERN_MAX_PAGES && atomic_load(&pages[i]); i++) {
+        free(atomic_load(&pages[i]));
+        atomic_store(&pages[i], NULL);
+    }
+    atomic_store(&next_id, 1);
+    initialized = 0;
+}
+
+uint32_t intern_hash(const char *text, size_t length) {
+    uint32_t hash = INTERN_HASH_INIT;
+    for (size_t i = 0; i < length; i++) {
+        hash = intern_hash_step(hash, (unsigned char)text[i]);
+    }
+    return hash;
+}
+
+static Symbol *symbol_record(SymbolId id) {
+    Symbol *page = atomic_load_explicit(&pages[id >> INTERN_PAGE_BITS], memory_order_acquire);
+    return &page[id & (INTERN_PAGE_SIZE - 1)];
+}
+
+// Copy a name into the shard's arena
+static const char *arena_copy(Shard *shard, const char *text, size_t length) {
+    ArenaChunk *chunk = shard->arena;
+    if (!chunk || chunk->size - chunk->used < length + 1) {
+        size_t size = length + 1 > INTERN_ARENA_SIZE ? length + 1 : INTERN_ARENA_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + size);
+        if (!chunk) {
+            fprintf(stderr, "Error: Memory allocation failed for intern table\n");
+            exit(1);
+        }
+        chunk->next = shard->arena;
+        chunk->used = 0;
+        chunk->size = size;
+        shard->arena = chunk;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+// Allocate the next dense ID, creating its record page on first use.
+// Returns SYMBOL_NONE when every ID is taken.
+static SymbolId new_symbol(const char *name, size_t length) {
+    SymbolId id = atomic_fetch_add(&next_id, 1);
+    size_t page_index = id >> INTERN_PAGE_BITS;
+    if (page_index >= INTERN_MAX_PAGES) {
+        atomic_fetch_sub(&next_id, 1);
+        return SYMBOL_NONE;
+    }
+
+    Symbol *page = atomic_load_explicit(&pages[page_index], memory_order_acquire);
+    if (!page) {
+        Symbol *fresh = calloc(INTERN_PAGE_SIZE, sizeof(Symbol));
+        if (!fresh) {
+            fprintf(stderr, "Error: Memory allocation failed for intern table\n");
+            exit(1);
+        }
+        if (atomic_compare_exchange_strong(&pages[page_index], &page, fresh)) {
+            page = fresh;
+        } else {
+            free(fresh); // Another thread created the page first
+        }
+    }
+
+    page[id & (INTERN_PAGE_SIZE - 1)] = (Symbol){name, (uint32_t)length};
+    return id;
+}
+
+// Double the shard's slot array, reinserting by stored hash
+static void grow_shard(Shard *shard) {
+    uint32_t capacity = shard->capacity ? shard->capacity * 2 : INTERN_MIN_CAPACITY;
+    Slot *slots = calloc(capacity, sizeof(Slot));
+    if (!slots) {
+        fprintf(stderr, "Error: Memory allocation failed for intern table\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < shard->capacity; i++) {
+        Slot slot = shard->slots[i];
+        if (slot.id == SYMBOL_NONE) continue;
+        uint32_t index = slot.hash & (capacity - 1);
+        while (slots[index].id != SYMBOL_NONE) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = slot;
+    }
+
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+}
+
+// The next ID to be handed out; symbols from it on can be released
+SymbolId intern_mark(void) {
+    return atomic_load(&next_id);
+}
+
+// Forget the symbols interned since intern_mark returned 'mark', so their
+// IDs are handed out again.  Each shard keeps the older symbols in a
+// table and an arena sized for them alone.
+void intern_release(SymbolId mark) {
+    if (!initialized || mark == SYMBOL_NONE || mark >= atomic_load(&next_id)) {
+        return;
+    }
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        Shard *shard = &shards[i];
+        Slot *slots = shard->slots;
+        uint32_t capacity = shard->capacity;
+        ArenaChunk *chunk = shard->arena;
+
+        uint32_t count = 0;
+        for (uint32_t j = 0; j < capacity; j++) {
+            count += slots[j].id != SYMBOL_NONE && slots[j].id < mark;
+        }
+        shard->slots = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+        shard->arena = NULL;
+        while (count > 0 && (count + 1) * 4 > shard->capacity * 3) {
+            grow_shard(shard);
+        }
+        for (uint32_t j = 0; j < capacity; j++) {
+            Slot slot = slots[j];
+            if (slot.id == SYMBOL_NONE || slot.id >= mark) continue;
+            Symbol *symbol = symbol_record(slot.id);
+            symbol->name = arena_copy(shard, symbol->name, symbol->length);
+            uint32_t index = slot.hash & (shard->capacity - 1);
+            while (shard->slots[index].id != SYMBOL_NONE) {
+                index = (index + 1) & (shard->capacity - 1);
+            }
+            shard->slots[index] = slot;
+            shard->count++;
+        }
+
+        free(slots);
+        while (chunk) {
+            ArenaChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+    }
+    // Pages holding only released IDs
+    for (size_t i = ((size_t)mark + INTERN_PAGE_SIZE - 1) >> INTERN_PAGE_BITS;
+         i < INTERN_MAX_PAGES && atomic_load(&pages[i]); i++) {
+        free(atomic_load(&pages[i]));
+        atomic_store(&pages[i], NULL);
+    }
+    atomic_store(&next_id, mark);
+}
+
+// Map a name to its symbol ID, adding it if it is new.
+// 'hash' must be intern_hash(text, length).
+SymbolId intern(const char *text, size_t length, uint32_t hash) {
+    if (!initialized) {
+        intern_init(0);
+    }
+
+    Shard *shard = &shards[hash >> (32 - INTERN_SHARD_BITS)];
+    if (shared_mode) {
+        pthread_mutex_lock(&shard->lock);
+    }
+
+    // Keep the load factor below 3/4
+    if ((shard->count + 1) * 4 > shard->capacity * 3) {
+        grow_shard(shard);
+    }
+
+    uint32_t mask = shard->capacity - 1;
+    uint32_t index = hash & mask;
+    SymbolId id;
+    for (;;) {
+        Slot *slot = &shard->slots[index];
+        if (slot->id == SYMBOL_NONE) {
+            id = new_symbol(arena_copy(shard, text, length), length);
+            if (id != SYMBOL_NONE) {
+                slot->hash = hash;
+                slot->id = id;
+                shard->count++;
+            }
+            break;
+        }
+        if (slot->hash == hash) {
+            Symbol *symbol = symbol_record(slot->id);
+            if (symbol->length == length && memcmp(symbol->name, text, length) == 0) {
+                id = slot->id;
+                break;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (shared_mode) {
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return id;
+}
+
+SymbolId intern_cstr(const char *text) {
+    size_t length = strlen(text);
+    return intern(text, length, intern_hash(text, length));
+}
+
+// Name of an interned symbol, or NULL for SYMBOL_NONE
+const char *symbol_name(SymbolId id) {
+    if (id == SYMBOL_NONE || id >= atomic_load(&next_id)) {
+        return NULL;
+    }
+    return symbol_record(id)->name;
+}
+
+size_t symbol_length(SymbolId id) {
+    if (id == SYMBOL_NONE || id >= atomic_load(&next_id)) {
+        return 0;
+    }
+    return symbol_record(id)->length;
+}
+
+// Number of symbols interned so far
+uint32_t symbol_count(void) {
+    return atomic_load(&next_id) - 1;
+}
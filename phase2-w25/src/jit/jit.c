@@ -0,0 +1,650 @@
+/* jit.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "../../include/jit.h"
+
+int jit_init(Jit *jit, const BytecodeProgram *program, int threshold) {
+    memset(jit, 0, sizeof(*jit));
+    int count = program->function_count + 1;
+    jit->function_count = program->function_count;
+    jit->native = calloc(count, sizeof(JitFunction));
+    jit->state = calloc(count, sizeof(unsigned char));
+    jit->calls = calloc(count, sizeof(int));
+    jit->loops = calloc(count, sizeof(int));
+    jit->resume = calloc(count, sizeof(int *));
+    jit->memory = calloc(count, sizeof(void *));
+    jit->memory_size = calloc(count, sizeof(size_t));
+    if (!jit->native || !jit->state || !jit->calls || !jit->loops ||
+        !jit->resume || !jit->memory || !jit->memory_size) {
+        jit_free(jit);
+        return -1;
+    }
+    jit->call_threshold = threshold > 0 ? threshold : JIT_CALL_THRESHOLD;
+    jit->loop_threshold = threshold > 0 ? threshold : JIT_LOOP_THRESHOLD;
+    return 0;
+}
+
+void jit_free(Jit *jit) {
+    for (int i = 0; i < jit->function_count; i++) {
+        if (jit->memory && jit->memory[i]) {
+            munmap(jit->memory[i], jit->memory_size[i]);
+        }
+        if (jit->resume) {
+            free(jit->resume[i]);
+        }
+    }
+    free(jit->native);
+    free(jit->state);
+    free(jit->calls);
+    free(jit->loops);
+    free(jit->resume);
+    free(jit->memory);
+    free(jit->memory_size);
+    memset(jit, 0, sizeof(*jit));
+}
+
+// Native address to continue 'function' at bytecode 'offset', or NULL if
+// the offset is not a loop head with an empty operand stack
+const void *jit_resume(const Jit *jit, const BytecodeProgram *program, int function, int offset) {
+    const int *resume = jit->resume[function];
+    if (!resume) {
+        return NULL;
+    }
+    int native = resume[offset - program->functions[function].entry];
+    return native >= 0 ? (const char *)jit->memory[function] + native : NULL;
+}
+
+#if defined(__x86_64__)
+
+// x86-64 registers by encoding
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Register roles.  The operand stack lives in caller-saved registers, one
+// per depth; the most used locals live in callee-saved registers.
+#define FRAME_REG R12           // Value *frame
+#define VM_REG R13              // VM *vm
+static const int temp_regs[] = {RCX, RSI, RDI, R8, R9, R10, R11};
+static const int local_regs[] = {RBX, R14, R15};
+#define TEMP_COUNT ((int)(sizeof(temp_regs) / sizeof(temp_regs[0])))
+#define LOCAL_REG_COUNT ((int)(sizeof(local_regs) / sizeof(local_regs[0])))
+
+// Condition codes for jcc/setcc
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G 0xf
+
+// Opcodes used with a ModRM operand (two-byte ones include the 0x0f escape)
+#define X86_ADD 0x01
+#define X86_SUB 0x29
+#define X86_CMP 0x39
+#define X86_TEST 0x85
+#define X86_STORE 0x89          // mov r/m, reg
+#define X86_LOAD 0x8b           // mov reg, r/m
+#define X86_LEA 0x8d
+#define X86_IMUL 0x0faf
+#define X86_MOVZX8 0x0fb6
+#define X86_GROUP3 0xf7         // neg (/3), idiv (/7)
+
+typedef struct {
+    unsigned char *code;
+    size_t length;
+    size_t capacity;
+    int failed;
+} Assembler;
+
+static void emit_byte(Assembler *a, int value) {
+    if (a->length == a->capacity) {
+        size_t capacity = a->capacity ? a->capacity * 2 : 4096;
+        unsigned char *grown = realloc(a->code, capacity);
+        if (!grown) {
+            a->failed = 1;
+            return;
+        }
+        a->code = grown;
+        a->capacity = capacity;
+    }
+    a->code[a->length++] = (unsigned char)value;
+}
+
+static void emit32(Assembler *a, int32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit_byte(a, (uint32_t)value >> (8 * i));
+    }
+}
+
+static void emit64(Assembler *a, int64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emit_byte(a, (uint64_t)value >> (8 * i));
+    }
+}
+
+static void emit_opcode(Assembler *a, int opcode) {
+    if (opcode > 0xff) {
+        emit_byte(a, opcode >> 8);
+    }
+    emit_byte(a, opcode & 0xff);
+}
+
+static void emit_rex(Assembler *a, int reg, int rm) {
+    emit_byte(a, 0x48 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1));
+}
+
+// opcode reg, rm (both registers, 64-bit)
+static void op_rr(Assembler *a, int opcode, int reg, int rm) {
+    emit_rex(a, reg, rm);
+    emit_opcode(a, opcode);
+    emit_byte(a, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// opcode reg, [base + disp32]
+static void op_rm(Assembler *a, int opcode, int reg, int base, int32_t disp) {
+    emit_rex(a, reg, base);
+    emit_opcode(a, opcode);
+    emit_byte(a, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) {
+        emit_byte(a, 0x24); // SIB: no index
+    }
+    emit32(a, disp);
+}
+
+static void mov_rr(Assembler *a, int dst, int src) {
+    if (dst != src) {
+        op_rr(a, X86_STORE, src, dst);
+    }
+}
+
+static void mov_imm(Assembler *a, int reg, long long value) {
+    emit_rex(a, 0, reg);
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        emit_byte(a, 0xc7);
+        emit_byte(a, 0xc0 | (reg & 7));
+        emit32(a, (int32_t)value);
+    } else {
+        emit_byte(a, 0xb8 | (reg & 7));
+        emit64(a, value);
+    }
+}
+
+static void push_reg(Assembler *a, int reg) {
+    if (reg >= R8) emit_byte(a, 0x41);
+    emit_byte(a, 0x50 | (reg & 7));
+}
+
+static void pop_reg(Assembler *a, int reg) {
+    if (reg >= R8) emit_byte(a, 0x41);
+    emit_byte(a, 0x58 | (reg & 7));
+}
+
+static void call_address(Assembler *a, const void *target) {
+    mov_imm(a, RAX, (long long)(intptr_t)target);
+    emit_byte(a, 0xff); // call rax
+    emit_byte(a, 0xd0);
+}
+
+// reg = (flags satisfy cc) ? 1 : 0
+static void set_condition(Assembler *a, int cc, int reg) {
+    emit_byte(a, 0x0f);
+    emit_byte(a, 0x90 | cc);
+    emit_byte(a, 0xc0); // al
+    op_rr(a, X86_MOVZX8, reg, RAX);
+}
+
+// Emit a jump with a rel32 to be filled in; returns the rel32 position
+static size_t jump_rel32(Assembler *a, int cc) {
+    if (cc < 0) {
+        emit_byte(a, 0xe9);
+    } else {
+        emit_byte(a, 0x0f);
+        emit_byte(a, 0x80 | cc);
+    }
+    emit32(a, 0);
+    return a->length - 4;
+}
+
+static void patch_rel32(Assembler *a, size_t at, size_t target) {
+    if (a->failed) return;
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(a->code + at, &rel, sizeof(rel));
+}
+
+// Compilation of one function
+typedef struct {
+    Assembler as;
+    int frame_size;
+    int slot_reg[LOCAL_REG_COUNT];  // Local slot held in each local register, -1 if unused
+} FunctionCompiler;
+
+static int local_register(FunctionCompiler *fc, int slot) {
+    for (int i = 0; i < LOCAL_REG_COUNT; i++) {
+        if (fc->slot_reg[i] == slot) {
+            return local_regs[i];
+        }
+    }
+    return -1;
+}
+
+static void load_local(FunctionCompiler *fc, int reg, int slot) {
+    int local = local_register(fc, slot);
+    if (local >= 0) {
+        mov_rr(&fc->as, reg, local);
+    } else {
+        op_rm(&fc->as, X86_LOAD, reg, FRAME_REG, slot * 8);
+    }
+}
+
+static void store_local(FunctionCompiler *fc, int slot, int reg) {
+    int local = local_register(fc, slot);
+    if (local >= 0) {
+        mov_rr(&fc->as, local, reg);
+    } else {
+        op_rm(&fc->as, X86_STORE, reg, FRAME_REG, slot * 8);
+    }
+}
+
+// Operand stack entries below 'depth' are written to (or read back from)
+// their VM stack slots around calls, which clobber the temp registers
+static void spill(FunctionCompiler *fc, int depth) {
+    for (int i = 0; i < depth; i++) {
+        op_rm(&fc->as, X86_STORE, temp_regs[i], FRAME_REG, (fc->frame_size + i) * 8);
+    }
+}
+
+static void reload(FunctionCompiler *fc, int depth) {
+    for (int i = 0; i < depth; i++) {
+        op_rm(&fc->as, X86_LOAD, temp_regs[i], FRAME_REG, (fc->frame_size + i) * 8);
+    }
+}
+
+static void emit_epilogue(Assembler *a) {
+    pop_reg(a, R15);
+    pop_reg(a, R14);
+    pop_reg(a, R13);
+    pop_reg(a, R12);
+    pop_reg(a, RBX);
+    emit_byte(a, 0xc3); // ret
+}
+
+static int supported(int op) {
+    switch (op) {
+        case OP_CONST: case OP_LOAD: case OP_STORE:
+        case OP_LOAD_GLOBAL: case OP_STORE_GLOBAL: case OP_POP:
+        case OP_ADD_I: case OP_SUB_I: case OP_MUL_I: case OP_DIV_I: case OP_MOD_I:
+        case OP_LT_I: case OP_GT_I: case OP_LE_I: case OP_GE_I: case OP_EQ_I: case OP_NE_I:
+        case OP_BOOL_I: case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_TRUE:
+        case OP_CALL: case OP_RETURN: case OP_FACTORIAL:
+        case OP_PRINT_I: case OP_PRINT_STR: case OP_PRINT_FACTORIAL:
+            return 1;
+        default:
+            return 0; // Floating point, HALT and profiled code stay interpreted
+    }
+}
+
+static int instruction_length(int op) {
+    switch (op) {
+        case OP_CONST: case OP_LOAD: case OP_STORE: case OP_LOAD_GLOBAL: case OP_STORE_GLOBAL:
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_JUMP_IF_TRUE: case OP_PRINT_STR:
+        case OP_STATEMENT: case OP_ENTER:
+            return 2;
+        case OP_CALL:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+// Give the locals used most (counting uses inside loops more) a register
+static void allocate_locals(FunctionCompiler *fc, const int32_t *code, int entry, int end) {
+    int *weight = calloc(fc->frame_size + 1, sizeof(int));
+    for (int i = 0; i < LOCAL_REG_COUNT; i++) {
+        fc->slot_reg[i] = -1;
+    }
+    if (!weight) {
+        return;
+    }
+
+    for (int offset = entry; offset < end; offset += instruction_length(code[offset])) {
+        int op = code[offset];
+        if (op != OP_LOAD && op != OP_STORE) {
+            continue;
+        }
+        int uses = 1;
+        // Backward branches after this point that land before it enclose it
+        for (int later = offset; later < end; later += instruction_length(code[later])) {
+            int later_op = code[later];
+            if ((later_op == OP_JUMP_IF_TRUE || later_op == OP_JUMP_IF_FALSE) &&
+                code[later + 1] <= offset) {
+                uses *= 8;
+            }
+        }
+        weight[code[offset + 1]] += uses;
+    }
+
+    for (int i = 0; i < LOCAL_REG_COUNT; i++) {
+        int best = -1;
+        for (int slot = 0; slot < fc->frame_size; slot++) {
+            if (weight[slot] > 0 && (best < 0 || weight[slot] > weight[best])) {
+                best = slot;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        fc->slot_reg[i] = best;
+        weight[best] = 0;
+    }
+    free(weight);
+}
+
+// A branch to bytecode 'target', patched once every instruction is placed
+typedef struct {
+    size_t at;
+    int target;
+} Fixup;
+
+// Translate one function's bytecode.  Returns 1 and sets the native code on
+// success; 0 leaves the function to the interpreter for good.
+int jit_compile(Jit *jit, VM *vm, int function) {
+    const BytecodeProgram *program = vm->program;
+    const VMFunction *fn = &program->functions[function];
+    const int32_t *code = program->code;
+    int entry = fn->entry;
+    int end = function + 1 < program->function_count ? program->functions[function + 1].entry
+                                                     : program->code_length;
+    int length = end - entry;
+
+    FunctionCompiler fc = {{0}};
+    fc.frame_size = fn->frame_size;
+    int *depth_at = malloc(length * sizeof(int));
+    int *native_at = malloc(length * sizeof(int));
+    Fixup *fixups = malloc(length * sizeof(Fixup));
+    int fixup_count = 0;
+    int ok = depth_at && native_at && fixups && fn->max_stack <= TEMP_COUNT;
+    for (int offset = entry; ok && offset < end; offset += instruction_length(code[offset])) {
+        ok = supported(code[offset]);
+    }
+    if (!ok) {
+        goto unsupported;
+    }
+    for (int i = 0; i < length; i++) {
+        depth_at[i] = -1;
+        native_at[i] = -1;
+    }
+    allocate_locals(&fc, code, entry, end);
+
+    Assembler *a = &fc.as;
+    // Prologue: save callee-saved registers (leaving the stack 16-byte
+    // aligned for calls), load register locals, then go to 'resume' if set
+    push_reg(a, RBX);
+    push_reg(a, R12);
+    push_reg(a, R13);
+    push_reg(a, R14);
+    push_reg(a, R15);
+    mov_rr(a, FRAME_REG, RDI);
+    mov_rr(a, VM_REG, RSI);
+    for (int i = 0; i < LOCAL_REG_COUNT; i++) {
+        if (fc.slot_reg[i] >= 0) {
+            op_rm(a, X86_LOAD, local_regs[i], FRAME_REG, fc.slot_reg[i] * 8);
+        }
+    }
+    op_rr(a, X86_TEST, RDX, RDX);
+    emit_byte(a, 0x74); // jz over the next instruction
+    emit_byte(a, 0x02);
+    emit_byte(a, 0xff); // jmp rdx
+    emit_byte(a, 0xe2);
+
+    int depth = 0;
+    int reachable = 1;
+    int depth_after = 0;    // Depth after an unconditional jump or return
+    for (int offset = entry; offset < end; offset += instruction_length(code[offset])) {
+        int index = offset - entry;
+        int op = code[offset];
+        const int32_t *args = code + offset + 1;
+        int line = program->lines[offset];
+
+        if (!reachable) {
+            depth = depth_at[index] >= 0 ? depth_at[index] : depth_after;
+            reachable = 1;
+        } else if (depth_at[index] >= 0 && depth_at[index] != depth) {
+            goto unsupported;
+        }
+        depth_at[index] = depth;
+        native_at[index] = (int)a->length;
+
+        int top = depth > 0 ? temp_regs[depth - 1] : -1;
+        int next = depth < TEMP_COUNT ? temp_regs[depth] : -1;
+        int below = depth > 1 ? temp_regs[depth - 2] : -1;
+        switch (op) {
+            case OP_CONST:
+                mov_imm(a, next, program->constants[args[0]].i);
+                depth++;
+                break;
+            case OP_LOAD:
+                load_local(&fc, next, args[0]);
+                depth++;
+                break;
+            case OP_STORE:
+                store_local(&fc, args[0], top);
+                depth--;
+                break;
+            case OP_LOAD_GLOBAL:
+                mov_imm(a, RAX, (long long)(intptr_t)&vm->globals[args[0]]);
+                op_rm(a, X86_LOAD, next, RAX, 0);
+                depth++;
+                break;
+            case OP_STORE_GLOBAL:
+                mov_imm(a, RAX, (long long)(intptr_t)&vm->globals[args[0]]);
+                op_rm(a, X86_STORE, top, RAX, 0);
+                depth--;
+                break;
+            case OP_POP:
+                depth--;
+                break;
+            case OP_ADD_I:
+                op_rr(a, X86_ADD, top, below);
+                depth--;
+                break;
+            case OP_SUB_I:
+                op_rr(a, X86_SUB, top, below);
+                depth--;
+                break;
+            case OP_MUL_I:
+                op_rr(a, X86_IMUL, below, top);
+                depth--;
+                break;
+            case OP_DIV_I:
+            case OP_MOD_I: {
+                // below = below / top, with the interpreter's checks
+                op_rr(a, X86_TEST, top, top);
+                size_t nonzero = jump_rel32(a, CC_NE);
+                // vm_fail is variadic, so al must hold the vector register count
+                mov_rr(a, RDI, VM_REG);
+                mov_imm(a, RSI, line);
+                mov_imm(a, RDX, (long long)(intptr_t)"division by zero");
+                mov_imm(a, R11, (long long)(intptr_t)vm_fail);
+                emit_byte(a, 0x31); // xor eax, eax
+                emit_byte(a, 0xc0);
+                emit_byte(a, 0x41); // call r11, which does not return
+                emit_byte(a, 0xff);
+                emit_byte(a, 0xd3);
+                patch_rel32(a, nonzero, a->length);
+
+                emit_rex(a, 0, top); // cmp top, -1
+                emit_byte(a, 0x83);
+                emit_byte(a, 0xf8 | (top & 7));
+                emit_byte(a, 0xff);
+                size_t general = jump_rel32(a, CC_NE);
+                if (op == OP_DIV_I) {
+                    op_rr(a, X86_GROUP3, 3, below); // neg: no INT64_MIN / -1 trap
+                } else {
+                    mov_imm(a, below, 0);
+                }
+                size_t done = jump_rel32(a, -1);
+                patch_rel32(a, general, a->length);
+                mov_rr(a, RAX, below);
+                emit_byte(a, 0x48); // cqo
+                emit_byte(a, 0x99);
+                op_rr(a, X86_GROUP3, 7, top); // idiv
+                mov_rr(a, below, op == OP_DIV_I ? RAX : RDX);
+                patch_rel32(a, done, a->length);
+                depth--;
+                break;
+            }
+            case OP_LT_I: case OP_GT_I: case OP_LE_I:
+            case OP_GE_I: case OP_EQ_I: case OP_NE_I: {
+                static const int conditions[] = {
+                    [OP_LT_I - OP_LT_I] = CC_L, [OP_GT_I - OP_LT_I] = CC_G,
+                    [OP_LE_I - OP_LT_I] = CC_LE, [OP_GE_I - OP_LT_I] = CC_GE,
+                    [OP_EQ_I - OP_LT_I] = CC_E, [OP_NE_I - OP_LT_I] = CC_NE
+                };
+                op_rr(a, X86_CMP, top, below);
+                set_condition(a, conditions[op - OP_LT_I], below);
+                depth--;
+                break;
+            }
+            case OP_BOOL_I:
+                op_rr(a, X86_TEST, top, top);
+                set_condition(a, CC_NE, top);
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE: {
+                if (op != OP_JUMP) {
+                    op_rr(a, X86_TEST, top, top);
+                    depth--;
+                }
+                int target = args[0] - entry;
+                if (target < 0 || target >= length ||
+                    (depth_at[target] >= 0 && depth_at[target] != depth)) {
+                    goto unsupported;
+                }
+                depth_at[target] = depth;
+                int cc = op == OP_JUMP ? -1 : (op == OP_JUMP_IF_FALSE ? CC_E : CC_NE);
+                fixups[fixup_count++] = (Fixup){jump_rel32(a, cc), target};
+                if (op == OP_JUMP) {
+                    reachable = 0;
+                    depth_after = depth;
+                }
+                break;
+            }
+            case OP_CALL: {
+                // Arguments are spilled along with the rest of the operand
+                // stack, which puts them at the start of the callee's frame
+                int argc = args[1];
+                spill(&fc, depth);
+                op_rm(a, X86_LEA, RDX, FRAME_REG, (fc.frame_size + depth - argc) * 8);
+                mov_imm(a, RSI, args[0]);
+                mov_imm(a, RCX, argc);
+                mov_imm(a, R8, line);
+                mov_rr(a, RDI, VM_REG);
+                call_address(a, (const void *)vm_call);
+                depth -= argc;
+                reload(&fc, depth);
+                mov_rr(a, temp_regs[depth], RAX);
+                depth++;
+                break;
+            }
+            case OP_RETURN:
+                mov_rr(a, RAX, top);
+                emit_epilogue(a);
+                reachable = 0;
+                depth_after = 0;
+                break;
+            case OP_FACTORIAL:
+                spill(&fc, depth - 1);
+                mov_rr(a, RSI, top);
+                mov_rr(a, RDI, VM_REG);
+                mov_imm(a, RDX, line);
+                call_address(a, (const void *)vm_factorial);
+                reload(&fc, depth - 1);
+                mov_rr(a, top, RAX);
+                break;
+            case OP_PRINT_I:
+            case OP_PRINT_FACTORIAL:
+                depth--;
+                spill(&fc, depth);
+                mov_rr(a, RSI, top);
+                mov_rr(a, RDI, VM_REG);
+                mov_imm(a, RDX, line);
+                call_address(a, op == OP_PRINT_I ? (const void *)vm_print_int
+                                                 : (const void *)vm_print_factorial);
+                reload(&fc, depth);
+                break;
+            case OP_PRINT_STR:
+                spill(&fc, depth);
+                mov_imm(a, RSI, (long long)(intptr_t)(program->strings + args[0]));
+                mov_rr(a, RDI, VM_REG);
+                call_address(a, (const void *)vm_print_string);
+                reload(&fc, depth);
+                break;
+        }
+    }
+
+    for (int i = 0; i < fixup_count; i++) {
+        if (native_at[fixups[i].target] < 0) {
+            goto unsupported;
+        }
+        patch_rel32(a, fixups[i].at, native_at[fixups[i].target]);
+    }
+    if (a->failed) {
+        goto unsupported;
+    }
+
+    // Copy into an executable mapping
+    void *memory = mmap(NULL, a->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        goto unsupported;
+    }
+    memcpy(memory, a->code, a->length);
+    if (mprotect(memory, a->length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, a->length);
+        goto unsupported;
+    }
+
+    // Loop heads with an empty operand stack can be entered from the interpreter
+    for (int i = 0; i < length; i++) {
+        if (depth_at[i] != 0) {
+            native_at[i] = -1;
+        }
+    }
+    jit->memory[function] = memory;
+    jit->memory_size[function] = a->length;
+    jit->resume[function] = native_at;
+    jit->native[function] = (JitFunction)memory;
+    jit->state[function] = JIT_COMPILED;
+    jit->compiled++;
+    free(depth_at);
+    free(fixups);
+    free(a->code);
+    return 1;
+
+unsupported:
+    jit->state[function] = JIT_UNSUPPORTED;
+    jit->unsupported++;
+    free(depth_at);
+    free(native_at);
+    free(fixups);
+    free(fc.as.code);
+    return 0;
+}
+
+#else
+
+// No native code generator for this architecture
+int jit_compile(Jit *jit, VM *vm, int function) {
+    (void)vm;
+    jit->state[function] = JIT_UNSUPPORTED;
+    jit->unsupported++;
+    return 0;
+}
+
+#endif
@@ -3,25 +3,21 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "../../include/tokens.h"
 #include "../../include/lexer.h"
+#include "../../include/writer.h"
+#include "../../include/intern.h"
+#include "../../include/diag.h"
 
 // All global variables must be reset between files
-static int current_line = 1;
-static int current_column = 1; 
-static char last_token_type = 'x'; // For checking consecutive operators
-static int in_error_recovery = 0; // Flag for error recovery mode 
-
-// Add variables to track stored errors
-#define MAX_STORED_ERRORS 50000
-static struct {
-    char lexeme[100];
-    int line;
-    int column;
-    ErrorType error_type;
-} stored_errors[MAX_STORED_ERRORS];
-static int num_stored_errors = 0;
+// Lexer state is thread-local so files can be processed on worker threads
+static _Thread_local int current_line = 1;
+static _Thread_local int current_column = 1; 
+static _Thread_local char last_token_type = 'x'; // For checking consecutive operators
+static _Thread_local int in_error_recovery = 0; // Flag for error recovery mode 
+static _Thread_local int token_start = 0; // Input offset where the current token begins
 
 // Reset all global variables after each file
 void reset_all_globals(void) {
@@ -29,20 +25,17 @@ void reset_all_globals(void) {
     current_column = 1; 
     last_token_type = 'x';
     in_error_recovery = 0;
-    num_stored_errors = 0;
-    
-    // Clear stored errors array
-    for (int i = 0; i < MAX_STORED_ERRORS; i++) {
-        stored_errors[i].lexeme[0] = '\0';
-        stored_errors[i].line = 0;
-        stored_errors[i].column = 0;
-        stored_errors[i].error_type = ERROR_NONE;
-    }
+    diag_reset();
 }
 
 // Clear stored errors
 void clear_error_state(void) {
-    num_stored_errors = 0;
+    diag_reset();
+}
+
+// Number of lexical errors reported since the last reset
+int lexer_error_count(void) {
+    return (int)diag_total(DIAG_LEXER);
 }
 
 // Reset the lexer state
@@ -50,6 +43,21 @@ void reset_lexer(void) {
     reset_all_globals();
 }
 
+// Save or restore the state that carries from one token to the next
+void lexer_save(LexerState *state) {
+    state->line = current_line;
+    state->column = current_column;
+    state->last_token_type = last_token_type;
+    state->in_error_recovery = in_error_recovery;
+}
+
+void lexer_restore(const LexerState *state) {
+    current_line = state->line;
+    current_column = state->column;
+    last_token_type = state->last_token_type;
+    in_error_recovery = state->in_error_recovery;
+}
+
 // advance position and update column count 
 static void advance_position(int *pos) {
     (*pos)++; 
@@ -69,33 +77,12 @@ static void skip_until(const char *input, int *pos, const char *delimiters) {
     }
 }
 
-// Store an error for immediate reporting
-static void store_error(ErrorType error, int line, int column, const char *lexeme) {
-    // Don't store errors if we already have too many
-    if (num_stored_errors >= MAX_STORED_ERRORS) {
-        return;
-    }
-    
-    // Store the error
-    stored_errors[num_stored_errors].error_type = error;
-    stored_errors[num_stored_errors].line = line;
-    stored_errors[num_stored_errors].column = column;
-    strncpy(stored_errors[num_stored_errors].lexeme, lexeme, sizeof(stored_errors[0].lexeme) - 1);
-    stored_errors[num_stored_errors].lexeme[sizeof(stored_errors[0].lexeme) - 1] = '\0';
-    num_stored_errors++;
-    
-    // Report the error immediately
-    printf("Lexical Error at line %d, column %d: ", line, column);
-    switch(error) {
-        case ERROR_CONSECUTIVE_OPERATORS:
-            printf("Consecutive operators not allowed\n");
-            break;
-        case ERROR_INVALID_CHAR:
-            printf("Invalid token '%s'\n", lexeme);
-            break;
-        default:
-            printf("Unknown error\n");
-    }
+// Record an error at the token being scanned, which starts at
+// 'token_start' and is 'length' bytes long
+static void store_error(ErrorType error, Token *token, int length) {
+    token->offset = token_start;
+    token->length = length;
+    diag_report(DIAG_LEXER, error, token);
 }
 
 // Keywords table
@@ -152,241 +139,149 @@ static int is_keyword(const char* word) {
 }
 
 
+// Lexical error messages, indexed by ErrorType.
+// Messages ending in a quote are followed by the lexeme and a closing quote.
+static const char *const error_messages[] = {
+    [ERROR_INVALID_CHAR] = "Invalid character '",
+    [ERROR_INVALID_NUMBER] = "Invalid number format",
+    [ERROR_CONSECUTIVE_OPERATORS] = "Consecutive operators not allowed",
+    [ERROR_UNTERMINATED_STRING] = "Unterminated string literal",
+    [ERROR_UNTERMINATED_CHAR] = "Unterminated character literal",
+    [ERROR_INVALID_IDENTIFIER] = "Invalid identifier",
+    [ERROR_STRING_TOO_LONG] = "String literal too long",
+    [ERROR_INVALID_ESCAPE_SEQUENCE] = "Invalid escape sequence",
+    [ERROR_EMPTY_CHAR_LITERAL] = "Empty character literal",
+    [ERROR_MULTI_CHAR_LITERAL] = "Multi-character literal not allowed",
+    [ERROR_INVALID_FLOAT] = "Invalid float format",
+    [ERROR_RECOVERY_MODE] = "Skipping invalid input ",
+    [ERROR_UNEXPECTED_TOKEN] = "Unexpected token '",
+    [ERROR_NUMBER_OVERFLOW] = "Integer literal out of range '"
+};
+
+// Token type names printed in the token stream, indexed by TokenType.
+// Types without a name print as UNKNOWN.
+static const char *const token_type_names[] = {
+    [TOKEN_EOF] = "EOF",
+    [TOKEN_NUMBER] = "NUMBER",
+    [TOKEN_FLOAT] = "FLOATING POINT NUMBER",
+    [TOKEN_OPERATOR] = "OPERATOR",
+    [TOKEN_EQUALS_EQUALS] = "EQUALS_EQUALS",
+    [TOKEN_NOT_EQUALS] = "NOT_EQUALS",
+    [TOKEN_LOGICAL_AND] = "LOGICAL_AND",
+    [TOKEN_LOGICAL_OR] = "LOGICAL_OR",
+    [TOKEN_GREATER_EQUALS] = "GREATER_EQUALS",
+    [TOKEN_LESS_EQUALS] = "LESS_EQUALS",
+    [TOKEN_IDENTIFIER] = "IDENTIFIER",
+    [TOKEN_STRING] = "STRING",
+    [TOKEN_CHAR_LITERAL] = "CHARACTER",
+    [TOKEN_COMMENT] = "COMMENT",
+    [TOKEN_POINTER] = "POINTER",
+    [TOKEN_EQUALS] = "EQUALS",
+    [TOKEN_SEMICOLON] = "SEMICOLON",
+    [TOKEN_LPAREN] = "LPAREN",
+    [TOKEN_RPAREN] = "RPAREN",
+    [TOKEN_LBRACE] = "LBRACE",
+    [TOKEN_RBRACE] = "RBRACE",
+    [TOKEN_COMMA] = "COMMA",
+    [TOKEN_IF] = "IF",
+    [TOKEN_INT] = "INT",
+    [TOKEN_CHAR] = "CHAR",
+    [TOKEN_VOID] = "VOID",
+    [TOKEN_RETURN] = "RETURN",
+    [TOKEN_FOR] = "FOR",
+    [TOKEN_WHILE] = "WHILE",
+    [TOKEN_DO] = "DO",
+    [TOKEN_BREAK] = "BREAK",
+    [TOKEN_CONTINUE] = "CONTINUE",
+    [TOKEN_SWITCH] = "SWITCH",
+    [TOKEN_CASE] = "CASE",
+    [TOKEN_DEFAULT] = "DEFAULT",
+    [TOKEN_GOTO] = "GOTO",
+    [TOKEN_SIZEOF] = "SIZEOF",
+    [TOKEN_STATIC] = "STATIC",
+    [TOKEN_EXTERN] = "EXTERN",
+    [TOKEN_CONST] = "CONST",
+    [TOKEN_VOLATILE] = "VOLATILE",
+    [TOKEN_STRUCT] = "STRUCT",
+    [TOKEN_UNION] = "UNION",
+    [TOKEN_ENUM] = "ENUM",
+    [TOKEN_TYPEDEF] = "TYPEDEF",
+    [TOKEN_UNSIGNED] = "UNSIGNED",
+    [TOKEN_SHORT] = "SHORT",
+    [TOKEN_LONG] = "LONG",
+    [TOKEN_FLOAT_KEY] = "FLOAT",
+    [TOKEN_DOUBLE] = "DOUBLE",
+    [TOKEN_ELSE] = "ELSE",
+    [TOKEN_VOID_STAR] = "VOID*",
+    [TOKEN_INT_STAR] = "INT*",
+    [TOKEN_PRINT] = "PRINT",
+    [TOKEN_REPEAT] = "REPEAT",
+    [TOKEN_UNTIL] = "UNTIL",
+    [TOKEN_FACTORIAL] = "FACTORIAL"
+};
+
+// Get the printed name of a token type
+const char *token_type_name(TokenType type) {
+    if ((unsigned)type < sizeof(token_type_names) / sizeof(token_type_names[0]) &&
+        token_type_names[type]) {
+        return token_type_names[type];
+    }
+    return "UNKNOWN";
+}
+
+// Write the message for a lexical error
+static void write_error(Writer *out, ErrorType error, int line, const char* lexeme) {
+    const char *message = NULL;
+    if ((unsigned)error < sizeof(error_messages) / sizeof(error_messages[0])) {
+        message = error_messages[error];
+    }
+
+    wr_str(out, "Lexical Error at line ");
+    wr_int(out, line);
+    wr_str(out, ": ");
+    if (!message) {
+        wr_str(out, "Unknown error\n");
+        return;
+    }
+
+    size_t len = strlen(message);
+    wr_bytes(out, message, len);
+    if (message[len - 1] == '\'') {
+        wr_str(out, lexeme);
+        wr_char(out, '\'');
+    }
+    wr_char(out, '\n');
+}
+
 // Print error messages for lexical errors 
 void print_error(ErrorType error, int line, const char* lexeme) {
-    printf("Lexical Error at line %d: ", line);
-    switch(error) {
-        case ERROR_INVALID_CHAR:
-            printf("Invalid character '%s'\n", lexeme);
-            break;
-        case ERROR_INVALID_NUMBER:
-            printf("Invalid number format\n");
-            break;
-        case ERROR_CONSECUTIVE_OPERATORS:
-            printf("Consecutive operators not allowed\n");
-            break;
-        case ERROR_UNTERMINATED_STRING:
-            printf("Unterminated string literal\n");
-            break;
-        case ERROR_UNTERMINATED_CHAR:
-            printf("Unterminated character literal\n");
-            break;
-        case ERROR_INVALID_IDENTIFIER:
-            printf("Invalid identifier\n");
-            break;
-        case ERROR_STRING_TOO_LONG:
-            printf("String literal too long\n");
-            break;
-        case ERROR_INVALID_ESCAPE_SEQUENCE:
-            printf("Invalid escape sequence\n");
-            break;
-        case ERROR_EMPTY_CHAR_LITERAL:
-            printf("Empty character literal\n");
-            break;
-        case ERROR_MULTI_CHAR_LITERAL:
-            printf("Multi-character literal not allowed\n");
-            break;
-        case ERROR_INVALID_FLOAT:
-            printf("Invalid float format\n");
-            break;
-        case ERROR_RECOVERY_MODE: 
-            printf("Skipping invalid input \n");
-            break; 
-        case ERROR_UNEXPECTED_TOKEN:
-            printf("Unexpected token '%s'\n", lexeme);
-            break;
-        default:
-            printf("Unknown error\n");
-    }
+    write_error(output_writer(), error, line, lexeme);
 }
 
-void print_token(Token token) {
+// Write one token stream line to a writer
+void write_token(Writer *out, Token token) {
     if(token.type == TOKEN_SKIP){
         return; 
     }
 
     if (token.error != ERROR_NONE) {
-        print_error(token.error, token.line, token.lexeme);
+        write_error(out, token.error, token.line, token.lexeme);
         return;
     }
 
-    printf("Token: ");
-    switch(token.type) {
-        case TOKEN_NUMBER:    
-            printf("NUMBER"); 
-            break;
-        case TOKEN_FLOAT:
-            printf("FLOATING POINT NUMBER");
-            break;
-        case TOKEN_OPERATOR:
-            printf("OPERATOR");
-            break;
-        case TOKEN_EQUALS_EQUALS:
-            printf("EQUALS_EQUALS");
-            break;
-        case TOKEN_NOT_EQUALS:
-            printf("NOT_EQUALS");
-            break;
-        case TOKEN_LOGICAL_AND:
-            printf("LOGICAL_AND");
-            break;
-        case TOKEN_LOGICAL_OR:
-            printf("LOGICAL_OR");
-            break;
-        case TOKEN_GREATER_EQUALS:
-            printf("GREATER_EQUALS");
-            break;
-        case TOKEN_LESS_EQUALS:
-            printf("LESS_EQUALS");
-            break;
-        case TOKEN_IDENTIFIER:
-            printf("IDENTIFIER");
-            break;
-        case TOKEN_STRING:
-            printf("STRING");
-            break;
-        case TOKEN_CHAR_LITERAL:
-            printf("CHARACTER");
-            break;
-        case TOKEN_POINTER: 
-            printf("POINTER");
-            break;
-        case TOKEN_COMMENT:
-            printf("COMMENT");
-            break; 
-        case TOKEN_EQUALS:     
-            printf("EQUALS"); 
-            break;
-        case TOKEN_SEMICOLON:  
-            printf("SEMICOLON"); 
-            break;
-        case TOKEN_LPAREN:     
-            printf("LPAREN"); 
-            break;
-        case TOKEN_RPAREN:     
-            printf("RPAREN"); 
-            break;
-        case TOKEN_LBRACE:     
-            printf("LBRACE"); 
-            break;
-        case TOKEN_RBRACE:     
-            printf("RBRACE"); 
-            break;
-        case TOKEN_COMMA:
-            printf("COMMA");
-            break;
-        case TOKEN_IF:         
-            printf("IF"); 
-            break;
-        case TOKEN_INT:        
-            printf("INT"); 
-            break;
-        case TOKEN_CHAR:
-            printf("CHAR");
-            break; 
-        case TOKEN_VOID:
-            printf("VOID");
-            break; 
-        case TOKEN_RETURN: 
-            printf("RETURN");
-            break;
-        case TOKEN_FOR:
-            printf("FOR");
-            break; 
-        case TOKEN_WHILE:
-            printf("WHILE");
-            break; 
-        case TOKEN_DO:
-            printf("DO");
-            break; 
-        case TOKEN_BREAK:
-            printf("BREAK");
-            break; 
-        case TOKEN_CONTINUE:
-            printf("CONTINUE");
-            break; 
-        case TOKEN_SWITCH:
-            printf("SWITCH");
-            break; 
-        case TOKEN_CASE:
-            printf("CASE");
-            break; 
-        case TOKEN_DEFAULT:
-            printf("DEFAULT");
-            break; 
-        case TOKEN_GOTO:
-            printf("GOTO");
-            break; 
-        case TOKEN_SIZEOF:
-            printf("SIZEOF");
-            break; 
-        case TOKEN_STATIC:
-            printf("STATIC");
-            break; 
-        case TOKEN_EXTERN:
-            printf("EXTERN");
-            break; 
-        case TOKEN_CONST:
-            printf("CONST");
-            break; 
-        case TOKEN_VOLATILE:
-            printf("VOLATILE");
-            break; 
-        case TOKEN_STRUCT: 
-            printf("STRUCT");
-            break; 
-        case TOKEN_UNION:
-            printf("UNION");
-            break; 
-        case TOKEN_ENUM: 
-            printf("ENUM");
-            break; 
-        case TOKEN_TYPEDEF:
-            printf("TYPEDEF");
-            break; 
-        case TOKEN_UNSIGNED:
-            printf("UNSIGNED");
-            break; 
-        case TOKEN_SHORT:
-            printf("SHORT");
-            break; 
-        case TOKEN_LONG:
-            printf("LONG");
-            break; 
-        case TOKEN_FLOAT_KEY:
-            printf("FLOAT"); 
-            break; 
-        case TOKEN_DOUBLE: 
-            printf("DOUBLE");
-            break; 
-        case TOKEN_ELSE:
-            printf("ELSE");
-            break; 
-        case TOKEN_VOID_STAR:
-            printf("VOID*");
-            break; 
-        case TOKEN_INT_STAR:
-            printf("INT*");
-            break;
-        case TOKEN_PRINT:      
-            printf("PRINT"); 
-            break;
-        case TOKEN_REPEAT:
-            printf("REPEAT");
-            break;
-        case TOKEN_UNTIL:
-            printf("UNTIL");
-            break;
-        case TOKEN_FACTORIAL:
-            printf("FACTORIAL");
-            break;
-        case TOKEN_EOF:        
-            printf("EOF"); 
-            break;
-        default:              
-            printf("UNKNOWN");
-    }
-    printf(" | Lexeme: '%s' | Line: %d | Column: %d\n", token.lexeme, token.line, token.column);
+    wr_str(out, "Token: ");
+    wr_str(out, token_type_name(token.type));
+    wr_str(out, " | Lexeme: '");
+    wr_str(out, token.lexeme);
+    wr_str(out, "' | Line: ");
+    wr_int(out, token.line);
+    wr_str(out, " | Column: ");
+    wr_int(out, token.column);
+    wr_char(out, '\n');
+}
+
+void print_token(Token token) {
+    write_token(output_writer(), token);
 }
 
 /* Handle the escape sequences in strings and chars */
@@ -407,6 +302,7 @@ static char handle_escape_sequence(char c) {
 static Token handle_string(const char *input, int *pos) {
     Token token = {TOKEN_STRING, "", current_line, current_column, ERROR_NONE, RECOVERY_NONE};
     int i = 0;
+    uint32_t hash = INTERN_HASH_INIT;
     advance_position(pos); // Skip opening quote
     
     while (input[*pos] != '\0' && input[*pos] != '"' && input[*pos] != '\n') {
@@ -430,6 +326,7 @@ static Token handle_string(const char *input, int *pos) {
         } else {
             token.lexeme[i++] = input[*pos];
         }
+        hash = intern_hash_step(hash, (unsigned char)token.lexeme[i - 1]);
         advance_position(pos);
     }
     
@@ -441,6 +338,7 @@ static Token handle_string(const char *input, int *pos) {
     
     advance_position(pos); // Skip closing quote
     token.lexeme[i] = '\0';
+    token.sym = intern(token.lexeme, i, hash);
     return token;
 }
 
@@ -497,7 +395,8 @@ static Token handle_comment(const char *input, int *pos) {
     *pos += 2;
     current_column += 2;
     
-    while (input[*pos] != '\0' && input[*pos] != '\n') {
+    while (input[*pos] != '\0' && input[*pos] != '\n' &&
+           !(input[*pos] == '\r' && input[*pos + 1] == '\n')) {
         if (i < sizeof(token.lexeme) - 1) {
             token.lexeme[i++] = input[*pos];
         }
@@ -508,27 +407,106 @@ static Token handle_comment(const char *input, int *pos) {
     return token;
 }
 
+// Convert 8 ASCII digits to their value with three multiplies (SWAR)
+static uint64_t parse_eight_digits(const char *digits) {
+    uint64_t v;
+    memcpy(&v, digits, sizeof(v));
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return v;
+}
+
+// Decode a run of decimal digits, eight at a time where possible.
+// The caller guarantees the run fits in 19 digits, so this cannot wrap.
+static uint64_t parse_digits(const char *digits, int count) {
+    uint64_t value = 0;
+    while (count >= 8) {
+        value = value * 100000000ull + parse_eight_digits(digits);
+        digits += 8;
+        count -= 8;
+    }
+    while (count-- > 0) {
+        value = value * 10 + (uint64_t)(*digits++ - '0');
+    }
+    return value;
+}
+
+// Decode an integer literal, returning 0 if it does not fit in int64
+static int decode_int(const char *digits, int count, long long *value) {
+    while (count > 1 && *digits == '0') {
+        digits++;
+        count--;
+    }
+    if (count > 19) {
+        return 0;
+    }
+    uint64_t v = parse_digits(digits, count);
+    if (v > (uint64_t)INT64_MAX) {
+        return 0;
+    }
+    *value = (long long)v;
+    return 1;
+}
+
+// Decode "int.frac".  When the digits form a mantissa below 2^53 and the
+// scale is at most 10^22, both are exact doubles and one division is
+// correctly rounded (Clinger's fast path).  Everything else goes to strtod.
+static double decode_float(const char *text, int int_count, int frac_count) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *digits = text;
+    int lead = int_count;
+    while (lead > 0 && *digits == '0') {
+        digits++;
+        lead--;
+    }
+    if (lead + frac_count <= 19 && frac_count <= 22) {
+        uint64_t mantissa = parse_digits(digits, lead);
+        mantissa = mantissa * (uint64_t)powers_of_ten[frac_count] +
+                   parse_digits(text + int_count + 1, frac_count);
+        if (mantissa <= (1ull << 53)) {
+            return (double)mantissa / powers_of_ten[frac_count];
+        }
+    }
+
+    char buffer[512];
+    int length = int_count + 1 + frac_count;
+    if (length > (int)sizeof(buffer) - 1) {
+        length = sizeof(buffer) - 1;
+    }
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+    return strtod(buffer, NULL);
+}
+
 /* Handle numbers */
 static Token handle_number(const char *input, int *pos) {
     Token token = {TOKEN_NUMBER, "", current_line, current_column, ERROR_NONE, RECOVERY_NONE};
     int i = 0;
+    int start = *pos;
     int decimal_count = 0;
     
     // Get digits before decimal
     while (isdigit(input[*pos])) {
-        token.lexeme[i++] = input[*pos];
+        if (i < (int)sizeof(token.lexeme) - 1) token.lexeme[i++] = input[*pos];
         advance_position(pos);
     }
+    int int_count = *pos - start;
     
     // Check for decimal points
     if (input[*pos] == '.') {
-        token.lexeme[i++] = input[*pos];
+        if (i < (int)sizeof(token.lexeme) - 1) token.lexeme[i++] = input[*pos];
         advance_position(pos);
         
         if (!isdigit(input[*pos])) {
             token.error = ERROR_INVALID_NUMBER;
             token.recovery = RECOVERY_TO_DELIMITER;
-            skip_until(input, pos, ";,) \t\n");
+            skip_until(input, pos, ";,) \t\r\n");
             return token;
         }
         
@@ -539,11 +517,11 @@ static Token handle_number(const char *input, int *pos) {
                 if (decimal_count > 1) {
                     token.error = ERROR_INVALID_FLOAT;
                     token.recovery = RECOVERY_TO_DELIMITER;
-                    skip_until(input, pos, ";,) \t\n");
+                    skip_until(input, pos, ";,) \t\r\n");
                     return token;
                 }
             }
-            token.lexeme[i++] = input[*pos];
+            if (i < (int)sizeof(token.lexeme) - 1) token.lexeme[i++] = input[*pos];
             advance_position(pos);
         }
     }
@@ -551,17 +529,23 @@ static Token handle_number(const char *input, int *pos) {
     token.lexeme[i] = '\0';
     if (decimal_count == 1) {
         token.type = TOKEN_FLOAT;
+        token.float_value = decode_float(input + start, int_count, *pos - start - int_count - 1);
+    } else if (!decode_int(input + start, int_count, &token.int_value)) {
+        token.error = ERROR_NUMBER_OVERFLOW;
+        token.int_value = INT64_MAX;
+        store_error(ERROR_NUMBER_OVERFLOW, &token, *pos - start);
     }
     return token;
 }
 
-// Get next token from input 
-Token get_next_token(const char* input, int* pos) {
+// Scan the next token from input 
+static Token scan_token(const char* input, int* pos) {
     Token token = {TOKEN_ERROR, "", current_line, current_column, ERROR_NONE, RECOVERY_NONE};
     char c;
 
-    // Skip whitespace and track line numbers
-    while ((c = input[*pos]) != '\0' && (c == ' ' || c == '\n' || c == '\t')) {
+    // Skip whitespace and track line numbers; '\r' so CRLF sources lex
+    // the same as LF ones
+    while ((c = input[*pos]) != '\0' && (c == ' ' || c == '\n' || c == '\t' || c == '\r')) {
         if (c == '\n') {
             current_line++;
             current_column = 1; 
@@ -572,6 +556,7 @@ Token get_next_token(const char* input, int* pos) {
         }
         (*pos)++;
     }
+    token_start = *pos;
 
     if (input[*pos] == '\0') {
         token.type = TOKEN_EOF;
@@ -603,19 +588,24 @@ Token get_next_token(const char* input, int* pos) {
 
     // Handle character literals 
     if(c == '\''){
+        last_token_type = 'l';
         return handle_char(input, pos);
     }
 
-    // Handle numbers
+    // Handle numbers; a literal ends a run of operators, so '7 / 2' is
+    // not reported as consecutive operators
     if (isdigit(c)) {
+        last_token_type = 'l';
         return handle_number(input, pos);
     }
 
     // Handle identifiers and keywords
     if (isalpha(c) || c == '_') {
         int i = 0;
+        uint32_t hash = INTERN_HASH_INIT;
         do {
             token.lexeme[i++] = c;
+            hash = intern_hash_step(hash, (unsigned char)c);
             (*pos)++;
             c = input[*pos];
         } while ((isalnum(c) || c == '_') && i < sizeof(token.lexeme) - 1);
@@ -630,6 +620,7 @@ Token get_next_token(const char* input, int* pos) {
 
         } else {
             token.type = TOKEN_IDENTIFIER;
+            token.sym = intern(token.lexeme, i, hash);
             last_token_type = 'i';
         }
         return token;
@@ -637,6 +628,7 @@ Token get_next_token(const char* input, int* pos) {
 
     // Handles String Literals 
     if(c == '\"'){
+        last_token_type = 'l';
         return handle_string(input, pos);
     }
 
@@ -718,7 +710,7 @@ Token get_next_token(const char* input, int* pos) {
                 token.lexeme[1] = '\0';
                 token.recovery = RECOVERY_TO_DELIMITER;
                 
-                store_error(ERROR_CONSECUTIVE_OPERATORS, current_line, current_column, token.lexeme);
+                store_error(ERROR_CONSECUTIVE_OPERATORS, &token, 1);
                 
                 advance_position(pos);
                 in_error_recovery = 1;
@@ -773,18 +765,26 @@ Token get_next_token(const char* input, int* pos) {
     token.lexeme[1] = '\0';
     token.recovery = RECOVERY_TO_DELIMITER;
     
-    store_error(ERROR_INVALID_CHAR, current_line, current_column, token.lexeme);
+    store_error(ERROR_INVALID_CHAR, &token, 1);
     
     advance_position(pos);
     in_error_recovery = 1;
     return token;
 }
 
+// Get next token from input, recording its source span
+Token get_next_token(const char* input, int* pos) {
+    Token token = scan_token(input, pos);
+    token.offset = token_start;
+    token.length = *pos - token_start;
+    return token;
+}
+
 /* Process test files */
 void process_test_file(const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
-        printf("Error: Could not open file %s\n", filename);
+        wr_printf(output_writer(), "Error: Could not open file %s\n", filename);
         return;
     }
     
@@ -798,10 +798,10 @@ void process_test_file(const char *filename) {
     
     int position = 0;
     Token token;
-    printf("\n==============================\n");
-    printf("TESTING FILE: %s\n", filename);
-    printf("==============================\n");
-    printf("Input:\n%s\n\n", buffer);
+    wr_printf(output_writer(), "\n==============================\n");
+    wr_printf(output_writer(), "TESTING FILE: %s\n", filename);
+    wr_printf(output_writer(), "==============================\n");
+    wr_printf(output_writer(), "Input:\n%s\n\n", buffer);
     
     do {
         token = get_next_token(buffer, &position);
@@ -812,6 +812,6 @@ void process_test_file(const char *filename) {
         }
     } while (token.type != TOKEN_EOF);
     
-    printf("\nEnd of %s\n", filename);
-    printf("==============================\n");
+    wr_printf(output_writer(), "\nEnd of %s\n", filename);
+    wr_printf(output_writer(), "==============================\n");
 }
@@ -0,0 +1,1496 @@
+/* lsp.c */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../../include/lsp.h"
+#include "../../include/parser.h"
+#include "../../include/lexer.h"
+#include "../../include/diag.h"
+#include "../../include/intern.h"
+#include "../../include/serialize.h"
+#include "../../include/trace.h"
+
+// Longest a change waits for more changes before it is parsed anyway
+#define LSP_MAX_DELAY_MS 50
+
+// Names interned by parses are released once there are this many
+#define LSP_SYMBOL_LIMIT (1u << 20)
+
+// JSON messages are parsed into a flat array of nodes pointing into the
+// message text
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} JsonType;
+
+typedef struct {
+    JsonType type;
+    int start;                  // Span in the text; strings exclude their quotes
+    int end;
+    int key;                    // Object members: the key's node, else -1
+    int child;                  // First element or member, -1 if none
+    int next;                   // Next sibling, -1 if last
+} JsonNode;
+
+typedef struct {
+    const char *text;
+    int len;
+    JsonNode *nodes;
+    int count;
+    int capacity;
+} Json;
+
+#define JSON_MAX_DEPTH 64
+
+static int json_add(Json *json, JsonType type, int start) {
+    if (json->count == json->capacity) {
+        int capacity = json->capacity ? json->capacity * 2 : 256;
+        JsonNode *nodes = realloc(json->nodes, capacity * sizeof(JsonNode));
+        if (!nodes) {
+            fprintf(stderr, "Error: Memory allocation failed for JSON message\n");
+            exit(1);
+        }
+        json->nodes = nodes;
+        json->capacity = capacity;
+    }
+    JsonNode *node = &json->nodes[json->count];
+    node->type = type;
+    node->start = start;
+    node->end = start;
+    node->key = -1;
+    node->child = -1;
+    node->next = -1;
+    return json->count++;
+}
+
+static void json_skip_space(const Json *json, int *pos) {
+    while (*pos < json->len) {
+        char c = json->text[*pos];
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') break;
+        (*pos)++;
+    }
+}
+
+static int json_parse_string(Json *json, int *pos) {
+    int node = json_add(json, JSON_STRING, *pos + 1);
+    for ((*pos)++; *pos < json->len && json->text[*pos] != '"'; (*pos)++) {
+        if (json->text[*pos] == '\\') (*pos)++;
+    }
+    if (*pos >= json->len) {
+        return -1;
+    }
+    json->nodes[node].end = (*pos)++;
+    return node;
+}
+
+static int json_parse_value(Json *json, int *pos, int depth) {
+    json_skip_space(json, pos);
+    if (*pos >= json->len || depth > JSON_MAX_DEPTH) {
+        return -1;
+    }
+    char c = json->text[*pos];
+    if (c == '"') {
+        return json_parse_string(json, pos);
+    }
+    if (c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        int node = json_add(json, c == '{' ? JSON_OBJECT : JSON_ARRAY, *pos);
+        int last = -1;
+        (*pos)++;
+        json_skip_space(json, pos);
+        if (*pos < json->len && json->text[*pos] == close) {
+            json->nodes[node].end = ++(*pos);
+            return node;
+        }
+        for (;;) {
+            int key = -1;
+            if (close == '}') {
+                json_skip_space(json, pos);
+                if (*pos >= json->len || json->text[*pos] != '"') return -1;
+                key = json_parse_string(json, pos);
+                json_skip_space(json, pos);
+                if (key < 0 || *pos >= json->len || json->text[*pos] != ':') return -1;
+                (*pos)++;
+            }
+            int value = json_parse_value(json, pos, depth + 1);
+            if (value < 0) {
+                return -1;
+            }
+            json->nodes[value].key = key;
+            if (last < 0) {
+                json->nodes[node].child = value;
+            } else {
+                json->nodes[last].next = value;
+            }
+            last = value;
+            json_skip_space(json, pos);
+            if (*pos < json->len && json->text[*pos] == ',') {
+                (*pos)++;
+            } else if (*pos < json->len && json->text[*pos] == close) {
+                json->nodes[node].end = ++(*pos);
+                return node;
+            } else {
+                return -1;
+            }
+        }
+    }
+
+    // Numbers and literals: the run of characters they are spelled with
+    int start = *pos;
+    while (*pos < json->len) {
+        c = json->text[*pos];
+        if (!isalnum((unsigned char)c) && c != '+' && c != '-' && c != '.') break;
+        (*pos)++;
+    }
+    if (*pos == start) {
+        return -1;
+    }
+    c = json->text[start];
+    JsonType type = c == 'n' ? JSON_NULL : (c == 't' || c == 'f') ? JSON_BOOL : JSON_NUMBER;
+    int node = json_add(json, type, start);
+    json->nodes[node].end = *pos;
+    return node;
+}
+
+// Parse a whole message, returning its root node or -1 if it is not JSON
+static int json_parse(Json *json, const char *text, int len) {
+    json->text = text;
+    json->len = len;
+    json->count = 0;
+    int pos = 0;
+    int root = json_parse_value(json, &pos, 0);
+    json_skip_space(json, &pos);
+    return root >= 0 && pos == len ? root : -1;
+}
+
+// Whether a string node holds 'text' (without escapes)
+static int json_equals(const Json *json, int node, const char *text) {
+    size_t len = strlen(text);
+    return node >= 0 && json->nodes[node].type == JSON_STRING &&
+           (size_t)(json->nodes[node].end - json->nodes[node].start) == len &&
+           memcmp(json->text + json->nodes[node].start, text, len) == 0;
+}
+
+static int json_member(const Json *json, int object, const char *key) {
+    if (object < 0 || json->nodes[object].type != JSON_OBJECT) {
+        return -1;
+    }
+    for (int member = json->nodes[object].child; member >= 0; member = json->nodes[member].next) {
+        if (json_equals(json, json->nodes[member].key, key)) {
+            return member;
+        }
+    }
+    return -1;
+}
+
+// Messages are NUL-terminated, so a number ends before the buffer does
+static long json_int(const Json *json, int node, long fallback) {
+    if (node < 0 || json->nodes[node].type != JSON_NUMBER) {
+        return fallback;
+    }
+    return strtol(json->text + json->nodes[node].start, NULL, 10);
+}
+
+// Write a value as it was sent, e.g. to echo a request id
+static void json_write_raw(Writer *out, const Json *json, int node) {
+    const JsonNode *value = &json->nodes[node];
+    int quoted = value->type == JSON_STRING;
+    wr_bytes(out, json->text + value->start - quoted, (size_t)(value->end - value->start + 2 * quoted));
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Four hex digits, or -1
+static long hex4(const char *c, const char *end) {
+    if (end - c < 4) {
+        return -1;
+    }
+    long value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(c[i]);
+        if (digit < 0) return -1;
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+static void write_utf8(Writer *out, unsigned long code) {
+    if (code < 0x80) {
+        wr_char(out, (char)code);
+    } else if (code < 0x800) {
+        wr_char(out, (char)(0xC0 | code >> 6));
+        wr_char(out, (char)(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+        wr_char(out, (char)(0xE0 | code >> 12));
+        wr_char(out, (char)(0x80 | (code >> 6 & 0x3F)));
+        wr_char(out, (char)(0x80 | (code & 0x3F)));
+    } else {
+        wr_char(out, (char)(0xF0 | code >> 18));
+        wr_char(out, (char)(0x80 | (code >> 12 & 0x3F)));
+        wr_char(out, (char)(0x80 | (code >> 6 & 0x3F)));
+        wr_char(out, (char)(0x80 | (code & 0x3F)));
+    }
+}
+
+// Append the decoded contents of a string node
+static void json_string(Writer *out, const Json *json, int node) {
+    const char *c = json->text + json->nodes[node].start;
+    const char *end = json->text + json->nodes[node].end;
+    while (c < end) {
+        const char *escape = memchr(c, '\\', (size_t)(end - c));
+        if (!escape) {
+            wr_bytes(out, c, (size_t)(end - c));
+            break;
+        }
+        wr_bytes(out, c, (size_t)(escape - c));
+        c = escape + 1;
+        if (c >= end) break;
+        char e = *c++;
+        switch (e) {
+            case 'n': wr_char(out, '\n'); break;
+            case 'r': wr_char(out, '\r'); break;
+            case 't': wr_char(out, '\t'); break;
+            case 'b': wr_char(out, '\b'); break;
+            case 'f': wr_char(out, '\f'); break;
+            case 'u': {
+                long code = hex4(c, end);
+                if (code < 0) break;
+                c += 4;
+                // A surrogate pair is one code point
+                if (code >= 0xD800 && code < 0xDC00 && end - c >= 6 && c[0] == '\\' && c[1] == 'u') {
+                    long low = hex4(c + 2, end);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        c += 6;
+                    }
+                }
+                write_utf8(out, (unsigned long)code);
+                break;
+            }
+            default:
+                wr_char(out, e);
+        }
+    }
+}
+
+// Messages are read with their Content-Length header into a buffer that
+// keeps the bytes after them for the next one
+typedef struct {
+    int fd;
+    char *data;
+    size_t start;               // First unread byte
+    size_t len;
+    size_t cap;
+    int eof;
+} LspInput;
+
+// Read what is available, or block until something is.  Returns the
+// number of bytes read, 0 at the end of the input, or -1.
+static ssize_t input_fill(LspInput *input) {
+    if (input->start > 0 && input->start == input->len) {
+        input->start = input->len = 0;
+    }
+    if (input->len == input->cap) {
+        if (input->start > 0) {
+            memmove(input->data, input->data + input->start, input->len - input->start);
+            input->len -= input->start;
+            input->start = 0;
+        } else {
+            size_t cap = input->cap ? input->cap * 2 : 65536;
+            char *data = realloc(input->data, cap);
+            if (!data) {
+                fprintf(stderr, "Error: Memory allocation failed for LSP input\n");
+                exit(1);
+            }
+            input->data = data;
+            input->cap = cap;
+        }
+    }
+    ssize_t n;
+    do {
+        n = read(input->fd, input->data + input->len, input->cap - input->len);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        input->len += (size_t)n;
+    } else if (n == 0 || errno != EAGAIN) {
+        input->eof = 1;
+    }
+    return n;
+}
+
+// Take the next whole message into 'message', NUL-terminated.  Returns 1,
+// 0 if it has not all arrived, or -1 for a header without a length (the
+// header is dropped).
+static int input_next(LspInput *input, Writer *message) {
+    const char *begin = input->data + input->start;
+    size_t available = input->len - input->start;
+    const char *blank = available >= 4 ? memmem(begin, available, "\r\n\r\n", 4) : NULL;
+    if (!blank) {
+        return 0;
+    }
+    size_t header = (size_t)(blank - begin) + 4;
+    long length = -1;
+    for (const char *line = begin; line < blank;) {
+        const char *eol = memchr(line, '\n', (size_t)(blank + 2 - line));
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = strtol(line + 15, NULL, 10);
+        }
+        if (!eol) break;
+        line = eol + 1;
+    }
+    if (length < 0) {
+        input->start += header;
+        return -1;
+    }
+    if (available - header < (size_t)length) {
+        return 0;
+    }
+    writer_reset(message);
+    wr_bytes(message, begin + header, (size_t)length);
+    wr_char(message, '\0');
+    message->len--;
+    input->start += header + (size_t)length;
+    return message->failed ? -1 : 1;
+}
+
+static void send_message(Writer *out, const Writer *body) {
+    wr_printf(out, "Content-Length: %zu\r\n\r\n", body->len);
+    wr_bytes(out, body->data, body->len);
+    writer_flush(out);
+}
+
+// A diagnostic of a top-level item.  Offsets are relative to the item's
+// first token, so moving the item only changes its checkpoint.
+typedef struct {
+    int offset;
+    int length;
+    uint8_t source;             // DiagSource
+    uint8_t code;
+    uint8_t severity;
+    char *message;
+} LspDiagnostic;
+
+typedef struct {
+    LspDiagnostic *list;
+    int count;
+    int capacity;
+} LspDiagnostics;
+
+// A top-level item: the parser state it starts from and what parsing it
+// reported
+typedef struct {
+    ParseCheckpoint start;
+    LspDiagnostics diagnostics;
+} LspItem;
+
+typedef struct {
+    char *uri;
+    long version;
+    char *text;                 // NUL-terminated
+    size_t len;
+    size_t cap;
+    int *lines;                 // Offset of each line, built when needed
+    int line_count;
+    int line_capacity;
+    int lines_valid;
+
+    LspDiagnostics head;        // Reported reading the first token
+    LspItem *items;
+    int item_count;
+    int item_capacity;
+    size_t parsed_len;          // Length of the text the items describe
+
+    // Bytes before 'dirty_start' and the last 'clean_suffix' bytes are as
+    // they were when the items were parsed
+    int dirty;
+    size_t dirty_start;
+    size_t clean_suffix;
+    uint64_t dirty_since;
+    uint64_t changed_at;
+} LspDocument;
+
+typedef struct {
+    const LspOptions *options;
+    Writer out;
+    Writer body;
+    Writer text;                // Scratch for decoded strings
+    Writer message;             // Scratch for diagnostic messages
+    Json json;
+    LspDocument **documents;
+    int document_count;
+    int document_capacity;
+    int shutdown;
+    FILE *record;
+    uint64_t started;
+    SymbolId symbols_kept;      // Interned before serving
+
+    long changes;
+    long parses;
+    long items_parsed;
+    long items_reused;
+    uint64_t parse_ns;
+    long checked;
+    long mismatches;
+} LspServer;
+
+// Length of the well-formed UTF-8 sequence at 's', or 0
+static size_t utf8_length(const unsigned char *s, size_t available) {
+    if (s[0] < 0x80) {
+        return 1;
+    }
+    size_t length = s[0] >= 0xF0 && s[0] <= 0xF4 ? 4 : s[0] >= 0xE0 ? 3 : s[0] >= 0xC2 && s[0] < 0xE0 ? 2 : 0;
+    if (length == 0 || length > available) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+    }
+    // Overlong forms, surrogates and code points past U+10FFFF
+    if ((s[0] == 0xE0 && s[1] < 0xA0) || (s[0] == 0xED && s[1] >= 0xA0) ||
+        (s[0] == 0xF0 && s[1] < 0x90) || (s[0] == 0xF4 && s[1] >= 0x90)) {
+        return 0;
+    }
+    return length;
+}
+
+static void diagnostics_clear(LspDiagnostics *diagnostics) {
+    for (int i = 0; i < diagnostics->count; i++) {
+        free(diagnostics->list[i].message);
+    }
+    free(diagnostics->list);
+    memset(diagnostics, 0, sizeof(*diagnostics));
+}
+
+static void diagnostics_add(LspDiagnostics *diagnostics, const Diagnostic *record, int base_offset,
+                            const char *message, size_t length) {
+    if (diagnostics->count == diagnostics->capacity) {
+        int capacity = diagnostics->capacity ? diagnostics->capacity * 2 : 4;
+        LspDiagnostic *list = realloc(diagnostics->list, capacity * sizeof(LspDiagnostic));
+        if (!list) {
+            fprintf(stderr, "Error: Memory allocation failed for diagnostics\n");
+            exit(1);
+        }
+        diagnostics->list = list;
+        diagnostics->capacity = capacity;
+    }
+    LspDiagnostic *diagnostic = &diagnostics->list[diagnostics->count++];
+    diagnostic->offset = (int)record->offset - base_offset;
+    diagnostic->length = (int)record->length;
+    diagnostic->source = record->source;
+    diagnostic->code = record->code;
+    diagnostic->severity = record->severity;
+
+    // JSON text is UTF-8, so a byte of a broken sequence (an invalid token
+    // can be one) becomes U+FFFD
+    char *copy = malloc(length * 3 + 1);
+    if (!copy) {
+        fprintf(stderr, "Error: Memory allocation failed for diagnostics\n");
+        exit(1);
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < length;) {
+        size_t valid = utf8_length((const unsigned char *)message + i, length - i);
+        if (valid) {
+            memcpy(copy + used, message + i, valid);
+            used += valid;
+            i += valid;
+        } else {
+            memcpy(copy + used, "\xEF\xBF\xBD", 3);
+            used += 3;
+            i++;
+        }
+    }
+    copy[used] = '\0';
+    diagnostic->message = copy;
+}
+
+// Copy the records reported since 'from', with offsets relative to
+// 'base_offset'
+static void take_diagnostics(Writer *message, int from, int base_offset, LspDiagnostics *diagnostics) {
+    for (int i = from; i < diag_count(); i++) {
+        const Diagnostic *record = diag_get(i);
+        writer_reset(message);
+        diag_message(message, record);
+        diagnostics_add(diagnostics, record, base_offset, message->data ? message->data : "", message->len);
+    }
+}
+
+static int same_token(const Token *a, const Token *b, int lines, int bytes) {
+    return a->type == b->type && a->line + lines == b->line && a->column == b->column &&
+           a->error == b->error && a->recovery == b->recovery && a->offset + bytes == b->offset &&
+           a->length == b->length && a->int_value == b->int_value && a->float_value == b->float_value &&
+           a->sym == b->sym && strcmp(a->lexeme, b->lexeme) == 0;
+}
+
+// Whether parsing on from 'old' in the old text does what parsing on from
+// 'now' does in the new one, 'bytes' further on and 'lines' further down
+static int same_state(const ParseCheckpoint *old, const ParseCheckpoint *now, int lines, int bytes) {
+    return old->position + bytes == now->position && same_token(&old->token, &now->token, lines, bytes) &&
+           old->lexer.line + lines == now->lexer.line && old->lexer.column == now->lexer.column &&
+           old->lexer.last_token_type == now->lexer.last_token_type &&
+           old->lexer.in_error_recovery == now->lexer.in_error_recovery &&
+           old->token_reported == now->token_reported;
+}
+
+static void shift_checkpoint(ParseCheckpoint *checkpoint, int lines, int bytes, int min_extent) {
+    checkpoint->token.line += lines;
+    checkpoint->token.offset += bytes;
+    checkpoint->position += bytes;
+    checkpoint->read_extent += bytes;
+    if (checkpoint->read_extent < min_extent) {
+        checkpoint->read_extent = min_extent;
+    }
+    checkpoint->lexer.line += lines;
+}
+
+static void add_item(LspItem **items, int *count, int *capacity, const ParseCheckpoint *start) {
+    if (*count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 64;
+        LspItem *list = realloc(*items, grown * sizeof(LspItem));
+        if (!list) {
+            fprintf(stderr, "Error: Memory allocation failed for document items\n");
+            exit(1);
+        }
+        *items = list;
+        *capacity = grown;
+    }
+    LspItem *item = &(*items)[(*count)++];
+    item->start = *start;
+    memset(&item->diagnostics, 0, sizeof(item->diagnostics));
+}
+
+// Parse the document again.  Items whose parse read only text before the
+// first change are kept; parsing resumes at the first one that did not,
+// and continues until it reaches the start of an old item in the text
+// after the last change with the same parser state, from where the old
+// items are kept too, moved by the change in length and lines.
+static void reparse(LspServer *server, LspDocument *doc, int incremental) {
+    uint64_t started = trace_clock();
+    int first = -1;
+    if (incremental) {
+        // Checkpoints read further and further, so the last one before the
+        // change is found by bisection
+        int low = 0;
+        int high = doc->item_count;
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if ((size_t)doc->items[mid].start.read_extent < doc->dirty_start) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        first = low - 1;
+    }
+    int old_end = (int)(doc->parsed_len - doc->clean_suffix);
+    int bytes = (int)doc->len - (int)doc->parsed_len;
+
+    LspItem *items = NULL;
+    int count = 0;
+    int capacity = 0;
+    ParseCheckpoint checkpoint;
+    if (first < 0) {
+        diagnostics_clear(&doc->head);
+        reset_lexer();
+        parser_init(doc->text);
+        take_diagnostics(&server->message, 0, 0, &doc->head);
+        first = 0;
+        parser_checkpoint(&checkpoint);
+    } else {
+        checkpoint = doc->items[first].start;
+        parser_resume(doc->text, &checkpoint);
+    }
+
+    // Old items from 'first' on are replaced up to 'rejoin'
+    int rejoin = doc->item_count;
+    int lines = 0;
+    for (;;) {
+        if (count > 0 && checkpoint.position - bytes >= old_end) {
+            int low = first;
+            int high = doc->item_count;
+            int target = checkpoint.position - bytes;
+            while (low < high) {
+                int mid = (low + high) / 2;
+                if (doc->items[mid].start.position < target) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            if (low < doc->item_count && doc->items[low].start.position == target) {
+                lines = checkpoint.token.line - doc->items[low].start.token.line;
+                if (same_state(&doc->items[low].start, &checkpoint, lines, bytes)) {
+                    rejoin = low;
+                    break;
+                }
+            }
+        }
+        if (checkpoint.token.type == TOKEN_EOF) {
+            break;
+        }
+        add_item(&items, &count, &capacity, &checkpoint);
+        int mark = diag_count();
+        recycle_ast(parse_next_item());
+        take_diagnostics(&server->message, mark, checkpoint.token.offset, &items[count - 1].diagnostics);
+        parser_checkpoint(&checkpoint);
+    }
+
+    // Splice: kept prefix, new items, then the old items after 'rejoin'
+    int kept = doc->item_count - rejoin;
+    int total = first + count + kept;
+    LspItem *merged = malloc((total > 0 ? total : 1) * sizeof(LspItem));
+    if (!merged) {
+        fprintf(stderr, "Error: Memory allocation failed for document items\n");
+        exit(1);
+    }
+    if (first > 0) {
+        memcpy(merged, doc->items, first * sizeof(LspItem));
+    }
+    if (count > 0) {
+        memcpy(merged + first, items, count * sizeof(LspItem));
+    }
+    if (kept > 0) {
+        memcpy(merged + first + count, doc->items + rejoin, kept * sizeof(LspItem));
+    }
+    for (int i = first + count; i < total; i++) {
+        shift_checkpoint(&merged[i].start, lines, bytes, checkpoint.read_extent);
+    }
+    for (int i = first; i < rejoin; i++) {
+        diagnostics_clear(&doc->items[i].diagnostics);
+    }
+    free(doc->items);
+    free(items);
+    doc->items = merged;
+    doc->item_count = total;
+    doc->item_capacity = total;
+    doc->parsed_len = doc->len;
+    doc->dirty = 0;
+    doc->dirty_start = doc->len;
+    doc->clean_suffix = doc->len;
+
+    server->parses++;
+    server->items_parsed += count;
+    server->items_reused += first + kept;
+    server->parse_ns += trace_clock() - started;
+}
+
+static void free_items(LspDocument *doc) {
+    diagnostics_clear(&doc->head);
+    for (int i = 0; i < doc->item_count; i++) {
+        diagnostics_clear(&doc->items[i].diagnostics);
+    }
+    free(doc->items);
+    doc->items = NULL;
+    doc->item_count = doc->item_capacity = 0;
+}
+
+// Compare the diagnostics of two parses of the same text
+static int same_diagnostics(const LspDocument *a, const LspDocument *b) {
+    const LspDocument *docs[2] = {a, b};
+    int index[2] = {-1, -1};
+    int next[2] = {0, 0};
+    for (;;) {
+        const LspDiagnostic *diagnostic[2] = {NULL, NULL};
+        int base[2] = {0, 0};
+        for (int side = 0; side < 2; side++) {
+            const LspDocument *doc = docs[side];
+            for (;;) {
+                const LspDiagnostics *list = index[side] < 0 ? &doc->head : &doc->items[index[side]].diagnostics;
+                if (next[side] < list->count) {
+                    diagnostic[side] = &list->list[next[side]++];
+                    base[side] = index[side] < 0 ? 0 : doc->items[index[side]].start.token.offset;
+                    break;
+                }
+                if (++index[side] >= doc->item_count) break;
+                next[side] = 0;
+            }
+        }
+        if (!diagnostic[0] || !diagnostic[1]) {
+            return !diagnostic[0] && !diagnostic[1] && a->item_count == b->item_count;
+        }
+        if (diagnostic[0]->offset + base[0] != diagnostic[1]->offset + base[1] ||
+            diagnostic[0]->length != diagnostic[1]->length || diagnostic[0]->source != diagnostic[1]->source ||
+            diagnostic[0]->code != diagnostic[1]->code || strcmp(diagnostic[0]->message, diagnostic[1]->message) != 0) {
+            return 0;
+        }
+    }
+}
+
+// --lsp-check: parse the text from scratch and compare
+static void check_parse(LspServer *server, LspDocument *doc) {
+    LspDocument full;
+    memset(&full, 0, sizeof(full));
+    full.text = doc->text;
+    full.len = doc->len;
+    long parses = server->parses;
+    long parsed = server->items_parsed;
+    long reused = server->items_reused;
+    uint64_t parse_ns = server->parse_ns;
+    reparse(server, &full, 0);
+    server->parses = parses;
+    server->items_parsed = parsed;
+    server->items_reused = reused;
+    server->parse_ns = parse_ns;
+
+    server->checked++;
+    int same = same_diagnostics(doc, &full);
+    for (int i = 0; same && i < doc->item_count; i++) {
+        const ParseCheckpoint *a = &doc->items[i].start;
+        const ParseCheckpoint *b = &full.items[i].start;
+        same = a->position == b->position && a->token.line == b->token.line &&
+               a->lexer.line == b->lexer.line && a->lexer.column == b->lexer.column;
+    }
+    if (!same) {
+        server->mismatches++;
+        fprintf(stderr, "LSP check: %s version %ld differs from a full parse\n", doc->uri, doc->version);
+    }
+    free_items(&full);
+}
+
+// Offsets of the line starts, for converting positions
+static void index_lines(LspDocument *doc) {
+    if (doc->lines_valid) {
+        return;
+    }
+    doc->line_count = 0;
+    const char *line = doc->text;
+    const char *end = doc->text + doc->len;
+    for (;;) {
+        if (doc->line_count == doc->line_capacity) {
+            int capacity = doc->line_capacity ? doc->line_capacity * 2 : 256;
+            int *lines = realloc(doc->lines, capacity * sizeof(int));
+            if (!lines) {
+                fprintf(stderr, "Error: Memory allocation failed for line index\n");
+                exit(1);
+            }
+            doc->lines = lines;
+            doc->line_capacity = capacity;
+        }
+        doc->lines[doc->line_count++] = (int)(line - doc->text);
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        if (!newline) break;
+        line = newline + 1;
+    }
+    doc->lines_valid = 1;
+}
+
+static size_t line_end(const LspDocument *doc, int line) {
+    return line + 1 < doc->line_count ? (size_t)doc->lines[line + 1] - 1 : doc->len;
+}
+
+// LSP positions count UTF-16 code units: one per UTF-8 sequence, two for
+// the four-byte ones.  A character past the end of the line means its end.
+static size_t position_offset(LspDocument *doc, long line, long character) {
+    index_lines(doc);
+    if (line < 0) {
+        return 0;
+    }
+    if (line >= doc->line_count) {
+        return doc->len;
+    }
+    size_t offset = (size_t)doc->lines[line];
+    size_t end = line_end(doc, (int)line);
+    while (character > 0 && offset < end) {
+        unsigned char c = (unsigned char)doc->text[offset];
+        int length = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        character -= length == 4 ? 2 : 1;
+        offset += (size_t)length;
+    }
+    return offset < end ? offset : end;
+}
+
+// The LSP position of a byte offset
+static void offset_position(LspDocument *doc, size_t offset, int *line, long *character) {
+    index_lines(doc);
+    if (offset > doc->len) {
+        offset = doc->len;
+    }
+    int low = 0;
+    int high = doc->line_count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if ((size_t)doc->lines[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    *line = low;
+    *character = 0;
+    for (size_t at = (size_t)doc->lines[low]; at < offset; at++) {
+        unsigned char c = (unsigned char)doc->text[at];
+        if ((c & 0xC0) != 0x80) {
+            *character += c >= 0xF0 ? 2 : 1;
+        }
+    }
+}
+
+// The range of the token reported at, cut at the end of its line
+static void write_diagnostic(Writer *body, LspDocument *doc, const LspDiagnostic *diagnostic, int base) {
+    Diagnostic record = {0};
+    record.source = diagnostic->source;
+    record.code = diagnostic->code;
+    size_t start = (size_t)(diagnostic->offset + base);
+    int line;
+    long character;
+    offset_position(doc, start, &line, &character);
+    size_t end = start + (size_t)(diagnostic->length > 0 ? diagnostic->length : 1);
+    if (end > line_end(doc, line)) {
+        end = line_end(doc, line) > start ? line_end(doc, line) : start + 1;
+    }
+    int end_line;
+    long end_character;
+    offset_position(doc, end, &end_line, &end_character);
+    if (end_line != line || end_character <= character) {
+        end_character = character + 1;
+    }
+    wr_printf(body, "{\"range\":{\"start\":{\"line\":%d,\"character\":%ld},\"end\":{\"line\":%d,\"character\":%ld}},"
+                    "\"severity\":%d,\"source\":\"%s\",\"code\":\"%s\",\"message\":",
+              line, character, line, end_character, diagnostic->severity,
+              diagnostic->source == DIAG_LEXER ? "lexer" : "parser", diag_code_name(&record));
+    serialize_string(body, diagnostic->message, SERIALIZE_JSON);
+    wr_char(body, '}');
+}
+
+static void publish(LspServer *server, LspDocument *doc, int empty) {
+    Writer *body = &server->body;
+    writer_reset(body);
+    wr_str(body, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    serialize_string(body, doc->uri, SERIALIZE_JSON);
+    wr_printf(body, ",\"version\":%ld,\"diagnostics\":[", doc->version);
+    int written = 0;
+    for (int i = -1; i < doc->item_count && !empty; i++) {
+        const LspDiagnostics *list = i < 0 ? &doc->head : &doc->items[i].diagnostics;
+        int base = i < 0 ? 0 : doc->items[i].start.token.offset;
+        for (int d = 0; d < list->count; d++) {
+            if (written++ > 0) wr_char(body, ',');
+            write_diagnostic(body, doc, &list->list[d], base);
+        }
+    }
+    wr_str(body, "]}}");
+    send_message(&server->out, body);
+}
+
+static LspDocument *find_document(LspServer *server, const Json *json, int uri, int *index) {
+    Writer *text = &server->text;
+    writer_reset(text);
+    json_string(text, json, uri);
+    wr_char(text, '\0');
+    for (int i = 0; i < server->document_count; i++) {
+        if (strcmp(server->documents[i]->uri, text->data) == 0) {
+            if (index) *index = i;
+            return server->documents[i];
+        }
+    }
+    return NULL;
+}
+
+static void set_text(LspDocument *doc, const char *text, size_t len) {
+    if (len + 1 > doc->cap) {
+        size_t cap = doc->cap ? doc->cap : 4096;
+        while (cap < len + 1) cap *= 2;
+        char *data = realloc(doc->text, cap);
+        if (!data) {
+            fprintf(stderr, "Error: Memory allocation failed for document text\n");
+            exit(1);
+        }
+        doc->text = data;
+        doc->cap = cap;
+    }
+    memmove(doc->text, text, len);
+    doc->text[len] = '\0';
+    doc->len = len;
+}
+
+// Replace bytes [start, end) of the text, tracking what is left as parsed
+static void edit_text(LspDocument *doc, size_t start, size_t end, const char *text, size_t len) {
+    size_t new_len = doc->len - (end - start) + len;
+    if (new_len + 1 > doc->cap) {
+        size_t cap = doc->cap ? doc->cap : 4096;
+        while (cap < new_len + 1) cap *= 2;
+        char *data = realloc(doc->text, cap);
+        if (!data) {
+            fprintf(stderr, "Error: Memory allocation failed for document text\n");
+            exit(1);
+        }
+        doc->text = data;
+        doc->cap = cap;
+    }
+    memmove(doc->text + start + len, doc->text + end, doc->len - end + 1);
+    memcpy(doc->text + start, text, len);
+    if (start < doc->dirty_start) {
+        doc->dirty_start = start;
+    }
+    if (doc->len - end < doc->clean_suffix) {
+        doc->clean_suffix = doc->len - end;
+    }
+    doc->len = new_len;
+    doc->lines_valid = 0;
+}
+
+static void mark_dirty(LspDocument *doc) {
+    uint64_t now = trace_clock();
+    if (!doc->dirty) {
+        doc->dirty = 1;
+        doc->dirty_since = now;
+    }
+    doc->changed_at = now;
+}
+
+static void did_open(LspServer *server, const Json *json, int params) {
+    int document = json_member(json, params, "textDocument");
+    int uri = json_member(json, document, "uri");
+    int text = json_member(json, document, "text");
+    if (uri < 0 || text < 0) {
+        return;
+    }
+    int index = -1;
+    LspDocument *doc = find_document(server, json, uri, &index);
+    if (!doc) {
+        doc = calloc(1, sizeof(LspDocument));
+        if (!doc || !(doc->uri = strdup(server->text.data))) {
+            fprintf(stderr, "Error: Memory allocation failed for document\n");
+            exit(1);
+        }
+        if (server->document_count == server->document_capacity) {
+            int capacity = server->document_capacity ? server->document_capacity * 2 : 8;
+            LspDocument **documents = realloc(server->documents, capacity * sizeof(LspDocument *));
+            if (!documents) {
+                fprintf(stderr, "Error: Memory allocation failed for document\n");
+                exit(1);
+            }
+            server->documents = documents;
+            server->document_capacity = capacity;
+        }
+        server->documents[server->document_count++] = doc;
+    }
+    doc->version = json_int(json, json_member(json, document, "version"), 0);
+    writer_reset(&server->text);
+    json_string(&server->text, json, text);
+    set_text(doc, server->text.data, server->text.len);
+    free_items(doc);
+    doc->parsed_len = 0;
+    doc->dirty_start = 0;
+    doc->clean_suffix = 0;
+    doc->lines_valid = 0;
+    mark_dirty(doc);
+}
+
+static void did_change(LspServer *server, const Json *json, int params) {
+    int document = json_member(json, params, "textDocument");
+    int uri = json_member(json, document, "uri");
+    LspDocument *doc = uri >= 0 ? find_document(server, json, uri, NULL) : NULL;
+    int changes = json_member(json, params, "contentChanges");
+    if (!doc || changes < 0 || json->nodes[changes].type != JSON_ARRAY) {
+        return;
+    }
+    doc->version = json_int(json, json_member(json, document, "version"), doc->version + 1);
+    for (int change = json->nodes[changes].child; change >= 0; change = json->nodes[change].next) {
+        int text = json_member(json, change, "text");
+        if (text < 0) continue;
+        writer_reset(&server->text);
+        json_string(&server->text, json, text);
+        int range = json_member(json, change, "range");
+        size_t start = 0;
+        size_t end = doc->len;
+        if (range >= 0) {
+            int from = json_member(json, range, "start");
+            int to = json_member(json, range, "end");
+            start = position_offset(doc, json_int(json, json_member(json, from, "line"), 0),
+                                    json_int(json, json_member(json, from, "character"), 0));
+            end = position_offset(doc, json_int(json, json_member(json, to, "line"), 0),
+                                  json_int(json, json_member(json, to, "character"), 0));
+            if (end < start) end = start;
+        }
+        edit_text(doc, start, end, server->text.data, server->text.len);
+        server->changes++;
+    }
+    mark_dirty(doc);
+}
+
+static void did_close(LspServer *server, const Json *json, int params) {
+    int uri = json_member(json, json_member(json, params, "textDocument"), "uri");
+    int index = -1;
+    LspDocument *doc = uri >= 0 ? find_document(server, json, uri, &index) : NULL;
+    if (!doc) {
+        return;
+    }
+    publish(server, doc, 1);
+    free_items(doc);
+    free(doc->uri);
+    free(doc->text);
+    free(doc->lines);
+    free(doc);
+    server->documents[index] = server->documents[--server->document_count];
+}
+
+static void respond(LspServer *server, const Json *json, int id, const char *result) {
+    if (id < 0) {
+        return;
+    }
+    Writer *body = &server->body;
+    writer_reset(body);
+    wr_str(body, "{\"jsonrpc\":\"2.0\",\"id\":");
+    json_write_raw(body, json, id);
+    wr_str(body, result);
+    wr_char(body, '}');
+    send_message(&server->out, body);
+}
+
+// Returns 1 when the exit notification arrives
+static int handle_message(LspServer *server, const char *text, int len) {
+    Json *json = &server->json;
+    int root = json_parse(json, text, len);
+    if (root < 0) {
+        Writer *body = &server->body;
+        writer_reset(body);
+        wr_str(body, "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":-32700,\"message\":\"Parse error\"}}");
+        send_message(&server->out, body);
+        return 0;
+    }
+    int method = json_member(json, root, "method");
+    int id = json_member(json, root, "id");
+    int params = json_member(json, root, "params");
+    if (method < 0) {
+        return 0;               // A response to a request of ours
+    }
+    if (json_equals(json, method, "initialize")) {
+        respond(server, json, id, ",\"result\":{\"capabilities\":{\"textDocumentSync\":"
+                                  "{\"openClose\":true,\"change\":2}},\"serverInfo\":{\"name\":\"parser\"}}");
+    } else if (json_equals(json, method, "shutdown")) {
+        server->shutdown = 1;
+        respond(server, json, id, ",\"result\":null");
+    } else if (json_equals(json, method, "exit")) {
+        return 1;
+    } else if (json_equals(json, method, "textDocument/didOpen")) {
+        did_open(server, json, params);
+    } else if (json_equals(json, method, "textDocument/didChange")) {
+        did_change(server, json, params);
+    } else if (json_equals(json, method, "textDocument/didClose")) {
+        did_close(server, json, params);
+    } else if (id >= 0) {
+        respond(server, json, id, ",\"error\":{\"code\":-32601,\"message\":\"Method not found\"}");
+    }
+    return 0;
+}
+
+static uint64_t ms_ns(long ms) {
+    return (uint64_t)ms * 1000000u;
+}
+
+// When a document is to be parsed: once changes stop for the debounce
+// time, but no later than LSP_MAX_DELAY_MS after that
+static uint64_t parse_due(const LspServer *server, const LspDocument *doc) {
+    uint64_t quiet = doc->changed_at + ms_ns(server->options->debounce_ms);
+    uint64_t latest = doc->dirty_since + ms_ns(server->options->debounce_ms + LSP_MAX_DELAY_MS);
+    return quiet < latest ? quiet : latest;
+}
+
+// Whether a document has waited LSP_MAX_DELAY_MS past its debounce time
+static int parse_overdue(const LspServer *server, uint64_t now) {
+    for (int i = 0; i < server->document_count; i++) {
+        const LspDocument *doc = server->documents[i];
+        if (doc->dirty && now >= doc->dirty_since + ms_ns(server->options->debounce_ms + LSP_MAX_DELAY_MS)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Release the names parses have interned once there are too many.  Only
+// the tokens the items start at outlive a parse, and they are interned
+// again.
+static void release_symbols(LspServer *server) {
+    if (intern_mark() - server->symbols_kept < LSP_SYMBOL_LIMIT) {
+        return;
+    }
+    intern_release(server->symbols_kept);
+    for (int i = 0; i < server->document_count; i++) {
+        LspDocument *doc = server->documents[i];
+        for (int j = 0; j < doc->item_count; j++) {
+            Token *token = &doc->items[j].start.token;
+            if (token->sym >= server->symbols_kept) {
+                token->sym = intern_cstr(token->lexeme);
+            }
+        }
+    }
+}
+
+// Parse and publish the documents that are due, returning the time the
+// next one is due, or 0
+static uint64_t parse_documents(LspServer *server, uint64_t now, int all) {
+    uint64_t next = 0;
+    for (int i = 0; i < server->document_count; i++) {
+        LspDocument *doc = server->documents[i];
+        if (!doc->dirty) {
+            continue;
+        }
+        uint64_t due = parse_due(server, doc);
+        if (!all && due > now) {
+            if (!next || due < next) next = due;
+            continue;
+        }
+        reparse(server, doc, doc->parsed_len > 0 || doc->item_count > 0);
+        if (server->options->check) {
+            check_parse(server, doc);
+        }
+        publish(server, doc, 0);
+    }
+    release_symbols(server);
+    return next;
+}
+
+// Save a message for lsp_replay: the time, then the message on one line
+static void record_message(LspServer *server, const char *text, size_t len) {
+    fprintf(server->record, "%.3f ", (trace_clock() - server->started) / 1e6);
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        fputc(c == '\n' || c == '\r' ? ' ' : c, server->record);
+    }
+    fputc('\n', server->record);
+    fflush(server->record);
+}
+
+int lsp_serve(int in_fd, int out_fd, const LspOptions *options) {
+    LspServer server;
+    memset(&server, 0, sizeof(server));
+    server.options = options;
+    server.started = trace_clock();
+    server.symbols_kept = intern_mark();
+    writer_init_fd(&server.out, out_fd);
+    writer_init_memory(&server.body);
+    writer_init_memory(&server.text);
+    writer_init_memory(&server.message);
+    if (options->record_path && !(server.record = fopen(options->record_path, "w"))) {
+        fprintf(stderr, "Error: Could not open file %s\n", options->record_path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // An editor shows every error in the document
+    DiagLimits unlimited = {0, 0};
+    diag_set_limits(&unlimited);
+
+    LspInput input = {in_fd, NULL, 0, 0, 0, 0};
+    Writer message;
+    writer_init_memory(&message);
+    int exiting = 0;
+    while (!exiting) {
+        // Take in every message that has arrived before parsing, so a burst
+        // of changes is parsed once
+        int taken;
+        while (!exiting && (taken = input_next(&input, &message)) != 0) {
+            if (taken > 0) {
+                if (server.record) {
+                    record_message(&server, message.data, message.len);
+                }
+                exiting = handle_message(&server, message.data, (int)message.len);
+            }
+        }
+        if (exiting || input.eof) {
+            break;
+        }
+        uint64_t now = trace_clock();
+        struct pollfd wait = {in_fd, POLLIN, 0};
+        if (poll(&wait, 1, 0) > 0 && !parse_overdue(&server, now)) {
+            input_fill(&input);
+            continue;
+        }
+        uint64_t next = parse_documents(&server, now, 0);
+        int timeout = -1;
+        if (next) {
+            timeout = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+        }
+        int ready = poll(&wait, 1, timeout);
+        if (ready > 0) {
+            input_fill(&input);
+        } else if (ready < 0 && errno != EINTR) {
+            break;
+        }
+    }
+    parse_documents(&server, trace_clock(), 1);
+
+    if (server.parses > 0) {
+        fprintf(stderr, "LSP: %ld changes in %ld parses, %ld items parsed and %ld reused, %.1f us per parse\n",
+                server.changes, server.parses, server.items_parsed, server.items_reused,
+                server.parse_ns / 1e3 / server.parses);
+    }
+    if (options->check) {
+        fprintf(stderr, "LSP check: %ld parses compared with a full parse, %ld differed\n",
+                server.checked, server.mismatches);
+    }
+    for (int i = 0; i < server.document_count; i++) {
+        free_items(server.documents[i]);
+        free(server.documents[i]->uri);
+        free(server.documents[i]->text);
+        free(server.documents[i]->lines);
+        free(server.documents[i]);
+    }
+    free(server.documents);
+    free(server.json.nodes);
+    free(input.data);
+    writer_free(&message);
+    writer_free(&server.message);
+    writer_free(&server.text);
+    writer_free(&server.body);
+    writer_free(&server.out);
+    if (server.record) {
+        fclose(server.record);
+    }
+    return server.shutdown && server.mismatches == 0 ? 0 : 1;
+}
+
+// A change sent by the replay, answered by the first diagnostics published
+// for its document with at least its version
+typedef struct {
+    char *uri;
+    long version;
+    uint64_t sent;
+    uint64_t latency;           // 0 until answered
+} ReplayChange;
+
+static int compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int spawn_server(char *const argv[], pid_t *pid, int *to_server, int *from_server) {
+    int request[2];
+    int response[2];
+    if (pipe(request) != 0) {
+        return -1;
+    }
+    if (pipe(response) != 0) {
+        close(request[0]);
+        close(request[1]);
+        return -1;
+    }
+    *pid = fork();
+    if (*pid == 0) {
+        dup2(request[0], STDIN_FILENO);
+        dup2(response[1], STDOUT_FILENO);
+        close(request[0]);
+        close(request[1]);
+        close(response[0]);
+        close(response[1]);
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    close(request[0]);
+    close(response[1]);
+    if (*pid < 0) {
+        close(request[1]);
+        close(response[0]);
+        return -1;
+    }
+    *to_server = request[1];
+    *from_server = response[0];
+    fcntl(*to_server, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+// Match diagnostics published by the server against the changes sent
+static void replay_response(Json *json, const char *text, int len, ReplayChange *changes, int count,
+                            long *published, Writer *scratch) {
+    int root = json_parse(json, text, len);
+    if (root < 0 || !json_equals(json, json_member(json, root, "method"), "textDocument/publishDiagnostics")) {
+        return;
+    }
+    (*published)++;
+    int params = json_member(json, root, "params");
+    long version = json_int(json, json_member(json, params, "version"), -1);
+    writer_reset(scratch);
+    json_string(scratch, json, json_member(json, params, "uri"));
+    wr_char(scratch, '\0');
+    uint64_t now = trace_clock();
+    for (int i = 0; i < count; i++) {
+        if (!changes[i].latency && changes[i].version <= version && strcmp(changes[i].uri, scratch->data) == 0) {
+            changes[i].latency = now - changes[i].sent;
+        }
+    }
+}
+
+int lsp_replay(const char *session, char *const server_argv[], double speed, Writer *out) {
+    FILE *file = fopen(session, "r");
+    if (!file) {
+        wr_printf(out, "Error: Could not open file %s\n", session);
+        return -1;
+    }
+
+    // Load the session: a time in milliseconds and a message per line
+    char **messages = NULL;
+    double *times = NULL;
+    int count = 0;
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, file)) > 0) {
+        char *body = NULL;
+        double time = strtod(line, &body);
+        if (body == line) continue;
+        while (*body == ' ') body++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            messages = realloc(messages, capacity * sizeof(char *));
+            times = realloc(times, capacity * sizeof(double));
+            if (!messages || !times) {
+                fprintf(stderr, "Error: Memory allocation failed for session\n");
+                exit(1);
+            }
+        }
+        times[count] = time;
+        messages[count++] = strdup(body);
+    }
+    free(line);
+    fclose(file);
+
+    pid_t pid;
+    int to_server;
+    int from_server;
+    if (spawn_server(server_argv, &pid, &to_server, &from_server) != 0) {
+        wr_printf(out, "Error: Could not start the language server\n");
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Json json;
+    memset(&json, 0, sizeof(json));
+    Writer scratch;
+    Writer pending;             // Framed messages not yet written
+    Writer message;
+    writer_init_memory(&scratch);
+    writer_init_memory(&pending);
+    writer_init_memory(&message);
+    ReplayChange *changes = calloc((size_t)count + 1, sizeof(ReplayChange));
+    int change_count = 0;
+    long published = 0;
+    size_t written = 0;
+    LspInput input = {from_server, NULL, 0, 0, 0, 0};
+
+    uint64_t start = trace_clock();
+    int next = 0;
+    while (!input.eof) {
+        uint64_t now = trace_clock();
+        // Queue the messages that are due
+        while (next < count && (speed <= 0 || now >= start + (uint64_t)(times[next] / speed * 1e6))) {
+            int root = json_parse(&json, messages[next], (int)strlen(messages[next]));
+            int params = json_member(&json, root, "params");
+            if (json_equals(&json, json_member(&json, root, "method"), "textDocument/didChange")) {
+                int document = json_member(&json, params, "textDocument");
+                writer_reset(&scratch);
+                json_string(&scratch, &json, json_member(&json, document, "uri"));
+                wr_char(&scratch, '\0');
+                changes[change_count].uri = strdup(scratch.data);
+                changes[change_count].version = json_int(&json, json_member(&json, document, "version"), 0);
+                changes[change_count].sent = now;
+                change_count++;
+            }
+            wr_printf(&pending, "Content-Length: %zu\r\n\r\n%s", strlen(messages[next]), messages[next]);
+            next++;
+        }
+        if (next == count && written == pending.len && to_server >= 0) {
+            close(to_server);   // All sent: the server ends at exit or at the end of its input
+            to_server = -1;
+        }
+
+        struct pollfd waits[2] = {{from_server, POLLIN, 0}, {to_server, POLLOUT, 0}};
+        int timeout = -1;
+        if (next < count && speed > 0) {
+            uint64_t due = start + (uint64_t)(times[next] / speed * 1e6);
+            timeout = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+        }
+        int waiting = to_server >= 0 && written < pending.len ? 2 : 1;
+        if (poll(waits, waiting, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        if (waiting == 2 && (waits[1].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            ssize_t n = write(to_server, pending.data + written, pending.len - written);
+            if (n > 0) {
+                written += (size_t)n;
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                written = pending.len;
+                next = count;
+            }
+            if (written == pending.len) {
+                writer_reset(&pending);
+                written = 0;
+            }
+        }
+        if (waits[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            input_fill(&input);
+            int taken;
+            while ((taken = input_next(&input, &message)) != 0) {
+                if (taken > 0) {
+                    replay_response(&json, message.data, (int)message.len, changes, change_count, &published,
+                                    &scratch);
+                }
+            }
+        }
+    }
+    double elapsed = (trace_clock() - start) / 1e6;
+    if (to_server >= 0) {
+        close(to_server);
+    }
+    close(from_server);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    // Latency of the answered changes
+    uint64_t *latencies = malloc(((size_t)change_count + 1) * sizeof(uint64_t));
+    int answered = 0;
+    for (int i = 0; i < change_count; i++) {
+        if (changes[i].latency) {
+            latencies[answered++] = changes[i].latency;
+        }
+        free(changes[i].uri);
+    }
+    qsort(latencies, (size_t)answered, sizeof(uint64_t), compare_latency);
+    wr_printf(out, "%d messages replayed in %.1f ms: %d changes, %ld diagnostics published", count, elapsed,
+              change_count, published);
+    if (answered > 0) {
+        wr_printf(out, ", latency p50 %.2f ms, p99 %.2f ms, max %.2f ms", latencies[answered / 2] / 1e6,
+                  latencies[answered * 99 / 100] / 1e6, latencies[answered - 1] / 1e6);
+    }
+    wr_printf(out, "; %d changes unanswered\n", change_count - answered);
+    int result = WIFEXITED(status) && WEXITSTATUS(status) == 0 && answered == change_count ? 0 : -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        wr_printf(out, "Error: The language server exited with status %d\n",
+                  WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    }
+
+    free(latencies);
+    free(changes);
+    for (int i = 0; i < count; i++) {
+        free(messages[i]);
+    }
+    free(messages);
+    free(times);
+    free(json.nodes);
+    free(input.data);
+    writer_free(&message);
+    writer_free(&pending);
+    writer_free(&scratch);
+    return result;
+}
@@ -0,0 +1,482 @@
+/* optimize.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../../include/optimize.h"
+#include "../../include/factorial.h"
+
+// Binary operators by lexeme
+typedef enum {
+    OP_NONE,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+    OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_OR
+} BinaryOp;
+
+typedef struct {
+    int passes;
+    int changed;
+    OptimizeStats *stats;
+} Optimizer;
+
+static ASTNode *optimize_statement(Optimizer *opt, ASTNode *node);
+
+static BinaryOp binary_op(const char *lexeme) {
+    switch (lexeme[0]) {
+        case '+': return lexeme[1] ? OP_NONE : OP_ADD;
+        case '-': return lexeme[1] ? OP_NONE : OP_SUB;
+        case '*': return lexeme[1] ? OP_NONE : OP_MUL;
+        case '/': return lexeme[1] ? OP_NONE : OP_DIV;
+        case '%': return lexeme[1] ? OP_NONE : OP_MOD;
+        case '<': return lexeme[1] == '=' ? OP_LE : (lexeme[1] ? OP_NONE : OP_LT);
+        case '>': return lexeme[1] == '=' ? OP_GE : (lexeme[1] ? OP_NONE : OP_GT);
+        case '=': return lexeme[1] == '=' ? OP_EQ : OP_NONE;
+        case '!': return lexeme[1] == '=' ? OP_NE : OP_NONE;
+        case '&': return lexeme[1] == '&' ? OP_AND : OP_NONE;
+        case '|': return lexeme[1] == '|' ? OP_OR : OP_NONE;
+        default: return OP_NONE;
+    }
+}
+
+// Operators whose result is always 0 or 1
+static int is_boolean_op(BinaryOp op) {
+    return op >= OP_LT;
+}
+
+static int is_literal(ASTNode *node) {
+    return node && node->type == AST_NUMBER && node->token.error == ERROR_NONE &&
+           (node->token.type == TOKEN_NUMBER || node->token.type == TOKEN_FLOAT);
+}
+
+static int is_int_literal(ASTNode *node) {
+    return is_literal(node) && node->token.type == TOKEN_NUMBER;
+}
+
+static double literal_value(ASTNode *node) {
+    return node->token.type == TOKEN_FLOAT ? node->token.float_value : (double)node->token.int_value;
+}
+
+static int literal_truth(ASTNode *node) {
+    return node->token.type == TOKEN_FLOAT ? node->token.float_value != 0.0 : node->token.int_value != 0;
+}
+
+// Whether evaluating the expression can have side effects: calls, and
+// '/', '%' and lairotcaf, which can stop the program with a runtime error
+static int is_pure(ASTNode *node) {
+    if (!node) return 1;
+    if (node->type == AST_FUNCTION_CALL || node->type == AST_FACTORIAL) return 0;
+    if (node->type == AST_BINOP) {
+        BinaryOp op = binary_op(node->token.lexeme);
+        if (op == OP_DIV || op == OP_MOD) return 0;
+    }
+    return is_pure(node->left) && is_pure(node->right);
+}
+
+// Whether the expression may have a floating point value.  Identifiers are
+// only known to be floats when names were resolved (--resolve).
+static int may_be_float(ASTNode *node) {
+    if (!node) return 0;
+    if (node->type == AST_NUMBER) return node->token.type == TOKEN_FLOAT;
+    if (node->type == AST_IDENTIFIER) {
+        return node->decl_type == TOKEN_FLOAT_KEY || node->decl_type == TOKEN_DOUBLE;
+    }
+    if (node->type == AST_FUNCTION_CALL) return 1;
+    return may_be_float(node->left) || may_be_float(node->right);
+}
+
+// Free a subtree that the optimizer dropped
+static void discard(Optimizer *opt, ASTNode *node) {
+    if (!node) return;
+    opt->stats->nodes_removed += count_ast_nodes(node);
+    free_ast(node);
+}
+
+// Turn 'node' into a literal in place, keeping its source position
+static void make_literal(Optimizer *opt, ASTNode *node) {
+    discard(opt, node->left);
+    discard(opt, node->right);
+    node->left = NULL;
+    node->right = NULL;
+    ast_set_type(node, AST_NUMBER);
+    node->token.error = ERROR_NONE;
+    node->scope_depth = -1;
+    node->slot = -1;
+    node->decl_type = TOKEN_EOF;
+    opt->changed = 1;
+}
+
+static void make_int(Optimizer *opt, ASTNode *node, long long value) {
+    make_literal(opt, node);
+    node->token.type = TOKEN_NUMBER;
+    node->token.int_value = value;
+    node->token.float_value = 0.0;
+    snprintf(node->token.lexeme, sizeof(node->token.lexeme), "%lld", value);
+}
+
+static void make_float(Optimizer *opt, ASTNode *node, double value) {
+    make_literal(opt, node);
+    node->token.type = TOKEN_FLOAT;
+    node->token.int_value = 0;
+    node->token.float_value = value;
+    snprintf(node->token.lexeme, sizeof(node->token.lexeme), "%.17g", value);
+    if (!strpbrk(node->token.lexeme, ".eni")) {
+        strcat(node->token.lexeme, ".0"); // Keep it recognisably a float
+    }
+}
+
+// Replace a binary node by one of its operands, freeing the rest
+static ASTNode *keep_operand(Optimizer *opt, ASTNode *node, ASTNode *operand) {
+    discard(opt, operand == node->left ? node->right : node->left);
+    node->left = NULL;
+    node->right = NULL;
+    free_ast(node);
+    opt->stats->nodes_removed++;
+    opt->changed = 1;
+    return operand;
+}
+
+// Integer arithmetic on int64.  Returns 0 when the result must be left to
+// run time: overflow, or division by zero.
+static int fold_int(BinaryOp op, long long a, long long b, long long *result) {
+    switch (op) {
+        case OP_ADD: return !__builtin_add_overflow(a, b, result);
+        case OP_SUB: return !__builtin_sub_overflow(a, b, result);
+        case OP_MUL: return !__builtin_mul_overflow(a, b, result);
+        case OP_DIV:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+            *result = a / b; // C truncates toward zero
+            return 1;
+        case OP_MOD:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return 0;
+            *result = a % b;
+            return 1;
+        case OP_LT: *result = a < b; return 1;
+        case OP_GT: *result = a > b; return 1;
+        case OP_LE: *result = a <= b; return 1;
+        case OP_GE: *result = a >= b; return 1;
+        case OP_EQ: *result = a == b; return 1;
+        case OP_NE: *result = a != b; return 1;
+        case OP_AND: *result = a && b; return 1;
+        case OP_OR: *result = a || b; return 1;
+        default: return 0;
+    }
+}
+
+// Evaluate a binary operator over two literals
+static int fold_literals(Optimizer *opt, ASTNode *node, BinaryOp op) {
+    ASTNode *left = node->left;
+    ASTNode *right = node->right;
+
+    if (is_int_literal(left) && is_int_literal(right)) {
+        long long result;
+        if (!fold_int(op, left->token.int_value, right->token.int_value, &result)) {
+            return 0;
+        }
+        make_int(opt, node, result);
+        return 1;
+    }
+
+    double a = literal_value(left);
+    double b = literal_value(right);
+    switch (op) {
+        case OP_ADD: make_float(opt, node, a + b); return 1;
+        case OP_SUB: make_float(opt, node, a - b); return 1;
+        case OP_MUL: make_float(opt, node, a * b); return 1;
+        case OP_DIV: make_float(opt, node, a / b); return 1;
+        case OP_LT: make_int(opt, node, a < b); return 1;
+        case OP_GT: make_int(opt, node, a > b); return 1;
+        case OP_LE: make_int(opt, node, a <= b); return 1;
+        case OP_GE: make_int(opt, node, a >= b); return 1;
+        case OP_EQ: make_int(opt, node, a == b); return 1;
+        case OP_NE: make_int(opt, node, a != b); return 1;
+        case OP_AND: make_int(opt, node, a != 0.0 && b != 0.0); return 1;
+        case OP_OR: make_int(opt, node, a != 0.0 || b != 0.0); return 1;
+        default: return 0; // No floating point '%'
+    }
+}
+
+// Rewrite 'node' (whose other operand is the literal 'constant') as the
+// truth value of 'operand': operand itself if it is already 0/1, else
+// operand != 0
+static ASTNode *truth_of(Optimizer *opt, ASTNode *node, ASTNode *operand, ASTNode *constant) {
+    if (operand->type == AST_BINOP && is_boolean_op(binary_op(operand->token.lexeme))) {
+        return keep_operand(opt, node, operand);
+    }
+    node->left = operand;
+    node->right = constant;
+    strcpy(node->token.lexeme, "!=");
+    make_int(opt, constant, 0);
+    return node;
+}
+
+// Simplify && and || when one operand is a literal
+static ASTNode *short_circuit(Optimizer *opt, ASTNode *node, BinaryOp op) {
+    ASTNode *left = node->left;
+    ASTNode *right = node->right;
+    int left_constant = is_literal(left);
+    ASTNode *constant = left_constant ? left : right;
+    ASTNode *operand = left_constant ? right : left;
+    int truth = literal_truth(constant);
+
+    // Value decided by the constant: 0 && x, 1 || x, and x && 0, x || 1
+    // when dropping x cannot drop a side effect (a left operand always runs)
+    if (truth == (op == OP_OR)) {
+        if (left_constant || is_pure(operand)) {
+            make_int(opt, node, truth);
+        }
+        return node;
+    }
+
+    // 1 && x, 0 || x, x && 1, x || 0 all reduce to the truth of x
+    return truth_of(opt, node, operand, constant);
+}
+
+static int is_int_value(ASTNode *node, long long value) {
+    return is_int_literal(node) && node->token.int_value == value;
+}
+
+// Algebraic identities with an integer literal operand.
+// Returns NULL when none applies.
+static ASTNode *apply_identity(Optimizer *opt, ASTNode *node, BinaryOp op) {
+    ASTNode *left = node->left;
+    ASTNode *right = node->right;
+
+    switch (op) {
+        case OP_ADD:
+            if (is_int_value(left, 0)) return keep_operand(opt, node, right);
+            if (is_int_value(right, 0)) return keep_operand(opt, node, left);
+            break;
+        case OP_SUB:
+            if (is_int_value(right, 0)) return keep_operand(opt, node, left);
+            break;
+        case OP_MUL:
+            if (is_int_value(left, 1)) return keep_operand(opt, node, right);
+            if (is_int_value(right, 1)) return keep_operand(opt, node, left);
+            // x*0 is 0 only for integer x without side effects
+            if ((is_int_value(left, 0) && is_pure(right) && !may_be_float(right)) ||
+                (is_int_value(right, 0) && is_pure(left) && !may_be_float(left))) {
+                make_int(opt, node, 0);
+                return node;
+            }
+            break;
+        case OP_DIV:
+            if (is_int_value(right, 1)) return keep_operand(opt, node, left);
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+// lairotcaf(n) with a literal argument becomes n! when it fits in int64.
+// Otherwise the call is left for run time with a warning, reported once:
+// the node's error field records that it has been diagnosed.
+static void fold_factorial(Optimizer *opt, ASTNode *node) {
+    if (!is_int_literal(node->left)) {
+        return;
+    }
+    long long result;
+    FactorialStatus status = factorial_int64(node->left->token.int_value, &result);
+    if (status == FACTORIAL_OK) {
+        make_int(opt, node, result);
+        opt->stats->folded++;
+    } else if (node->token.error == ERROR_NONE) {
+        node->token.error = ERROR_NUMBER_OVERFLOW;
+        wr_printf(output_writer(), "Warning at line %d, column %d: lairotcaf(%lld) %s\n",
+                  node->token.line, node->token.column,
+                  node->left->token.int_value, factorial_status_message(status));
+    }
+}
+
+static ASTNode *optimize_expression(Optimizer *opt, ASTNode *node) {
+    if (!node) return NULL;
+
+    switch (node->type) {
+        case AST_BINOP:
+            break;
+        case AST_FACTORIAL:
+            node->left = optimize_expression(opt, node->left);
+            if (opt->passes & OPT_FOLD) {
+                fold_factorial(opt, node);
+            }
+            return node;
+        case AST_FUNCTION_CALL:
+            node->left = optimize_expression(opt, node->left);
+            return node;
+        default:
+            return node;
+    }
+
+    node->left = optimize_expression(opt, node->left);
+    node->right = optimize_expression(opt, node->right);
+    BinaryOp op = binary_op(node->token.lexeme);
+    if (op == OP_NONE || !node->left || !node->right) {
+        return node;
+    }
+
+    if ((opt->passes & OPT_FOLD) && is_literal(node->left) && is_literal(node->right)) {
+        if (fold_literals(opt, node, op)) {
+            opt->stats->folded++;
+        }
+        return node;
+    }
+
+    if ((opt->passes & OPT_SHORT_CIRCUIT) && (op == OP_AND || op == OP_OR) &&
+        (is_literal(node->left) || is_literal(node->right))) {
+        int changed = opt->changed;
+        opt->changed = 0;
+        ASTNode *result = short_circuit(opt, node, op);
+        if (opt->changed) opt->stats->short_circuits++;
+        opt->changed |= changed;
+        return result;
+    }
+
+    if (opt->passes & OPT_IDENTITIES) {
+        ASTNode *result = apply_identity(opt, node, op);
+        if (result) {
+            opt->stats->identities++;
+            return result;
+        }
+    }
+    return node;
+}
+
+// Optimize each statement of a Program or Block chain, then unlink the
+// statements that were removed
+static void optimize_chain(Optimizer *opt, ASTNode *head) {
+    for (ASTNode *link = head; link && link->type == head->type; link = link->right) {
+        link->left = optimize_statement(opt, link->left);
+    }
+
+    ASTNode *prev = NULL;
+    ASTNode *link = head;
+    while (link && link->type == head->type) {
+        ASTNode *next = link->right;
+        if (link->left || (next && next->type != head->type)) {
+            prev = link;
+            link = next;
+        } else if (next) {
+            // Pull the next statement into this link
+            link->left = next->left;
+            link->right = next->right;
+            next->left = NULL;
+            next->right = NULL;
+            free_ast(next);
+        } else {
+            if (prev) {
+                prev->right = NULL;
+                free_ast(link);
+            }
+            break;
+        }
+    }
+}
+
+// Replace a control statement by its (already detached) body, or nothing
+static ASTNode *replace_statement(Optimizer *opt, ASTNode *node, ASTNode *body) {
+    discard(opt, node);
+    opt->stats->dead_branches++;
+    opt->changed = 1;
+    return optimize_statement(opt, body);
+}
+
+static ASTNode *optimize_if(Optimizer *opt, ASTNode *node) {
+    node->left = optimize_expression(opt, node->left);
+
+    // The right child is the then block, or an Else node holding both blocks
+    ASTNode *else_node = node->right && node->right->type == AST_ELSE ? node->right : NULL;
+    ASTNode *then_block = else_node ? else_node->left : node->right;
+    ASTNode *else_block = else_node ? else_node->right : NULL;
+
+    if ((opt->passes & OPT_DEAD_BRANCHES) && is_literal(node->left)) {
+        ASTNode *taken = literal_truth(node->left) ? then_block : else_block;
+        if (taken && else_node) {
+            if (taken == then_block) else_node->left = NULL;
+            else else_node->right = NULL;
+        } else if (taken) {
+            node->right = NULL;
+        }
+        return replace_statement(opt, node, taken);
+    }
+
+    then_block = optimize_statement(opt, then_block);
+    if (else_node) {
+        else_node->left = then_block;
+        else_node->right = optimize_statement(opt, else_block);
+    } else {
+        node->right = then_block;
+    }
+    return node;
+}
+
+static ASTNode *optimize_statement(Optimizer *opt, ASTNode *node) {
+    if (!node) return NULL;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            optimize_chain(opt, node);
+            return node;
+        case AST_VARDECL:
+        case AST_ASSIGN:
+            node->right = optimize_expression(opt, node->right);
+            return node;
+        case AST_PRINT:
+        case AST_RETURN:
+            node->left = optimize_expression(opt, node->left);
+            return node;
+        case AST_FUNCTION_DECL:
+            node->right = optimize_statement(opt, node->right);
+            return node;
+        case AST_IF:
+            return optimize_if(opt, node);
+        case AST_WHILE:
+            node->left = optimize_expression(opt, node->left);
+            if ((opt->passes & OPT_DEAD_BRANCHES) && is_literal(node->left) &&
+                !literal_truth(node->left)) {
+                return replace_statement(opt, node, NULL); // Never runs
+            }
+            node->right = optimize_statement(opt, node->right);
+            return node;
+        case AST_FOR:
+            node->right = optimize_expression(opt, node->right);
+            if ((opt->passes & OPT_DEAD_BRANCHES) && is_literal(node->right) &&
+                literal_truth(node->right)) {
+                ASTNode *body = node->left; // Runs exactly once
+                node->left = NULL;
+                return replace_statement(opt, node, body);
+            }
+            node->left = optimize_statement(opt, node->left);
+            return node;
+        default:
+            return optimize_expression(opt, node);
+    }
+}
+
+// Run the selected passes over the tree until nothing changes (or the
+// iteration limit is reached)
+ASTNode *optimize_ast(ASTNode *root, int passes, int max_iterations, OptimizeStats *stats) {
+    Optimizer opt = {passes, 0, stats};
+    if (max_iterations < 1) {
+        max_iterations = 1;
+    }
+
+    for (int i = 0; i < max_iterations && root; i++) {
+        opt.changed = 0;
+        root = optimize_statement(&opt, root);
+        stats->iterations++;
+        if (!opt.changed) {
+            break;
+        }
+    }
+    return root;
+}
+
+void optimize_report(Writer *out, const OptimizeStats *stats) {
+    wr_printf(out, "Optimizer: %d constants folded, %d identities, %d short-circuits, "
+                   "%d dead branches, %d nodes removed (%d iterations)\n",
+              stats->folded, stats->identities, stats->short_circuits,
+              stats->dead_branches, stats->nodes_removed, stats->iterations);
+}
@@ -2,26 +2,116 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../../include/parser.h"
 #include "../../include/lexer.h"
+#include "../../include/writer.h"
 #include "../../include/tokens.h"
+#include "../../include/perf.h"
+#include "../../include/trace.h"
+#include "../../include/btok.h"
+#include "../../include/serialize.h"
+#include "../../include/intern.h"
+#include "../../include/scope.h"
+#include "../../include/optimize.h"
+#include "../../include/factorial.h"
+#include "../../include/vm.h"
+#include "../../include/cgen.h"
+#include "../../include/ssa.h"
+#include "../../include/ssaopt.h"
+#include "../../include/batch.h"
+#include "../../include/profile.h"
+#include "../../include/image.h"
+#include "../../include/superop.h"
+#include "../../include/hashcons.h"
+#include "../../include/astindex.h"
+#include "../../include/symindex.h"
+#include "../../include/server.h"
+#include "../../include/lsp.h"
+#include "../../include/diag.h"
 
 // Current token being processed
-static Token current_token;
-static int position = 0;
-static int pos2 = 0;
-static const char *source;
+// Parser state is thread-local so files can be processed on worker threads
+static _Thread_local Token current_token;
+static _Thread_local int position = 0;
+static _Thread_local int pos2 = 0;
+static _Thread_local int read_extent = 0;  // Furthest position lexed (ParseCheckpoint)
+static _Thread_local const char *source;
+static _Thread_local long tokens_consumed = 0;
 
 // Error reporting control
-static int error_reporting_enabled = 1;
-static int last_reported_line = 0;
-static int last_reported_column = 0;
-static int error_count = 0;
+static _Thread_local int error_reporting_enabled = 1;
+static _Thread_local int error_count = 0;
+
+// A function body shares its scope with the parameters, so parse_block
+// skips opening a scope when this is set (name resolution only)
+static _Thread_local int function_body_pending = 0;
+
+// Interned name of the factorial function
+static _Thread_local SymbolId factorial_sym = SYMBOL_NONE;
+
+// Recycled AST nodes (linked through 'right') and live node counts
+static _Thread_local ASTNode *free_nodes = NULL;
+static _Thread_local long live_nodes = 0;
+static _Thread_local long peak_live_nodes = 0;
+
+// Expressions shared while parsing the current file (--hashcons)
+static _Thread_local HashconsTable shared_nodes;
+
+// Index new nodes are added to (parser_set_index), NULL for none
+static _Thread_local ASTIndex *node_index = NULL;
+
+// Hardware counter instrumentation (--perf)
+static int perf_enabled = 0;
+
+// Resolve identifiers to declarations while parsing (--resolve)
+static int resolve_enabled = 0;
+
+// Run the AST optimizer after parsing (--optimize)
+static int optimize_enabled = 0;
+
+// Share identical pure expressions (--hashcons).  The optimizer rewrites
+// nodes in place, so with --optimize they are shared once it has run.
+static int hashcons_enabled = 0;
+
+// Compile through the SSA form (--ssa), running the selected passes
+// (--ssa-passes)
+static int ssa_enabled = 0;
+static unsigned ssa_passes = SSA_PASS_ALL;
+
+// Function evaluated over generated rows (--batch), and how many rows
+// (--batch-rows)
+#define BATCH_DEFAULT_ROWS 1000000
+#define BATCH_MAX_ROWS 100000000
+static const char *batch_function = NULL;
+static size_t batch_rows = BATCH_DEFAULT_ROWS;
+
+// Profiler sampling rate (--profile-hz) and statements listed per input
+#define PROFILE_REPORT_ROWS 15
+#define PROFILE_MAX_HZ 10000
+static int profile_hz = PROFILE_DEFAULT_HZ;
+
+// Instruction stretches counted over every input (--superops-train), for
+// the header written once all have run
+static VMCounts superop_counts;
+static const char *superops_path = NULL;
 
 // Forward declarations for utility functions
 void parse_error(ParseError error, Token token);
 static void advance(void);
 static ASTNode *create_node(ASTNodeType type);
+static void destroy_node(ASTNode *node);
+static void release_shared_nodes(void);
+static ASTNode *create_zero_node(void);
 static int match(TokenType type);
 static void synchronize(void);
 
@@ -52,13 +142,31 @@ static void reset_parser_state(void) {
     position = 0;
     pos2 = 0;
     source = NULL;
-    last_reported_line = 0;
-    last_reported_column = 0;
     error_reporting_enabled = 1;
     error_count = 0;
     
     // Reset the lexer state too
     reset_lexer();
+
+    // The previous file's AST is gone, and its shared expressions with it
+    release_shared_nodes();
+    
+    // Fresh global scope for each file
+    if (resolve_enabled) {
+        scope_begin();
+    } else {
+        scope_end();
+    }
+}
+
+// Reset the parser for a new file, for drivers outside this file
+void parser_reset(void) {
+    reset_parser_state();
+}
+
+// Parse errors reported since the last reset
+int parser_error_count(void) {
+    return error_count;
 }
 
 void parse_error(ParseError error, Token token) {
@@ -72,50 +180,10 @@ void parse_error(ParseError error, Token token) {
         return;
     }
     
-    // Skip duplicate errors at the same location (but not entirely the same line)
-    if (token.line == last_reported_line && token.column == last_reported_column) {
-        return;
-    }
-    
-    // Update the last reported error location
-    last_reported_line = token.line;
-    last_reported_column = token.column;
-    error_count++;
-    
-    printf("Parse Error at line %d, column %d: ", token.line, token.column);
-    switch (error) {
-        case PARSE_ERROR_UNEXPECTED_TOKEN:
-            printf("Unexpected token '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_MISSING_SEMICOLON:
-            printf("Missing semicolon after '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_MISSING_IDENTIFIER:
-            printf("Expected identifier after '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_MISSING_EQUALS:
-            printf("Expected '=' after '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_MISSING_PARENTHESES:
-            printf("Missing parenthesis in expression\n");
-            break;
-        case PARSE_ERROR_MISSING_CONDITION:
-            printf("Expected condition after '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_BLOCK_BRACES:
-            printf("Missing brace for block statement\n");
-            break;
-        case PARSE_ERROR_INVALID_OPERATOR:
-            printf("Invalid operator '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_INVALID_FUNCTION_CALL:
-            printf("Invalid function call to '%s'\n", token.lexeme);
-            break;
-        case PARSE_ERROR_INVALID_EXPRESSION:
-            printf("Invalid expression after '%s'\n", token.lexeme);
-            break;
-        default:
-            printf("Unknown error\n");
+    // Recorded for rendering later; a second error at the same token is a
+    // repeat and not counted
+    if (diag_report(DIAG_PARSER, error, &token)) {
+        error_count++;
     }
 }
 
@@ -123,22 +191,46 @@ void parse_error(ParseError error, Token token) {
 static void advance(void) {
     // Get the next token
     current_token = get_next_token(source, &position);
+    tokens_consumed++;
     
     // Skip comments and error tokens during error recovery
     while (current_token.type == TOKEN_ERROR || current_token.type == TOKEN_SKIP || current_token.type == TOKEN_COMMENT) {
         // The error reporting is now handled by the lexer not here
         current_token = get_next_token(source, &position);
     }
+    if (position > read_extent) {
+        read_extent = position;
+    }
 }
 
-// Create a new AST node
+// Create a new AST node, reusing a recycled one when available
 static ASTNode *create_node(ASTNodeType type) {
-    ASTNode *node = malloc(sizeof(ASTNode));
+    ASTNode *node = free_nodes;
+    if (node) {
+        free_nodes = node->right;
+    } else {
+        node = malloc(sizeof(ASTNode));
+    }
     if (node) {
+        if (++live_nodes > peak_live_nodes) {
+            peak_live_nodes = live_nodes;
+        }
         node->type = type;
         node->token = current_token;
         node->left = NULL;
         node->right = NULL;
+        node->scope_depth = -1;
+        node->slot = -1;
+        node->decl_type = TOKEN_EOF;
+        node->id = 0;
+        node->by_type = (ASTLink){NULL, NULL};
+        node->by_name = (ASTLink){NULL, NULL};
+        if (node_index) {
+            ast_index_add(node_index, node);
+            if (type == AST_IDENTIFIER) {
+                ast_index_add_use(node_index, node);
+            }
+        }
     } else {
         fprintf(stderr, "Error: Memory allocation failed for AST node\n");
         exit(1);
@@ -146,6 +238,57 @@ static ASTNode *create_node(ASTNodeType type) {
     return node;
 }
 
+// Create a literal 0 used in place of missing expressions
+static ASTNode *create_zero_node(void) {
+    ASTNode *node = create_node(AST_NUMBER);
+    node->token.type = TOKEN_NUMBER;
+    node->token.lexeme[0] = '0';
+    node->token.lexeme[1] = '\0';
+    node->token.int_value = 0;
+    node->token.float_value = 0.0;
+    return node;
+}
+
+// Return a single node to the free list
+static void destroy_node(ASTNode *node) {
+    ast_index_remove(node);
+    node->right = free_nodes;
+    free_nodes = node;
+    live_nodes--;
+}
+
+// Replace a completed expression node by its shared copy (--hashcons)
+static ASTNode *share_node(ASTNode *node) {
+    if (!hashcons_enabled || optimize_enabled) {
+        return node;
+    }
+    ASTNode *shared = hashcons_intern(&shared_nodes, node);
+    if (shared != node) {
+        destroy_node(node);
+    }
+    return shared;
+}
+
+// Free the current file's shared expressions
+static void release_shared_nodes(void) {
+    live_nodes -= hashcons_free(&shared_nodes);
+}
+
+// Share the expressions of a tree the optimizer has finished with
+static ASTNode *share_optimized(ASTNode *ast) {
+    return hashcons_enabled ? hashcons_ast(&shared_nodes, ast) : ast;
+}
+
+// Optimize a tree as --optimize and --hashcons ask; unchanged without
+// --optimize
+ASTNode *parser_optimize(ASTNode *ast) {
+    if (!optimize_enabled) {
+        return ast;
+    }
+    OptimizeStats stats = {0};
+    return share_optimized(optimize_ast(ast, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+}
+
 // Match current token with expected type
 static int match(TokenType type) {
     return current_token.type == type;
@@ -184,8 +327,13 @@ static void synchronize(void) {
 static ASTNode *parse_primary_expression(void) {
     ASTNode *node;
 
-    if (match(TOKEN_NUMBER)) {
-        node = create_node(AST_NUMBER);
+    if (match(TOKEN_NUMBER) || match(TOKEN_FLOAT)) {
+        // The lexer has already decoded the literal's value, and reported
+        // one out of range; the parse still fails on it
+        if (current_token.error == ERROR_NUMBER_OVERFLOW && error_reporting_enabled) {
+            error_count++;
+        }
+        node = share_node(create_node(AST_NUMBER));
         advance();
     } else if (match(TOKEN_IDENTIFIER)) {
         node = create_node(AST_IDENTIFIER);
@@ -195,18 +343,16 @@ static ASTNode *parse_primary_expression(void) {
         // Check if this is a function call (if followed by left parenthesis)
         if (match(TOKEN_LPAREN)) {
             // Special case for factorial function
-            if (strcmp(identifier_token.lexeme, "lairotcaf") == 0) {
+            if (identifier_token.sym == factorial_sym) {
                 // Create factorial node
                 ASTNode *factorial_node = create_node(AST_FACTORIAL);
                 advance(); // Consume '('
                 
                 // Empty parentheses - create a dummy argument
                 if (match(TOKEN_RPAREN)) {
-                    factorial_node->left = create_node(AST_NUMBER);
-                    factorial_node->left->token.lexeme[0] = '0';
-                    factorial_node->left->token.lexeme[1] = '\0';
+                    factorial_node->left = create_zero_node();
                     advance(); // Consume ')'
-                    free(node); // Free the original identifier node
+                    destroy_node(node); // Free the original identifier node
                     return factorial_node;
                 }
                 
@@ -217,17 +363,20 @@ static ASTNode *parse_primary_expression(void) {
                 if (!match(TOKEN_RPAREN)) {
                     parse_error(PARSE_ERROR_MISSING_PARENTHESES, current_token);
                     synchronize();
-                    free(node); // Free the original identifier node
+                    destroy_node(node); // Free the original identifier node
                     return factorial_node;
                 }
                 advance(); // Consume ')'
                 
-                free(node); // Free the original identifier node
+                destroy_node(node); // Free the original identifier node
                 return factorial_node;
             } else {
                 // Generic function call
                 ASTNode *call_node = create_node(AST_FUNCTION_CALL);
                 call_node->token = identifier_token;
+                if (node_index) {
+                    ast_index_add_use(node_index, call_node);
+                }
                 advance(); // Consume '('
                 
                 // Parse arguments if any
@@ -239,15 +388,18 @@ static ASTNode *parse_primary_expression(void) {
                 if (!match(TOKEN_RPAREN)) {
                     parse_error(PARSE_ERROR_MISSING_PARENTHESES, current_token);
                     synchronize();
-                    free(node); // Free the original identifier node
+                    destroy_node(node); // Free the original identifier node
                     return call_node;
                 }
                 advance(); // Consume ')'
                 
-                free(node); // Free the original identifier node
+                destroy_node(node); // Free the original identifier node
                 return call_node;
             }
+        } else if (scope_active() && !scope_resolve(node)) {
+            parse_error(PARSE_ERROR_UNDECLARED_IDENTIFIER, identifier_token);
         }
+        node = share_node(node);
     } else if (match(TOKEN_FACTORIAL)) {
         // Direct factorial token
         Token factorial_token = current_token;
@@ -280,9 +432,7 @@ static ASTNode *parse_primary_expression(void) {
         
         // Empty parentheses, create a dummy argument
         if (match(TOKEN_RPAREN)) {
-            node->left = create_node(AST_NUMBER);
-            node->left->token.lexeme[0] = '0';
-            node->left->token.lexeme[1] = '\0';
+            node->left = create_zero_node();
             advance(); // Consume ')'
             return node;
         }
@@ -304,9 +454,7 @@ static ASTNode *parse_primary_expression(void) {
         
         // Empty parentheses, create a dummy expression
         if (match(TOKEN_RPAREN)) {
-            node = create_node(AST_NUMBER);
-            node->token.lexeme[0] = '0';
-            node->token.lexeme[1] = '\0';
+            node = create_zero_node();
             advance(); // Consume ')'
             return node;
         }
@@ -329,9 +477,7 @@ static ASTNode *parse_primary_expression(void) {
         parse_error(PARSE_ERROR_INVALID_EXPRESSION, current_token);
         synchronize();
         // Create a dummy node to allow parsing to continue
-        node = create_node(AST_NUMBER);
-        node->token.lexeme[0] = '0';
-        node->token.lexeme[1] = '\0';
+        node = create_zero_node();
     }
 
     return node;
@@ -356,7 +502,7 @@ static ASTNode *parse_multiplicative_expression(void) {
 
         node->left = left;
         node->right = parse_primary_expression();
-        left = node;
+        left = share_node(node);
     }
 
     return left;
@@ -374,7 +520,7 @@ static ASTNode *parse_additive_expression(void) {
 
         node->left = left;
         node->right = parse_multiplicative_expression();
-        left = node;
+        left = share_node(node);
     }
 
     return left;
@@ -395,7 +541,7 @@ static ASTNode *parse_comparison_expression(void) {
 
         node->left = left;
         node->right = parse_additive_expression();
-        left = node;
+        left = share_node(node);
     }
 
     return left;
@@ -412,7 +558,7 @@ static ASTNode *parse_logical_and_expression(void) {
 
         node->left = left;
         node->right = parse_comparison_expression();
-        left = node;
+        left = share_node(node);
     }
 
     return left;
@@ -429,7 +575,7 @@ static ASTNode *parse_logical_or_expression(void) {
 
         node->left = left;
         node->right = parse_logical_and_expression();
-        left = node;
+        left = share_node(node);
     }
 
     return left;
@@ -441,9 +587,7 @@ static ASTNode *parse_expression(void) {
     if (match(TOKEN_SEMICOLON) || match(TOKEN_RPAREN)) {
         parse_error(PARSE_ERROR_INVALID_EXPRESSION, current_token);
         // Create a dummy node for recovery
-        ASTNode *dummy = create_node(AST_NUMBER);
-        dummy->token.lexeme[0] = '0';  
-        dummy->token.lexeme[1] = '\0';
+        ASTNode *dummy = create_zero_node();
         return dummy;
     }
     
@@ -463,6 +607,9 @@ static ASTNode *parse_declaration(void) {
     }
 
     node->token = current_token;
+    if (scope_active() && !scope_declare(node, type_token.type)) {
+        parse_error(PARSE_ERROR_DUPLICATE_DECLARATION, current_token);
+    }
     advance();
 
     // Handle initialization if present
@@ -503,8 +650,14 @@ static ASTNode *parse_function_declaration(void) {
 
     node->token = current_token; // Save function name
     Token function_name = current_token; // Keep function name for error reporting
+    node->decl_type = type_token.type;
     advance(); // consume function name
 
+    // Parameters and locals get slots in the function's own frame
+    if (scope_active()) {
+        scope_enter_function();
+    }
+
     // Parse parameters
     if (!match(TOKEN_LPAREN)) {
         parse_error(PARSE_ERROR_MISSING_PARENTHESES, current_token);
@@ -540,12 +693,16 @@ static ASTNode *parse_function_declaration(void) {
             // Parameter name
             if (!match(TOKEN_IDENTIFIER)) {
                 parse_error(PARSE_ERROR_MISSING_IDENTIFIER, param_type);
-                free(param); // Free unused node
+                destroy_node(param); // Free unused node
                 break;
             }
             
             // Save parameter name to node
             param->token = current_token;
+            param->decl_type = param_type.type;
+            if (scope_active() && !scope_declare(param, param_type.type)) {
+                parse_error(PARSE_ERROR_DUPLICATE_DECLARATION, current_token);
+            }
             advance();
             
             // Add parameter to list
@@ -579,11 +736,18 @@ static ASTNode *parse_function_declaration(void) {
     if (match(TOKEN_SEMICOLON)) {
         parse_error(PARSE_ERROR_BLOCK_BRACES, function_name);
         advance(); // Consume ';'
+        if (scope_active()) {
+            node->slot = scope_leave_function();
+        }
         return node;
     }
     
     // Parse function body as the right child
+    function_body_pending = scope_active();
     node->right = parse_block();
+    if (scope_active()) {
+        node->slot = scope_leave_function(); // Frame size
+    }
     return node;
 }
 
@@ -600,13 +764,16 @@ static ASTNode *parse_assignment(void) {
         
         // Clean up if we can't continue
         free_ast(node->left);
-        free(node);
+        destroy_node(node);
         
         synchronize();
         return create_node(AST_PROGRAM); // Return a dummy node
     }
     
     advance(); // Consume '='
+    if (scope_active() && !scope_resolve(node->left)) {
+        parse_error(PARSE_ERROR_UNDECLARED_IDENTIFIER, id_token);
+    }
     
     // Check for invalid expression after equals
     if (match(TOKEN_SEMICOLON)) {
@@ -626,8 +793,20 @@ static ASTNode *parse_assignment(void) {
     return node;
 }
 
-// Parse block statement
+// Parse block statement, opening a scope for its declarations
+static ASTNode *parse_block_statements(void);
+
 static ASTNode *parse_block(void) {
+    int own_scope = scope_active() && !function_body_pending;
+    function_body_pending = 0;
+    
+    if (own_scope) scope_enter();
+    ASTNode *block = parse_block_statements();
+    if (own_scope) scope_leave();
+    return block;
+}
+
+static ASTNode *parse_block_statements(void) {
     if (!match(TOKEN_LBRACE)) {
         parse_error(PARSE_ERROR_BLOCK_BRACES, current_token);
         // Create an empty block node
@@ -685,9 +864,7 @@ static ASTNode *parse_if_statement(void) {
     if (match(TOKEN_RPAREN)) {
         parse_error(PARSE_ERROR_MISSING_CONDITION, if_token);
         // Create a dummy condition
-        node->left = create_node(AST_NUMBER);
-        node->left->token.lexeme[0] = '0';
-        node->left->token.lexeme[1] = '\0';
+        node->left = create_zero_node();
         advance(); // Consume ')'
     } else {
         node->left = parse_expression(); // Parse condition
@@ -731,9 +908,7 @@ static ASTNode *parse_while_statement(void) {
     if (match(TOKEN_RPAREN)) {
         parse_error(PARSE_ERROR_MISSING_CONDITION, while_token);
         // Create a dummy condition
-        node->left = create_node(AST_NUMBER);
-        node->left->token.lexeme[0] = '0';
-        node->left->token.lexeme[1] = '\0';
+        node->left = create_zero_node();
         advance(); // Consume ')'
     } else {
         node->left = parse_expression(); // Parse condition
@@ -781,9 +956,7 @@ static ASTNode *parse_repeat_until_statement(void) {
     if (match(TOKEN_RPAREN)) {
         parse_error(PARSE_ERROR_MISSING_CONDITION, until_token);
         // Create a dummy condition
-        node->right = create_node(AST_NUMBER);
-        node->right->token.lexeme[0] = '0';
-        node->right->token.lexeme[1] = '\0';
+        node->right = create_zero_node();
         advance(); // Consume ')'
     } else {
         node->right = parse_expression(); // Parse condition
@@ -831,9 +1004,7 @@ static ASTNode *parse_return_statement(void) {
     if (match(TOKEN_SEMICOLON)) {
         parse_error(PARSE_ERROR_INVALID_EXPRESSION, return_token);
         // Create a dummy return value
-        node->left = create_node(AST_NUMBER);
-        node->left->token.lexeme[0] = '0';
-        node->left->token.lexeme[1] = '\0';
+        node->left = create_zero_node();
         advance(); // Consume ';'
         return node;
     }
@@ -899,7 +1070,7 @@ static ASTNode *parse_statement(void) {
         
         // Still parse the else block to recover gracefully
         if (match(TOKEN_LBRACE)) {
-            parse_block();
+            recycle_ast(parse_block());
         }
         
         return create_node(AST_PROGRAM); // Return dummy node
@@ -922,15 +1093,8 @@ static ASTNode *parse_statement(void) {
     }
 }
 
-// Parse program (multiple statements)
-static ASTNode *parse_program(void) {
-    ASTNode *program = create_node(AST_PROGRAM);
-    
-    // Handle edge case of empty input
-    if (match(TOKEN_EOF)) {
-        return program;
-    }
-    
+// Parse one top-level item: a function declaration or a statement
+static ASTNode *parse_top_level_item(void) {
     // Function declaration check
     if (match(TOKEN_INT) || match(TOKEN_VOID) || match(TOKEN_CHAR) ||
         match(TOKEN_FLOAT_KEY) || match(TOKEN_LONG) || match(TOKEN_SHORT) ||
@@ -948,14 +1112,17 @@ static ASTNode *parse_program(void) {
                 // This is a function declaration
                 position = save_position; // Backtrack to the type token
                 current_token = save_token; // Restore the saved token
-                program->left = parse_function_declaration();
-                
-                // Parse any additional statements after the function
-                if (!match(TOKEN_EOF)) {
-                    program->right = parse_program();
+
+                uint64_t span_start = trace_enabled() ? trace_clock() : 0;
+                long span_tokens = tokens_consumed;
+                int span_errors = error_count;
+                ASTNode *function = parse_function_declaration();
+                if (span_start) {
+                    trace_span("parse_function", function->token.lexeme, span_start,
+                               position - save_position, tokens_consumed - span_tokens,
+                               error_count - span_errors);
                 }
-                
-                return program;
+                return function;
             }
         }
         
@@ -965,24 +1132,94 @@ static ASTNode *parse_program(void) {
     }
     
     // Regular statement handling
-    program->left = parse_statement();
+    return parse_statement();
+}
+
+// Parse program (multiple statements)
+static ASTNode *parse_program(void) {
+    ASTNode *program = create_node(AST_PROGRAM);
+    ASTNode *current = program;
     
-    if (!match(TOKEN_EOF)) {
-        program->right = parse_program();
+    // Handle edge case of empty input
+    if (match(TOKEN_EOF)) {
+        return program;
+    }
+    
+    // Each statement hangs off its own Program link
+    for (;;) {
+        current->left = parse_top_level_item();
+        if (match(TOKEN_EOF)) {
+            break;
+        }
+        current->right = create_node(AST_PROGRAM);
+        current = current->right;
     }
     
     return program;
 }
 
+// Parse the program one top-level item at a time, handing each completed
+// statement or function declaration to 'callback'.  Items the callback does
+// not keep are recycled, so only the largest single item is ever resident.
+// Returns the number of items parsed.
+int parse_program_streaming(ParseItemCallback callback, void *user) {
+    int items = 0;
+    error_reporting_enabled = 1;
+    
+    while (!match(TOKEN_EOF)) {
+        ASTNode *item = parse_top_level_item();
+        items++;
+        if (callback(item, user) == PARSE_ITEM_RECYCLE) {
+            recycle_ast(item);
+        }
+    }
+    
+    return items;
+}
+
+// Parse the next top-level item for streaming consumers.
+// Returns NULL once the input is exhausted.
+ASTNode *parse_next_item(void) {
+    if (match(TOKEN_EOF)) {
+        return NULL;
+    }
+    return parse_top_level_item();
+}
+
+// Record the state between two top-level items
+void parser_checkpoint(ParseCheckpoint *checkpoint) {
+    checkpoint->token = current_token;
+    checkpoint->position = position;
+    checkpoint->read_extent = read_extent;
+    checkpoint->token_reported = diag_reported(DIAG_PARSER, current_token.offset);
+    lexer_save(&checkpoint->lexer);
+}
+
+// Continue parsing 'input' from a checkpoint, as parser_init would start it
+void parser_resume(const char *input, const ParseCheckpoint *checkpoint) {
+    source = input;
+    current_token = checkpoint->token;
+    position = checkpoint->position;
+    read_extent = checkpoint->read_extent;
+    lexer_restore(&checkpoint->lexer);
+    diag_reset();
+    if (checkpoint->token_reported) {
+        diag_mark(DIAG_PARSER, checkpoint->token.offset);
+    }
+    error_reporting_enabled = 1;
+    error_count = 0;
+    factorial_sym = intern_cstr("lairotcaf");
+}
+
 // Initialize parser
 void parser_init(const char *input) {
     source = input;
     position = 0;
     pos2 = 0;
-    last_reported_line = 0;
-    last_reported_column = 0;
+    read_extent = 0;
     error_reporting_enabled = 1;
     error_count = 0;
+    factorial_sym = intern_cstr("lairotcaf");
     advance(); // Get first token
 }
 
@@ -994,149 +1231,1793 @@ ASTNode *parse(void) {
     return result;
 }
 
-// Print AST
-void print_ast(ASTNode *node, int level) {
-    if (!node) return;
-
-    // Indent based on level
-    for (int i = 0; i < level; i++) printf("  ");
+// Node labels printed by print_ast, indexed by ASTNodeType.
+// Nodes with a closing string are followed by their lexeme and that string.
+static const struct {
+    const char *label;
+    const char *close;
+} node_labels[] = {
+    [AST_PROGRAM] = {"Program", NULL},
+    [AST_VARDECL] = {"VarDecl: ", ""},
+    [AST_ASSIGN] = {"Assign", NULL},
+    [AST_PRINT] = {"Print Statement", NULL},
+    [AST_NUMBER] = {"Number: ", ""},
+    [AST_STRING] = {"String: \"", "\""},
+    [AST_IDENTIFIER] = {"Identifier: ", ""},
+    [AST_IF] = {"If Statement", NULL},
+    [AST_ELSE] = {"Else Statement", NULL},
+    [AST_WHILE] = {"While Loop", NULL},
+    [AST_FOR] = {"Repeat-Until Loop", NULL},
+    [AST_BLOCK] = {"Block", NULL},
+    [AST_BINOP] = {"BinaryOp: ", ""},
+    [AST_FACTORIAL] = {"Factorial Function", NULL},
+    [AST_FUNCTION_CALL] = {"Function Call: ", ""},
+    [AST_RETURN] = {"Return Statement", NULL},
+    [AST_FUNCTION_DECL] = {"Function Declaration: ", ""}
+};
+
+// Write AST to a writer
+void write_ast(Writer *out, ASTNode *node, int level) {
+    while (node) {
+        // Indent based on level
+        wr_indent(out, level);
+
+        // Print node info
+        if ((unsigned)node->type < sizeof(node_labels) / sizeof(node_labels[0]) &&
+            node_labels[node->type].label) {
+            wr_str(out, node_labels[node->type].label);
+            if (node_labels[node->type].close) {
+                wr_str(out, node->token.lexeme);
+                wr_str(out, node_labels[node->type].close);
+            }
+            // Resolution results, only present with --resolve
+            if (node->scope_depth >= 0) {
+                wr_str(out, " [depth ");
+                wr_int(out, node->scope_depth);
+                wr_str(out, ", slot ");
+                wr_int(out, node->slot);
+                wr_char(out, ']');
+            } else if (node->type == AST_FUNCTION_DECL && node->slot >= 0) {
+                wr_str(out, " [frame ");
+                wr_int(out, node->slot);
+                wr_char(out, ']');
+            }
+            // Shared expressions, only present with --hashcons
+            if (node->id) {
+                wr_str(out, " [id ");
+                wr_int(out, node->id);
+                wr_char(out, ']');
+            }
+            wr_char(out, '\n');
+        } else {
+            wr_str(out, "Unknown node type: ");
+            wr_int(out, node->type);
+            wr_char(out, '\n');
+        }
 
-    // Print node info
-    switch (node->type) {
-        case AST_PROGRAM:
-            printf("Program\n");
-            break;
-        case AST_VARDECL:
-            printf("VarDecl: %s\n", node->token.lexeme);
-            break;
-        case AST_ASSIGN:
-            printf("Assign\n");
-            break;
-        case AST_NUMBER:
-            printf("Number: %s\n", node->token.lexeme);
-            break;
-        case AST_STRING:
-            printf("String: \"%s\"\n", node->token.lexeme);
-            break;
-        case AST_IDENTIFIER:
-            printf("Identifier: %s\n", node->token.lexeme);
-            break;
-        case AST_IF:
-            printf("If Statement\n");
-            break;
-        case AST_ELSE:
-            printf("Else Statement\n");
-            break;
-        case AST_WHILE:
-            printf("While Loop\n");
-            break;
-        case AST_FOR:
-            printf("Repeat-Until Loop\n");
-            break;
-        case AST_BLOCK:
-            printf("Block\n");
-            break;
-        case AST_BINOP:
-            printf("BinaryOp: %s\n", node->token.lexeme);
-            break;
-        case AST_PRINT:
-            printf("Print Statement\n");
-            break;
-        case AST_FACTORIAL:
-            printf("Factorial Function\n");
-            break;
-        case AST_FUNCTION_CALL:
-            printf("Function Call: %s\n", node->token.lexeme);
-            break;
-        case AST_RETURN:
-            printf("Return Statement\n");
-            break;
-        case AST_FUNCTION_DECL:
-            printf("Function Declaration: %s\n", node->token.lexeme);
-            break;
-        default:
-            printf("Unknown node type: %d\n", node->type);
+        // Print children (the right child iteratively, since statement
+        // chains grow to the right)
+        write_ast(out, node->left, level + 1);
+        node = node->right;
+        level++;
     }
+}
 
-    // Print children
-    print_ast(node->left, level + 1);
-    print_ast(node->right, level + 1);
+// Print AST
+void print_ast(ASTNode *node, int level) {
+    write_ast(output_writer(), node, level);
 }
 
-// Print the token input stream
-void print_token_stream(const char* input) {
+// Print the token input stream, returning the number of tokens
+int print_token_stream(const char* input) {
     Token token;
     int temp_pos = 0;
+    int count = 0;
+    
+    Writer *out = output_writer();
     
     do {
         token = get_next_token(input, &temp_pos);
-        print_token(token);
+        write_token(out, token);
+        count++;
+    } while (token.type != TOKEN_EOF);
+
+    return count;
+}
+
+// Lex the input without printing; returns the number of tokens
+static int lex_tokens(const char *input) {
+    int position = 0;
+    int count = 0;
+    Token token;
+    do {
+        token = get_next_token(input, &position);
+        count++;
     } while (token.type != TOKEN_EOF);
+    return count;
+}
+
+// Count the nodes in an AST
+int count_ast_nodes(ASTNode *node) {
+    if (!node) return 0;
+    return 1 + count_ast_nodes(node->left) + count_ast_nodes(node->right);
 }
 
-// Free AST memory
+// Free AST memory.  Left subtrees are rotated into the right spine so the
+// tree is released without recursion.  Shared expressions are left to the
+// table that owns them.
 void free_ast(ASTNode *node) {
-    if (!node) return;
-    free_ast(node->left);
-    free_ast(node->right);
-    free(node);
+    while (node && !node->id) {
+        if (node->left && !node->left->id) {
+            ASTNode *left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+        } else {
+            ASTNode *next = node->right;
+            ast_index_remove(node);
+            free(node);
+            live_nodes--;
+            node = next;
+        }
+    }
+}
+
+// Return an AST's nodes to the parser's free list for reuse
+void recycle_ast(ASTNode *node) {
+    while (node && !node->id) {
+        if (node->left && !node->left->id) {
+            ASTNode *left = node->left;
+            node->left = left->right;
+            left->right = node;
+            node = left;
+        } else {
+            ASTNode *next = node->right;
+            ast_index_remove(node);
+            node->right = free_nodes;
+            free_nodes = node;
+            live_nodes--;
+            node = next;
+        }
+    }
+}
+
+// Release the calling thread's recycled and shared nodes
+void parser_release_nodes(void) {
+    release_shared_nodes();
+    while (free_nodes) {
+        ASTNode *next = free_nodes->right;
+        free(free_nodes);
+        free_nodes = next;
+    }
+    peak_live_nodes = live_nodes;
+}
+
+// Add the nodes the calling thread creates from now on to 'index', or
+// stop indexing with NULL
+void parser_set_index(ASTIndex *index) {
+    node_index = index;
+}
+
+// Change a node's type, moving it to the right list of the index
+void ast_set_type(ASTNode *node, ASTNodeType type) {
+    if (node_index) {
+        ast_index_retype(node_index, node, type);
+    } else {
+        ast_link_remove(&node->by_type);
+        node->type = type;
+    }
+}
+
+// Largest number of AST nodes alive at once since the last release
+long parser_peak_nodes(void) {
+    return peak_live_nodes;
+}
+
+// Read a whole file into a NUL-terminated buffer
+char *read_file(const char *filename, long *length) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    char *buffer = malloc(size + 1);
+    if (!buffer) {
+        fclose(file);
+        return NULL;
+    }
+    size_t len = fread(buffer, 1, size, file);
+    buffer[len] = '\0';
+    fclose(file);
+
+    *length = (long)len;
+    return buffer;
+}
+
+// Map a whole file read-only with a NUL terminator after the last byte.
+// The file is mapped over a reserved anonymous region one byte larger, so
+// the terminator is a zero page even when the size is page aligned.
+char *map_file(const char *filename, size_t *length) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *base = mmap(NULL, size + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (size > 0 &&
+        mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, size + 1);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    madvise(base, size, MADV_SEQUENTIAL);
+    *length = size;
+    return base;
+}
+
+void unmap_file(char *base, size_t length) {
+    munmap(base, length + 1);
 }
 
 /* Process test files */
 void proc_test_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        printf("Error: Could not open file %s\n", filename);
+    Writer *out = output_writer();
+    uint64_t span_start = trace_enabled() ? trace_clock() : 0;
+    long len = 0;
+    char *buffer = read_file(filename, &len);
+    if (!buffer) {
+        wr_printf(out, "Error: Could not open file %s\n", filename);
         return;
     }
+    if (span_start) trace_span("read", filename, span_start, len, 0, 0);
     
     // Reset everything for each file
     reset_parser_state();
     
-    char buffer[2048];
-    size_t len = fread(buffer, 1, sizeof(buffer) - 1, file);
-    buffer[len] = '\0';
-    fclose(file);
-    
-    printf("\n==============================\n");
-    printf("PARSING FILE: %s\n", filename);
-    printf("==============================\n");
-    printf("Input:\n%s\n\n", buffer);
+    wr_str(out, "\n==============================\n");
+    wr_printf(out, "PARSING FILE: %s\n", filename);
+    wr_str(out, "==============================\n");
+    wr_str(out, "Input:\n");
+    wr_str(out, buffer);
+    wr_str(out, "\n\n");
     
     // Reset error reporting state for each test file
-    last_reported_line = 0;
-    last_reported_column = 0;
     error_count = 0;
     
+    if (perf_enabled) {
+        perf_reset();
+    }
+
+    // The Lex counters cover a bare lexing pass; printing the stream formats
+    // and writes every token, which would swamp the lexer's own cost
+    if (perf_enabled) {
+        perf_begin(PERF_PHASE_LEX);
+        lex_tokens(buffer);
+        perf_end(PERF_PHASE_LEX);
+        reset_lexer();
+    }
+
     // First show token stream
-    printf("TOKEN STREAM:\n");
-    print_token_stream(buffer);
+    wr_str(out, "TOKEN STREAM:\n");
+    if (span_start) span_start = trace_clock();
+    int token_count = print_token_stream(buffer);
+    if (span_start) trace_span("tokenize", filename, span_start, len, token_count, lexer_error_count());
     
     // IMPORTANT FIX: Reset lexer state again after token stream printing
     reset_lexer();
     
     // Then parse and display AST
+    if (span_start) span_start = trace_clock();
+    if (perf_enabled) perf_begin(PERF_PHASE_PARSE);
     parser_init(buffer);
     ASTNode *ast = parse();
+    if (perf_enabled) perf_end(PERF_PHASE_PARSE);
+    if (span_start) trace_span("parse", filename, span_start, len, tokens_consumed, error_count);
+    diag_render(out, buffer, 0, 1, 1);
+
+    OptimizeStats optimize_stats = {0};
+    if (optimize_enabled) {
+        if (span_start) span_start = trace_clock();
+        ast = share_optimized(optimize_ast(ast, OPT_ALL, OPT_MAX_ITERATIONS, &optimize_stats));
+        if (span_start) trace_span("optimize", filename, span_start, len, 0, 0);
+    }
 
-    printf("\nABSTRACT SYNTAX TREE:\n");
+    wr_str(out, "\nABSTRACT SYNTAX TREE:\n");
+    if (span_start) span_start = trace_clock();
+    if (perf_enabled) perf_begin(PERF_PHASE_PRINT);
     print_ast(ast, 0);
+    if (perf_enabled) perf_end(PERF_PHASE_PRINT);
+    if (span_start) trace_span("print", filename, span_start, len, tokens_consumed, error_count);
     
     if (error_count > 0) {
-        printf("\nParsing completed with %d errors.\n", error_count);
+        wr_printf(out, "\nParsing completed with %d errors.\n", error_count);
     } else {
-        printf("\nParsing completed successfully with no errors.\n");
+        wr_str(out, "\nParsing completed successfully with no errors.\n");
+    }
+    if (optimize_enabled) {
+        optimize_report(out, &optimize_stats);
+    }
+    if (hashcons_enabled) {
+        hashcons_report(out, &shared_nodes);
+    }
+
+    if (perf_enabled) {
+        perf_report(token_count, count_ast_nodes(ast));
     }
     
-    printf("==============================\n");
+    wr_str(out, "==============================\n");
 
+    if (span_start) span_start = trace_clock();
     free_ast(ast);
+    free(buffer);
+    if (span_start) trace_span("free", filename, span_start, len, tokens_consumed, error_count);
 }
 
-// Main function for testing
-int main() {
-    // Test with both valid and invalid inputs
-    proc_test_file("../test/input_valid.txt");
-    proc_test_file("../test/input_invalid.txt");
+// Write each input as <file>.btok (--btok) or round-trip check it (--btok-check)
+static void proc_btok_file(const char *filename, int check) {
+    Writer *out = output_writer();
+    long len = 0;
+    char *buffer = read_file(filename, &len);
+    if (!buffer) {
+        wr_printf(out, "Error: Could not open file %s\n", filename);
+        return;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.btok", filename);
+    if (check) {
+        wr_printf(out, "%s:\n", filename);
+        btok_check(buffer, path);
+    } else if (btok_write_file(buffer, path, BTOK_FLAG_STRINGS) != 0) {
+        wr_printf(out, "Error: Could not write %s\n", path);
+    }
+    free(buffer);
+}
+
+// Serialization target passed through parse_program_streaming()
+typedef struct {
+    Writer *out;
+    SerializeFormat format;
+} SerializeStream;
+
+static ParseItemAction serialize_item(ASTNode *item, void *user) {
+    SerializeStream *stream = user;
+    if (optimize_enabled) {
+        // The optimizer may replace the item, so recycle the result here
+        OptimizeStats stats = {0};
+        item = share_optimized(optimize_ast(item, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+        if (!item) return PARSE_ITEM_KEEP;
+    }
+    serialize_ast(stream->out, item, stream->format);
+    wr_char(stream->out, '\n');
+    if (optimize_enabled) {
+        recycle_ast(item);
+        return PARSE_ITEM_KEEP;
+    }
+    return PARSE_ITEM_RECYCLE;
+}
+
+// Serialize each input's AST as JSON or S-expressions (--json, --sexpr).
+// With 'stream' set, each top-level item is written and recycled as soon as
+// it is parsed.  Diagnostics go to stderr so the output stays machine-readable.
+static void proc_serialize_file(const char *filename, SerializeFormat format, int stream) {
+    Writer *out = output_writer();
+    size_t len = 0;
+    char *buffer = map_file(filename, &len);
+    if (!buffer) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return;
+    }
+
+    Writer errors;
+    writer_init_fd(&errors, STDERR_FILENO);
+    set_output_writer(&errors);
+
+    reset_parser_state();
+    parser_init(buffer);
+    if (stream) {
+        SerializeStream target = {out, format};
+        parse_program_streaming(serialize_item, &target);
+        diag_render(&errors, buffer, 0, 1, 1);
+    } else {
+        ASTNode *ast = parse();
+        diag_render(&errors, buffer, 0, 1, 1);
+        if (optimize_enabled) {
+            OptimizeStats stats = {0};
+            ast = share_optimized(optimize_ast(ast, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+        }
+        serialize_ast(out, ast, format);
+        wr_char(out, '\n');
+        free_ast(ast);
+    }
+
+    set_output_writer(out);
+    writer_free(&errors);
+    unmap_file(buffer, len);
+}
+
+// Print one item under the Program header.  Unlike print_ast, items are not
+// nested one level deeper per statement, so output stays linear in size.
+static ParseItemAction print_item(ASTNode *item, void *user) {
+    if (optimize_enabled) {
+        OptimizeStats stats = {0};
+        item = share_optimized(optimize_ast(item, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+        write_ast(user, item, 1);
+        recycle_ast(item);
+        return PARSE_ITEM_KEEP;
+    }
+    write_ast(user, item, 1);
+    return PARSE_ITEM_RECYCLE;
+}
+
+// Parse a file in bounded memory and print its AST as items complete
+static void proc_stream_file(const char *filename) {
+    Writer *out = output_writer();
+    size_t len = 0;
+    char *buffer = map_file(filename, &len);
+    if (!buffer) {
+        wr_printf(out, "Error: Could not open file %s\n", filename);
+        return;
+    }
+
+    reset_parser_state();
+    wr_printf(out, "\nABSTRACT SYNTAX TREE: %s\n", filename);
+    wr_str(out, "Program\n");
+    parser_init(buffer);
+    parse_program_streaming(print_item, out);
+    diag_render(out, buffer, 0, 1, 1);
+
+    if (error_count > 0) {
+        wr_printf(out, "\nParsing completed with %d errors.\n", error_count);
+    } else {
+        wr_str(out, "\nParsing completed successfully with no errors.\n");
+    }
+    wr_printf(out, "Peak AST nodes: %ld\n", parser_peak_nodes());
+    if (hashcons_enabled) {
+        hashcons_report(out, &shared_nodes);
+    }
+
+    parser_release_nodes();
+    unmap_file(buffer, len);
+}
+
+// Node type with the name --json gives it, or -1
+static int node_type_named(const char *name) {
+    for (int type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        if (strcmp(ast_node_type_name(type), name) == 0) return type;
+    }
+    return -1;
+}
+
+// Parse (and optimize, with --optimize) a file, indexing its nodes and
+// rendering its diagnostics to the output writer
+static ASTNode *parse_indexed(const char *buffer, ASTIndex *index) {
+    reset_parser_state();
+    ast_index_init(index);
+    parser_set_index(index);
+    parser_init(buffer);
+    ASTNode *ast = parse();
+    diag_render(output_writer(), buffer, 0, 1, 1);
+    if (optimize_enabled) {
+        OptimizeStats stats = {0};
+        ast = share_optimized(optimize_ast(ast, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+    }
+    parser_set_index(NULL);
+    return ast;
+}
+
+// List the nodes of one type, or with '@name' the identifiers and calls
+// naming it, found through the AST index (--query).  Diagnostics go to
+// stderr.
+static void proc_query_file(const char *filename, const char *what) {
+    Writer *out = output_writer();
+    size_t len = 0;
+    char *buffer = map_file(filename, &len);
+    if (!buffer) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return;
+    }
+
+    Writer errors;
+    writer_init_fd(&errors, STDERR_FILENO);
+    set_output_writer(&errors);
+
+    ASTIndex index;
+    ASTNode *ast = parse_indexed(buffer, &index);
+    int found = 0;
+    int by_name = what[0] == '@';
+    ASTNode *node = by_name ? ast_index_first_use(&index, intern_cstr(what + 1))
+                            : ast_index_first(&index, node_type_named(what));
+    while (node) {
+        wr_printf(out, "%s:%d:%d: %s %s\n", filename, node->token.line, node->token.column,
+                  ast_node_type_name(node->type), node->token.lexeme);
+        found++;
+        node = by_name ? ast_index_next_use(&index, node) : ast_index_next(&index, node);
+    }
+    wr_printf(out, "%s: %d found\n", filename, found);
+
+    free_ast(ast);
+    release_shared_nodes();
+    ast_index_free(&index);
+    set_output_writer(out);
+    writer_free(&errors);
+    unmap_file(buffer, len);
+}
+
+// Growable list of nodes
+typedef struct {
+    ASTNode **nodes;
+    size_t count;
+    size_t capacity;
+} NodeList;
+
+static void node_list_push(NodeList *list, ASTNode *node) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->nodes = realloc(list->nodes, list->capacity * sizeof(ASTNode *));
+        if (!list->nodes) {
+            fprintf(stderr, "Error: Memory allocation failed for node list\n");
+            exit(1);
+        }
+    }
+    list->nodes[list->count++] = node;
+}
+
+static int compare_node_pointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(ASTNode *const *)a;
+    uintptr_t y = (uintptr_t)*(ASTNode *const *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sort a list and drop repeats, which shared expressions cause
+static void node_list_sort(NodeList *list) {
+    if (list->count == 0) {
+        return;
+    }
+    qsort(list->nodes, list->count, sizeof(ASTNode *), compare_node_pointers);
+    size_t unique = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (unique == 0 || list->nodes[unique - 1] != list->nodes[i]) {
+            list->nodes[unique++] = list->nodes[i];
+        }
+    }
+    list->count = unique;
+}
+
+static int node_lists_equal(const NodeList *a, const NodeList *b) {
+    return a->count == b->count &&
+           (a->count == 0 || memcmp(a->nodes, b->nodes, a->count * sizeof(ASTNode *)) == 0);
+}
+
+// Walk a tree without recursion, keeping the nodes of one type (all with -1)
+static void collect_nodes(ASTNode *root, int type, NodeList *found) {
+    NodeList stack = {0};
+    if (root) node_list_push(&stack, root);
+    while (stack.count > 0) {
+        ASTNode *node = stack.nodes[--stack.count];
+        if (type < 0 || node->type == (ASTNodeType)type) node_list_push(found, node);
+        if (node->right) node_list_push(&stack, node->right);
+        if (node->left) node_list_push(&stack, node->left);
+    }
+    free(stack.nodes);
+}
+
+static int is_name_use(const ASTNode *node) {
+    return (node->type == AST_IDENTIFIER || node->type == AST_FUNCTION_CALL) &&
+           node->token.sym != SYMBOL_NONE;
+}
+
+// Whether the index holds exactly the tree's nodes, each in the list of its
+// type, and its identifiers and calls in the uses of their names
+static int index_matches(const ASTIndex *index, ASTNode *ast) {
+    NodeList tree = {0}, uses = {0}, by_type = {0}, by_name = {0};
+    collect_nodes(ast, -1, &tree);
+    node_list_sort(&tree);
+    for (size_t i = 0; i < tree.count; i++) {
+        if (is_name_use(tree.nodes[i])) node_list_push(&uses, tree.nodes[i]);
+    }
+
+    int ok = 1;
+    for (int type = 0; type < AST_NODE_TYPE_COUNT; type++) {
+        for (ASTNode *node = ast_index_first(index, type); node; node = ast_index_next(index, node)) {
+            ok &= node->type == (ASTNodeType)type;
+            node_list_push(&by_type, node);
+        }
+    }
+    for (uint32_t name = 0; name < index->name_capacity; name++) {
+        for (ASTNode *node = ast_index_first_use(index, name); node; node = ast_index_next_use(index, node)) {
+            ok &= is_name_use(node) && node->token.sym == name;
+            node_list_push(&by_name, node);
+        }
+    }
+    size_t listed = by_type.count + by_name.count;
+    node_list_sort(&by_type);
+    node_list_sort(&by_name);
+    ok &= listed == by_type.count + by_name.count;     // No node listed twice
+    ok &= node_lists_equal(&tree, &by_type) && node_lists_equal(&uses, &by_name);
+
+    free(tree.nodes);
+    free(uses.nodes);
+    free(by_type.nodes);
+    free(by_name.nodes);
+    return ok;
+}
+
+// Check the AST index against walks of the tree after parsing, after
+// optimizing (with --optimize) and once the tree is freed, then time
+// parsing with and without it and listing the calls both ways (--index-check)
+static void check_index(const char *filename, const char *buffer, Writer *report) {
+    ASTIndex index;
+    ASTNode *ast = parse_indexed(buffer, &index);
+    const char *failed = index_matches(&index, ast) ? NULL : "after parsing";
+
+    // Walking the tree for the calls against reading their list
+    NodeList walked = {0};
+    uint64_t start = trace_clock();
+    collect_nodes(ast, AST_FUNCTION_CALL, &walked);
+    double walk_us = (trace_clock() - start) / 1e3;
+    int calls = 0;
+    start = trace_clock();
+    for (ASTNode *node = ast_index_first(&index, AST_FUNCTION_CALL); node; node = ast_index_next(&index, node)) {
+        calls++;
+    }
+    double index_us = (trace_clock() - start) / 1e3;
+    free(walked.nodes);
+    int node_count = count_ast_nodes(ast);
+
+    free_ast(ast);
+    release_shared_nodes();
+    if (!failed && !index_matches(&index, NULL)) {
+        failed = "once the tree was freed";
+    }
+    ast_index_free(&index);
+
+    // Best of three, alternating; the parse errors are not rendered again
+    double ms[2] = {0, 0};
+    for (int round = 0; round < 3; round++) {
+        for (int indexed = 0; indexed < 2; indexed++) {
+            reset_parser_state();
+            ast_index_init(&index);
+            parser_set_index(indexed ? &index : NULL);
+            start = trace_clock();
+            parser_init(buffer);
+            ast = parse();
+            double elapsed = (trace_clock() - start) / 1e6;
+            parser_set_index(NULL);
+            if (round == 0 || elapsed < ms[indexed]) ms[indexed] = elapsed;
+            free_ast(ast);
+            release_shared_nodes();
+            ast_index_free(&index);
+        }
+    }
+
+    if (failed) {
+        wr_printf(report, "%s: index MISMATCH %s\n", filename, failed);
+    } else {
+        wr_printf(report, "%s: index matches the tree (%d nodes, %d calls); parse %.2f ms indexed, "
+                  "%.2f ms without; calls listed in %.1f us, %.1f us walking the tree\n",
+                  filename, node_count, calls, ms[1], ms[0], index_us, walk_us);
+    }
+}
+
+// Run check_index over a file, sending parse errors to stderr
+static void proc_index_check_file(const char *filename) {
+    Writer *out = output_writer();
+    size_t len = 0;
+    char *buffer = map_file(filename, &len);
+    if (!buffer) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return;
+    }
+    Writer errors;
+    writer_init_fd(&errors, STDERR_FILENO);
+    set_output_writer(&errors);
+    check_index(filename, buffer, out);
+    set_output_writer(out);
+    writer_free(&errors);
+    unmap_file(buffer, len);
+}
+
+// What proc_run_file does with each compiled program
+enum {
+    RUN_NONE, RUN_EXECUTE, RUN_DISASSEMBLE, RUN_JIT_CHECK, RUN_EMIT_C, RUN_EMIT_C_CHECK,
+    RUN_SSA_DUMP, RUN_SSA_CHECK, RUN_BATCH, RUN_PROFILE, RUN_IMAGE, RUN_IMAGE_CHECK,
+    RUN_SUPEROPS_TRAIN, RUN_FUSE_CHECK
+};
+
+// Compile a resolved program to bytecode, through the optimized SSA form
+// with --ssa; returns the number of compile errors
+static int compile_program(ASTNode *ast, int vm_flags, BytecodeProgram *program, Writer *errors) {
+    if (!ssa_enabled) {
+        return vm_compile(ast, vm_flags, program, errors);
+    }
+    SsaProgram ssa;
+    int compile_errors = ssa_lower(ast, vm_flags, &ssa, errors);
+    if (compile_errors == 0) {
+        SsaStats stats = {0};
+        ssa_optimize(&ssa, ssa_passes, &stats, NULL);
+        ssa_codegen(&ssa, program);
+    } else {
+        memset(program, 0, sizeof(*program));
+    }
+    ssa_program_free(&ssa);
+    return compile_errors;
+}
+
+// Print the optimized SSA form of a program, verifying it before and
+// after each pass (--ssa-dump)
+static void dump_ssa(ASTNode *ast, int vm_flags, Writer *out, Writer *errors) {
+    SsaProgram ssa;
+    if (ssa_lower(ast, vm_flags, &ssa, errors) == 0 && ssa_verify(&ssa, errors) == 0) {
+        SsaStats stats = {0};
+        ssa_optimize(&ssa, ssa_passes, &stats, errors);
+        ssa_report(out, &stats);
+        ssa_dump(out, &ssa);
+    }
+    ssa_program_free(&ssa);
+}
+
+// Run a program compiled directly and compiled through the SSA form, and
+// compare output and runtime errors (--ssa-check).  The SSA form is
+// verified after lowering and after each pass.
+static void check_ssa(const char *filename, ASTNode *ast, const BytecodeProgram *program,
+                      int vm_flags, Writer *report) {
+    SsaProgram ssa;
+    Writer verify;
+    writer_init_memory(&verify);
+    int problems = ssa_lower(ast, vm_flags, &ssa, &verify);
+    problems += ssa_verify(&ssa, &verify);
+    if (problems > 0) {
+        wr_printf(report, "%s: SSA FAILED before optimization\n", filename);
+        wr_bytes(report, verify.data, verify.len);
+        writer_free(&verify);
+        ssa_program_free(&ssa);
+        return;
+    }
+    SsaStats stats = {0};
+    problems = ssa_optimize(&ssa, ssa_passes, &stats, &verify);
+    if (problems > 0) {
+        wr_printf(report, "%s: SSA FAILED in optimization\n", filename);
+        wr_bytes(report, verify.data, verify.len);
+        writer_free(&verify);
+        ssa_program_free(&ssa);
+        return;
+    }
+    writer_free(&verify);
+
+    BytecodeProgram optimized;
+    ssa_codegen(&ssa, &optimized);
+    ssa_program_free(&ssa);
+
+    Writer out[2], errors[2];
+    const BytecodeProgram *programs[2] = {program, &optimized};
+    for (int i = 0; i < 2; i++) {
+        writer_init_memory(&out[i]);
+        writer_init_memory(&errors[i]);
+        vm_run(programs[i], NULL, &out[i], &errors[i], NULL);
+    }
+
+    int same_out = out[0].len == out[1].len && memcmp(out[0].data, out[1].data, out[0].len) == 0;
+    int same_errors = errors[0].len == errors[1].len &&
+                      memcmp(errors[0].data, errors[1].data, errors[0].len) == 0;
+    if (same_out && same_errors) {
+        wr_printf(report, "%s: SSA output matches interpreter (%d bytecode words, was %d)\n",
+                  filename, optimized.code_length, program->code_length);
+    } else {
+        wr_printf(report, "%s: SSA MISMATCH in %s\n", filename,
+                  same_out ? "runtime errors" : "program output");
+    }
+    for (int i = 0; i < 2; i++) {
+        writer_free(&out[i]);
+        writer_free(&errors[i]);
+    }
+    vm_program_free(&optimized);
+}
+
+// Run a program interpreted and again with every function compiled on its
+// first call, and compare output and runtime errors (--jit-check)
+static void check_jit(const char *filename, const BytecodeProgram *program, Writer *report) {
+    Writer out[2], errors[2];
+    int compiled = 0;
+    VMOptions options[2] = {{0, 0, NULL}, {1, 1, &compiled}};
+    for (int i = 0; i < 2; i++) {
+        writer_init_memory(&out[i]);
+        writer_init_memory(&errors[i]);
+        vm_run(program, &options[i], &out[i], &errors[i], NULL);
+    }
+
+    int same_out = out[0].len == out[1].len && memcmp(out[0].data, out[1].data, out[0].len) == 0;
+    int same_errors = errors[0].len == errors[1].len &&
+                      memcmp(errors[0].data, errors[1].data, errors[0].len) == 0;
+    if (same_out && same_errors) {
+        wr_printf(report, "%s: JIT output matches interpreter (%d of %d functions compiled)\n",
+                  filename, compiled, program->function_count);
+    } else {
+        wr_printf(report, "%s: JIT MISMATCH in %s\n", filename,
+                  same_out ? "runtime errors" : "program output");
+    }
+    for (int i = 0; i < 2; i++) {
+        writer_free(&out[i]);
+        writer_free(&errors[i]);
+    }
+}
+
+// Run a program without superinstructions and count the stretches of
+// instructions it executes back to back (--superops-train).  Its output is
+// dropped; runtime errors are reported.
+static void train_superops(const BytecodeProgram *program, Writer *errors) {
+    Writer out;
+    writer_init_memory(&out);
+    VMOptions options = {0};
+    options.no_fuse = 1;
+    options.counts = &superop_counts;
+    superop_counts.next_offset = -1;
+    vm_run(program, &options, &out, errors, NULL);
+    writer_free(&out);
+}
+
+// Write the superinstructions chosen from every input's stretches to
+// superops_path and list them
+static void write_superops(Writer *report) {
+    int fd = open(superops_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not write %s\n", superops_path);
+        return;
+    }
+    Writer header;
+    writer_init_fd(&header, fd);
+    superop_write_header(&header, report, &superop_counts, SUPEROP_DEFAULT_COUNT);
+    writer_free(&header);
+    close(fd);
+    wr_printf(report, "wrote %s; rebuild to use it\n", superops_path);
+}
+
+// Run a program without and with superinstructions, counting dispatches,
+// then time each run uncounted; report whether output and runtime errors
+// match (--fuse-check)
+static void check_fuse(const char *filename, const BytecodeProgram *program, Writer *report) {
+    Writer out[2], errors[2];
+    VMCounts counts[2];
+    VMOptions options[2] = {{0}, {0}};
+    options[0].no_fuse = 1;
+    for (int i = 0; i < 2; i++) {
+        writer_init_memory(&out[i]);
+        writer_init_memory(&errors[i]);
+        superop_counts_init(&counts[i], 0);
+        options[i].counts = &counts[i];
+        vm_run(program, &options[i], &out[i], &errors[i], NULL);
+    }
+    int same_out = out[0].len == out[1].len && memcmp(out[0].data, out[1].data, out[0].len) == 0;
+    int same_errors = errors[0].len == errors[1].len &&
+                      memcmp(errors[0].data, errors[1].data, errors[0].len) == 0;
+
+    // Best of three, alternating
+    double ms[2] = {0, 0};
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 2; i++) {
+            options[i].counts = NULL;
+            writer_reset(&out[i]);
+            writer_reset(&errors[i]);
+            uint64_t start = trace_clock();
+            vm_run(program, &options[i], &out[i], &errors[i], NULL);
+            double elapsed = (trace_clock() - start) / 1e6;
+            if (round == 0 || elapsed < ms[i]) ms[i] = elapsed;
+        }
+    }
+
+    if (same_out && same_errors) {
+        unsigned long long before = counts[0].dispatches;
+        unsigned long long after = counts[1].dispatches;
+        wr_printf(report, "%s: superinstruction output matches (dispatches %llu -> %llu, %.1f%% fewer; "
+                  "%.2f ms -> %.2f ms, %.2fx)\n", filename, before, after,
+                  before ? 100.0 * (before - after) / before : 0.0, ms[0], ms[1],
+                  ms[1] > 0 ? ms[0] / ms[1] : 0.0);
+    } else {
+        wr_printf(report, "%s: superinstruction MISMATCH in %s\n", filename,
+                  same_out ? "runtime errors" : "program output");
+    }
+    for (int i = 0; i < 2; i++) {
+        writer_free(&out[i]);
+        writer_free(&errors[i]);
+        superop_counts_free(&counts[i]);
+    }
+}
+
+// Save a program as a bytecode image, load it back through the verifier
+// and compare its output and runtime errors with the program's (--image-check)
+static void check_image(const char *filename, const BytecodeProgram *program, Writer *report) {
+    char path[] = "/tmp/bimageXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        wr_printf(report, "%s: Could not create an image file\n", filename);
+        return;
+    }
+    close(fd);
+    Writer load_errors;
+    writer_init_memory(&load_errors);
+    BytecodeImage image;
+    if (image_write(program, path, &load_errors) != 0 || image_open(&image, path, &load_errors) != 0) {
+        wr_printf(report, "%s: image FAILED to load\n", filename);
+        wr_bytes(report, load_errors.data, load_errors.len);
+        writer_free(&load_errors);
+        unlink(path);
+        return;
+    }
+    writer_free(&load_errors);
+
+    Writer out[2], errors[2];
+    const BytecodeProgram *programs[2] = {program, &image.program};
+    for (int i = 0; i < 2; i++) {
+        writer_init_memory(&out[i]);
+        writer_init_memory(&errors[i]);
+        vm_run(programs[i], NULL, &out[i], &errors[i], NULL);
+    }
+    int same_out = out[0].len == out[1].len && memcmp(out[0].data, out[1].data, out[0].len) == 0;
+    int same_errors = errors[0].len == errors[1].len &&
+                      memcmp(errors[0].data, errors[1].data, errors[0].len) == 0;
+    if (same_out && same_errors) {
+        wr_printf(report, "%s: image output matches bytecode (%zu bytes)\n", filename, image.size);
+    } else {
+        wr_printf(report, "%s: image MISMATCH in %s\n", filename,
+                  same_out ? "runtime errors" : "program output");
+    }
+    for (int i = 0; i < 2; i++) {
+        writer_free(&out[i]);
+        writer_free(&errors[i]);
+    }
+    image_close(&image);
+    unlink(path);
+}
+
+// Run, list or JIT-check a bytecode image (see --image) without parsing
+static void run_image(const char *filename, const char *data, size_t len, int run_mode,
+                      const VMOptions *options, Writer *out, Writer *errors) {
+    uint64_t span_start = trace_enabled() ? trace_clock() : 0;
+    BytecodeImage image;
+    int loaded = image_load(&image, data, len, filename, errors);
+    if (span_start) trace_span("load", filename, span_start, len, image.program.code_length, loaded != 0);
+    if (loaded != 0) {
+        wr_printf(errors, "%s: not run\n", filename);
+        return;
+    }
+
+    if (run_mode == RUN_DISASSEMBLE) {
+        vm_disassemble(out, &image.program);
+    } else if (run_mode == RUN_JIT_CHECK) {
+        check_jit(filename, &image.program, out);
+    } else if (run_mode == RUN_EXECUTE) {
+        if (span_start) span_start = trace_clock();
+        vm_run(&image.program, options, out, errors, NULL);
+        if (span_start) trace_span("run", filename, span_start, len, 0, 0);
+    } else {
+        wr_printf(errors, "%s: is a bytecode image; only --run, --disasm and --jit-check take one\n",
+                  filename);
+    }
+    image_close(&image);
+}
+
+// Evaluate batch_function over generated argument columns with each batch
+// instruction set this CPU supports and, one call per row, with the VM;
+// report the times and whether results and failing rows match (--batch)
+static void check_batch(const char *filename, ASTNode *ast, const BytecodeProgram *program,
+                        const VMOptions *options, Writer *report) {
+    ASTNode *decl = NULL;
+    for (ASTNode *link = ast; link && link->type == AST_PROGRAM; link = link->right) {
+        if (link->left && link->left->type == AST_FUNCTION_DECL &&
+            strcmp(link->left->token.lexeme, batch_function) == 0) {
+            decl = link->left;
+        }
+    }
+    int function = -1;
+    for (int i = 0; i < program->function_count; i++) {
+        if (strcmp(symbol_name(program->functions[i].name), batch_function) == 0) {
+            function = i;
+        }
+    }
+    if (!decl || function < 0) {
+        wr_printf(report, "%s: no function '%s'\n", filename, batch_function);
+        return;
+    }
+
+    Writer errors;
+    writer_init_memory(&errors);
+    BatchKernel kernel;
+    if (batch_compile(decl, &kernel, &errors) > 0) {
+        wr_printf(report, "%s: '%s' cannot be batched\n", filename, batch_function);
+        wr_bytes(report, errors.data, errors.len);
+        writer_free(&errors);
+        batch_free(&kernel);
+        return;
+    }
+
+    // Arguments are mostly small, with zeros and full-range values mixed in
+    size_t rows = batch_rows;
+    long long **columns = malloc((kernel.params + 1) * sizeof(long long *));
+    long long *results[2] = {malloc(rows * sizeof(long long)), malloc(rows * sizeof(long long))};
+    unsigned char *failed[2] = {malloc(rows), malloc(rows)};
+    if (!columns || !results[0] || !results[1] || !failed[0] || !failed[1]) {
+        fprintf(stderr, "Error: Memory allocation failed for batch rows\n");
+        exit(1);
+    }
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (int p = 0; p < kernel.params; p++) {
+        columns[p] = malloc(rows * sizeof(long long));
+        if (!columns[p]) {
+            fprintf(stderr, "Error: Memory allocation failed for batch rows\n");
+            exit(1);
+        }
+        for (size_t row = 0; row < rows; row++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            columns[p][row] = row % 61 == 0 ? (long long)state : (long long)((state >> 33) % 2001) - 1000;
+        }
+    }
+
+    uint64_t start = trace_clock();
+    size_t failures = vm_call_rows(program, options, function, (const long long *const *)columns, rows,
+                                   results[0], failed[0], &errors);
+    double vm_ms = (trace_clock() - start) / 1e6;
+    wr_printf(report, "%s: %s over %zu rows (%zu fail): VM %.1f ms", filename, batch_function,
+              rows, failures, vm_ms);
+
+    const char *mismatch = NULL;
+    size_t mismatch_row = 0;
+    for (BatchIsa isa = 0; isa < BATCH_ISA_COUNT; isa++) {
+        if (!batch_isa_supported(isa)) {
+            continue;
+        }
+        start = trace_clock();
+        batch_run(&kernel, isa, (const long long *const *)columns, rows, results[1], failed[1]);
+        double ms = (trace_clock() - start) / 1e6;
+        wr_printf(report, ", %s %.1f ms (%.1fx)", batch_isa_name(isa), ms, ms > 0 ? vm_ms / ms : 0);
+        for (size_t row = 0; row < rows && !mismatch; row++) {
+            if (failed[0][row] != failed[1][row] || results[0][row] != results[1][row]) {
+                mismatch = batch_isa_name(isa);
+                mismatch_row = row;
+            }
+        }
+    }
+    wr_str(report, "\n");
+    if (mismatch) {
+        wr_printf(report, "%s: BATCH MISMATCH (%s) at row %zu: batch %lld%s, VM %lld%s\n", filename,
+                  mismatch, mismatch_row, results[1][mismatch_row], failed[1][mismatch_row] ? " failed" : "",
+                  results[0][mismatch_row], failed[0][mismatch_row] ? " failed" : "");
+    } else {
+        wr_printf(report, "%s: batch results match VM\n", filename);
+    }
+
+    for (int p = 0; p < kernel.params; p++) {
+        free(columns[p]);
+    }
+    free(columns);
+    for (int i = 0; i < 2; i++) {
+        free(results[i]);
+        free(failed[i]);
+    }
+    writer_free(&errors);
+    batch_free(&kernel);
+}
+
+// Write one profile output to 'path'; returns 0 on success
+static int write_profile_file(const Profile *profile, const char *filename, const char *path,
+                              void (*write)(Writer *, const Profile *, const char *), Writer *errors) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        wr_printf(errors, "Error: Could not write %s\n", path);
+        return -1;
+    }
+    Writer file;
+    writer_init_fd(&file, fd);
+    write(&file, profile, filename);
+    writer_free(&file);
+    close(fd);
     return 0;
+}
+
+// Run a program compiled with VM_PROFILE under the sampling profiler,
+// list its hottest statements and write <file>.folded (collapsed stacks)
+// and <file>.callgrind (--profile)
+static void profile_program(const char *filename, const BytecodeProgram *program,
+                            const VMOptions *options, Writer *out, Writer *errors) {
+    Profile profile;
+    if (profile_init(&profile, program, profile_hz) != 0) {
+        wr_printf(errors, "Error: Sampling rate %d Hz is out of range\n", profile_hz);
+        return;
+    }
+    VMOptions profiled = *options;
+    profiled.profile = &profile;
+    if (profile_start(&profile) != 0) {
+        wr_printf(errors, "%s: could not start the profiling timer, counting hits only\n", filename);
+    }
+    vm_run(program, &profiled, out, errors, NULL);
+    profile_stop(&profile);
+    writer_flush(out);
+
+    profile_report(out, &profile, filename, PROFILE_REPORT_ROWS);
+    char folded[4096];
+    char callgrind[4096];
+    snprintf(folded, sizeof(folded), "%s.folded", filename);
+    snprintf(callgrind, sizeof(callgrind), "%s.callgrind", filename);
+    if (write_profile_file(&profile, filename, folded, profile_write_folded, errors) == 0 &&
+        write_profile_file(&profile, filename, callgrind, profile_write_callgrind, errors) == 0) {
+        wr_printf(out, "%s: wrote %s and %s\n", filename, folded, callgrind);
+    }
+    profile_free(&profile);
+}
+
+// Translate a parsed input to C in 'path'; returns 0 on success
+static int write_c_file(ASTNode *ast, const char *filename, const char *path, Writer *errors) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        wr_printf(errors, "Error: Could not write %s\n", path);
+        return -1;
+    }
+    Writer c_out;
+    writer_init_fd(&c_out, fd);
+    int compile_errors = cgen_emit(ast, filename, path, &c_out, errors);
+    writer_free(&c_out);
+    close(fd);
+    if (compile_errors > 0) {
+        wr_printf(errors, "%s: not translated, %d compile errors\n", filename, compile_errors);
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+// Build and run the C translation of a program and compare its output and
+// runtime errors with the interpreter's (--emit-c-check)
+static void check_c(const char *filename, const BytecodeProgram *program, const char *c_path,
+                    Writer *report) {
+    Writer out[2], errors[2];
+    for (int i = 0; i < 2; i++) {
+        writer_init_memory(&out[i]);
+        writer_init_memory(&errors[i]);
+    }
+    vm_run(program, NULL, &out[0], &errors[0], NULL);
+    int status = cgen_build_and_run(c_path, &out[1], &errors[1]);
+
+    int same_out = out[0].len == out[1].len && memcmp(out[0].data, out[1].data, out[0].len) == 0;
+    int same_errors = errors[0].len == errors[1].len &&
+                      memcmp(errors[0].data, errors[1].data, errors[0].len) == 0;
+    if (status < 0) {
+        wr_printf(report, "%s: C build FAILED\n", filename);
+        wr_bytes(report, errors[1].data, errors[1].len);
+    } else if (status == 128 + SIGALRM) {
+        wr_printf(report, "%s: C program timed out after %d seconds\n", filename, CGEN_RUN_TIMEOUT);
+    } else if (status > 128) {
+        wr_printf(report, "%s: C program ended by signal %d\n", filename, status - 128);
+    } else if (same_out && same_errors) {
+        wr_printf(report, "%s: C output matches interpreter\n", filename);
+    } else {
+        wr_printf(report, "%s: C MISMATCH in %s\n", filename,
+                  same_out ? "runtime errors" : "program output");
+    }
+    for (int i = 0; i < 2; i++) {
+        writer_free(&out[i]);
+        writer_free(&errors[i]);
+    }
+}
+
+// Compile each input to bytecode and run it (--run), list the bytecode
+// (--disasm), compare the JIT with the interpreter (--jit-check), or
+// translate it to <file>.c (--emit-c) and check the translation
+// (--emit-c-check), print or check the SSA form (--ssa-dump,
+// --ssa-check), evaluate one function over many rows (--batch), or run
+// it under the profiler (--profile), save it as <file>.bci (--image) and
+// check the image (--image-check), or count instruction stretches for
+// superinstructions (--superops-train) and compare the interpreter with
+// and without them (--fuse-check).  Bytecode images are recognized
+// by their header and run without parsing.  Program output goes to the
+// output writer; diagnostics go to stderr.  Inputs with lexical or parse
+// errors are not run.
+static void proc_run_file(const char *filename, int vm_flags, int run_mode, const VMOptions *options) {
+    Writer *out = output_writer();
+    size_t len = 0;
+    char *buffer = map_file(filename, &len);
+    if (!buffer) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return;
+    }
+
+    Writer errors;
+    writer_init_fd(&errors, STDERR_FILENO);
+    set_output_writer(&errors);
+
+    if (image_is_image(buffer, len)) {
+        run_image(filename, buffer, len, run_mode, options, out, &errors);
+        writer_flush(out);
+        set_output_writer(out);
+        writer_free(&errors);
+        unmap_file(buffer, len);
+        return;
+    }
+
+    uint64_t span_start = trace_enabled() ? trace_clock() : 0;
+    reset_parser_state();
+    parser_init(buffer);
+    ASTNode *ast = parse();
+    diag_render(&errors, buffer, 0, 1, 1);
+    if (optimize_enabled) {
+        OptimizeStats stats = {0};
+        ast = share_optimized(optimize_ast(ast, OPT_ALL, OPT_MAX_ITERATIONS, &stats));
+    }
+    if (span_start) trace_span("parse", filename, span_start, len, tokens_consumed, error_count);
+
+    // The lexer drops tokens it rejects, so a file with lexical errors is a
+    // different program from the one written; refuse it like a parse error
+    int lex_errors = lexer_error_count();
+    int refused = error_count > 0 || lex_errors > 0;
+
+    // The C check builds in a private directory, translating before the
+    // AST is freed
+    char c_dir[] = "/tmp/bcheckXXXXXX";
+    char c_path[4096] = "";
+    int made_dir = 0;
+    if (!refused && run_mode == RUN_EMIT_C_CHECK) {
+        const char *base = strrchr(filename, '/');
+        if (!mkdtemp(c_dir)) {
+            wr_printf(&errors, "Error: Could not create a directory for %s\n", filename);
+        } else {
+            made_dir = 1;
+            snprintf(c_path, sizeof(c_path), "%s/%s.c", c_dir, base ? base + 1 : filename);
+            if (write_c_file(ast, filename, c_path, &errors) != 0) {
+                c_path[0] = '\0';
+            }
+        }
+    }
+
+    if (lex_errors > 0) {
+        wr_printf(&errors, "%s: not run, %d lexical errors, %d parse errors\n",
+                  filename, lex_errors, error_count);
+    } else if (refused) {
+        wr_printf(&errors, "%s: not run, %d parse errors\n", filename, error_count);
+    } else if (run_mode == RUN_EMIT_C) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.c", filename);
+        write_c_file(ast, filename, path, &errors);
+    } else if (run_mode == RUN_EMIT_C_CHECK && !c_path[0]) {
+        // Already reported
+    } else if (run_mode == RUN_SSA_DUMP) {
+        dump_ssa(ast, vm_flags, out, &errors);
+    } else {
+        BytecodeProgram program;
+        if (span_start) span_start = trace_clock();
+        // Profiled code is compiled directly, so statements keep their markers
+        int compile_errors = run_mode == RUN_SSA_CHECK ? vm_compile(ast, vm_flags, &program, &errors)
+                           : run_mode == RUN_PROFILE ? vm_compile(ast, vm_flags | VM_PROFILE, &program, &errors)
+                           : compile_program(ast, vm_flags, &program, &errors);
+        if (span_start) trace_span("compile", filename, span_start, len, program.code_length, compile_errors);
+        if (run_mode != RUN_SSA_CHECK && run_mode != RUN_BATCH) {
+            free_ast(ast);
+            ast = NULL;
+        }
+
+        if (compile_errors > 0) {
+            wr_printf(&errors, "%s: not run, %d compile errors\n", filename, compile_errors);
+        } else if (run_mode == RUN_SSA_CHECK) {
+            check_ssa(filename, ast, &program, vm_flags, out);
+        } else if (run_mode == RUN_BATCH) {
+            check_batch(filename, ast, &program, options, out);
+        } else if (run_mode == RUN_PROFILE) {
+            profile_program(filename, &program, options, out, &errors);
+        } else if (run_mode == RUN_DISASSEMBLE) {
+            vm_disassemble(out, &program);
+        } else if (run_mode == RUN_JIT_CHECK) {
+            check_jit(filename, &program, out);
+        } else if (run_mode == RUN_EMIT_C_CHECK) {
+            check_c(filename, &program, c_path, out);
+        } else if (run_mode == RUN_IMAGE) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s.bci", filename);
+            image_write(&program, path, &errors);
+        } else if (run_mode == RUN_IMAGE_CHECK) {
+            check_image(filename, &program, out);
+        } else if (run_mode == RUN_SUPEROPS_TRAIN) {
+            train_superops(&program, &errors);
+        } else if (run_mode == RUN_FUSE_CHECK) {
+            check_fuse(filename, &program, out);
+        } else {
+            if (span_start) span_start = trace_clock();
+            vm_run(&program, options, out, &errors, NULL);
+            if (span_start) trace_span("run", filename, span_start, len, 0, 0);
+        }
+        vm_program_free(&program);
+    }
+
+    if (c_path[0]) {
+        unlink(c_path);
+    }
+    if (made_dir) {
+        rmdir(c_dir);
+    }
+    free_ast(ast);
+    writer_flush(out);
+    set_output_writer(out);
+    writer_free(&errors);
+    unmap_file(buffer, len);
+}
+
+// Output file descriptor (--output), stdout by default
+static int output_fd = STDOUT_FILENO;
+
+// Largest --jobs value accepted; run_jobs further caps the worker threads
+// at JOBS_PER_CPU per online CPU
+#define MAX_JOBS 1024
+#define JOBS_PER_CPU 4
+
+// Work queue shared by --jobs worker threads.  A finished file's output
+// waits in job_outputs until every file before it has been written, so the
+// output follows the order of the arguments, not the order files finish.
+static char **job_files;
+static int job_count;
+static atomic_int next_job;
+static Writer *job_outputs;
+static unsigned char *job_done;
+static int next_output;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Worker thread: process files from the queue, capturing each file's
+// output in memory and writing it to the output fd as one block
+static void *job_worker(void *arg) {
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", (int)(long)arg);
+    trace_thread_name(name);
+
+    for (;;) {
+        int index = atomic_fetch_add(&next_job, 1);
+        if (index >= job_count) {
+            break;
+        }
+
+        Writer capture;
+        writer_init_memory(&capture);
+        set_output_writer(&capture);
+        proc_test_file(job_files[index]);
+        set_output_writer(NULL);
+
+        uint64_t span_start = trace_enabled() ? trace_clock() : 0;
+        long written = 0;
+        pthread_mutex_lock(&output_lock);
+        job_outputs[index] = capture;
+        job_done[index] = 1;
+        while (next_output < job_count && job_done[next_output]) {
+            Writer *ready = &job_outputs[next_output++];
+            Writer target = {ready->data, ready->len, ready->cap, output_fd, 0};
+            writer_flush(&target);
+            written += (long)ready->len;
+            writer_free(ready);
+        }
+        pthread_mutex_unlock(&output_lock);
+        if (span_start) trace_span("output", job_files[index], span_start, written, 0, 0);
+    }
+
+    parser_release_nodes();
+    diag_free();
+    scope_end();
+    return NULL;
+}
+
+// Process files on 'jobs' worker threads, but never more threads than
+// files or than a few per online CPU
+static void run_jobs(char **files, int count, int jobs) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && jobs > cpus * JOBS_PER_CPU) jobs = (int)(cpus * JOBS_PER_CPU);
+    if (jobs > count) jobs = count > 0 ? count : 1;
+    pthread_t *threads = malloc((size_t)jobs * sizeof(pthread_t));
+    int started = 0;
+
+    job_files = files;
+    job_count = count;
+    job_outputs = calloc(count > 0 ? count : 1, sizeof(Writer));
+    job_done = calloc(count > 0 ? count : 1, 1);
+    next_output = 0;
+    atomic_store(&next_job, 0);
+    if (!job_outputs || !job_done) {
+        fprintf(stderr, "Error: Memory allocation failed for --jobs\n");
+        exit(1);
+    }
+
+    for (int i = 0; threads && i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, job_worker, (void *)(long)i) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // Could not start any worker, process on this thread
+        job_worker((void *)0L);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(job_outputs);
+    free(job_done);
+    job_outputs = NULL;
+    job_done = NULL;
+}
+
+// Parse the value of integer option 'flag', which must be a decimal
+// number from 'min' to 'max'.  Reports a usage error and returns 0 if not.
+static int parse_int_option(const char *flag, const char *arg, long long min, long long max,
+                            long long *value) {
+    char *end;
+    errno = 0;
+    long long parsed = strtoll(arg, &end, 10);
+    if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno == ERANGE ||
+        parsed < min || parsed > max) {
+        fprintf(stderr, "Error: %s needs an integer from %lld to %lld, not '%s'\n", flag, min, max, arg);
+        return 0;
+    }
+    *value = parsed;
+    return 1;
+}
+
+// Main function for testing
+// Usage: parser [--perf] [--trace out.json] [--jobs N] [--output file]
+//               [--btok | --btok-check] [--json | --sexpr] [--stream] [--resolve] [--optimize]
+//               [--hashcons] [--query TYPE | --query @NAME | --index-check]
+//               [--symindex INDEX [--find-decl NAME] [--find-calls NAME] [--symindex-check]]
+//               [--serve SOCKET | --send SOCKET | --loadgen SOCKET [--requests N]]
+//               [--op tokenize|parse|dump] [--by-path]
+//               [--lsp [--lsp-record FILE] | --lsp-replay SESSION [--replay-speed X]]
+//               [--lsp-debounce MS] [--lsp-check]
+//               [--max-errors N] [--max-errors-per-code N]
+//               [--run | --disasm | --jit-check | --emit-c | --emit-c-check] [--bigint] [--jit]
+//               [--ssa-dump | --ssa-check] [--ssa] [--ssa-passes LIST]
+//               [--batch NAME] [--batch-rows N] [--profile] [--profile-hz N]
+//               [files...]
+//        parser --factorial N
+int main(int argc, char *argv[]) {
+    static char *default_files[] = {"../test/input_valid.txt", "../test/input_invalid.txt"};
+    int file_count = 0;
+    int jobs = 1;
+    int btok_mode = 0;
+    int serialize_mode = 0;
+    int stream = 0;
+    int run_mode = RUN_NONE;
+    int vm_flags = 0;
+    const char *query = NULL;
+    int index_check = 0;
+    const char *symindex_path = NULL;
+    const char *find_decl = NULL;
+    const char *find_calls = NULL;
+    int symindex_check = 0;
+    int server_mode = 0;
+    const char *socket_path = NULL;
+    int request_op = SERVE_PARSE;
+    int request_flags = 0;
+    long request_count = 10000;
+    int lsp_mode = 0;
+    LspOptions lsp_options = {0, 0, NULL};
+    const char *lsp_session = NULL;
+    char *lsp_debounce = NULL;
+    double replay_speed = 1.0;
+    DiagLimits diag_limits = {DIAG_DEFAULT_PER_FILE, DIAG_DEFAULT_PER_CODE};
+    int status = 0;
+    VMOptions vm_options = {0};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--perf") == 0) {
+            perf_enabled = 1;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_init(argv[++i]);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            long long value;
+            if (!parse_int_option("--jobs", argv[++i], 1, MAX_JOBS, &value)) {
+                return 1;
+            }
+            jobs = (int)value;
+        } else if (strcmp(argv[i], "--btok") == 0) {
+            btok_mode = 1;
+        } else if (strcmp(argv[i], "--btok-check") == 0) {
+            btok_mode = 2;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            serialize_mode = 1;
+        } else if (strcmp(argv[i], "--sexpr") == 0) {
+            serialize_mode = 2;
+        } else if (strcmp(argv[i], "--factorial") == 0 && i + 1 < argc) {
+            // Exact n! using the arbitrary-precision path
+            const char *arg = argv[++i];
+            char *end;
+            errno = 0;
+            unsigned long long n = strtoull(arg, &end, 10);
+            if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno == ERANGE) {
+                fprintf(stderr, "Error: --factorial needs a non-negative integer, not '%s'\n", arg);
+                return 1;
+            }
+            char *digits = n <= ULONG_MAX ? factorial_decimal((unsigned long)n) : NULL;
+            if (!digits) {
+                fprintf(stderr, "Error: Could not compute lairotcaf(%s)\n", argv[i]);
+                return 1;
+            }
+            printf("%s\n", digits);
+            free(digits);
+            return 0;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run_mode = RUN_EXECUTE;
+        } else if (strcmp(argv[i], "--disasm") == 0) {
+            run_mode = RUN_DISASSEMBLE;
+        } else if (strcmp(argv[i], "--jit-check") == 0) {
+            run_mode = RUN_JIT_CHECK;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            run_mode = RUN_EMIT_C;
+        } else if (strcmp(argv[i], "--emit-c-check") == 0) {
+            run_mode = RUN_EMIT_C_CHECK;
+        } else if (strcmp(argv[i], "--ssa-dump") == 0) {
+            run_mode = RUN_SSA_DUMP;
+        } else if (strcmp(argv[i], "--ssa-check") == 0) {
+            run_mode = RUN_SSA_CHECK;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            run_mode = RUN_BATCH;
+            batch_function = argv[++i];
+        } else if (strcmp(argv[i], "--batch-rows") == 0 && i + 1 < argc) {
+            long long rows;
+            if (!parse_int_option("--batch-rows", argv[++i], 1, BATCH_MAX_ROWS, &rows)) {
+                return 1;
+            }
+            batch_rows = (size_t)rows;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            run_mode = RUN_PROFILE;
+        } else if (strcmp(argv[i], "--image") == 0) {
+            run_mode = RUN_IMAGE;
+        } else if (strcmp(argv[i], "--image-check") == 0) {
+            run_mode = RUN_IMAGE_CHECK;
+        } else if (strcmp(argv[i], "--superops-train") == 0 && i + 1 < argc) {
+            run_mode = RUN_SUPEROPS_TRAIN;
+            superops_path = argv[++i];
+        } else if (strcmp(argv[i], "--fuse-check") == 0) {
+            run_mode = RUN_FUSE_CHECK;
+        } else if (strcmp(argv[i], "--no-fuse") == 0) {
+            vm_options.no_fuse = 1;
+        } else if (strcmp(argv[i], "--profile-hz") == 0 && i + 1 < argc) {
+            long long hz;
+            if (!parse_int_option("--profile-hz", argv[++i], 1, PROFILE_MAX_HZ, &hz)) {
+                return 1;
+            }
+            profile_hz = (int)hz;
+        } else if (strcmp(argv[i], "--ssa") == 0) {
+            ssa_enabled = 1;
+        } else if (strcmp(argv[i], "--ssa-passes") == 0 && i + 1 < argc) {
+            if (ssa_parse_passes(argv[++i], &ssa_passes) != 0) {
+                fprintf(stderr, "Error: Unknown SSA pass in %s (use sccp, gvn, licm, dce, all or none)\n",
+                        argv[i]);
+                return 1;
+            }
+            ssa_enabled = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            vm_options.jit = 1;
+        } else if (strcmp(argv[i], "--bigint") == 0) {
+            vm_flags |= VM_BIGINT;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            optimize_enabled = 1;
+        } else if (strcmp(argv[i], "--hashcons") == 0) {
+            hashcons_enabled = 1;
+        } else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) {
+            query = argv[++i];
+            if (query[0] != '@' && node_type_named(query) < 0) {
+                fprintf(stderr, "Error: Unknown node type %s (use a --json type name, or @name for uses of a name)\n",
+                        query);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--index-check") == 0) {
+            index_check = 1;
+        } else if (strcmp(argv[i], "--symindex") == 0 && i + 1 < argc) {
+            symindex_path = argv[++i];
+        } else if (strcmp(argv[i], "--find-decl") == 0 && i + 1 < argc) {
+            find_decl = argv[++i];
+        } else if (strcmp(argv[i], "--find-calls") == 0 && i + 1 < argc) {
+            find_calls = argv[++i];
+        } else if (strcmp(argv[i], "--symindex-check") == 0) {
+            symindex_check = 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            server_mode = 's';
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--send") == 0 && i + 1 < argc) {
+            server_mode = 'c';
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--loadgen") == 0 && i + 1 < argc) {
+            server_mode = 'l';
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--op") == 0 && i + 1 < argc) {
+            request_op = serve_op_named(argv[++i]);
+            if (request_op < 0) {
+                fprintf(stderr, "Error: Unknown request %s (use tokenize, parse or dump)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            long long count;
+            if (!parse_int_option("--requests", argv[++i], 1, 1000000000, &count)) {
+                return 1;
+            }
+            request_count = (long)count;
+        } else if (strcmp(argv[i], "--by-path") == 0) {
+            request_flags |= SERVE_FLAG_PATH;
+        } else if (strcmp(argv[i], "--lsp") == 0) {
+            lsp_mode = 1;
+        } else if (strcmp(argv[i], "--lsp-replay") == 0 && i + 1 < argc) {
+            lsp_mode = 2;
+            lsp_session = argv[++i];
+        } else if (strcmp(argv[i], "--lsp-record") == 0 && i + 1 < argc) {
+            lsp_options.record_path = argv[++i];
+        } else if (strcmp(argv[i], "--lsp-debounce") == 0 && i + 1 < argc) {
+            long long ms;
+            lsp_debounce = argv[++i];
+            if (!parse_int_option("--lsp-debounce", lsp_debounce, 0, 60000, &ms)) {
+                return 1;
+            }
+            lsp_options.debounce_ms = (int)ms;
+        } else if (strcmp(argv[i], "--lsp-check") == 0) {
+            lsp_options.check = 1;
+        } else if (strcmp(argv[i], "--replay-speed") == 0 && i + 1 < argc) {
+            const char *arg = argv[++i];
+            char *end;
+            replay_speed = strtod(arg, &end);
+            int leading = arg[0] == '.' ? 1 : 0;
+            if (!isdigit((unsigned char)arg[leading]) || *end != '\0' || !(replay_speed <= 1e6)) {
+                fprintf(stderr, "Error: --replay-speed needs a number from 0 to 1000000, not '%s'\n", arg);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            long long limit;
+            if (!parse_int_option("--max-errors", argv[++i], 0, INT_MAX, &limit)) {
+                return 1;
+            }
+            diag_limits.per_file = (int)limit;
+        } else if (strcmp(argv[i], "--max-errors-per-code") == 0 && i + 1 < argc) {
+            long long limit;
+            if (!parse_int_option("--max-errors-per-code", argv[++i], 0, INT_MAX, &limit)) {
+                return 1;
+            }
+            diag_limits.per_code = (int)limit;
+        } else if (strcmp(argv[i], "--resolve") == 0) {
+            resolve_enabled = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_fd = open(argv[++i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (output_fd < 0) {
+                fprintf(stderr, "Error: Could not open output file %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            // A mistyped flag, or one missing its value, is not a file name
+            fprintf(stderr, "Error: Unknown option %s, or it needs a value\n", argv[i]);
+            return 1;
+        } else {
+            argv[++file_count] = argv[i];
+        }
+    }
+
+    // Test with both valid and invalid inputs by default
+    char **files = argv + 1;
+    int named_files = file_count;
+    if (file_count == 0) {
+        files = default_files;
+        file_count = 2;
+    }
+
+    if (perf_enabled && jobs > 1) {
+        // Counters are opened for the calling thread only
+        fprintf(stderr, "Warning: --perf is ignored with --jobs\n");
+        perf_enabled = 0;
+    }
+    if (perf_enabled) {
+        perf_init();
+    }
+    // Worker threads share one symbol table
+    intern_init(jobs > 1);
+    diag_set_limits(&diag_limits);
+
+    Writer out;
+    writer_init_fd(&out, output_fd);
+    set_output_writer(&out);
+
+    if (run_mode) {
+        // The compiler needs every variable resolved to a slot
+        resolve_enabled = 1;
+        if (run_mode == RUN_SUPEROPS_TRAIN) {
+            superop_counts_init(&superop_counts, 1);
+        }
+        for (int i = 0; i < file_count; i++) {
+            proc_run_file(files[i], vm_flags, run_mode, &vm_options);
+        }
+        if (run_mode == RUN_SUPEROPS_TRAIN) {
+            write_superops(&out);
+            superop_counts_free(&superop_counts);
+        }
+    } else if (lsp_mode == 1) {
+        // Items are parsed on their own, without name resolution
+        resolve_enabled = 0;
+        hashcons_enabled = 0;
+        status = lsp_serve(STDIN_FILENO, STDOUT_FILENO, &lsp_options);
+    } else if (lsp_mode == 2) {
+        char *server_argv[] = {argv[0], "--lsp", NULL, NULL, NULL, NULL};
+        int arg = 2;
+        if (lsp_debounce) {
+            server_argv[arg++] = "--lsp-debounce";
+            server_argv[arg++] = lsp_debounce;
+        }
+        if (lsp_options.check) {
+            server_argv[arg++] = "--lsp-check";
+        }
+        if (lsp_replay(lsp_session, server_argv, replay_speed, &out) != 0) {
+            status = 1;
+        }
+    } else if (server_mode == 's') {
+        if (serve_parser(socket_path, jobs) != 0) {
+            status = 1;
+        }
+    } else if (server_mode) {
+        if (serialize_mode == 1) {
+            request_flags |= SERVE_FLAG_JSON;
+        }
+        if (server_mode == 'c') {
+            serve_send_files(socket_path, files, file_count, request_op, request_flags);
+        } else {
+            serve_load_files(socket_path, files, file_count, request_op, request_flags, jobs, request_count);
+        }
+    } else if (symindex_path) {
+        symindex_run(symindex_path, files, named_files, find_decl, find_calls, symindex_check);
+    } else if (query) {
+        for (int i = 0; i < file_count; i++) {
+            proc_query_file(files[i], query);
+        }
+    } else if (index_check) {
+        for (int i = 0; i < file_count; i++) {
+            proc_index_check_file(files[i]);
+        }
+    } else if (serialize_mode) {
+        SerializeFormat format = serialize_mode == 1 ? SERIALIZE_JSON : SERIALIZE_SEXPR;
+        for (int i = 0; i < file_count; i++) {
+            proc_serialize_file(files[i], format, stream);
+        }
+    } else if (stream) {
+        for (int i = 0; i < file_count; i++) {
+            proc_stream_file(files[i]);
+        }
+    } else if (btok_mode) {
+        for (int i = 0; i < file_count; i++) {
+            proc_btok_file(files[i], btok_mode == 2);
+        }
+    } else if (jobs > 1) {
+        run_jobs(files, file_count, jobs);
+    } else {
+        trace_thread_name("main");
+        for (int i = 0; i < file_count; i++) {
+            proc_test_file(files[i]);
+        }
+    }
+
+    if (perf_enabled) {
+        perf_shutdown();
+    }
+    parser_release_nodes();
+    diag_free();
+    scope_end();
+    intern_free();
+    set_output_writer(NULL);
+    writer_free(&out);
+    trace_finish();
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+/* perf.c */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "../../include/perf.h"
+#include "../../include/writer.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+// Counter file descriptors, -1 when the event could not be opened
+static int counter_fds[PERF_EVENT_COUNT] = {-1, -1, -1, -1, -1};
+static int counters_open = 0;
+static int open_errno = 0;
+
+// Accumulated values for each phase
+static uint64_t phase_counts[PERF_PHASE_COUNT][PERF_EVENT_COUNT];
+static uint64_t phase_start[PERF_EVENT_COUNT];
+static double phase_wall_ms[PERF_PHASE_COUNT];
+static struct timespec wall_start;
+
+static const char *phase_names[PERF_PHASE_COUNT] = {"Lex", "Parse", "Print"};
+
+#ifdef __linux__
+// Event type/config pairs in PerfEvent order
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} event_table[PERF_EVENT_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+};
+
+static int open_counter(PerfEvent event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event_table[event].type;
+    attr.config = event_table[event].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Read a counter, scaling for multiplexing when the PMU was shared
+static uint64_t read_counter(int fd) {
+    uint64_t values[3];
+    if (read(fd, values, sizeof(values)) != sizeof(values)) {
+        return 0;
+    }
+    if (values[2] == 0) {
+        return 0;
+    }
+    if (values[2] < values[1]) {
+        return (uint64_t)((double)values[0] * values[1] / values[2]);
+    }
+    return values[0];
+}
+#endif
+
+// Open all counters; events the PMU does not support are left disabled
+int perf_init(void) {
+    counters_open = 0;
+#ifdef __linux__
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        counter_fds[i] = open_counter((PerfEvent)i);
+        if (counter_fds[i] >= 0) {
+            ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            counters_open++;
+        } else if (open_errno == 0) {
+            open_errno = errno;
+        }
+    }
+#else
+    open_errno = ENOSYS;
+#endif
+    perf_reset();
+    return counters_open;
+}
+
+// Close all counters
+void perf_shutdown(void) {
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (counter_fds[i] >= 0) {
+            close(counter_fds[i]);
+            counter_fds[i] = -1;
+        }
+    }
+    counters_open = 0;
+}
+
+// Clear accumulated values before a new file
+void perf_reset(void) {
+    memset(phase_counts, 0, sizeof(phase_counts));
+    memset(phase_wall_ms, 0, sizeof(phase_wall_ms));
+}
+
+// Snapshot counters at the start of a phase
+void perf_begin(PerfPhase phase) {
+    (void)phase;
+#ifdef __linux__
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        phase_start[i] = counter_fds[i] >= 0 ? read_counter(counter_fds[i]) : 0;
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+}
+
+// Accumulate counter deltas at the end of a phase
+void perf_end(PerfPhase phase) {
+    struct timespec wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    phase_wall_ms[phase] += (wall_end.tv_sec - wall_start.tv_sec) * 1e3 +
+                            (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+#ifdef __linux__
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (counter_fds[i] >= 0) {
+            phase_counts[phase][i] += read_counter(counter_fds[i]) - phase_start[i];
+        }
+    }
+#endif
+}
+
+// Print a counter value, or n/a when the event is unavailable
+static void print_count(PerfEvent event, uint64_t value) {
+    Writer *out = output_writer();
+    if (counter_fds[event] >= 0) {
+        wr_printf(out, " %12llu", (unsigned long long)value);
+    } else {
+        wr_printf(out, " %12s", "n/a");
+    }
+}
+
+// Print a per-unit ratio, or n/a when it cannot be computed
+static void print_ratio(int available, double num, double den) {
+    Writer *out = output_writer();
+    if (available && den > 0) {
+        wr_printf(out, " %10.3f", num / den);
+    } else {
+        wr_printf(out, " %10s", "n/a");
+    }
+}
+
+// Print per-phase counters with IPC and misses per token (lex) or per node (parse, print)
+void perf_report(int token_count, int node_count) {
+    Writer *out = output_writer();
+    wr_printf(out, "\nPERFORMANCE COUNTERS:\n");
+    if (counters_open == 0) {
+        wr_printf(out, "Hardware counters unavailable (%s); reporting wall-clock time only\n",
+                  strerror(open_errno ? open_errno : ENODEV));
+    }
+
+    wr_printf(out, "%-6s %10s %12s %12s %12s %12s %12s %10s %10s %10s %10s\n",
+              "Phase", "Wall(ms)", "Cycles", "Instr", "BrMiss", "L1dMiss", "LLCMiss",
+              "IPC", "BrMiss/u", "L1d/u", "LLC/u");
+
+    for (int p = 0; p < PERF_PHASE_COUNT; p++) {
+        uint64_t *c = phase_counts[p];
+        double units = (p == PERF_PHASE_LEX) ? token_count : node_count;
+
+        wr_printf(out, "%-6s %10.3f", phase_names[p], phase_wall_ms[p]);
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            print_count((PerfEvent)e, c[e]);
+        }
+        print_ratio(counter_fds[PERF_EVENT_CYCLES] >= 0 && counter_fds[PERF_EVENT_INSTRUCTIONS] >= 0,
+                    (double)c[PERF_EVENT_INSTRUCTIONS], (double)c[PERF_EVENT_CYCLES]);
+        print_ratio(counter_fds[PERF_EVENT_BRANCH_MISSES] >= 0, (double)c[PERF_EVENT_BRANCH_MISSES], units);
+        print_ratio(counter_fds[PERF_EVENT_L1D_MISSES] >= 0, (double)c[PERF_EVENT_L1D_MISSES], units);
+        print_ratio(counter_fds[PERF_EVENT_LLC_MISSES] >= 0, (double)c[PERF_EVENT_LLC_MISSES], units);
+        wr_printf(out, "\n");
+    }
+    wr_printf(out, "(u = %d tokens for Lex, %d nodes for Parse and Print)\n", token_count, node_count);
+}
@@ -0,0 +1,430 @@
+/* profile.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../../include/profile.h"
+#include "../../include/intern.h"
+
+// The profile the timer samples, the handler it replaced, and the timer:
+// a POSIX timer on the process CPU clock, which unlike ITIMER_PROF is not
+// limited to the scheduler tick
+static Profile *volatile active_profile;
+static struct sigaction saved_action;
+static timer_t sample_timer;
+
+static void *allocate(size_t size) {
+    void *data = malloc(size);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for profile\n");
+        exit(1);
+    }
+    return data;
+}
+
+int profile_init(Profile *profile, const BytecodeProgram *program, int hz) {
+    memset(profile, 0, sizeof(*profile));
+    if (hz < 1 || hz > 100000) {
+        return -1;
+    }
+    profile->program = program;
+    profile->interval_us = 1000000 / hz;
+    profile->hits = allocate((program->statement_count + 1) * sizeof(unsigned long long));
+    memset(profile->hits, 0, (program->statement_count + 1) * sizeof(unsigned long long));
+    int *sites = allocate((VM_MAX_FRAMES + 1) * sizeof(int));
+    for (int i = 0; i <= VM_MAX_FRAMES; i++) {
+        sites[i] = -1;
+    }
+    profile->sites = sites;
+    profile->samples = allocate(PROFILE_BUFFER_WORDS * sizeof(int));
+    return 0;
+}
+
+void profile_free(Profile *profile) {
+    free(profile->hits);
+    free((int *)profile->sites);
+    free(profile->samples);
+    free(profile->calls);
+    free(profile->self);
+    free(profile->total);
+    memset(profile, 0, sizeof(*profile));
+}
+
+// Sampling
+
+// SIGPROF handler: copy the statement running at each call depth, keeping
+// the innermost PROFILE_MAX_DEPTH.  It runs on the thread it interrupted,
+// so the VM's state is as of the last instruction.
+static void take_sample(int signal_number) {
+    (void)signal_number;
+    Profile *profile = active_profile;
+    volatile int *depth_word = profile ? profile->depth : NULL;
+    if (!depth_word) {
+        return;
+    }
+    int depth = *depth_word;
+    int first = depth >= PROFILE_MAX_DEPTH ? depth - PROFILE_MAX_DEPTH + 1 : 0;
+    int count = depth - first + 1;
+    size_t used = profile->sample_words;
+    if (used + count + 1 > PROFILE_BUFFER_WORDS) {
+        profile->dropped++;
+        return;
+    }
+    int *sample = profile->samples + used;
+    sample[0] = first > 0 ? -count : count;
+    for (int i = 0; i < count; i++) {
+        sample[1 + i] = profile->sites[first + i];
+    }
+    profile->sample_words = used + count + 1;
+    profile->sample_count++;
+}
+
+static uint64_t cpu_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int profile_start(Profile *profile) {
+    profile->cpu_ns = cpu_clock();
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &saved_action) != 0) {
+        return -1;
+    }
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    long interval_ns = profile->interval_us * 1000L;
+    struct itimerspec period = {{interval_ns / 1000000000L, interval_ns % 1000000000L},
+                                {interval_ns / 1000000000L, interval_ns % 1000000000L}};
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &sample_timer) != 0) {
+        sigaction(SIGPROF, &saved_action, NULL);
+        return -1;
+    }
+    active_profile = profile;
+    if (timer_settime(sample_timer, 0, &period, NULL) != 0) {
+        active_profile = NULL;
+        timer_delete(sample_timer);
+        sigaction(SIGPROF, &saved_action, NULL);
+        return -1;
+    }
+    profile->timer_running = 1;
+    return 0;
+}
+
+// Calls from a statement into a function, counted as they happen
+
+static uint32_t call_hash(int site, int function) {
+    return ((uint32_t)site * 0x9e3779b1u) ^ ((uint32_t)function * 0x85ebca6bu);
+}
+
+static ProfileCall *find_call(Profile *profile, int site, int function) {
+    if (profile->call_count * 2 >= profile->call_capacity) {
+        int capacity = profile->call_capacity ? profile->call_capacity * 2 : 64;
+        ProfileCall *calls = allocate(capacity * sizeof(ProfileCall));
+        for (int i = 0; i < capacity; i++) {
+            calls[i].site = INT_MIN;
+        }
+        for (int i = 0; i < profile->call_capacity; i++) {
+            if (profile->calls[i].site == INT_MIN) {
+                continue;
+            }
+            uint32_t slot = call_hash(profile->calls[i].site, profile->calls[i].function) & (capacity - 1);
+            while (calls[slot].site != INT_MIN) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            calls[slot] = profile->calls[i];
+        }
+        free(profile->calls);
+        profile->calls = calls;
+        profile->call_capacity = capacity;
+    }
+    uint32_t mask = profile->call_capacity - 1;
+    uint32_t slot = call_hash(site, function) & mask;
+    while (profile->calls[slot].site != INT_MIN) {
+        if (profile->calls[slot].site == site && profile->calls[slot].function == function) {
+            return &profile->calls[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    profile->calls[slot] = (ProfileCall){site, function, 0, 0, 0};
+    profile->call_count++;
+    return &profile->calls[slot];
+}
+
+void profile_count_call(Profile *profile, int site, int function) {
+    find_call(profile, site, function)->calls++;
+}
+
+// Totals
+
+static int valid_statement(const Profile *profile, int statement) {
+    return statement >= 0 && statement < profile->program->statement_count;
+}
+
+// Walk the samples, counting each statement once per sample for 'total'
+// however many depths it runs at, and the same for each call
+static void aggregate(Profile *profile) {
+    const VMStatement *statements = profile->program->statements;
+    int count = profile->program->statement_count;
+    profile->self = allocate((count + 1) * sizeof(unsigned long long));
+    profile->total = allocate((count + 1) * sizeof(unsigned long long));
+    size_t *seen = allocate((count + 1) * sizeof(size_t));
+    memset(profile->self, 0, (count + 1) * sizeof(unsigned long long));
+    memset(profile->total, 0, (count + 1) * sizeof(unsigned long long));
+    memset(seen, 0, (count + 1) * sizeof(size_t));
+
+    size_t offset = 0;
+    for (size_t sample = 1; sample <= profile->sample_count; sample++) {
+        int depth = abs(profile->samples[offset]);
+        const int *stack = profile->samples + offset + 1;
+        offset += depth + 1;
+
+        if (valid_statement(profile, stack[depth - 1])) {
+            profile->self[stack[depth - 1]]++;
+        }
+        for (int i = 0; i < depth; i++) {
+            for (int s = stack[i]; valid_statement(profile, s) && seen[s] != sample; s = statements[s].parent) {
+                seen[s] = sample;
+                profile->total[s]++;
+            }
+        }
+        for (int i = 0; i + 1 < depth; i++) {
+            if (!valid_statement(profile, stack[i]) || !valid_statement(profile, stack[i + 1])) {
+                continue;
+            }
+            ProfileCall *call = find_call(profile, stack[i], statements[stack[i + 1]].function);
+            if (call->seen != sample) {
+                call->seen = sample;
+                call->samples++;
+            }
+        }
+    }
+    free(seen);
+}
+
+void profile_stop(Profile *profile) {
+    if (profile->timer_running) {
+        timer_delete(sample_timer);
+        sigaction(SIGPROF, &saved_action, NULL);
+        active_profile = NULL;
+        profile->timer_running = 0;
+    }
+    profile->cpu_ns = cpu_clock() - profile->cpu_ns;
+    aggregate(profile);
+}
+
+// Output
+
+static const char *function_name(const BytecodeProgram *program, int function) {
+    return function < 0 ? "(top level)" : symbol_name(program->functions[function].name);
+}
+
+static const char *statement_kind(int kind) {
+    switch (kind) {
+        case AST_PROGRAM: return "program";
+        case AST_FUNCTION_DECL: return "entry";
+        case AST_VARDECL: return "declaration";
+        case AST_ASSIGN: return "assignment";
+        case AST_PRINT: return "tnirp";
+        case AST_IF: return "fi";
+        case AST_WHILE: return "elihw";
+        case AST_FOR: return "taeper";
+        case AST_RETURN: return "nruter";
+        case AST_FUNCTION_CALL: return "call";
+        default: return "expression";
+    }
+}
+
+typedef struct {
+    unsigned long long total;
+    unsigned long long self;
+    unsigned long long hits;
+    int statement;
+} ReportRow;
+
+static int compare_rows(const void *a, const void *b) {
+    const ReportRow *x = a;
+    const ReportRow *y = b;
+    if (x->total != y->total) return x->total < y->total ? 1 : -1;
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    if (x->hits != y->hits) return x->hits < y->hits ? 1 : -1;
+    return x->statement - y->statement;
+}
+
+// CPU time a sample stands for.  Timers may fire less often than asked
+// (some kernels round CPU timers up to the scheduler tick), so this is
+// measured rather than taken from the interval.
+static double sample_ms(const Profile *profile) {
+    size_t samples = profile->sample_count + profile->dropped;
+    return samples ? profile->cpu_ns / 1e6 / samples : profile->interval_us / 1000.0;
+}
+
+// The 'rows' statements with the most time, then the most hits
+void profile_report(Writer *out, const Profile *profile, const char *source, int rows) {
+    const BytecodeProgram *program = profile->program;
+    double ms = sample_ms(profile);
+    wr_printf(out, "%s: %zu samples over %.1f ms of CPU, one per %.3f ms", source,
+              profile->sample_count, profile->cpu_ns / 1e6, ms);
+    if (profile->dropped) {
+        wr_printf(out, ", %zu dropped", profile->dropped);
+    }
+    wr_char(out, '\n');
+
+    ReportRow *table = allocate((program->statement_count + 1) * sizeof(ReportRow));
+    int count = 0;
+    for (int s = 0; s < program->statement_count; s++) {
+        if (profile->hits[s] || profile->total[s]) {
+            table[count++] = (ReportRow){profile->total[s], profile->self[s], profile->hits[s], s};
+        }
+    }
+    qsort(table, count, sizeof(ReportRow), compare_rows);
+
+    wr_printf(out, "  %-9s %-12s %-16s %12s %10s %10s\n", "line:col", "statement", "function",
+              "hits", "self ms", "total ms");
+    for (int i = 0; i < count && i < rows; i++) {
+        const VMStatement *statement = &program->statements[table[i].statement];
+        char position[32];
+        snprintf(position, sizeof(position), "%d:%d", statement->line, statement->column);
+        wr_printf(out, "  %-9s %-12s %-16s %12llu %10.1f %10.1f\n", position,
+                  statement_kind(statement->kind), function_name(program, statement->function),
+                  table[i].hits, table[i].self * ms, table[i].total * ms);
+    }
+    free(table);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Collapsed stacks for flame graph tools: per call depth a frame for the
+// function and one for the statement running in it, then the sample count
+void profile_write_folded(Writer *out, const Profile *profile, const char *source) {
+    const BytecodeProgram *program = profile->program;
+    const char *base = strrchr(source, '/');
+    base = base ? base + 1 : source;
+    Writer stacks;
+    writer_init_memory(&stacks);
+    size_t *starts = allocate((profile->sample_count + 1) * sizeof(size_t));
+
+    size_t offset = 0;
+    for (size_t sample = 0; sample < profile->sample_count; sample++) {
+        int depth = profile->samples[offset];
+        const int *stack = profile->samples + offset + 1;
+        starts[sample] = stacks.len;
+        if (depth < 0) {
+            depth = -depth;
+            wr_str(&stacks, "(truncated);");
+        }
+        offset += depth + 1;
+        for (int i = 0; i < depth; i++) {
+            if (i > 0) {
+                wr_char(&stacks, ';');
+            }
+            if (!valid_statement(profile, stack[i])) {
+                wr_str(&stacks, "(unknown)");
+                continue;
+            }
+            const VMStatement *statement = &program->statements[stack[i]];
+            wr_str(&stacks, function_name(program, statement->function));
+            if (statement->parent >= 0) {
+                wr_printf(&stacks, ";%s:%d:%d %s", base, statement->line, statement->column,
+                          statement_kind(statement->kind));
+            }
+        }
+        wr_char(&stacks, '\0');
+    }
+
+    char **lines = allocate((profile->sample_count + 1) * sizeof(char *));
+    for (size_t sample = 0; sample < profile->sample_count; sample++) {
+        lines[sample] = stacks.data + starts[sample];
+    }
+    qsort(lines, profile->sample_count, sizeof(char *), compare_strings);
+    for (size_t i = 0; i < profile->sample_count;) {
+        size_t same = i + 1;
+        while (same < profile->sample_count && strcmp(lines[same], lines[i]) == 0) {
+            same++;
+        }
+        wr_printf(out, "%s %zu\n", lines[i], same - i);
+        i = same;
+    }
+
+    free(lines);
+    free(starts);
+    writer_free(&stacks);
+}
+
+static int compare_calls(const void *a, const void *b) {
+    const ProfileCall *x = a;
+    const ProfileCall *y = b;
+    if (x->site != y->site) return x->site < y->site ? -1 : 1;
+    return x->function - y->function;
+}
+
+// Callgrind format: per function its statements' lines with samples and
+// hits, and under each calling statement the calls it made with the
+// samples spent in them
+void profile_write_callgrind(Writer *out, const Profile *profile, const char *source) {
+    const BytecodeProgram *program = profile->program;
+    unsigned long long hits = 0;
+    int *entry_line = allocate((program->function_count + 1) * sizeof(int));
+    for (int f = 0; f < program->function_count; f++) {
+        entry_line[f] = 0;
+    }
+    for (int s = 0; s < program->statement_count; s++) {
+        hits += profile->hits[s];
+        if (program->statements[s].kind == AST_FUNCTION_DECL && program->statements[s].function >= 0) {
+            entry_line[program->statements[s].function] = program->statements[s].line;
+        }
+    }
+
+    ProfileCall *calls = allocate((profile->call_count + 1) * sizeof(ProfileCall));
+    int call_count = 0;
+    for (int i = 0; i < profile->call_capacity; i++) {
+        if (profile->calls[i].site != INT_MIN) {
+            calls[call_count++] = profile->calls[i];
+        }
+    }
+    qsort(calls, call_count, sizeof(ProfileCall), compare_calls);
+
+    wr_str(out, "# callgrind format\nversion: 1\ncreator: parser --profile\n");
+    wr_printf(out, "cmd: %s\npositions: line\n", source);
+    wr_printf(out, "event: Samples : Samples (%.0f us of CPU each)\nevent: Hits : Statements started\n",
+              sample_ms(profile) * 1000);
+    wr_printf(out, "events: Samples Hits\nsummary: %zu %llu\n\nfl=%s\n", profile->sample_count, hits, source);
+
+    // A function's statements are numbered together, in function order
+    int function = INT_MIN;
+    int next_call = 0;
+    for (int s = 0; s < program->statement_count; s++) {
+        const VMStatement *statement = &program->statements[s];
+        if (statement->function != function) {
+            function = statement->function;
+            wr_printf(out, "fn=%s\n", function_name(program, function));
+        }
+        if (profile->hits[s] || profile->self[s]) {
+            wr_printf(out, "%d %llu %llu\n", statement->line, profile->self[s], profile->hits[s]);
+        }
+        while (next_call < call_count && calls[next_call].site < s) {
+            next_call++;
+        }
+        for (; next_call < call_count && calls[next_call].site == s; next_call++) {
+            const ProfileCall *call = &calls[next_call];
+            wr_printf(out, "cfn=%s\ncalls=%llu %d\n%d %llu\n", function_name(program, call->function),
+                      call->calls, call->function >= 0 ? entry_line[call->function] : 0,
+                      statement->line, call->samples);
+        }
+    }
+
+    free(calls);
+    free(entry_line);
+}
@@ -0,0 +1,212 @@
+/* scope.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/scope.h"
+#include "../../include/intern.h"
+
+// One declaration.  Bindings form an undo log: leaving a scope pops its
+// bindings and restores whatever each one shadowed.
+typedef struct {
+    SymbolId sym;
+    int depth;
+    int slot;
+    TokenType type;
+    int shadowed;       // Previous binding of the same symbol, -1 if none
+} Binding;
+
+// Saved state for each open scope
+typedef struct {
+    int bindings;       // Undo log length when the scope was opened
+    int next_slot;      // Frame slot counter when the scope was opened
+} ScopeMark;
+
+// Saved frame state for the enclosing function (only one level deep)
+typedef struct {
+    int next_slot;
+    int frame_size;
+    int base_level;
+} FrameMark;
+
+// Resolution state is thread-local, like the parser's
+static _Thread_local int active = 0;
+static _Thread_local int *current = NULL;       // Innermost binding per symbol ID, -1 if none
+static _Thread_local uint32_t current_size = 0;
+static _Thread_local Binding *bindings = NULL;
+static _Thread_local int binding_count = 0;
+static _Thread_local int binding_capacity = 0;
+static _Thread_local ScopeMark *marks = NULL;
+static _Thread_local int level = 0;              // Number of open scopes
+static _Thread_local int mark_capacity = 0;
+static _Thread_local int next_slot = 0;          // Next free slot in the current frame
+static _Thread_local int frame_size = 0;         // Slots needed by the current frame
+static _Thread_local int in_function = 0;       // Function nesting depth
+static _Thread_local FrameMark saved_frame;
+
+static void *grow_array(void *data, int *capacity, size_t element) {
+    int grown = *capacity ? *capacity * 2 : 64;
+    void *resized = realloc(data, grown * element);
+    if (!resized) {
+        fprintf(stderr, "Error: Memory allocation failed for scope table\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return resized;
+}
+
+// Start resolving a new file in the global scope
+void scope_begin(void) {
+    scope_end();
+    active = 1;
+}
+
+// Stop resolving and release the tables
+void scope_end(void) {
+    free(current);
+    free(bindings);
+    free(marks);
+    current = NULL;
+    current_size = 0;
+    bindings = NULL;
+    binding_count = binding_capacity = 0;
+    marks = NULL;
+    level = mark_capacity = 0;
+    next_slot = frame_size = 0;
+    in_function = 0;
+    active = 0;
+}
+
+int scope_active(void) {
+    return active;
+}
+
+// Depth reported for bindings made at the current level
+static int current_depth(void) {
+    return in_function ? level - saved_frame.base_level : 0;
+}
+
+// Innermost binding for a symbol, -1 if it is not in scope
+static int lookup(SymbolId sym) {
+    return sym < current_size ? current[sym] : -1;
+}
+
+void scope_enter(void) {
+    if (level == mark_capacity) {
+        marks = grow_array(marks, &mark_capacity, sizeof(ScopeMark));
+    }
+    marks[level++] = (ScopeMark){binding_count, next_slot};
+}
+
+// Pop the innermost scope, unshadowing outer bindings.
+// Slots are reused by sibling scopes; the frame keeps the high-water mark.
+void scope_leave(void) {
+    if (level == 0) {
+        return;
+    }
+    ScopeMark mark = marks[--level];
+    while (binding_count > mark.bindings) {
+        Binding *binding = &bindings[--binding_count];
+        current[binding->sym] = binding->shadowed;
+    }
+    next_slot = mark.next_slot;
+}
+
+// Open a function: a new frame with the parameters' scope
+void scope_enter_function(void) {
+    if (in_function) {
+        in_function++;
+        scope_enter();
+        return;
+    }
+    saved_frame = (FrameMark){next_slot, frame_size, level};
+    next_slot = 0;
+    frame_size = 0;
+    in_function = 1;
+    scope_enter();
+}
+
+// Close a function, returning the number of slots its frame needs
+int scope_leave_function(void) {
+    if (!in_function) {
+        return 0;
+    }
+    if (in_function > 1) {
+        // Nested declaration: its locals live in the outer frame
+        in_function--;
+        scope_leave();
+        return 0;
+    }
+    while (level > saved_frame.base_level) {
+        scope_leave();
+    }
+    int size = frame_size;
+    next_slot = saved_frame.next_slot;
+    frame_size = saved_frame.frame_size;
+    in_function = 0;
+    return size;
+}
+
+// Declare the variable named by 'node' in the innermost scope.
+// Returns 0 if the name is already declared in that same scope.
+int scope_declare(ASTNode *node, TokenType type) {
+    SymbolId sym = node->token.sym;
+    if (sym == SYMBOL_NONE) {
+        return 1;
+    }
+
+    int previous = lookup(sym);
+    int scope_start = level > 0 ? marks[level - 1].bindings : 0;
+    if (previous >= scope_start) {
+        node->scope_depth = bindings[previous].depth;
+        node->slot = bindings[previous].slot;
+        node->decl_type = bindings[previous].type;
+        return 0;
+    }
+
+    if (sym >= current_size) {
+        uint32_t size = current_size ? current_size : 256;
+        while (size <= sym) size *= 2;
+        int *resized = realloc(current, size * sizeof(int));
+        if (!resized) {
+            fprintf(stderr, "Error: Memory allocation failed for scope table\n");
+            exit(1);
+        }
+        memset(resized + current_size, 0xff, (size - current_size) * sizeof(int));
+        current = resized;
+        current_size = size;
+    }
+    if (binding_count == binding_capacity) {
+        bindings = grow_array(bindings, &binding_capacity, sizeof(Binding));
+    }
+
+    int slot = next_slot++;
+    if (next_slot > frame_size) {
+        frame_size = next_slot;
+    }
+    bindings[binding_count] = (Binding){sym, current_depth(), slot, type, previous};
+    current[sym] = binding_count++;
+
+    node->scope_depth = current_depth();
+    node->slot = slot;
+    node->decl_type = type;
+    return 1;
+}
+
+// Annotate an identifier use with its declaration.
+// Returns 0 if no declaration is in scope.
+int scope_resolve(ASTNode *node) {
+    int index = lookup(node->token.sym);
+    if (index < 0) {
+        return 0;
+    }
+    node->scope_depth = bindings[index].depth;
+    node->slot = bindings[index].slot;
+    node->decl_type = bindings[index].type;
+    return 1;
+}
+
+// Slots used by the global frame so far
+int scope_global_count(void) {
+    return in_function ? saved_frame.frame_size : frame_size;
+}
@@ -0,0 +1,322 @@
+/* serialize.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../../include/serialize.h"
+
+// Traversal states for the explicit serialization stack
+typedef enum {
+    FRAME_OPEN,     // Node header not yet written
+    FRAME_BODY,     // Walking a Program/Block statement chain
+    FRAME_LEFT,     // Left child next
+    FRAME_RIGHT,    // Right child next
+    FRAME_CLOSE     // Only the closing bracket remains
+} FrameState;
+
+typedef struct {
+    ASTNode *node;
+    ASTNode *chain;     // Next chain link for FRAME_BODY
+    int items;          // Items written so far in FRAME_BODY
+    FrameState state;
+} Frame;
+
+// Serialized node type names, indexed by ASTNodeType
+static const char *const node_type_names[] = {
+    [AST_PROGRAM] = "Program",
+    [AST_VARDECL] = "VarDecl",
+    [AST_ASSIGN] = "Assign",
+    [AST_PRINT] = "Print",
+    [AST_NUMBER] = "Number",
+    [AST_STRING] = "String",
+    [AST_OPERATOR] = "Operator",
+    [AST_IDENTIFIER] = "Identifier",
+    [AST_IF] = "If",
+    [AST_ELSE] = "Else",
+    [AST_WHILE] = "While",
+    [AST_FOR] = "RepeatUntil",
+    [AST_BLOCK] = "Block",
+    [AST_BINOP] = "BinaryOp",
+    [AST_FACTORIAL] = "Factorial",
+    [AST_FUNCTION_CALL] = "FunctionCall",
+    [AST_RETURN] = "Return",
+    [AST_FUNCTION_DECL] = "FunctionDecl"
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+const char *ast_node_type_name(ASTNodeType type) {
+    if ((unsigned)type < sizeof(node_type_names) / sizeof(node_type_names[0]) &&
+        node_type_names[type]) {
+        return node_type_names[type];
+    }
+    return "Unknown";
+}
+
+// Node types whose lexeme is part of the node's value
+static int has_value(ASTNodeType type) {
+    switch (type) {
+        case AST_VARDECL:
+        case AST_NUMBER:
+        case AST_STRING:
+        case AST_IDENTIFIER:
+        case AST_OPERATOR:
+        case AST_BINOP:
+        case AST_FUNCTION_CALL:
+        case AST_FUNCTION_DECL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Program and Block nodes form right-linked statement chains
+static int is_chain(ASTNodeType type) {
+    return type == AST_PROGRAM || type == AST_BLOCK;
+}
+
+// Write a quoted string, copying runs of plain characters in bulk
+static void write_quoted(Writer *out, const char *text, SerializeFormat format) {
+    const char *run = text;
+    wr_char(out, '"');
+    for (const char *c = text; *c; c++) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        wr_bytes(out, run, c - run);
+        run = c + 1;
+        wr_char(out, '\\');
+        switch (ch) {
+            case '"': wr_char(out, '"'); break;
+            case '\\': wr_char(out, '\\'); break;
+            case '\n': wr_char(out, 'n'); break;
+            case '\r': wr_char(out, 'r'); break;
+            case '\t': wr_char(out, 't'); break;
+            default:
+                if (format == SERIALIZE_JSON) {
+                    wr_str(out, "u00");
+                } else {
+                    wr_char(out, 'x');
+                }
+                wr_char(out, hex_digits[ch >> 4]);
+                wr_char(out, hex_digits[ch & 0xf]);
+        }
+    }
+    wr_str(out, run);
+    wr_char(out, '"');
+}
+
+void serialize_string(Writer *out, const char *text, SerializeFormat format) {
+    write_quoted(out, text, format);
+}
+
+// Write the node header: type, value and source position
+static void write_open(Writer *out, ASTNode *node, SerializeFormat format) {
+    if (format == SERIALIZE_JSON) {
+        wr_str(out, "{\"type\":\"");
+        wr_str(out, ast_node_type_name(node->type));
+        wr_char(out, '"');
+        if (has_value(node->type)) {
+            wr_str(out, ",\"value\":");
+            write_quoted(out, node->token.lexeme, format);
+        }
+        wr_str(out, ",\"line\":");
+        wr_int(out, node->token.line);
+        wr_str(out, ",\"column\":");
+        wr_int(out, node->token.column);
+        if (node->scope_depth >= 0) {
+            wr_str(out, ",\"depth\":");
+            wr_int(out, node->scope_depth);
+            wr_str(out, ",\"slot\":");
+            wr_int(out, node->slot);
+        }
+        if (node->id) {
+            wr_str(out, ",\"id\":");
+            wr_int(out, node->id);
+        }
+    } else {
+        wr_char(out, '(');
+        wr_str(out, ast_node_type_name(node->type));
+        if (has_value(node->type)) {
+            wr_char(out, ' ');
+            write_quoted(out, node->token.lexeme, format);
+        }
+        wr_str(out, " @");
+        wr_int(out, node->token.line);
+        wr_char(out, ':');
+        wr_int(out, node->token.column);
+        if (node->scope_depth >= 0) {
+            wr_str(out, " #");
+            wr_int(out, node->scope_depth);
+            wr_char(out, ':');
+            wr_int(out, node->slot);
+        }
+        if (node->id) {
+            wr_str(out, " =");
+            wr_int(out, node->id);
+        }
+    }
+}
+
+static void write_varint(Writer *out, uint32_t value) {
+    wr_reserve(out, 5);
+    while (value >= 0x80) {
+        wr_char(out, (char)(value | 0x80));
+        value >>= 7;
+    }
+    wr_char(out, (char)value);
+}
+
+// Binary records follow the tree as it is, so the stack only holds the
+// right children still to be written
+static void serialize_binary(Writer *out, ASTNode *root) {
+    ASTNode *local[64];
+    ASTNode **stack = local;
+    int capacity = 64;
+    int depth = 0;
+
+    if (root) {
+        stack[depth++] = root;
+    }
+    while (depth > 0) {
+        ASTNode *node = stack[--depth];
+        write_varint(out, (uint32_t)node->type << 2 | (node->left != NULL) << 1 | (node->right != NULL));
+        write_varint(out, (uint32_t)node->token.type);
+        write_varint(out, (uint32_t)node->token.line);
+        write_varint(out, (uint32_t)node->token.column);
+        if (has_value(node->type)) {
+            size_t length = strlen(node->token.lexeme);
+            write_varint(out, (uint32_t)length);
+            wr_bytes(out, node->token.lexeme, length);
+        }
+        if (depth + 2 > capacity) {
+            ASTNode **grown = malloc(sizeof(ASTNode *) * capacity * 2);
+            if (!grown) {
+                out->failed = 1;
+                break;
+            }
+            memcpy(grown, stack, sizeof(ASTNode *) * depth);
+            if (stack != local) free(stack);
+            stack = grown;
+            capacity *= 2;
+        }
+        if (node->right) stack[depth++] = node->right;
+        if (node->left) stack[depth++] = node->left;
+    }
+
+    if (stack != local) {
+        free(stack);
+    }
+}
+
+// Serialize an AST in one pass using an explicit stack.
+// Statement chains are written as flat bodies, so the stack only grows
+// with expression and block nesting, not with the number of statements.
+void serialize_ast(Writer *out, ASTNode *root, SerializeFormat format) {
+    Frame local[64];
+    Frame *stack = local;
+    int capacity = 64;
+    int depth = 0;
+
+    if (format == SERIALIZE_BINARY) {
+        serialize_binary(out, root);
+        return;
+    }
+    if (!root) {
+        wr_str(out, format == SERIALIZE_JSON ? "null" : "nil");
+        return;
+    }
+
+    stack[depth++] = (Frame){root, NULL, 0, FRAME_OPEN};
+
+    while (depth > 0) {
+        Frame *frame = &stack[depth - 1];
+        ASTNode *node = frame->node;
+        ASTNode *child = NULL;
+
+        switch (frame->state) {
+            case FRAME_OPEN:
+                write_open(out, node, format);
+                if (is_chain(node->type)) {
+                    if (format == SERIALIZE_JSON) wr_str(out, ",\"body\":[");
+                    frame->chain = node;
+                    frame->state = FRAME_BODY;
+                } else {
+                    frame->state = FRAME_LEFT;
+                }
+                break;
+
+            case FRAME_BODY:
+                // Find the next non-empty statement in the chain
+                while (!child && frame->chain) {
+                    ASTNode *link = frame->chain;
+                    if (link->type != node->type) {
+                        // Not a chain continuation: treat as one more item
+                        child = link;
+                        frame->chain = NULL;
+                    } else {
+                        child = link->left;
+                        frame->chain = link->right;
+                    }
+                }
+                if (!child) {
+                    if (format == SERIALIZE_JSON) wr_char(out, ']');
+                    frame->state = FRAME_CLOSE;
+                    break;
+                }
+                if (format == SERIALIZE_JSON) {
+                    if (frame->items > 0) wr_char(out, ',');
+                } else {
+                    wr_char(out, ' ');
+                }
+                frame->items++;
+                break;
+
+            case FRAME_LEFT:
+                frame->state = FRAME_RIGHT;
+                if (node->left) {
+                    wr_str(out, format == SERIALIZE_JSON ? ",\"left\":" : " ");
+                    child = node->left;
+                }
+                break;
+
+            case FRAME_RIGHT:
+                frame->state = FRAME_CLOSE;
+                if (node->right) {
+                    if (format == SERIALIZE_JSON) {
+                        wr_str(out, ",\"right\":");
+                    } else {
+                        wr_str(out, node->left ? " " : " nil ");
+                    }
+                    child = node->right;
+                }
+                break;
+
+            case FRAME_CLOSE:
+                wr_char(out, format == SERIALIZE_JSON ? '}' : ')');
+                depth--;
+                break;
+        }
+
+        if (child) {
+            if (depth == capacity) {
+                Frame *grown = malloc(sizeof(Frame) * capacity * 2);
+                if (!grown) {
+                    out->failed = 1;
+                    break;
+                }
+                memcpy(grown, stack, sizeof(Frame) * depth);
+                if (stack != local) free(stack);
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[depth++] = (Frame){child, NULL, 0, FRAME_OPEN};
+        }
+    }
+
+    if (stack != local) {
+        free(stack);
+    }
+}
@@ -0,0 +1,692 @@
+/* server.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "../../include/server.h"
+#include "../../include/trace.h"
+#include "../../include/parser.h"
+#include "../../include/lexer.h"
+#include "../../include/btok.h"
+#include "../../include/diag.h"
+#include "../../include/intern.h"
+#include "../../include/scope.h"
+#include "../../include/serialize.h"
+
+static atomic_int stopping = 0;
+static int listen_fd = -1;
+static const ServeHandler *serve_handler = NULL;
+static atomic_long served_requests = 0;
+static atomic_long served_connections = 0;
+
+// Read exactly 'len' bytes.  Returns 0, 1 if the stream ended before the
+// first byte, or -1.  Server sockets time out so that a worker waiting
+// on an idle connection notices a shutdown.
+static int read_full(int fd, void *data, size_t len) {
+    char *bytes = data;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, bytes + done, len - done);
+        if (n > 0) {
+            done += (size_t)n;
+        } else if (n == 0) {
+            return done == 0 ? 1 : -1;
+        } else if (errno != EINTR &&
+                   !((errno == EAGAIN || errno == EWOULDBLOCK) && !atomic_load(&stopping))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Send all of the parts, without SIGPIPE if the peer has gone
+static int send_parts(int fd, struct iovec *parts, int count) {
+    while (count > 0) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = parts;
+        message.msg_iovlen = (size_t)count;
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= parts->iov_len) {
+            n -= (ssize_t)parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char *)parts->iov_base + n;
+            parts->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// Answer the requests on one connection until it closes.  The frame and
+// payload buffers belong to the worker, so they stay allocated between
+// requests and connections.
+static void serve_connection(int client, Writer *frame, char **payload, size_t *capacity) {
+    for (;;) {
+        ServeRequest request;
+        if (read_full(client, &request, sizeof(request)) != 0) {
+            return;
+        }
+        ServeResponse response;
+        memset(&response, 0, sizeof(response));
+        response.id = request.id;
+        writer_reset(frame);
+        wr_bytes(frame, (const char *)&response, sizeof(response));
+
+        int valid = request.size <= SERVE_MAX_PAYLOAD && request.op >= SERVE_TOKENIZE && request.op <= SERVE_DUMP;
+        if (valid && request.size + 1 > *capacity) {
+            size_t grown = *capacity ? *capacity : 4096;
+            while (grown < request.size + 1) {
+                grown *= 2;
+            }
+            char *buffer = realloc(*payload, grown);
+            if (!buffer) return;
+            *payload = buffer;
+            *capacity = grown;
+        }
+        if (valid) {
+            if (read_full(client, *payload, request.size) != 0) {
+                return;
+            }
+            (*payload)[request.size] = '\0';
+            response.status = (uint8_t)serve_handler->handle(&request, *payload, frame, &response.errors);
+        } else {
+            wr_str(frame, "malformed request");
+            response.status = SERVE_BAD_REQUEST;
+        }
+        if (frame->failed) {
+            return;
+        }
+
+        response.size = (uint32_t)(frame->len - sizeof(response));
+        memcpy(frame->data, &response, sizeof(response));
+        struct iovec part = {frame->data, frame->len};
+        if (send_parts(client, &part, 1) != 0 || !valid) {
+            return;
+        }
+        atomic_fetch_add(&served_requests, 1);
+    }
+}
+
+// Each worker accepts a connection and serves it to the end.  The kernel
+// hands each connection to one waiting worker.
+static void *serve_worker(void *arg) {
+    char name[32];
+    snprintf(name, sizeof(name), "server %d", (int)(long)arg);
+    trace_thread_name(name);
+
+    Writer frame;
+    writer_init_memory(&frame);
+    char *payload = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0) {
+            if (atomic_load(&stopping)) break;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(10000);
+                continue;
+            }
+            break;
+        }
+        struct timeval timeout = {0, 200000};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        atomic_fetch_add(&served_connections, 1);
+        serve_connection(client, &frame, &payload, &capacity);
+        close(client);
+    }
+    free(payload);
+    writer_free(&frame);
+    if (serve_handler->worker_exit) {
+        serve_handler->worker_exit();
+    }
+    return NULL;
+}
+
+static int socket_address(struct sockaddr_un *address, const char *path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+int serve_connect(const char *path) {
+    struct sockaddr_un address;
+    if (socket_address(&address, path) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const char *path, int workers, const ServeHandler *handler) {
+    struct sockaddr_un address;
+    if (socket_address(&address, path) != 0) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+
+    // Replace a socket left by a server that was killed, but not a live one
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = serve_connect(path);
+        if (probe >= 0) {
+            close(probe);
+            fprintf(stderr, "Error: A server is already listening on %s\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(077);
+    int bound = fd >= 0 ? bind(fd, (struct sockaddr *)&address, sizeof(address)) : -1;
+    umask(mask);
+    if (bound != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    // Workers inherit the blocked signals, so only sigwait sees them
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+    listen_fd = fd;
+    serve_handler = handler;
+    atomic_store(&stopping, 0);
+    pthread_t *threads = malloc((size_t)workers * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; threads && i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, serve_worker, (void *)(long)i) == 0) {
+            started++;
+        }
+    }
+    int result = 0;
+    if (started == 0) {
+        fprintf(stderr, "Error: Could not start server workers\n");
+        result = -1;
+    } else {
+        fprintf(stderr, "Serving on %s with %d workers\n", path, started);
+        int signal_number;
+        sigwait(&signals, &signal_number);
+    }
+
+    // Shutting the socket down wakes the workers blocked in accept
+    atomic_store(&stopping, 1);
+    shutdown(fd, SHUT_RDWR);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    close(fd);
+    unlink(path);
+    listen_fd = -1;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (started > 0) {
+        fprintf(stderr, "Served %ld requests on %ld connections\n",
+                atomic_load(&served_requests), atomic_load(&served_connections));
+    }
+    return result;
+}
+
+int serve_call(int fd, const ServeRequest *request, const void *payload, ServeResponse *response, Writer *body) {
+    struct iovec parts[2] = {{(void *)request, sizeof(*request)}, {(void *)payload, request->size}};
+    if (send_parts(fd, parts, request->size ? 2 : 1) != 0 ||
+        read_full(fd, response, sizeof(*response)) != 0) {
+        return -1;
+    }
+    wr_reserve(body, response->size);
+    if (body->failed || body->len + response->size > body->cap ||
+        read_full(fd, body->data + body->len, response->size) != 0) {
+        return -1;
+    }
+    body->len += response->size;
+    return 0;
+}
+
+typedef struct {
+    const char *path;
+    const ServeLoad *load;
+    long first;                 // Requests first .. first + count - 1
+    long count;
+    uint64_t *latencies;        // Nanoseconds, one per completed request
+    long completed;
+    long failed;
+    size_t received;
+} LoadClient;
+
+static void *load_client(void *arg) {
+    LoadClient *client = arg;
+    const ServeLoad *load = client->load;
+    int fd = serve_connect(client->path);
+    if (fd < 0) {
+        client->failed = client->count;
+        return NULL;
+    }
+    Writer body;
+    writer_init_memory(&body);
+    for (long i = 0; i < client->count; i++) {
+        long number = client->first + i;
+        int payload = (int)(number % load->payload_count);
+        ServeRequest request = {(uint32_t)load->sizes[payload], (uint32_t)number, (uint8_t)load->op,
+                                (uint8_t)load->flags, 0};
+        ServeResponse response;
+        writer_reset(&body);
+        uint64_t start = trace_clock();
+        if (serve_call(fd, &request, load->payloads[payload], &response, &body) != 0) {
+            client->failed += client->count - i;
+            break;
+        }
+        client->latencies[client->completed++] = trace_clock() - start;
+        if (response.status != SERVE_OK || response.id != request.id) {
+            client->failed++;
+        }
+        client->received += response.size;
+    }
+    writer_free(&body);
+    close(fd);
+    return NULL;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, long count, double fraction) {
+    long index = (long)(fraction * (double)count);
+    if (index >= count) index = count - 1;
+    return sorted[index] / 1e3;
+}
+
+int serve_loadgen(const char *path, const ServeLoad *load, Writer *out) {
+    int clients = load->clients > 0 ? load->clients : 1;
+    LoadClient *state = calloc((size_t)clients, sizeof(LoadClient));
+    uint64_t *latencies = malloc(((size_t)load->requests + 1) * sizeof(uint64_t));
+    pthread_t *threads = malloc((size_t)clients * sizeof(pthread_t));
+    if (!state || !latencies || !threads || load->payload_count == 0) {
+        fprintf(stderr, "Error: Memory allocation failed for load generator\n");
+        exit(1);
+    }
+
+    // Each client gets a contiguous share of the request numbers, and
+    // records into its own part of the latency array
+    long first = 0;
+    for (int i = 0; i < clients; i++) {
+        long count = load->requests / clients + (i < load->requests % clients);
+        state[i] = (LoadClient){path, load, first, count, latencies + first, 0, 0, 0};
+        first += count;
+    }
+    uint64_t start = trace_clock();
+    int started = 0;
+    for (int i = 0; i < clients; i++) {
+        if (pthread_create(&threads[i], NULL, load_client, &state[i]) != 0) break;
+        started++;
+    }
+    for (int i = started; i < clients; i++) {
+        load_client(&state[i]);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (trace_clock() - start) / 1e9;
+
+    // Gather the completed latencies at the front, then sort them
+    long completed = 0;
+    long failed = 0;
+    size_t received = 0;
+    for (int i = 0; i < clients; i++) {
+        memmove(latencies + completed, state[i].latencies, (size_t)state[i].completed * sizeof(uint64_t));
+        completed += state[i].completed;
+        failed += state[i].failed;
+        received += state[i].received;
+    }
+    int result = 0;
+    if (completed == 0) {
+        wr_printf(out, "Error: No response from %s\n", path);
+        result = -1;
+    } else {
+        qsort(latencies, (size_t)completed, sizeof(uint64_t), compare_latencies);
+        wr_printf(out, "%ld requests over %d connections in %.1f ms: %.0f requests/s, latency p50 %.1f us, "
+                  "p99 %.1f us, max %.1f us; %ld failed, %zu bytes received\n",
+                  completed, clients, elapsed * 1e3, completed / elapsed,
+                  percentile_us(latencies, completed, 0.50), percentile_us(latencies, completed, 0.99),
+                  latencies[completed - 1] / 1e3, failed, received);
+    }
+    free(state);
+    free(latencies);
+    free(threads);
+    return result;
+}
+
+// Parse server (--serve).  Each worker thread is a parser context: its
+// node free list, diagnostics records and buffer for the optimizer's
+// warnings stay warm from one request to the next.
+static _Thread_local Writer serve_warnings;
+static _Thread_local int serve_warnings_ready = 0;
+
+// Names interned while answering requests are released once there are
+// SERVE_SYMBOL_LIMIT of them: the last request to finish waits for the
+// others and releases them, and new requests wait until it has
+#define SERVE_SYMBOL_LIMIT (1u << 20)
+static pthread_mutex_t serve_symbols_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t serve_symbols_changed = PTHREAD_COND_INITIALIZER;
+static SymbolId serve_symbols_kept;     // Interned before serving
+static int serve_active = 0;            // Requests being answered
+static int serve_releasing = 0;
+
+// The diagnostics as a JSON array of objects: the records, placed in
+// 'source', then one warning per line the optimizer printed to 'warnings'
+static void write_diagnostics_json(Writer *body, const char *source, Writer *warnings) {
+    wr_str(body, "\"diagnostics\":[");
+    int written = 0;
+    for (int i = 0; i < diag_count(); i++) {
+        const Diagnostic *diagnostic = diag_get(i);
+        if (written++ > 0) wr_char(body, ',');
+        wr_str(body, "{\"source\":");
+        wr_str(body, diagnostic->source == DIAG_LEXER ? "\"lexer\"" : "\"parser\"");
+        wr_str(body, ",\"code\":");
+        serialize_string(body, diag_code_name(diagnostic), SERIALIZE_JSON);
+        int line;
+        int column;
+        diag_position(source, diagnostic, &line, &column);
+        wr_printf(body, ",\"severity\":%d,\"line\":%d,\"column\":%d,\"offset\":%u,\"length\":%u,\"message\":",
+                  diagnostic->severity, line, column, diagnostic->offset, diagnostic->length);
+        // Formatted past the end of the warnings, then dropped
+        size_t mark = warnings->len;
+        diag_message(warnings, diagnostic);
+        wr_char(warnings, '\0');
+        serialize_string(body, warnings->failed ? "" : warnings->data + mark, SERIALIZE_JSON);
+        warnings->len = mark;
+        wr_char(body, '}');
+    }
+    wr_char(warnings, '\0');
+    if (!warnings->failed) {
+        char *line = warnings->data;
+        char *end = warnings->data + warnings->len - 1;
+        while (line < end) {
+            char *newline = memchr(line, '\n', (size_t)(end - line));
+            if (newline) *newline = '\0';
+            if (written++ > 0) wr_char(body, ',');
+            wr_printf(body, "{\"source\":\"optimizer\",\"severity\":%d,\"message\":", DIAG_WARNING);
+            serialize_string(body, line, SERIALIZE_JSON);
+            wr_char(body, '}');
+            line = newline ? newline + 1 : end;
+        }
+    }
+    wr_printf(body, "],\"omitted\":%ld", diag_omitted());
+}
+
+// Tokens as JSON objects; lexical errors also go to the diagnostics
+static uint32_t write_tokens_json(Writer *body, const char *source) {
+    uint32_t errors = 0;
+    int position = 0;
+    int count = 0;
+    Token token;
+    reset_lexer();
+    wr_str(body, "{\"tokens\":[");
+    do {
+        token = get_next_token(source, &position);
+        if (token.type == TOKEN_SKIP) continue;
+        if (count++ > 0) wr_char(body, ',');
+        wr_str(body, "{\"type\":");
+        serialize_string(body, token_type_name(token.type), SERIALIZE_JSON);
+        wr_str(body, ",\"value\":");
+        serialize_string(body, token.lexeme, SERIALIZE_JSON);
+        wr_str(body, ",\"line\":");
+        wr_int(body, token.line);
+        wr_str(body, ",\"column\":");
+        wr_int(body, token.column);
+        if (token.error != ERROR_NONE) {
+            wr_str(body, ",\"error\":true");
+            diag_report(DIAG_LEXER, token.error, &token);
+            errors++;
+        }
+        wr_char(body, '}');
+    } while (token.type != TOKEN_EOF);
+    wr_str(body, "],\"errors\":");
+    wr_int(body, errors);
+    wr_char(body, ',');
+    return errors;
+}
+
+static ServeStatus answer_request(const ServeRequest *request, const char *payload, Writer *body, uint32_t *errors) {
+    const char *source = payload;
+    char *mapped = NULL;
+    size_t mapped_len = 0;
+    if (request->flags & SERVE_FLAG_PATH) {
+        mapped = map_file(payload, &mapped_len);
+        if (!mapped) {
+            wr_printf(body, "Could not open file %s", payload);
+            return SERVE_NO_FILE;
+        }
+        source = mapped;
+    }
+    if (!serve_warnings_ready) {
+        writer_init_memory(&serve_warnings);
+        serve_warnings_ready = 1;
+    }
+    Writer *warnings = &serve_warnings;
+    writer_reset(warnings);
+    set_output_writer(warnings);
+    parser_reset();
+
+    int json = request->flags & SERVE_FLAG_JSON;
+    if (request->op == SERVE_TOKENIZE) {
+        if (json) {
+            *errors = write_tokens_json(body, source);
+            write_diagnostics_json(body, source, warnings);
+            wr_char(body, '}');
+        } else {
+            int invalid = btok_encode(source, body, BTOK_FLAG_STRINGS);
+            *errors = invalid > 0 ? (uint32_t)invalid : 0;
+        }
+    } else {
+        parser_init(source);
+        ASTNode *ast = parser_optimize(parse());
+        *errors = (uint32_t)parser_error_count();
+        uint32_t nodes = (uint32_t)count_ast_nodes(ast);
+        if (json) {
+            wr_str(body, "{\"errors\":");
+            wr_int(body, *errors);
+            wr_str(body, ",\"nodes\":");
+            wr_int(body, nodes);
+            wr_char(body, ',');
+            write_diagnostics_json(body, source, warnings);
+            if (request->op == SERVE_DUMP) {
+                wr_str(body, ",\"ast\":");
+                serialize_ast(body, ast, SERIALIZE_JSON);
+            }
+            wr_char(body, '}');
+        } else {
+            // The report lines, then the optimizer's; the length goes in
+            // once they are written
+            uint32_t length = 0;
+            wr_bytes(body, (const char *)&nodes, sizeof(nodes));
+            size_t length_at = body->len;
+            wr_bytes(body, (const char *)&length, sizeof(length));
+            diag_render(body, source, 0, 0, 1);
+            wr_bytes(body, warnings->data, warnings->len);
+            length = (uint32_t)(body->len - length_at - sizeof(length));
+            if (!body->failed) {
+                memcpy(body->data + length_at, &length, sizeof(length));
+            }
+            if (request->op == SERVE_DUMP) {
+                serialize_ast(body, ast, SERIALIZE_BINARY);
+            }
+        }
+        recycle_ast(ast);       // Kept on this worker's free list
+    }
+
+    set_output_writer(NULL);
+    if (mapped) {
+        unmap_file(mapped, mapped_len);
+    }
+    return SERVE_OK;
+}
+
+static ServeStatus serve_request(const ServeRequest *request, const char *payload, Writer *body, uint32_t *errors) {
+    pthread_mutex_lock(&serve_symbols_lock);
+    while (serve_releasing) {
+        pthread_cond_wait(&serve_symbols_changed, &serve_symbols_lock);
+    }
+    serve_active++;
+    pthread_mutex_unlock(&serve_symbols_lock);
+
+    ServeStatus status = answer_request(request, payload, body, errors);
+
+    pthread_mutex_lock(&serve_symbols_lock);
+    serve_active--;
+    if (!serve_releasing && intern_mark() - serve_symbols_kept >= SERVE_SYMBOL_LIMIT) {
+        serve_releasing = 1;
+        while (serve_active > 0) {
+            pthread_cond_wait(&serve_symbols_changed, &serve_symbols_lock);
+        }
+        intern_release(serve_symbols_kept);
+        serve_releasing = 0;
+    }
+    pthread_cond_broadcast(&serve_symbols_changed);
+    pthread_mutex_unlock(&serve_symbols_lock);
+    return status;
+}
+
+static void serve_worker_exit(void) {
+    if (serve_warnings_ready) {
+        writer_free(&serve_warnings);
+        serve_warnings_ready = 0;
+    }
+    parser_release_nodes();
+    diag_free();
+    scope_end();
+}
+
+// Answer requests with the parser until SIGINT or SIGTERM; the names
+// interned before this call are kept when the others are released
+int serve_parser(const char *path, int workers) {
+    ServeHandler handler = {serve_request, serve_worker_exit};
+    serve_symbols_kept = intern_mark();
+    return serve(path, workers, &handler);
+}
+
+static const char *const serve_op_names[] = {
+    [SERVE_TOKENIZE] = "tokenize",
+    [SERVE_PARSE] = "parse",
+    [SERVE_DUMP] = "dump"
+};
+
+int serve_op_named(const char *name) {
+    for (int op = SERVE_TOKENIZE; op <= SERVE_DUMP; op++) {
+        if (strcmp(serve_op_names[op], name) == 0) return op;
+    }
+    return -1;
+}
+
+// Send each file to a server as one request and print the response:
+// JSON bodies as they are, binary ones as a summary line
+void serve_send_files(const char *socket_path, char **files, int file_count, int op, int flags) {
+    static const char *const status_names[] = {"ok", "bad request", "no file"};
+    Writer *out = output_writer();
+    int fd = serve_connect(socket_path);
+    if (fd < 0) {
+        wr_printf(out, "Error: Could not connect to %s\n", socket_path);
+        return;
+    }
+    Writer body;
+    writer_init_memory(&body);
+    for (int i = 0; i < file_count; i++) {
+        long len = 0;
+        char *source = NULL;
+        if (!(flags & SERVE_FLAG_PATH)) {
+            source = read_file(files[i], &len);
+            if (!source) {
+                wr_printf(out, "Error: Could not open file %s\n", files[i]);
+                continue;
+            }
+        }
+        const char *payload = source ? source : files[i];
+        ServeRequest request = {(uint32_t)(source ? (size_t)len : strlen(files[i])), (uint32_t)i,
+                                (uint8_t)op, (uint8_t)flags, 0};
+        ServeResponse response;
+        writer_reset(&body);
+        int sent = serve_call(fd, &request, payload, &response, &body);
+        free(source);
+        if (sent != 0) {
+            wr_printf(out, "Error: Connection to %s lost\n", socket_path);
+            break;
+        }
+        if ((flags & SERVE_FLAG_JSON) || response.status != SERVE_OK) {
+            wr_printf(out, "%s: %s, %u errors: ", files[i],
+                      response.status <= SERVE_NO_FILE ? status_names[response.status] : "?", response.errors);
+            wr_bytes(out, body.data, body.len);
+            wr_char(out, '\n');
+        } else {
+            wr_printf(out, "%s: ok, %u errors, %u bytes of %s results\n", files[i], response.errors,
+                      response.size, serve_op_names[op]);
+        }
+    }
+    writer_free(&body);
+    close(fd);
+}
+
+// Send 'requests' requests cycling through the files, as sources or paths
+void serve_load_files(const char *socket_path, char **files, int file_count, int op, int flags,
+                      int clients, long requests) {
+    Writer *out = output_writer();
+    char **payloads = calloc((size_t)file_count + 1, sizeof(char *));
+    size_t *sizes = calloc((size_t)file_count + 1, sizeof(size_t));
+    if (!payloads || !sizes) {
+        fprintf(stderr, "Error: Memory allocation failed for load generator\n");
+        exit(1);
+    }
+    int count = 0;
+    for (int i = 0; i < file_count; i++) {
+        long len = 0;
+        char *source = (flags & SERVE_FLAG_PATH) ? strdup(files[i]) : read_file(files[i], &len);
+        if (!source) {
+            wr_printf(out, "Error: Could not open file %s\n", files[i]);
+            continue;
+        }
+        payloads[count] = source;
+        sizes[count++] = (flags & SERVE_FLAG_PATH) ? strlen(source) : (size_t)len;
+    }
+    if (count > 0) {
+        ServeLoad load = {clients, requests, op, flags, payloads, sizes, count};
+        serve_loadgen(socket_path, &load, out);
+    }
+    for (int i = 0; i < count; i++) {
+        free(payloads[i]);
+    }
+    free(payloads);
+    free(sizes);
+}
@@ -0,0 +1,2220 @@
+/* ssa.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "../../include/ssa.h"
+#include "../../include/intern.h"
+
+static const char *const op_names[SSA_OP_COUNT] = {
+    [SSA_CONST] = "const", [SSA_PARAM] = "param", [SSA_PHI] = "phi",
+    [SSA_ADD] = "add", [SSA_SUB] = "sub", [SSA_MUL] = "mul",
+    [SSA_DIV] = "div", [SSA_MOD] = "mod",
+    [SSA_LT] = "lt", [SSA_GT] = "gt", [SSA_LE] = "le",
+    [SSA_GE] = "ge", [SSA_EQ] = "eq", [SSA_NE] = "ne",
+    [SSA_I2F] = "i2f", [SSA_F2I] = "f2i", [SSA_BOOL] = "bool",
+    [SSA_LOAD_GLOBAL] = "load_global", [SSA_STORE_GLOBAL] = "store_global",
+    [SSA_CALL] = "call", [SSA_FACTORIAL] = "factorial",
+    [SSA_PRINT] = "print", [SSA_PRINT_STRING] = "print_string",
+    [SSA_PRINT_FACTORIAL] = "print_factorial",
+    [SSA_JUMP] = "jump", [SSA_BRANCH] = "branch",
+    [SSA_RETURN] = "return", [SSA_HALT] = "halt"
+};
+
+static void *grow_array(void *data, int *capacity, size_t element) {
+    int grown = *capacity ? *capacity * 2 : 8;
+    void *resized = realloc(data, grown * element);
+    if (!resized) {
+        fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return resized;
+}
+
+static void *allocate(size_t count, size_t element) {
+    void *data = calloc(count ? count : 1, element);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+        exit(1);
+    }
+    return data;
+}
+
+// Operation properties
+
+int ssa_is_terminator(SsaOp op) {
+    return op >= SSA_JUMP;
+}
+
+// Neither reads memory, writes anything nor can fail at run time
+int ssa_is_pure(const SsaInstr *instr) {
+    switch (instr->op) {
+        case SSA_CONST: case SSA_PARAM: case SSA_PHI:
+        case SSA_ADD: case SSA_SUB: case SSA_MUL:
+        case SSA_LT: case SSA_GT: case SSA_LE: case SSA_GE: case SSA_EQ: case SSA_NE:
+        case SSA_I2F: case SSA_F2I: case SSA_BOOL:
+            return 1;
+        case SSA_DIV:
+            return instr->type == SSA_FLOAT; // Only integer division by zero fails
+        default:
+            return 0;
+    }
+}
+
+const char *ssa_op_name(SsaOp op) {
+    return op < SSA_OP_COUNT ? op_names[op] : "?";
+}
+
+// Construction and editing
+
+int ssa_add_block(SsaFunction *f) {
+    if (f->block_count == f->block_capacity) {
+        f->blocks = grow_array(f->blocks, &f->block_capacity, sizeof(SsaBlock));
+    }
+    memset(&f->blocks[f->block_count], 0, sizeof(SsaBlock));
+    return f->block_count++;
+}
+
+static int new_instr(SsaFunction *f, SsaOp op, SsaType type, int line) {
+    if (f->instr_count == f->instr_capacity) {
+        f->instrs = grow_array(f->instrs, &f->instr_capacity, sizeof(SsaInstr));
+    }
+    SsaInstr *instr = &f->instrs[f->instr_count];
+    memset(instr, 0, sizeof(*instr));
+    instr->op = op;
+    instr->type = type;
+    instr->line = line;
+    instr->block = -1;
+    return f->instr_count++;
+}
+
+// Put 'value' at 'position' in a block's instruction list
+static void insert_at(SsaFunction *f, int block, int position, int value) {
+    SsaBlock *b = &f->blocks[block];
+    if (b->instr_count == b->instr_capacity) {
+        b->instrs = grow_array(b->instrs, &b->instr_capacity, sizeof(int));
+    }
+    memmove(b->instrs + position + 1, b->instrs + position,
+            (b->instr_count - position) * sizeof(int));
+    b->instrs[position] = value;
+    b->instr_count++;
+    f->instrs[value].block = block;
+}
+
+// Append to a block; phis go after the block's other phis
+int ssa_add_instr(SsaFunction *f, int block, SsaOp op, SsaType type, int line) {
+    int value = new_instr(f, op, type, line);
+    SsaBlock *b = &f->blocks[block];
+    int position = b->instr_count;
+    if (op == SSA_PHI) {
+        position = 0;
+        while (position < b->instr_count && f->instrs[b->instrs[position]].op == SSA_PHI) {
+            position++;
+        }
+    }
+    insert_at(f, block, position, value);
+    return value;
+}
+
+void ssa_add_operand(SsaFunction *f, int value, int operand) {
+    SsaInstr *instr = &f->instrs[value];
+    if (instr->operand_count == instr->operand_capacity) {
+        instr->operands = grow_array(instr->operands, &instr->operand_capacity, sizeof(int));
+    }
+    instr->operands[instr->operand_count++] = operand;
+}
+
+void ssa_add_edge(SsaFunction *f, int from, int to) {
+    SsaBlock *source = &f->blocks[from];
+    source->succs[source->succ_count++] = to;
+    SsaBlock *target = &f->blocks[to];
+    if (target->pred_count == target->pred_capacity) {
+        target->preds = grow_array(target->preds, &target->pred_capacity, sizeof(int));
+    }
+    target->preds[target->pred_count++] = from;
+}
+
+static void unlink_instr(SsaFunction *f, int value) {
+    SsaInstr *instr = &f->instrs[value];
+    SsaBlock *b = &f->blocks[instr->block];
+    for (int i = 0; i < b->instr_count; i++) {
+        if (b->instrs[i] == value) {
+            memmove(b->instrs + i, b->instrs + i + 1, (b->instr_count - i - 1) * sizeof(int));
+            b->instr_count--;
+            break;
+        }
+    }
+    instr->block = -1;
+}
+
+void ssa_remove_instr(SsaFunction *f, int value) {
+    if (f->instrs[value].block >= 0) {
+        unlink_instr(f, value);
+    }
+    f->instrs[value].operand_count = 0;
+}
+
+void ssa_move_before_terminator(SsaFunction *f, int value, int block) {
+    unlink_instr(f, value);
+    SsaBlock *b = &f->blocks[block];
+    int position = b->instr_count;
+    if (position > 0 && ssa_is_terminator(f->instrs[b->instrs[position - 1]].op)) {
+        position--;
+    }
+    insert_at(f, block, position, value);
+}
+
+// Drop the edge from 'pred' into 'block', with the matching phi operands
+void ssa_remove_pred(SsaFunction *f, int block, int pred) {
+    SsaBlock *b = &f->blocks[block];
+    int index = 0;
+    while (index < b->pred_count && b->preds[index] != pred) {
+        index++;
+    }
+    if (index == b->pred_count) {
+        return;
+    }
+    memmove(b->preds + index, b->preds + index + 1, (b->pred_count - index - 1) * sizeof(int));
+    b->pred_count--;
+    for (int i = 0; i < b->instr_count; i++) {
+        SsaInstr *phi = &f->instrs[b->instrs[i]];
+        if (phi->op != SSA_PHI) {
+            break;
+        }
+        memmove(phi->operands + index, phi->operands + index + 1,
+                (phi->operand_count - index - 1) * sizeof(int));
+        phi->operand_count--;
+    }
+}
+
+static int resolve(int *replace, int value) {
+    int target = value;
+    while (replace[target] != target) {
+        target = replace[target];
+    }
+    while (replace[value] != target) {
+        int next = replace[value];
+        replace[value] = target;
+        value = next;
+    }
+    return target;
+}
+
+// Rewrite every operand v to replace[v], following chains; replace[v] == v
+// leaves v alone
+void ssa_apply_replacements(SsaFunction *f, int *replace) {
+    for (int v = 0; v < f->instr_count; v++) {
+        SsaInstr *instr = &f->instrs[v];
+        if (instr->block < 0) {
+            continue;
+        }
+        for (int i = 0; i < instr->operand_count; i++) {
+            instr->operands[i] = resolve(replace, instr->operands[i]);
+        }
+    }
+}
+
+// Empty every block the entry cannot reach; returns the number removed
+int ssa_remove_unreachable(SsaFunction *f) {
+    int count = 0;
+    int *rpo = ssa_reverse_postorder(f, &count);
+    char *reachable = allocate(f->block_count, 1);
+    for (int i = 0; i < count; i++) {
+        reachable[rpo[i]] = 1;
+    }
+
+    int removed = 0;
+    for (int b = 0; b < f->block_count; b++) {
+        SsaBlock *block = &f->blocks[b];
+        if (reachable[b] || block->removed) {
+            continue;
+        }
+        for (int i = 0; i < block->succ_count; i++) {
+            if (reachable[block->succs[i]]) {
+                ssa_remove_pred(f, block->succs[i], b);
+            }
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            f->instrs[block->instrs[i]].block = -1;
+            f->instrs[block->instrs[i]].operand_count = 0;
+        }
+        block->instr_count = 0;
+        block->pred_count = 0;
+        block->succ_count = 0;
+        block->removed = 1;
+        removed++;
+    }
+    free(reachable);
+    free(rpo);
+    return removed;
+}
+
+static int entry_constant(SsaFunction *f, SsaType type) {
+    int value = new_instr(f, SSA_CONST, type, 0);
+    insert_at(f, 0, 0, value);
+    return value;
+}
+
+// Replace phis whose operands are all one value (or the phi itself) by
+// that value, until none are left
+void ssa_remove_trivial_phis(SsaFunction *f) {
+    int *replace = allocate(f->instr_count, sizeof(int));
+    for (int v = 0; v < f->instr_count; v++) {
+        replace[v] = v;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 0; b < f->block_count; b++) {
+            SsaBlock *block = &f->blocks[b];
+            for (int i = 0; i < block->instr_count; i++) {
+                int phi = block->instrs[i];
+                if (f->instrs[phi].op != SSA_PHI) {
+                    break;
+                }
+                int same = -1;
+                int trivial = 1;
+                for (int k = 0; k < f->instrs[phi].operand_count; k++) {
+                    int operand = resolve(replace, f->instrs[phi].operands[k]);
+                    if (operand == phi || operand == same) {
+                        continue;
+                    }
+                    if (same >= 0) {
+                        trivial = 0;
+                        break;
+                    }
+                    same = operand;
+                }
+                if (!trivial) {
+                    continue;
+                }
+                if (same < 0) {
+                    // Only reachable through itself
+                    same = entry_constant(f, f->instrs[phi].type);
+                    replace = realloc(replace, f->instr_count * sizeof(int));
+                    if (!replace) {
+                        fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+                        exit(1);
+                    }
+                    replace[same] = same;
+                }
+                replace[phi] = same;
+                ssa_remove_instr(f, phi);
+                i--;
+                changed = 1;
+            }
+        }
+    }
+    ssa_apply_replacements(f, replace);
+    free(replace);
+}
+
+// Put a block on each edge from a block with two successors to one with
+// several predecessors, so that copies for phis have a place to go
+void ssa_split_critical_edges(SsaFunction *f) {
+    int count = f->block_count;
+    for (int b = 0; b < count; b++) {
+        if (f->blocks[b].removed || f->blocks[b].succ_count < 2) {
+            continue;
+        }
+        for (int k = 0; k < f->blocks[b].succ_count; k++) {
+            int succ = f->blocks[b].succs[k];
+            if (f->blocks[succ].pred_count < 2) {
+                continue;
+            }
+            SsaBlock *source = &f->blocks[b];
+            int line = f->instrs[source->instrs[source->instr_count - 1]].line;
+            int middle = ssa_add_block(f);
+            ssa_add_instr(f, middle, SSA_JUMP, SSA_VOID, line);
+            f->blocks[b].succs[k] = middle;
+
+            SsaBlock *target = &f->blocks[succ];
+            for (int i = 0; i < target->pred_count; i++) {
+                if (target->preds[i] == b) {
+                    target->preds[i] = middle;
+                    break;
+                }
+            }
+            SsaBlock *split = &f->blocks[middle];
+            split->preds = grow_array(NULL, &split->pred_capacity, sizeof(int));
+            split->preds[split->pred_count++] = b;
+            split->succs[split->succ_count++] = succ;
+        }
+    }
+}
+
+// Analysis
+
+int *ssa_reverse_postorder(const SsaFunction *f, int *count) {
+    int *order = allocate(f->block_count, sizeof(int));
+    int *stack = allocate(f->block_count, sizeof(int));
+    int *next_succ = allocate(f->block_count, sizeof(int));
+    char *visited = allocate(f->block_count, 1);
+    int done = 0;
+    int depth = 0;
+
+    if (f->block_count > 0 && !f->blocks[0].removed) {
+        stack[depth++] = 0;
+        visited[0] = 1;
+    }
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        const SsaBlock *block = &f->blocks[b];
+        if (next_succ[b] < block->succ_count) {
+            // Later successors first, so the first successor follows its
+            // block in the order
+            int succ = block->succs[block->succ_count - 1 - next_succ[b]++];
+            if (!visited[succ]) {
+                visited[succ] = 1;
+                stack[depth++] = succ;
+            }
+        } else {
+            order[done++] = b;
+            depth--;
+        }
+    }
+
+    for (int i = 0; i < done / 2; i++) {
+        int swap = order[i];
+        order[i] = order[done - 1 - i];
+        order[done - 1 - i] = swap;
+    }
+    free(stack);
+    free(next_succ);
+    free(visited);
+    *count = done;
+    return order;
+}
+
+// Immediate dominators by the Cooper-Harvey-Kennedy iteration
+int *ssa_dominators(const SsaFunction *f, const int *rpo, int count) {
+    int *idom = allocate(f->block_count, sizeof(int));
+    int *index = allocate(f->block_count, sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        idom[b] = -1;
+        index[b] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        index[rpo[i]] = i;
+    }
+    if (count == 0) {
+        free(index);
+        return idom;
+    }
+
+    idom[rpo[0]] = rpo[0];
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 1; i < count; i++) {
+            const SsaBlock *block = &f->blocks[rpo[i]];
+            int dominator = -1;
+            for (int k = 0; k < block->pred_count; k++) {
+                int pred = block->preds[k];
+                if (index[pred] < 0 || idom[pred] < 0) {
+                    continue;
+                }
+                if (dominator < 0) {
+                    dominator = pred;
+                    continue;
+                }
+                int a = pred;
+                int b = dominator;
+                while (a != b) {
+                    while (index[a] > index[b]) a = idom[a];
+                    while (index[b] > index[a]) b = idom[b];
+                }
+                dominator = a;
+            }
+            if (dominator >= 0 && idom[rpo[i]] != dominator) {
+                idom[rpo[i]] = dominator;
+                changed = 1;
+            }
+        }
+    }
+    idom[rpo[0]] = -1;
+    free(index);
+    return idom;
+}
+
+int ssa_dominates(const int *idom, int a, int b) {
+    for (; b >= 0; b = idom[b]) {
+        if (b == a) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Lowering from the AST
+
+typedef struct {
+    int slot;
+    int phi;
+} PendingPhi;
+
+typedef struct {
+    int *defs;                  // Current value of each variable slot, -1 if none
+    int sealed;                 // Every predecessor is known
+    PendingPhi *pending;        // Phis whose operands wait for the block to be sealed
+    int pending_count;
+    int pending_capacity;
+} BlockState;
+
+typedef struct {
+    SsaProgram *program;
+    SsaFunction *f;
+    Writer *errors;
+    int error_count;
+    int flags;
+    int line;                   // Line recorded for new instructions
+    int current;                // Block being filled
+    BlockState *states;
+    int state_capacity;
+    int slot_count;             // Variable slots of the function being lowered
+    ASTNode **declarations;     // Declaration of each function
+    int declaration_capacity;
+    int *function_index;        // Function per symbol ID, -1 if none
+    uint32_t function_index_size;
+    int in_function;
+    SsaType return_type;
+} Lowerer;
+
+static int lower_expression(Lowerer *l, ASTNode *node);
+static void lower_statement(Lowerer *l, ASTNode *node);
+
+static void lower_error(Lowerer *l, ASTNode *node, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(l->errors, "Compile error at line %d, column %d: %s\n",
+              node ? node->token.line : 0, node ? node->token.column : 0, message);
+    l->error_count++;
+}
+
+static SsaType declared_type(TokenType type) {
+    return type == TOKEN_FLOAT_KEY || type == TOKEN_DOUBLE ? SSA_FLOAT : SSA_INT;
+}
+
+static SsaType type_of(Lowerer *l, int value) {
+    return l->f->instrs[value].type;
+}
+
+static int new_block(Lowerer *l) {
+    int block = ssa_add_block(l->f);
+    if (block >= l->state_capacity) {
+        l->states = grow_array(l->states, &l->state_capacity, sizeof(BlockState));
+    }
+    BlockState *state = &l->states[block];
+    memset(state, 0, sizeof(*state));
+    state->defs = allocate(l->slot_count, sizeof(int));
+    for (int i = 0; i < l->slot_count; i++) {
+        state->defs[i] = -1;
+    }
+    return block;
+}
+
+static int emit(Lowerer *l, SsaOp op, SsaType type) {
+    return ssa_add_instr(l->f, l->current, op, type, l->line);
+}
+
+static int emit_unary(Lowerer *l, SsaOp op, SsaType type, int operand) {
+    int value = emit(l, op, type);
+    ssa_add_operand(l->f, value, operand);
+    return value;
+}
+
+static int emit_binary(Lowerer *l, SsaOp op, SsaType type, int left, int right) {
+    int value = emit_unary(l, op, type, left);
+    ssa_add_operand(l->f, value, right);
+    return value;
+}
+
+static int emit_constant(Lowerer *l, SsaType type, Value imm) {
+    int value = emit(l, SSA_CONST, type);
+    l->f->instrs[value].imm = imm;
+    return value;
+}
+
+static int emit_int(Lowerer *l, long long value) {
+    return emit_constant(l, SSA_INT, (Value){.i = value});
+}
+
+static int emit_zero(Lowerer *l, SsaType type) {
+    return type == SSA_FLOAT ? emit_constant(l, SSA_FLOAT, (Value){.f = 0.0}) : emit_int(l, 0);
+}
+
+// End the current block with a jump or branch
+static void emit_jump(Lowerer *l, int target) {
+    emit(l, SSA_JUMP, SSA_VOID);
+    ssa_add_edge(l->f, l->current, target);
+}
+
+static void emit_branch(Lowerer *l, int condition, int if_true, int if_false) {
+    emit_unary(l, SSA_BRANCH, SSA_VOID, condition);
+    ssa_add_edge(l->f, l->current, if_true);
+    ssa_add_edge(l->f, l->current, if_false);
+}
+
+// Code after a return goes into a block no edge reaches
+static void start_unreachable(Lowerer *l) {
+    l->current = new_block(l);
+    l->states[l->current].sealed = 1;
+}
+
+static int convert(Lowerer *l, int value, SsaType to) {
+    SsaType from = type_of(l, value);
+    if (from == SSA_INT && to == SSA_FLOAT) {
+        SsaInstr *instr = &l->f->instrs[value];
+        if (instr->op == SSA_CONST) {
+            return emit_constant(l, SSA_FLOAT, (Value){.f = (double)instr->imm.i});
+        }
+        return emit_unary(l, SSA_I2F, SSA_FLOAT, value);
+    }
+    if (from == SSA_FLOAT && to == SSA_INT) {
+        return emit_unary(l, SSA_F2I, SSA_INT, value);
+    }
+    return value;
+}
+
+// Variables, after Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form"
+
+static int read_variable(Lowerer *l, int block, int slot, SsaType type);
+
+static void add_phi_operands(Lowerer *l, int block, int slot, int phi) {
+    SsaType type = l->f->instrs[phi].type;
+    for (int i = 0; i < l->f->blocks[block].pred_count; i++) {
+        int operand = read_variable(l, l->f->blocks[block].preds[i], slot, type);
+        ssa_add_operand(l->f, phi, operand);
+    }
+}
+
+// A value made in a finished block goes before its terminator
+static int finished_block_zero(Lowerer *l, int block, SsaType type) {
+    int saved = l->current;
+    l->current = block;
+    int value = emit_zero(l, type);
+    l->current = saved;
+    const SsaBlock *b = &l->f->blocks[block];
+    if (b->instr_count > 1 && ssa_is_terminator(l->f->instrs[b->instrs[b->instr_count - 2]].op)) {
+        ssa_move_before_terminator(l->f, value, block);
+    }
+    return value;
+}
+
+static int read_variable(Lowerer *l, int block, int slot, SsaType type) {
+    int value = l->states[block].defs[slot];
+    if (value >= 0) {
+        return value;
+    }
+
+    const SsaBlock *b = &l->f->blocks[block];
+    if (!l->states[block].sealed) {
+        // Operands are added once every predecessor is known
+        value = ssa_add_instr(l->f, block, SSA_PHI, type, l->line);
+        BlockState *state = &l->states[block];
+        if (state->pending_count == state->pending_capacity) {
+            state->pending = grow_array(state->pending, &state->pending_capacity, sizeof(PendingPhi));
+        }
+        state->pending[state->pending_count++] = (PendingPhi){slot, value};
+    } else if (b->pred_count == 0) {
+        value = finished_block_zero(l, block, type);
+    } else if (b->pred_count == 1) {
+        value = read_variable(l, b->preds[0], slot, type);
+    } else {
+        value = ssa_add_instr(l->f, block, SSA_PHI, type, l->line);
+        l->states[block].defs[slot] = value; // Ends cycles through loops
+        add_phi_operands(l, block, slot, value);
+    }
+    l->states[block].defs[slot] = value;
+    return value;
+}
+
+static void seal_block(Lowerer *l, int block) {
+    BlockState *state = &l->states[block];
+    for (int i = 0; i < state->pending_count; i++) {
+        add_phi_operands(l, block, state->pending[i].slot, state->pending[i].phi);
+        state = &l->states[block];
+    }
+    free(state->pending);
+    state->pending = NULL;
+    state->pending_count = state->pending_capacity = 0;
+    state->sealed = 1;
+}
+
+// Expressions
+
+static const struct {
+    const char *lexeme;
+    SsaOp op;
+} binary_ops[] = {
+    {"+", SSA_ADD}, {"-", SSA_SUB}, {"*", SSA_MUL}, {"/", SSA_DIV}, {"%", SSA_MOD},
+    {"<", SSA_LT}, {">", SSA_GT}, {"<=", SSA_LE}, {">=", SSA_GE}, {"==", SSA_EQ}, {"!=", SSA_NE}
+};
+
+static int binary_index(const char *lexeme) {
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (strcmp(lexeme, binary_ops[i].lexeme) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int is_logical(ASTNode *node) {
+    return node->type == AST_BINOP &&
+           (strcmp(node->token.lexeme, "&&") == 0 || strcmp(node->token.lexeme, "||") == 0);
+}
+
+// Expressions whose int value is already 0 or 1
+static int is_boolean(ASTNode *node) {
+    if (node->type != AST_BINOP) {
+        return 0;
+    }
+    int index = binary_index(node->token.lexeme);
+    return is_logical(node) || (index >= 0 && binary_ops[index].op >= SSA_LT);
+}
+
+static int function_of(Lowerer *l, SymbolId sym) {
+    return sym < l->function_index_size ? l->function_index[sym] : -1;
+}
+
+static int lower_load(Lowerer *l, ASTNode *node) {
+    if (node->scope_depth < 0) {
+        lower_error(l, node, "Unresolved identifier '%s'", node->token.lexeme);
+        return emit_int(l, 0);
+    }
+    SsaType type = declared_type(node->decl_type);
+    if (node->scope_depth == 0) {
+        int value = emit(l, SSA_LOAD_GLOBAL, type);
+        l->f->instrs[value].index = node->slot;
+        return value;
+    }
+    return read_variable(l, l->current, node->slot, type);
+}
+
+static void lower_store(Lowerer *l, ASTNode *node, int value) {
+    if (node->scope_depth < 0) {
+        lower_error(l, node, "Unresolved identifier '%s'", node->token.lexeme);
+        return;
+    }
+    value = convert(l, value, declared_type(node->decl_type));
+    if (node->scope_depth == 0) {
+        int store = emit_unary(l, SSA_STORE_GLOBAL, SSA_VOID, value);
+        l->f->instrs[store].index = node->slot;
+        if (node->slot >= l->program->global_count) {
+            l->program->global_count = node->slot + 1;
+        }
+    } else {
+        l->states[l->current].defs[node->slot] = value;
+    }
+}
+
+// 0 or 1 for a condition
+static int lower_truth(Lowerer *l, ASTNode *node) {
+    int value = lower_expression(l, node);
+    if (type_of(l, value) == SSA_FLOAT || !is_boolean(node)) {
+        value = emit_unary(l, SSA_BOOL, SSA_INT, value);
+    }
+    return value;
+}
+
+// An int whose zero-ness is the condition, for branches
+static int lower_condition(Lowerer *l, ASTNode *node) {
+    int value = lower_expression(l, node);
+    if (type_of(l, value) == SSA_FLOAT) {
+        value = emit_unary(l, SSA_BOOL, SSA_INT, value);
+    }
+    return value;
+}
+
+// && and || evaluate their right operand only when needed
+static int lower_logical(Lowerer *l, ASTNode *node) {
+    int is_and = node->token.lexeme[0] == '&';
+    int condition = lower_condition(l, node->left);
+    int short_circuit = emit_int(l, is_and ? 0 : 1);
+    int right = new_block(l);
+    int join = new_block(l);
+    if (is_and) {
+        emit_branch(l, condition, right, join);
+    } else {
+        emit_branch(l, condition, join, right);
+    }
+    seal_block(l, right);
+
+    l->current = right;
+    int value = lower_truth(l, node->right);
+    emit_jump(l, join);
+    seal_block(l, join);
+
+    // Operands follow the join's predecessors: the branch, then the right side
+    l->current = join;
+    int phi = emit(l, SSA_PHI, SSA_INT);
+    ssa_add_operand(l->f, phi, short_circuit);
+    ssa_add_operand(l->f, phi, value);
+    return phi;
+}
+
+static int lower_binary(Lowerer *l, ASTNode *node) {
+    if (is_logical(node)) {
+        return lower_logical(l, node);
+    }
+    int index = binary_index(node->token.lexeme);
+    if (index < 0) {
+        lower_error(l, node, "Unsupported operator '%s'", node->token.lexeme);
+        return emit_int(l, 0);
+    }
+
+    int left = lower_expression(l, node->left);
+    int right = lower_expression(l, node->right);
+    SsaType type = type_of(l, left) == SSA_FLOAT || type_of(l, right) == SSA_FLOAT ? SSA_FLOAT : SSA_INT;
+    left = convert(l, left, type);
+    right = convert(l, right, type);
+
+    SsaOp op = binary_ops[index].op;
+    if (op == SSA_MOD && type == SSA_FLOAT) {
+        lower_error(l, node, "Operator '%s' needs integer operands", node->token.lexeme);
+        return emit_int(l, 0);
+    }
+    l->line = node->token.line;    // A fault is reported at the operator
+    return emit_binary(l, op, op >= SSA_LT ? SSA_INT : type, left, right);
+}
+
+static int lower_call(Lowerer *l, ASTNode *node) {
+    int index = function_of(l, node->token.sym);
+    if (index < 0) {
+        lower_error(l, node, "Call to undefined function '%s'", node->token.lexeme);
+        return emit_int(l, 0);
+    }
+
+    ASTNode *decl = l->declarations[index];
+    int argc = node->left ? 1 : 0;
+    if (argc > l->program->functions[index].params) {
+        lower_error(l, node, "Too many arguments to '%s'", node->token.lexeme);
+    }
+    int argument = -1;
+    if (argc) {
+        argument = lower_expression(l, node->left);
+        if (decl->left) {
+            argument = convert(l, argument, declared_type(decl->left->decl_type));
+        }
+    }
+    l->line = node->token.line;
+    int call = emit(l, SSA_CALL, declared_type(decl->decl_type));
+    l->f->instrs[call].index = index;
+    if (argc) {
+        ssa_add_operand(l->f, call, argument);
+    }
+    return call;
+}
+
+static int lower_expression(Lowerer *l, ASTNode *node) {
+    if (!node) {
+        return emit_int(l, 0);
+    }
+    l->line = node->token.line;
+
+    switch (node->type) {
+        case AST_NUMBER:
+            if (node->token.type == TOKEN_FLOAT) {
+                return emit_constant(l, SSA_FLOAT, (Value){.f = node->token.float_value});
+            }
+            return emit_int(l, node->token.int_value);
+        case AST_IDENTIFIER:
+            return lower_load(l, node);
+        case AST_BINOP:
+            return lower_binary(l, node);
+        case AST_FACTORIAL: {
+            int value = convert(l, lower_expression(l, node->left), SSA_INT);
+            l->line = node->token.line;
+            return emit_unary(l, SSA_FACTORIAL, SSA_INT, value);
+        }
+        case AST_FUNCTION_CALL:
+            return lower_call(l, node);
+        case AST_STRING:
+            lower_error(l, node, "String literals can only be printed");
+            return emit_int(l, 0);
+        default:
+            lower_error(l, node, "Unsupported expression");
+            return emit_int(l, 0);
+    }
+}
+
+// Statements
+
+static int add_string(SsaProgram *p, const char *text) {
+    int length = (int)strlen(text) + 1;
+    while (p->strings_length + length > p->strings_capacity) {
+        p->strings = grow_array(p->strings, &p->strings_capacity, 1);
+    }
+    memcpy(p->strings + p->strings_length, text, length);
+    p->strings_length += length;
+    return p->strings_length - length;
+}
+
+static void lower_print(Lowerer *l, ASTNode *node) {
+    ASTNode *value = node->left;
+    if (value && value->type == AST_STRING) {
+        int print = emit(l, SSA_PRINT_STRING, SSA_VOID);
+        l->f->instrs[print].index = add_string(l->program, value->token.lexeme);
+    } else if (value && value->type == AST_FACTORIAL && (l->flags & VM_BIGINT)) {
+        int n = convert(l, lower_expression(l, value->left), SSA_INT);
+        l->line = value->token.line;
+        emit_unary(l, SSA_PRINT_FACTORIAL, SSA_VOID, n);
+    } else {
+        emit_unary(l, SSA_PRINT, SSA_VOID, lower_expression(l, value));
+    }
+}
+
+static void lower_if(Lowerer *l, ASTNode *node) {
+    ASTNode *then_branch = node->right;
+    ASTNode *else_branch = NULL;
+    if (then_branch && then_branch->type == AST_ELSE) {
+        else_branch = then_branch->right;
+        then_branch = then_branch->left;
+    }
+
+    int condition = lower_condition(l, node->left);
+    int then_block = new_block(l);
+    int else_block = else_branch ? new_block(l) : -1;
+    int join = new_block(l);
+    emit_branch(l, condition, then_block, else_branch ? else_block : join);
+    seal_block(l, then_block);
+
+    l->current = then_block;
+    lower_statement(l, then_branch);
+    emit_jump(l, join);
+    if (else_branch) {
+        seal_block(l, else_block);
+        l->current = else_block;
+        lower_statement(l, else_branch);
+        emit_jump(l, join);
+    }
+    seal_block(l, join);
+    l->current = join;
+}
+
+// Loops are rotated: the condition is tested before the first iteration
+// and again at the end of the body, so the body is the loop header
+static void lower_while(Lowerer *l, ASTNode *node) {
+    int condition = lower_condition(l, node->left);
+    int body = new_block(l);
+    int exit = new_block(l);
+    emit_branch(l, condition, body, exit);
+
+    l->current = body;
+    lower_statement(l, node->right);
+    condition = lower_condition(l, node->left);
+    emit_branch(l, condition, body, exit);
+    seal_block(l, body);
+    seal_block(l, exit);
+    l->current = exit;
+}
+
+// taeper { body } litnu (condition): run the body until the condition holds
+static void lower_repeat(Lowerer *l, ASTNode *node) {
+    int body = new_block(l);
+    emit_jump(l, body);
+
+    l->current = body;
+    lower_statement(l, node->left);
+    int condition = lower_condition(l, node->right);
+    int exit = new_block(l);
+    emit_branch(l, condition, exit, body);
+    seal_block(l, body);
+    seal_block(l, exit);
+    l->current = exit;
+}
+
+static void lower_statement(Lowerer *l, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    l->line = node->token.line;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            for (ASTNode *link = node; link && link->type == node->type; link = link->right) {
+                lower_statement(l, link->left);
+            }
+            break;
+        case AST_VARDECL:
+            if (node->right) {
+                lower_store(l, node, lower_expression(l, node->right));
+            } else {
+                lower_store(l, node, emit_zero(l, declared_type(node->decl_type)));
+            }
+            break;
+        case AST_ASSIGN:
+            lower_store(l, node->left, lower_expression(l, node->right));
+            break;
+        case AST_PRINT:
+            lower_print(l, node);
+            break;
+        case AST_RETURN:
+            if (l->in_function) {
+                int value = convert(l, lower_expression(l, node->left), l->return_type);
+                emit_unary(l, SSA_RETURN, SSA_VOID, value);
+            } else {
+                int value = convert(l, lower_expression(l, node->left), SSA_INT);
+                emit_unary(l, SSA_HALT, SSA_VOID, value);
+            }
+            start_unreachable(l);
+            break;
+        case AST_IF:
+            lower_if(l, node);
+            break;
+        case AST_WHILE:
+            lower_while(l, node);
+            break;
+        case AST_FOR:
+            lower_repeat(l, node);
+            break;
+        case AST_FUNCTION_DECL:
+            if (l->in_function) {
+                lower_error(l, node, "Nested function '%s' is not supported", node->token.lexeme);
+            }
+            break; // Top-level functions are lowered separately
+        default:
+            // Expression statement
+            lower_expression(l, node);
+            break;
+    }
+}
+
+static void begin_function(Lowerer *l, SsaFunction *f, int slot_count) {
+    l->f = f;
+    l->slot_count = slot_count;
+    l->current = new_block(l);
+    l->states[l->current].sealed = 1;
+}
+
+// Drop what construction left unreachable or redundant, and the
+// construction state
+static void end_function(Lowerer *l) {
+    for (int b = 0; b < l->f->block_count; b++) {
+        free(l->states[b].defs);
+        free(l->states[b].pending);
+    }
+    ssa_remove_unreachable(l->f);
+    ssa_remove_trivial_phis(l->f);
+}
+
+static void lower_function(Lowerer *l, int index) {
+    ASTNode *decl = l->declarations[index];
+    SsaFunction *f = &l->program->functions[index];
+    int slot_count = decl->slot > f->params ? decl->slot : f->params;
+    begin_function(l, f, slot_count);
+    l->in_function = 1;
+    l->return_type = f->return_type;
+
+    int number = 0;
+    for (ASTNode *param = decl->left; param; param = param->right) {
+        l->line = param->token.line;
+        int value = emit(l, SSA_PARAM, declared_type(param->decl_type));
+        f->instrs[value].index = number++;
+        if (param->slot >= 0 && param->slot < slot_count) {
+            l->states[l->current].defs[param->slot] = value;
+        }
+    }
+
+    lower_statement(l, decl->right);
+    l->line = decl->token.line;
+    emit_unary(l, SSA_RETURN, SSA_VOID, emit_zero(l, l->return_type)); // Falling off the end returns 0
+    end_function(l);
+}
+
+// Register every top-level function so calls can precede declarations
+static void declare_functions(Lowerer *l, ASTNode *root) {
+    SsaProgram *p = l->program;
+    int capacity = 0;
+    for (ASTNode *link = root; link && link->type == AST_PROGRAM; link = link->right) {
+        ASTNode *decl = link->left;
+        if (!decl || decl->type != AST_FUNCTION_DECL) {
+            continue;
+        }
+        if (decl->slot < 0) {
+            lower_error(l, decl, "Function '%s' was not resolved", decl->token.lexeme);
+            continue;
+        }
+        if (function_of(l, decl->token.sym) >= 0) {
+            lower_error(l, decl, "Duplicate function '%s'", decl->token.lexeme);
+            continue;
+        }
+
+        if (decl->token.sym >= l->function_index_size) {
+            uint32_t size = l->function_index_size ? l->function_index_size : 256;
+            while (size <= decl->token.sym) size *= 2;
+            int *resized = realloc(l->function_index, size * sizeof(int));
+            if (!resized) {
+                fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+                exit(1);
+            }
+            memset(resized + l->function_index_size, 0xff,
+                   (size - l->function_index_size) * sizeof(int));
+            l->function_index = resized;
+            l->function_index_size = size;
+        }
+        if (p->function_count == capacity) {
+            int declarations = capacity;
+            p->functions = grow_array(p->functions, &capacity, sizeof(SsaFunction));
+            l->declarations = grow_array(l->declarations, &declarations, sizeof(ASTNode *));
+        }
+
+        SsaFunction *f = &p->functions[p->function_count];
+        memset(f, 0, sizeof(*f));
+        f->name = decl->token.sym;
+        f->return_type = declared_type(decl->decl_type);
+        for (ASTNode *param = decl->left; param; param = param->right) {
+            f->params++;
+        }
+        l->function_index[decl->token.sym] = p->function_count;
+        l->declarations[p->function_count++] = decl;
+    }
+}
+
+// Lower a parsed program.  Identifiers must have been resolved (--resolve)
+// so that every variable has a scope depth and a frame slot.
+int ssa_lower(ASTNode *root, int flags, SsaProgram *program, Writer *errors) {
+    memset(program, 0, sizeof(*program));
+    Lowerer l = {0};
+    l.program = program;
+    l.errors = errors;
+    l.flags = flags;
+
+    if (root && root->type == AST_PROGRAM) {
+        declare_functions(&l, root);
+    }
+
+    // Top-level statements, then niam() if there is one
+    program->top.name = SYMBOL_NONE;
+    program->top.return_type = SSA_INT;
+    begin_function(&l, &program->top, 0);
+    lower_statement(&l, root);
+    int entry = function_of(&l, intern_cstr("niam"));
+    int result;
+    if (entry >= 0) {
+        result = emit(&l, SSA_CALL, program->functions[entry].return_type);
+        program->top.instrs[result].index = entry;
+    } else {
+        result = emit_int(&l, 0);
+    }
+    emit_unary(&l, SSA_HALT, SSA_VOID, result);
+    end_function(&l);
+
+    for (int i = 0; i < program->function_count; i++) {
+        lower_function(&l, i);
+    }
+
+    free(l.states);
+    free(l.declarations);
+    free(l.function_index);
+    return l.error_count;
+}
+
+// Verification
+
+typedef struct {
+    const SsaProgram *program;
+    const SsaFunction *f;
+    Writer *errors;
+    int problems;
+} Verifier;
+
+static void verify_error(Verifier *v, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    const char *name = v->f->name == SYMBOL_NONE ? "top level" : symbol_name(v->f->name);
+    wr_printf(v->errors, "SSA error in %s: %s\n", name, message);
+    v->problems++;
+}
+
+static int count_of(const int *list, int length, int item) {
+    int count = 0;
+    for (int i = 0; i < length; i++) {
+        count += list[i] == item;
+    }
+    return count;
+}
+
+// Operands an instruction must have, -1 for a call (checked separately)
+static int expected_operands(const SsaFunction *f, const SsaInstr *instr) {
+    switch (instr->op) {
+        case SSA_CONST: case SSA_PARAM: case SSA_LOAD_GLOBAL: case SSA_PRINT_STRING: case SSA_JUMP:
+            return 0;
+        case SSA_PHI:
+            return f->blocks[instr->block].pred_count;
+        case SSA_ADD: case SSA_SUB: case SSA_MUL: case SSA_DIV: case SSA_MOD:
+        case SSA_LT: case SSA_GT: case SSA_LE: case SSA_GE: case SSA_EQ: case SSA_NE:
+            return 2;
+        case SSA_CALL:
+            return -1;
+        default:
+            return 1;
+    }
+}
+
+static void verify_types(Verifier *v, int value) {
+    const SsaFunction *f = v->f;
+    const SsaInstr *instr = &f->instrs[value];
+    SsaType first = instr->operand_count > 0 ? f->instrs[instr->operands[0]].type : SSA_VOID;
+    SsaType second = instr->operand_count > 1 ? f->instrs[instr->operands[1]].type : SSA_VOID;
+
+    switch (instr->op) {
+        case SSA_ADD: case SSA_SUB: case SSA_MUL: case SSA_DIV: case SSA_MOD:
+            if (instr->type == SSA_VOID || first != instr->type || second != instr->type) {
+                verify_error(v, "v%d: operand types do not match the result", value);
+            } else if (instr->op == SSA_MOD && instr->type != SSA_INT) {
+                verify_error(v, "v%d: mod of floats", value);
+            }
+            break;
+        case SSA_LT: case SSA_GT: case SSA_LE: case SSA_GE: case SSA_EQ: case SSA_NE:
+            if (instr->type != SSA_INT || first != second || first == SSA_VOID) {
+                verify_error(v, "v%d: comparison types are wrong", value);
+            }
+            break;
+        case SSA_I2F:
+            if (first != SSA_INT || instr->type != SSA_FLOAT) {
+                verify_error(v, "v%d: i2f needs an int operand and a float result", value);
+            }
+            break;
+        case SSA_F2I:
+            if (first != SSA_FLOAT || instr->type != SSA_INT) {
+                verify_error(v, "v%d: f2i needs a float operand and an int result", value);
+            }
+            break;
+        case SSA_BOOL: case SSA_FACTORIAL:
+            if (instr->type != SSA_INT || (instr->op == SSA_FACTORIAL && first != SSA_INT)) {
+                verify_error(v, "v%d: %s types are wrong", value, op_names[instr->op]);
+            }
+            break;
+        case SSA_PHI:
+            for (int i = 0; i < instr->operand_count; i++) {
+                if (f->instrs[instr->operands[i]].type != instr->type) {
+                    verify_error(v, "v%d: phi operand v%d has another type", value, instr->operands[i]);
+                }
+            }
+            break;
+        case SSA_CONST: case SSA_PARAM: case SSA_LOAD_GLOBAL:
+            if (instr->type == SSA_VOID) {
+                verify_error(v, "v%d: %s without a type", value, op_names[instr->op]);
+            }
+            if (instr->op == SSA_PARAM && (instr->index < 0 || instr->index >= f->params)) {
+                verify_error(v, "v%d: no parameter %d", value, instr->index);
+            }
+            if (instr->op == SSA_LOAD_GLOBAL &&
+                (instr->index < 0 || instr->index >= v->program->global_count)) {
+                verify_error(v, "v%d: no global %d", value, instr->index);
+            }
+            break;
+        case SSA_STORE_GLOBAL:
+            if (instr->index < 0 || instr->index >= v->program->global_count) {
+                verify_error(v, "v%d: no global %d", value, instr->index);
+            }
+            break;
+        case SSA_CALL:
+            if (instr->index < 0 || instr->index >= v->program->function_count) {
+                verify_error(v, "v%d: no function %d", value, instr->index);
+            } else if (instr->operand_count > 1 ||
+                       instr->operand_count > v->program->functions[instr->index].params) {
+                verify_error(v, "v%d: too many arguments", value);
+            } else if (instr->type != v->program->functions[instr->index].return_type) {
+                verify_error(v, "v%d: call type differs from the return type", value);
+            }
+            break;
+        case SSA_PRINT_FACTORIAL:
+            if (first != SSA_INT) {
+                verify_error(v, "v%d: print_factorial needs an int", value);
+            }
+            break;
+        case SSA_PRINT_STRING:
+            if (instr->index < 0 || instr->index >= v->program->strings_length) {
+                verify_error(v, "v%d: no string at %d", value, instr->index);
+            }
+            break;
+        case SSA_BRANCH:
+            if (first != SSA_INT) {
+                verify_error(v, "v%d: branch condition is not an int", value);
+            }
+            break;
+        case SSA_RETURN:
+            if (first != f->return_type) {
+                verify_error(v, "v%d: returned type differs from the function's", value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void verify_function(Verifier *v) {
+    const SsaFunction *f = v->f;
+    if (f->block_count == 0 || f->blocks[0].removed) {
+        verify_error(v, "no entry block");
+        return;
+    }
+    if (f->blocks[0].pred_count > 0) {
+        verify_error(v, "entry block b0 has predecessors");
+    }
+
+    int count = 0;
+    int *rpo = ssa_reverse_postorder(f, &count);
+    int *idom = ssa_dominators(f, rpo, count);
+    char *reachable = allocate(f->block_count, 1);
+    int *position = allocate(f->instr_count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        reachable[rpo[i]] = 1;
+    }
+
+    // Block structure and edges
+    for (int b = 0; b < f->block_count; b++) {
+        const SsaBlock *block = &f->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        if (!reachable[b]) {
+            verify_error(v, "b%d is unreachable", b);
+            continue;
+        }
+        if (block->instr_count == 0) {
+            verify_error(v, "b%d is empty", b);
+            continue;
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            int value = block->instrs[i];
+            const SsaInstr *instr = &f->instrs[value];
+            position[value] = i;
+            if (instr->block != b) {
+                verify_error(v, "v%d is listed in b%d but belongs to b%d", value, b, instr->block);
+            }
+            if (instr->op == SSA_PHI && i > 0 && f->instrs[block->instrs[i - 1]].op != SSA_PHI) {
+                verify_error(v, "phi v%d follows other instructions in b%d", value, b);
+            }
+            if (ssa_is_terminator(instr->op) && i != block->instr_count - 1) {
+                verify_error(v, "terminator v%d is not last in b%d", value, b);
+            }
+        }
+        const SsaInstr *last = &f->instrs[block->instrs[block->instr_count - 1]];
+        int succs = last->op == SSA_JUMP ? 1 : last->op == SSA_BRANCH ? 2 : 0;
+        if (!ssa_is_terminator(last->op)) {
+            verify_error(v, "b%d does not end with a terminator", b);
+        } else if (block->succ_count != succs) {
+            verify_error(v, "b%d has %d successors for a %s", b, block->succ_count, op_names[last->op]);
+        }
+        for (int i = 0; i < block->succ_count; i++) {
+            const SsaBlock *succ = &f->blocks[block->succs[i]];
+            if (succ->removed ||
+                count_of(succ->preds, succ->pred_count, b) != count_of(block->succs, block->succ_count, block->succs[i])) {
+                verify_error(v, "edge b%d -> b%d is not in the predecessors", b, block->succs[i]);
+            }
+        }
+        for (int i = 0; i < block->pred_count; i++) {
+            int pred = block->preds[i];
+            if (pred < 0 || pred >= f->block_count || f->blocks[pred].removed ||
+                count_of(f->blocks[pred].succs, f->blocks[pred].succ_count, b) == 0) {
+                verify_error(v, "predecessor b%d of b%d has no edge to it", pred, b);
+            }
+        }
+    }
+
+    // Operands: defined, dominating their uses, and well typed
+    for (int i = 0; i < count; i++) {
+        int b = rpo[i];
+        const SsaBlock *block = &f->blocks[b];
+        for (int j = 0; j < block->instr_count; j++) {
+            int value = block->instrs[j];
+            const SsaInstr *instr = &f->instrs[value];
+            int expected = expected_operands(f, instr);
+            if (expected >= 0 && instr->operand_count != expected) {
+                verify_error(v, "v%d: %s has %d operands, not %d", value, op_names[instr->op],
+                             instr->operand_count, expected);
+                continue;
+            }
+
+            int valid = 1;
+            for (int k = 0; k < instr->operand_count; k++) {
+                int operand = instr->operands[k];
+                if (operand < 0 || operand >= f->instr_count || f->instrs[operand].block < 0) {
+                    verify_error(v, "v%d uses v%d, which is not defined", value, operand);
+                    valid = 0;
+                    continue;
+                }
+                const SsaInstr *def = &f->instrs[operand];
+                if (def->type == SSA_VOID) {
+                    verify_error(v, "v%d uses v%d, which has no value", value, operand);
+                    valid = 0;
+                    continue;
+                }
+                int use_block = instr->op == SSA_PHI ? block->preds[k] : b;
+                int dominates = def->block == use_block
+                                    ? instr->op == SSA_PHI || position[operand] < j
+                                    : ssa_dominates(idom, def->block, use_block);
+                if (!dominates) {
+                    verify_error(v, "v%d uses v%d, which does not dominate it", value, operand);
+                }
+            }
+            if (valid) {
+                verify_types(v, value);
+            }
+        }
+    }
+
+    free(rpo);
+    free(idom);
+    free(reachable);
+    free(position);
+}
+
+// Check the structure, dominance and typing rules of every function;
+// problems are reported to 'errors'
+int ssa_verify(const SsaProgram *program, Writer *errors) {
+    Verifier v = {program, &program->top, errors, 0};
+    verify_function(&v);
+    for (int i = 0; i < program->function_count; i++) {
+        v.f = &program->functions[i];
+        verify_function(&v);
+    }
+    return v.problems;
+}
+
+// Printing
+
+static const char *type_name(SsaType type) {
+    return type == SSA_INT ? "int" : type == SSA_FLOAT ? "float" : "void";
+}
+
+// Fewest significant digits (15 to 17) that read back as the same value
+static void write_float(Writer *out, double value) {
+    char text[32];
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    wr_str(out, text);
+}
+
+static void dump_instr(Writer *out, const SsaProgram *p, const SsaFunction *f, int value) {
+    const SsaInstr *instr = &f->instrs[value];
+    const SsaBlock *block = &f->blocks[instr->block];
+    wr_str(out, "    ");
+    if (instr->type != SSA_VOID) {
+        wr_printf(out, "v%d = %s %s", value, op_names[instr->op], type_name(instr->type));
+    } else {
+        wr_str(out, op_names[instr->op]);
+    }
+
+    switch (instr->op) {
+        case SSA_CONST:
+            wr_char(out, ' ');
+            if (instr->type == SSA_FLOAT) {
+                write_float(out, instr->imm.f);
+            } else {
+                wr_int(out, instr->imm.i);
+            }
+            break;
+        case SSA_PARAM:
+            wr_printf(out, " %d", instr->index);
+            break;
+        case SSA_PHI:
+            for (int k = 0; k < instr->operand_count; k++) {
+                wr_printf(out, "%s [v%d, b%d]", k ? "," : "", instr->operands[k],
+                          k < block->pred_count ? block->preds[k] : -1);
+            }
+            break;
+        case SSA_LOAD_GLOBAL:
+            wr_printf(out, " g%d", instr->index);
+            break;
+        case SSA_STORE_GLOBAL:
+            wr_printf(out, " g%d, v%d", instr->index, instr->operands[0]);
+            break;
+        case SSA_CALL:
+            wr_printf(out, " %s(", symbol_name(p->functions[instr->index].name));
+            for (int k = 0; k < instr->operand_count; k++) {
+                wr_printf(out, "%sv%d", k ? ", " : "", instr->operands[k]);
+            }
+            wr_char(out, ')');
+            break;
+        case SSA_PRINT_STRING:
+            wr_printf(out, " \"%s\"", p->strings + instr->index);
+            break;
+        case SSA_JUMP:
+            wr_printf(out, " b%d", block->succs[0]);
+            break;
+        case SSA_BRANCH:
+            wr_printf(out, " v%d, b%d, b%d", instr->operands[0], block->succs[0], block->succs[1]);
+            break;
+        default:
+            for (int k = 0; k < instr->operand_count; k++) {
+                wr_printf(out, "%s v%d", k ? "," : "", instr->operands[k]);
+            }
+            break;
+    }
+    wr_char(out, '\n');
+}
+
+static void dump_function(Writer *out, const SsaProgram *p, const SsaFunction *f) {
+    if (f->name == SYMBOL_NONE) {
+        wr_str(out, "== top level ==\n");
+    } else {
+        wr_printf(out, "== %s (params %d) -> %s ==\n", symbol_name(f->name), f->params,
+                  type_name(f->return_type));
+    }
+    for (int b = 0; b < f->block_count; b++) {
+        const SsaBlock *block = &f->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        wr_printf(out, "b%d:", b);
+        for (int k = 0; k < block->pred_count; k++) {
+            wr_printf(out, "%s b%d", k ? "," : "    ; preds", block->preds[k]);
+        }
+        wr_char(out, '\n');
+        for (int i = 0; i < block->instr_count; i++) {
+            dump_instr(out, p, f, block->instrs[i]);
+        }
+    }
+}
+
+// Listing of the top-level code and each function
+void ssa_dump(Writer *out, const SsaProgram *program) {
+    dump_function(out, program, &program->top);
+    for (int i = 0; i < program->function_count; i++) {
+        dump_function(out, program, &program->functions[i]);
+    }
+}
+
+// Bytecode generation.  A value used once, later in its own block, is
+// computed on the operand stack where it is used (if that keeps memory
+// accesses and failures in order); other values live in frame slots, which
+// are shared between values that are never live at once.  Phis become
+// copies at the end of each predecessor, made through the operand stack.
+
+typedef struct {
+    BytecodeProgram *program;
+    SsaFunction *f;
+    int line;                   // Line recorded for emitted words
+    int depth;                  // Operand stack depth at this point
+    int max_depth;
+    int global_base;            // Slots of the top-level code are globals from here, -1 in functions
+    int *uses;                  // Uses of each value
+    int *user;                  // An instruction using each value
+    int *phi_user;              // A phi using each value, -1 if none
+    char *inlined;              // Computed where its only user needs it
+    int *root;                  // Instruction whose code computes each value
+    int *slot;                  // Frame slot of each value, -1 if none
+    int *block_offset;          // Code offset of each block
+    char *skipped;              // Blocks holding only a jump, which are not emitted
+    int *fixups;                // Pairs of jump operand offset and target block
+    int fixup_count;
+    int fixup_capacity;
+    int *constant_table;        // Constant index + 1 by hash of its bits, 0 if empty
+    int constant_table_size;
+} Codegen;
+
+static void gen_word(Codegen *g, int32_t word) {
+    BytecodeProgram *p = g->program;
+    if (p->code_length == p->code_capacity) {
+        int capacity = p->code_capacity;
+        p->code = grow_array(p->code, &p->code_capacity, sizeof(int32_t));
+        p->lines = grow_array(p->lines, &capacity, sizeof(int));
+    }
+    p->lines[p->code_length] = g->line;
+    p->code[p->code_length++] = word;
+}
+
+static void gen_op(Codegen *g, Opcode op, int effect) {
+    gen_word(g, op);
+    g->depth += effect;
+    if (g->depth > g->max_depth) {
+        g->max_depth = g->depth;
+    }
+}
+
+static void gen_op_arg(Codegen *g, Opcode op, int effect, int32_t operand) {
+    gen_op(g, op, effect);
+    gen_word(g, operand);
+}
+
+static void gen_jump(Codegen *g, Opcode op, int effect, int block) {
+    gen_op(g, op, effect);
+    if (g->fixup_count + 2 > g->fixup_capacity) {
+        g->fixups = grow_array(g->fixups, &g->fixup_capacity, sizeof(int));
+    }
+    g->fixups[g->fixup_count++] = g->program->code_length;
+    g->fixups[g->fixup_count++] = block;
+    gen_word(g, -1);
+}
+
+static int gen_constant(Codegen *g, Value value) {
+    BytecodeProgram *p = g->program;
+    if (p->constant_count * 2 >= g->constant_table_size) {
+        // Rebuild the lookup table at twice the size
+        int size = g->constant_table_size ? g->constant_table_size * 2 : 64;
+        int *table = allocate(size, sizeof(int));
+        for (int i = 0; i < p->constant_count; i++) {
+            uint64_t h = (uint64_t)p->constants[i].i * 0x9e3779b97f4a7c15ULL;
+            int slot = (int)(h >> 32) & (size - 1);
+            while (table[slot]) slot = (slot + 1) & (size - 1);
+            table[slot] = i + 1;
+        }
+        free(g->constant_table);
+        g->constant_table = table;
+        g->constant_table_size = size;
+    }
+
+    // Constants are deduplicated by bit pattern
+    uint64_t h = (uint64_t)value.i * 0x9e3779b97f4a7c15ULL;
+    int mask = g->constant_table_size - 1;
+    int slot = (int)(h >> 32) & mask;
+    while (g->constant_table[slot]) {
+        int index = g->constant_table[slot] - 1;
+        if (p->constants[index].i == value.i) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (p->constant_count == p->constant_capacity) {
+        p->constants = grow_array(p->constants, &p->constant_capacity, sizeof(Value));
+    }
+    p->constants[p->constant_count] = value;
+    g->constant_table[slot] = p->constant_count + 1;
+    return p->constant_count++;
+}
+
+static void gen_load(Codegen *g, int slot) {
+    if (g->global_base >= 0) {
+        gen_op_arg(g, OP_LOAD_GLOBAL, 1, g->global_base + slot);
+    } else {
+        gen_op_arg(g, OP_LOAD, 1, slot);
+    }
+}
+
+static void gen_store(Codegen *g, int slot) {
+    if (g->global_base >= 0) {
+        gen_op_arg(g, OP_STORE_GLOBAL, -1, g->global_base + slot);
+    } else {
+        gen_op_arg(g, OP_STORE, -1, slot);
+    }
+}
+
+static void gen_compute(Codegen *g, int value);
+
+// Push an operand: constants are rematerialized at each use
+static void gen_operand(Codegen *g, int value) {
+    const SsaInstr *instr = &g->f->instrs[value];
+    if (instr->op == SSA_CONST) {
+        gen_op_arg(g, OP_CONST, 1, gen_constant(g, instr->imm));
+    } else if (g->inlined[value]) {
+        gen_compute(g, value);
+    } else {
+        gen_load(g, g->slot[value]);
+    }
+}
+
+// Push the operands of 'value' and apply its operation
+static void gen_compute(Codegen *g, int value) {
+    const SsaFunction *f = g->f;
+    const SsaInstr *instr = &f->instrs[value];
+    for (int i = 0; i < instr->operand_count; i++) {
+        gen_operand(g, instr->operands[i]);
+    }
+    g->line = instr->line;
+    int is_float = instr->operand_count > 0 && f->instrs[instr->operands[0]].type == SSA_FLOAT;
+
+    switch (instr->op) {
+        case SSA_ADD: case SSA_SUB: case SSA_MUL: case SSA_DIV: case SSA_MOD:
+            gen_op(g, (is_float ? OP_ADD_F : OP_ADD_I) + (instr->op - SSA_ADD), -1);
+            break;
+        case SSA_LT: case SSA_GT: case SSA_LE: case SSA_GE: case SSA_EQ: case SSA_NE:
+            gen_op(g, (is_float ? OP_LT_F : OP_LT_I) + (instr->op - SSA_LT), -1);
+            break;
+        case SSA_I2F:
+            gen_op(g, OP_I2F, 0);
+            break;
+        case SSA_F2I:
+            gen_op(g, OP_F2I, 0);
+            break;
+        case SSA_BOOL:
+            gen_op(g, is_float ? OP_BOOL_F : OP_BOOL_I, 0);
+            break;
+        case SSA_LOAD_GLOBAL:
+            gen_op_arg(g, OP_LOAD_GLOBAL, 1, instr->index);
+            break;
+        case SSA_STORE_GLOBAL:
+            gen_op_arg(g, OP_STORE_GLOBAL, -1, instr->index);
+            break;
+        case SSA_CALL:
+            gen_op(g, OP_CALL, 1 - instr->operand_count);
+            gen_word(g, instr->index);
+            gen_word(g, instr->operand_count);
+            break;
+        case SSA_FACTORIAL:
+            gen_op(g, OP_FACTORIAL, 0);
+            break;
+        case SSA_PRINT:
+            gen_op(g, is_float ? OP_PRINT_F : OP_PRINT_I, -1);
+            break;
+        case SSA_PRINT_STRING:
+            gen_op_arg(g, OP_PRINT_STR, 0, instr->index);
+            break;
+        case SSA_PRINT_FACTORIAL:
+            gen_op(g, OP_PRINT_FACTORIAL, -1);
+            break;
+        case SSA_RETURN:
+            gen_op(g, OP_RETURN, -1);
+            break;
+        case SSA_HALT:
+            gen_op(g, OP_HALT, -1);
+            break;
+        default:
+            break;
+    }
+}
+
+// Decide which values of a block are computed inside their user's code
+// Whether computing an inlined tree reads memory or can fail
+static int tree_has_effect(const Codegen *g, int value) {
+    const SsaInstr *instr = &g->f->instrs[value];
+    if (!ssa_is_pure(instr)) {
+        return 1;
+    }
+    for (int i = 0; i < instr->operand_count; i++) {
+        if (g->inlined[instr->operands[i]] && tree_has_effect(g, instr->operands[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A tree is emitted operands first, left to right, so an inlined value
+// with effects must not end up after an effect that follows it in the block:
+// on its way up to the root, no earlier operand may hold one
+static int keeps_effect_order(const Codegen *g, int value, int root) {
+    const SsaFunction *f = g->f;
+    int node = value;
+    while (node != root) {
+        const SsaInstr *parent = &f->instrs[g->user[node]];
+        for (int i = 0; i < parent->operand_count && parent->operands[i] != node; i++) {
+            if (g->inlined[parent->operands[i]] && tree_has_effect(g, parent->operands[i])) {
+                return 0;
+            }
+        }
+        node = g->user[node];
+    }
+    return 1;
+}
+
+static void plan_block(Codegen *g, int b) {
+    const SsaFunction *f = g->f;
+    const SsaBlock *block = &f->blocks[b];
+    for (int i = block->instr_count - 1; i >= 0; i--) {
+        int value = block->instrs[i];
+        const SsaInstr *instr = &f->instrs[value];
+        g->root[value] = value;
+        if (instr->op == SSA_CONST || instr->op == SSA_PHI || instr->op == SSA_PARAM ||
+            instr->type == SSA_VOID || g->uses[value] != 1) {
+            continue;
+        }
+        int user = g->user[value];
+        if (f->instrs[user].block != b || f->instrs[user].op == SSA_PHI) {
+            continue;
+        }
+
+        // Moving a value that reads memory or can fail past anything but
+        // its own tree could reorder their effects
+        int root = g->root[user];
+        if (!ssa_is_pure(instr)) {
+            int movable = 1;
+            for (int j = i + 1; movable && block->instrs[j] != root; j++) {
+                int other = block->instrs[j];
+                movable = ssa_is_pure(&f->instrs[other]) || g->root[other] == root;
+            }
+            if (!movable || !keeps_effect_order(g, value, root)) {
+                continue;
+            }
+        }
+        g->inlined[value] = 1;
+        g->root[value] = root;
+    }
+}
+
+static int needs_slot(const Codegen *g, int value) {
+    const SsaInstr *instr = &g->f->instrs[value];
+    return instr->block >= 0 && instr->type != SSA_VOID && instr->op != SSA_CONST &&
+           !g->inlined[value] && g->uses[value] > 0;
+}
+
+// Values read from slots by the code that computes 'value'
+static void add_tree_uses(const Codegen *g, const int *id, int value, uint64_t *set) {
+    const SsaInstr *instr = &g->f->instrs[value];
+    for (int i = 0; i < instr->operand_count; i++) {
+        int operand = instr->operands[i];
+        if (g->inlined[operand]) {
+            add_tree_uses(g, id, operand, set);
+        } else if (id[operand] >= 0) {
+            set[id[operand] / 64] |= 1ULL << (id[operand] % 64);
+        }
+    }
+}
+
+static int pred_index(const SsaBlock *block, int pred) {
+    for (int k = 0; k < block->pred_count; k++) {
+        if (block->preds[k] == pred) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// Give each value that needs a slot the lowest slot not used by a value
+// live at the same time, preferring the slot of a phi it flows into (or
+// out of) so that the copy disappears.  Returns the number of slots.
+static int allocate_slots(Codegen *g, const int *rpo, int count) {
+    const SsaFunction *f = g->f;
+    int *id = allocate(f->instr_count, sizeof(int));
+    int *values = allocate(f->instr_count, sizeof(int));
+    int n = 0;
+    for (int v = 0; v < f->instr_count; v++) {
+        id[v] = -1;
+        g->slot[v] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        const SsaBlock *block = &f->blocks[rpo[i]];
+        for (int j = 0; j < block->instr_count; j++) {
+            int value = block->instrs[j];
+            if (needs_slot(g, value)) {
+                id[value] = n;
+                values[n++] = value;
+            }
+        }
+    }
+
+    int words = (n + 63) / 64;
+    uint64_t *live_in = allocate((size_t)f->block_count * words, sizeof(uint64_t));
+    uint64_t *live_out = allocate((size_t)f->block_count * words, sizeof(uint64_t));
+    uint64_t *gen = allocate((size_t)f->block_count * words, sizeof(uint64_t));
+    uint64_t *kill = allocate((size_t)f->block_count * words, sizeof(uint64_t));
+    uint64_t *set = allocate(words, sizeof(uint64_t));
+
+    // Uses before definitions and definitions of each block
+    for (int i = 0; i < count; i++) {
+        int b = rpo[i];
+        const SsaBlock *block = &f->blocks[b];
+        uint64_t *block_gen = gen + (size_t)b * words;
+        uint64_t *block_kill = kill + (size_t)b * words;
+        for (int j = 0; j < block->instr_count; j++) {
+            int value = block->instrs[j];
+            const SsaInstr *instr = &f->instrs[value];
+            if (instr->op != SSA_PHI && !g->inlined[value]) {
+                memset(set, 0, words * sizeof(uint64_t));
+                add_tree_uses(g, id, value, set);
+                for (int w = 0; w < words; w++) {
+                    block_gen[w] |= set[w] & ~block_kill[w];
+                }
+            }
+            if (id[value] >= 0) {
+                block_kill[id[value] / 64] |= 1ULL << (id[value] % 64);
+            }
+        }
+    }
+
+    // Live values at block boundaries; phi operands are used at the end
+    // of the matching predecessor
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = count - 1; i >= 0; i--) {
+            int b = rpo[i];
+            const SsaBlock *block = &f->blocks[b];
+            uint64_t *out = live_out + (size_t)b * words;
+            for (int s = 0; s < block->succ_count; s++) {
+                int succ = block->succs[s];
+                const SsaBlock *target = &f->blocks[succ];
+                for (int w = 0; w < words; w++) {
+                    out[w] |= live_in[(size_t)succ * words + w];
+                }
+                int k = pred_index(target, b);
+                for (int j = 0; j < target->instr_count; j++) {
+                    const SsaInstr *phi = &f->instrs[target->instrs[j]];
+                    if (phi->op != SSA_PHI) {
+                        break;
+                    }
+                    int operand = phi->operands[k];
+                    if (id[operand] >= 0) {
+                        out[id[operand] / 64] |= 1ULL << (id[operand] % 64);
+                    }
+                }
+            }
+            uint64_t *in = live_in + (size_t)b * words;
+            for (int w = 0; w < words; w++) {
+                uint64_t updated = gen[(size_t)b * words + w] | (out[w] & ~kill[(size_t)b * words + w]);
+                if (updated != in[w]) {
+                    in[w] = updated;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // Values interfere when one is defined while the other is live
+    uint64_t *interferes = allocate((size_t)n * words, sizeof(uint64_t));
+#define INTERFERE(a, b) do { \
+        interferes[(size_t)(a) * words + (b) / 64] |= 1ULL << ((b) % 64); \
+        interferes[(size_t)(b) * words + (a) / 64] |= 1ULL << ((a) % 64); \
+    } while (0)
+    for (int i = 0; i < count; i++) {
+        int b = rpo[i];
+        const SsaBlock *block = &f->blocks[b];
+        memcpy(set, live_out + (size_t)b * words, words * sizeof(uint64_t));
+        int first = 0;
+        while (first < block->instr_count && f->instrs[block->instrs[first]].op == SSA_PHI) {
+            first++;
+        }
+        for (int j = block->instr_count - 1; j >= first; j--) {
+            int value = block->instrs[j];
+            if (g->inlined[value]) {
+                continue;
+            }
+            if (id[value] >= 0) {
+                int a = id[value];
+                for (int w = 0; w < words; w++) {
+                    for (uint64_t bits = set[w]; bits; bits &= bits - 1) {
+                        int other = w * 64 + __builtin_ctzll(bits);
+                        if (other != a) INTERFERE(a, other);
+                    }
+                }
+                set[a / 64] &= ~(1ULL << (a % 64));
+            }
+            add_tree_uses(g, id, value, set);
+        }
+        // Phis are all defined on entry to the block
+        for (int j = 0; j < first; j++) {
+            int a = id[block->instrs[j]];
+            if (a < 0) {
+                continue;
+            }
+            for (int w = 0; w < words; w++) {
+                for (uint64_t bits = set[w]; bits; bits &= bits - 1) {
+                    INTERFERE(a, w * 64 + __builtin_ctzll(bits));
+                }
+            }
+            for (int k = 0; k < j; k++) {
+                if (id[block->instrs[k]] >= 0) INTERFERE(a, id[block->instrs[k]]);
+            }
+        }
+    }
+#undef INTERFERE
+
+    // Parameters arrive in slots 0..params-1
+    int slots = f->params;
+    int *stamp = allocate(n + f->params + 1, sizeof(int));
+    for (int k = 0; k < n; k++) {
+        const SsaInstr *instr = &f->instrs[values[k]];
+        if (instr->op == SSA_PARAM) {
+            g->slot[values[k]] = instr->index;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        int value = values[k];
+        const SsaInstr *instr = &f->instrs[value];
+        if (instr->op == SSA_PARAM) {
+            continue;
+        }
+        for (int w = 0; w < words; w++) {
+            for (uint64_t bits = interferes[(size_t)k * words + w]; bits; bits &= bits - 1) {
+                int other = values[w * 64 + __builtin_ctzll(bits)];
+                if (g->slot[other] >= 0) {
+                    stamp[g->slot[other]] = k + 1;
+                }
+            }
+        }
+
+        int choice = -1;
+        if (instr->op == SSA_PHI) {
+            for (int i = 0; i < instr->operand_count && choice < 0; i++) {
+                int operand = instr->operands[i];
+                if (id[operand] >= 0 && g->slot[operand] >= 0 && stamp[g->slot[operand]] != k + 1) {
+                    choice = g->slot[operand];
+                }
+            }
+        }
+        int phi = g->phi_user[value];
+        if (choice < 0 && phi >= 0 && g->slot[phi] >= 0 && stamp[g->slot[phi]] != k + 1) {
+            choice = g->slot[phi];
+        }
+        if (choice < 0) {
+            choice = 0;
+            while (stamp[choice] == k + 1) {
+                choice++;
+            }
+        }
+        g->slot[value] = choice;
+        if (choice + 1 > slots) {
+            slots = choice + 1;
+        }
+    }
+
+    free(stamp);
+    free(interferes);
+    free(set);
+    free(live_in);
+    free(live_out);
+    free(gen);
+    free(kill);
+    free(values);
+    free(id);
+    return slots;
+}
+
+// Copies into the successor's phis on the way out of 'b'; returns how many
+// are needed, emitting them if 'emit' is set
+static int gen_copies(Codegen *g, int b, int emit) {
+    const SsaFunction *f = g->f;
+    const SsaBlock *block = &f->blocks[b];
+    if (block->succ_count != 1) {
+        return 0;
+    }
+    const SsaBlock *target = &f->blocks[block->succs[0]];
+    int k = pred_index(target, b);
+    int count = 0;
+    for (int j = 0; j < target->instr_count; j++) {
+        int phi = target->instrs[j];
+        if (f->instrs[phi].op != SSA_PHI) {
+            break;
+        }
+        int operand = f->instrs[phi].operands[k];
+        if (g->slot[phi] < 0 || g->slot[operand] == g->slot[phi]) {
+            continue;
+        }
+        count++;
+        if (emit) {
+            gen_operand(g, operand);
+        }
+    }
+    if (emit) {
+        // Every operand is pushed before any phi is written, so copies
+        // that swap values need no temporaries
+        for (int j = target->instr_count - 1; j >= 0; j--) {
+            int phi = target->instrs[j];
+            if (f->instrs[phi].op != SSA_PHI) {
+                continue;
+            }
+            int operand = f->instrs[phi].operands[k];
+            if (g->slot[phi] >= 0 && g->slot[operand] != g->slot[phi]) {
+                gen_store(g, g->slot[phi]);
+            }
+        }
+    }
+    return count;
+}
+
+// The block a jump to 'b' should land on, passing over skipped blocks
+static int jump_target(const Codegen *g, int b) {
+    while (g->skipped[b]) {
+        b = g->f->blocks[b].succs[0];
+    }
+    return b;
+}
+
+static void gen_block(Codegen *g, int b, int next) {
+    const SsaFunction *f = g->f;
+    const SsaBlock *block = &f->blocks[b];
+    g->block_offset[b] = g->program->code_length;
+    g->depth = 0;
+
+    for (int i = 0; i < block->instr_count; i++) {
+        int value = block->instrs[i];
+        const SsaInstr *instr = &f->instrs[value];
+        if (instr->op == SSA_PHI || instr->op == SSA_PARAM || instr->op == SSA_CONST ||
+            g->inlined[value]) {
+            continue;
+        }
+        if (instr->op == SSA_JUMP) {
+            gen_copies(g, b, 1);
+            g->line = instr->line;
+            int target = jump_target(g, block->succs[0]);
+            if (target != next) {
+                gen_jump(g, OP_JUMP, 0, target);
+            }
+        } else if (instr->op == SSA_BRANCH) {
+            gen_operand(g, instr->operands[0]);
+            g->line = instr->line;
+            int if_true = jump_target(g, block->succs[0]);
+            int if_false = jump_target(g, block->succs[1]);
+            if (if_true == if_false) {
+                gen_op(g, OP_POP, -1);
+                if (if_true != next) gen_jump(g, OP_JUMP, 0, if_true);
+            } else if (if_true == next) {
+                gen_jump(g, OP_JUMP_IF_FALSE, -1, if_false);
+            } else {
+                gen_jump(g, OP_JUMP_IF_TRUE, -1, if_true);
+                if (if_false != next) gen_jump(g, OP_JUMP, 0, if_false);
+            }
+        } else {
+            gen_compute(g, value);
+            if (instr->type != SSA_VOID && !ssa_is_terminator(instr->op)) {
+                if (g->slot[value] >= 0) {
+                    gen_store(g, g->slot[value]);
+                } else {
+                    gen_op(g, OP_POP, -1);
+                }
+            }
+        }
+    }
+}
+
+// Emit one function at the end of the code; returns its frame size
+static int gen_function(Codegen *g, SsaFunction *f, int global_base) {
+    ssa_remove_unreachable(f);
+    ssa_remove_trivial_phis(f);
+    ssa_split_critical_edges(f);
+
+    g->f = f;
+    g->global_base = global_base;
+    g->depth = g->max_depth = 0;
+    g->fixup_count = 0;
+    int count = 0;
+    int *rpo = ssa_reverse_postorder(f, &count);
+    g->uses = allocate(f->instr_count, sizeof(int));
+    g->user = allocate(f->instr_count, sizeof(int));
+    g->phi_user = allocate(f->instr_count, sizeof(int));
+    g->inlined = allocate(f->instr_count, 1);
+    g->root = allocate(f->instr_count, sizeof(int));
+    g->slot = allocate(f->instr_count, sizeof(int));
+    g->block_offset = allocate(f->block_count, sizeof(int));
+    g->skipped = allocate(f->block_count, 1);
+
+    for (int v = 0; v < f->instr_count; v++) {
+        g->phi_user[v] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        const SsaBlock *block = &f->blocks[rpo[i]];
+        for (int j = 0; j < block->instr_count; j++) {
+            int value = block->instrs[j];
+            const SsaInstr *instr = &f->instrs[value];
+            for (int k = 0; k < instr->operand_count; k++) {
+                int operand = instr->operands[k];
+                g->uses[operand]++;
+                g->user[operand] = value;
+                if (instr->op == SSA_PHI) {
+                    g->phi_user[operand] = value;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        plan_block(g, rpo[i]);
+    }
+    int frame_size = allocate_slots(g, rpo, count);
+
+    // Blocks that would only jump are passed over, unless they form a cycle
+    for (int i = 1; i < count; i++) {
+        const SsaBlock *block = &f->blocks[rpo[i]];
+        g->skipped[rpo[i]] = block->instr_count == 1 && f->instrs[block->instrs[0]].op == SSA_JUMP &&
+                             gen_copies(g, rpo[i], 0) == 0;
+    }
+    for (int i = 1; i < count; i++) {
+        int b = rpo[i];
+        int steps = 0;
+        while (g->skipped[b] && steps++ <= count) {
+            b = f->blocks[b].succs[0];
+        }
+        if (g->skipped[b]) {
+            g->skipped[rpo[i]] = 0;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (g->skipped[rpo[i]]) {
+            continue;
+        }
+        int next = -1;
+        for (int j = i + 1; j < count && next < 0; j++) {
+            if (!g->skipped[rpo[j]]) next = rpo[j];
+        }
+        gen_block(g, rpo[i], next);
+    }
+    for (int i = 0; i < g->fixup_count; i += 2) {
+        g->program->code[g->fixups[i]] = g->block_offset[g->fixups[i + 1]];
+    }
+
+    free(rpo);
+    free(g->uses);
+    free(g->user);
+    free(g->phi_user);
+    free(g->inlined);
+    free(g->root);
+    free(g->slot);
+    free(g->block_offset);
+    free(g->skipped);
+    return frame_size;
+}
+
+// Translate to the VM's bytecode: the top-level code (whose temporaries
+// become extra globals) at offset 0, then each function.  Blocks are
+// laid out in reverse postorder; jumps to the next block are left out.
+void ssa_codegen(SsaProgram *program, BytecodeProgram *bytecode) {
+    memset(bytecode, 0, sizeof(*bytecode));
+    Codegen g = {0};
+    g.program = bytecode;
+
+    if (program->strings_length > 0) {
+        bytecode->strings = allocate(program->strings_length, 1);
+        memcpy(bytecode->strings, program->strings, program->strings_length);
+        bytecode->strings_length = bytecode->strings_capacity = program->strings_length;
+    }
+    bytecode->functions = allocate(program->function_count, sizeof(VMFunction));
+    bytecode->function_count = bytecode->function_capacity = program->function_count;
+
+    int temporaries = gen_function(&g, &program->top, program->global_count);
+    bytecode->global_count = program->global_count + temporaries;
+    bytecode->max_stack = g.max_depth + 1;
+
+    for (int i = 0; i < program->function_count; i++) {
+        SsaFunction *f = &program->functions[i];
+        VMFunction *function = &bytecode->functions[i];
+        function->name = f->name;
+        function->params = f->params;
+        function->entry = bytecode->code_length;
+        function->frame_size = gen_function(&g, f, -1);
+        function->max_stack = g.max_depth + 1;
+    }
+
+    free(g.fixups);
+    free(g.constant_table);
+}
+
+static void free_function(SsaFunction *f) {
+    for (int v = 0; v < f->instr_count; v++) {
+        free(f->instrs[v].operands);
+    }
+    for (int b = 0; b < f->block_count; b++) {
+        free(f->blocks[b].instrs);
+        free(f->blocks[b].preds);
+    }
+    free(f->instrs);
+    free(f->blocks);
+}
+
+void ssa_program_free(SsaProgram *program) {
+    free_function(&program->top);
+    for (int i = 0; i < program->function_count; i++) {
+        free_function(&program->functions[i]);
+    }
+    free(program->functions);
+    free(program->strings);
+    memset(program, 0, sizeof(*program));
+}
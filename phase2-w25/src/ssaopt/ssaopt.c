@@ -0,0 +1,796 @@
+/* ssaopt.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/ssaopt.h"
+#include "../../include/factorial.h"
+
+static void *allocate(size_t count, size_t element) {
+    void *data = calloc(count ? count : 1, element);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+        exit(1);
+    }
+    return data;
+}
+
+static int *identity_map(int count) {
+    int *map = allocate(count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        map[i] = i;
+    }
+    return map;
+}
+
+// Integer division and remainder fail only when the divisor can be zero
+static int can_fail(const SsaFunction *f, const SsaInstr *instr) {
+    if ((instr->op == SSA_DIV || instr->op == SSA_MOD) && instr->type == SSA_INT) {
+        const SsaInstr *divisor = &f->instrs[instr->operands[1]];
+        return divisor->op != SSA_CONST || divisor->imm.i == 0;
+    }
+    return !ssa_is_pure(instr) && instr->op != SSA_LOAD_GLOBAL;
+}
+
+// Sparse conditional constant propagation (Wegman and Zadeck): values
+// start unknown and only fall to "varying", while only edges that can be
+// taken under the constants found so far are followed
+
+typedef enum {
+    LATTICE_UNKNOWN,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING
+} LatticeState;
+
+typedef struct {
+    LatticeState state;
+    Value value;
+} Lattice;
+
+typedef struct {
+    SsaFunction *f;
+    Lattice *lattice;
+    char *reached;              // Blocks with an executable incoming edge
+    char *executable;           // Edges, by edge_base[block] + predecessor index
+    int *edge_base;
+    int *users;                 // Users of each value, from user_start[v]
+    int *user_start;
+    int *block_work;
+    int block_work_count;
+    int *value_work;
+    int value_work_count;
+    int value_work_capacity;
+} Sccp;
+
+// Evaluate an operation on constants the way the VM does; returns 0 if
+// it fails at run time (or the result is not defined)
+static int fold(SsaOp op, SsaType type, SsaType operand_type, Value a, Value b, Value *result) {
+    unsigned long long x = (unsigned long long)a.i;
+    unsigned long long y = (unsigned long long)b.i;
+    if (operand_type == SSA_FLOAT) {
+        switch (op) {
+            case SSA_ADD: result->f = a.f + b.f; return 1;
+            case SSA_SUB: result->f = a.f - b.f; return 1;
+            case SSA_MUL: result->f = a.f * b.f; return 1;
+            case SSA_DIV: result->f = a.f / b.f; return 1;
+            case SSA_LT: result->i = a.f < b.f; return 1;
+            case SSA_GT: result->i = a.f > b.f; return 1;
+            case SSA_LE: result->i = a.f <= b.f; return 1;
+            case SSA_GE: result->i = a.f >= b.f; return 1;
+            case SSA_EQ: result->i = a.f == b.f; return 1;
+            case SSA_NE: result->i = a.f != b.f; return 1;
+            case SSA_BOOL: result->i = a.f != 0.0; return 1;
+            case SSA_F2I:
+                if (!(a.f >= -9223372036854775808.0 && a.f < 9223372036854775808.0)) {
+                    return 0;
+                }
+                result->i = (long long)a.f;
+                return 1;
+            default: return 0;
+        }
+    }
+    switch (op) {
+        case SSA_ADD: result->i = (long long)(x + y); return 1;
+        case SSA_SUB: result->i = (long long)(x - y); return 1;
+        case SSA_MUL: result->i = (long long)(x * y); return 1;
+        case SSA_DIV:
+            if (b.i == 0) return 0;
+            result->i = b.i == -1 ? (long long)(0 - x) : a.i / b.i;
+            return 1;
+        case SSA_MOD:
+            if (b.i == 0) return 0;
+            result->i = b.i == -1 ? 0 : a.i % b.i;
+            return 1;
+        case SSA_LT: result->i = a.i < b.i; return 1;
+        case SSA_GT: result->i = a.i > b.i; return 1;
+        case SSA_LE: result->i = a.i <= b.i; return 1;
+        case SSA_GE: result->i = a.i >= b.i; return 1;
+        case SSA_EQ: result->i = a.i == b.i; return 1;
+        case SSA_NE: result->i = a.i != b.i; return 1;
+        case SSA_BOOL: result->i = a.i != 0; return 1;
+        case SSA_I2F: result->f = (double)a.i; return 1;
+        case SSA_FACTORIAL: return factorial_int64(a.i, &result->i) == FACTORIAL_OK;
+        default: (void)type; return 0;
+    }
+}
+
+static Lattice evaluate(Sccp *s, int value) {
+    const SsaFunction *f = s->f;
+    const SsaInstr *instr = &f->instrs[value];
+    Lattice result = {LATTICE_UNKNOWN, {0}};
+
+    switch (instr->op) {
+        case SSA_CONST:
+            result.state = LATTICE_CONSTANT;
+            result.value = instr->imm;
+            return result;
+        case SSA_PHI: {
+            int base = s->edge_base[instr->block];
+            for (int k = 0; k < instr->operand_count; k++) {
+                if (!s->executable[base + k]) {
+                    continue;
+                }
+                Lattice operand = s->lattice[instr->operands[k]];
+                if (operand.state == LATTICE_VARYING ||
+                    (operand.state == LATTICE_CONSTANT && result.state == LATTICE_CONSTANT &&
+                     operand.value.i != result.value.i)) {
+                    result.state = LATTICE_VARYING;
+                    return result;
+                }
+                if (operand.state == LATTICE_CONSTANT) {
+                    result = operand;
+                }
+            }
+            return result;
+        }
+        case SSA_ADD: case SSA_SUB: case SSA_MUL: case SSA_DIV: case SSA_MOD:
+        case SSA_LT: case SSA_GT: case SSA_LE: case SSA_GE: case SSA_EQ: case SSA_NE:
+        case SSA_I2F: case SSA_F2I: case SSA_BOOL: case SSA_FACTORIAL: {
+            Value operands[2] = {{0}, {0}};
+            for (int k = 0; k < instr->operand_count; k++) {
+                Lattice operand = s->lattice[instr->operands[k]];
+                if (operand.state == LATTICE_VARYING) {
+                    result.state = LATTICE_VARYING;
+                    return result;
+                }
+                if (operand.state == LATTICE_UNKNOWN) {
+                    return result;
+                }
+                operands[k] = operand.value;
+            }
+            SsaType operand_type = f->instrs[instr->operands[0]].type;
+            result.state = fold(instr->op, instr->type, operand_type, operands[0], operands[1],
+                                &result.value) ? LATTICE_CONSTANT : LATTICE_VARYING;
+            return result;
+        }
+        default:
+            result.state = LATTICE_VARYING;
+            return result;
+    }
+}
+
+static void push_value(Sccp *s, int value) {
+    if (s->value_work_count == s->value_work_capacity) {
+        s->value_work_capacity = s->value_work_capacity ? s->value_work_capacity * 2 : 64;
+        s->value_work = realloc(s->value_work, s->value_work_capacity * sizeof(int));
+        if (!s->value_work) {
+            fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+            exit(1);
+        }
+    }
+    s->value_work[s->value_work_count++] = value;
+}
+
+static void mark_edge(Sccp *s, int from, int to) {
+    const SsaBlock *block = &s->f->blocks[to];
+    int base = s->edge_base[to];
+    int k = 0;
+    while (k < block->pred_count && (block->preds[k] != from || s->executable[base + k])) {
+        k++;
+    }
+    if (k == block->pred_count) {
+        return;
+    }
+    s->executable[base + k] = 1;
+    if (!s->reached[to]) {
+        s->reached[to] = 1;
+        s->block_work[s->block_work_count++] = to;
+        return;
+    }
+    // A new way in can only change the block's phis
+    for (int i = 0; i < block->instr_count && s->f->instrs[block->instrs[i]].op == SSA_PHI; i++) {
+        push_value(s, block->instrs[i]);
+    }
+}
+
+static void visit(Sccp *s, int value) {
+    const SsaInstr *instr = &s->f->instrs[value];
+    const SsaBlock *block = &s->f->blocks[instr->block];
+    if (instr->op == SSA_JUMP) {
+        mark_edge(s, instr->block, block->succs[0]);
+        return;
+    }
+    if (instr->op == SSA_BRANCH) {
+        Lattice condition = s->lattice[instr->operands[0]];
+        if (condition.state == LATTICE_VARYING) {
+            mark_edge(s, instr->block, block->succs[0]);
+            mark_edge(s, instr->block, block->succs[1]);
+        } else if (condition.state == LATTICE_CONSTANT) {
+            mark_edge(s, instr->block, block->succs[condition.value.i ? 0 : 1]);
+        }
+        return;
+    }
+    if (instr->type == SSA_VOID) {
+        return;
+    }
+
+    Lattice updated = evaluate(s, value);
+    Lattice *current = &s->lattice[value];
+    if (updated.state != current->state ||
+        (updated.state == LATTICE_CONSTANT && updated.value.i != current->value.i)) {
+        *current = updated;
+        for (int i = s->user_start[value]; i < s->user_start[value + 1]; i++) {
+            push_value(s, s->users[i]);
+        }
+    }
+}
+
+static void run_sccp(SsaProgram *program, SsaFunction *f, SsaStats *stats) {
+    (void)program;
+    Sccp s = {0};
+    s.f = f;
+    s.lattice = allocate(f->instr_count, sizeof(Lattice));
+    s.reached = allocate(f->block_count, 1);
+    s.edge_base = allocate(f->block_count + 1, sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        s.edge_base[b + 1] = s.edge_base[b] + f->blocks[b].pred_count;
+    }
+    s.executable = allocate(s.edge_base[f->block_count], 1);
+    s.block_work = allocate(f->block_count, sizeof(int));
+
+    // Users of each value
+    s.user_start = allocate(f->instr_count + 1, sizeof(int));
+    for (int v = 0; v < f->instr_count; v++) {
+        const SsaInstr *instr = &f->instrs[v];
+        for (int k = 0; instr->block >= 0 && k < instr->operand_count; k++) {
+            s.user_start[instr->operands[k] + 1]++;
+        }
+    }
+    for (int v = 0; v < f->instr_count; v++) {
+        s.user_start[v + 1] += s.user_start[v];
+    }
+    s.users = allocate(s.user_start[f->instr_count], sizeof(int));
+    int *fill = allocate(f->instr_count, sizeof(int));
+    for (int v = 0; v < f->instr_count; v++) {
+        const SsaInstr *instr = &f->instrs[v];
+        for (int k = 0; instr->block >= 0 && k < instr->operand_count; k++) {
+            int operand = instr->operands[k];
+            s.users[s.user_start[operand] + fill[operand]++] = v;
+        }
+    }
+    free(fill);
+
+    s.reached[0] = 1;
+    s.block_work[s.block_work_count++] = 0;
+    while (s.block_work_count > 0 || s.value_work_count > 0) {
+        if (s.block_work_count > 0) {
+            const SsaBlock *block = &f->blocks[s.block_work[--s.block_work_count]];
+            for (int i = 0; i < block->instr_count; i++) {
+                visit(&s, block->instrs[i]);
+            }
+        } else {
+            int value = s.value_work[--s.value_work_count];
+            if (f->instrs[value].block >= 0 && s.reached[f->instrs[value].block]) {
+                visit(&s, value);
+            }
+        }
+    }
+
+    // Constants replace computations, and branches on constants become
+    // jumps; phis found constant are replaced by a constant in the entry
+    int evaluated = f->instr_count;
+    int *replace = identity_map(evaluated);
+    for (int b = 0; b < f->block_count; b++) {
+        SsaBlock *block = &f->blocks[b];
+        if (!s.reached[b]) {
+            continue;
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            int value = block->instrs[i];
+            if (value >= evaluated) {
+                continue;
+            }
+            SsaInstr *instr = &f->instrs[value];
+            Lattice result = s.lattice[value];
+            if (instr->op == SSA_BRANCH && s.lattice[instr->operands[0]].state == LATTICE_CONSTANT) {
+                int taken = block->succs[s.lattice[instr->operands[0]].value.i ? 0 : 1];
+                int other = block->succs[s.lattice[instr->operands[0]].value.i ? 1 : 0];
+                ssa_remove_pred(f, other, b);
+                block->succs[0] = taken;
+                block->succ_count = 1;
+                instr->op = SSA_JUMP;
+                instr->operand_count = 0;
+                stats->branches++;
+            }
+            if (instr->type == SSA_VOID || instr->op == SSA_CONST || result.state != LATTICE_CONSTANT) {
+                continue;
+            }
+            stats->folded++;
+            if (instr->op == SSA_PHI) {
+                int constant = ssa_add_instr(f, 0, SSA_CONST, instr->type, instr->line);
+                f->instrs[constant].imm = result.value;
+                ssa_move_before_terminator(f, constant, 0);
+                replace[value] = constant;
+                ssa_remove_instr(f, value);
+                i--;
+                continue;
+            }
+            instr->op = SSA_CONST;
+            instr->imm = result.value;
+            instr->operand_count = 0;
+        }
+    }
+    // Constants added for phis are new values that stay themselves
+    if (f->instr_count > evaluated) {
+        int *grown = realloc(replace, f->instr_count * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed for SSA\n");
+            exit(1);
+        }
+        replace = grown;
+        for (int v = evaluated; v < f->instr_count; v++) {
+            replace[v] = v;
+        }
+    }
+    ssa_apply_replacements(f, replace);
+    stats->blocks_removed += ssa_remove_unreachable(f);
+    ssa_remove_trivial_phis(f);
+
+    free(replace);
+    free(s.lattice);
+    free(s.reached);
+    free(s.edge_base);
+    free(s.executable);
+    free(s.block_work);
+    free(s.value_work);
+    free(s.users);
+    free(s.user_start);
+}
+
+// Global value numbering: walking the dominator tree, an instruction equal
+// to one in a dominating position (same operation, type and operands) is
+// replaced by it.  Operands of commutative operations are ordered first.
+
+typedef struct {
+    SsaFunction *f;
+    int *replace;
+    int *head;                  // First value of each hash bucket, -1 if none
+    int *next;                  // Next value in the same bucket
+    uint32_t *hash;
+    int mask;
+} Gvn;
+
+static int numbered(const SsaInstr *instr) {
+    return instr->op != SSA_PARAM && instr->type != SSA_VOID &&
+           (ssa_is_pure(instr) || instr->op == SSA_DIV || instr->op == SSA_MOD);
+}
+
+static uint32_t hash_instr(const SsaInstr *instr) {
+    uint64_t h = instr->op * 31u + instr->type;
+    h = h * 0x9e3779b97f4a7c15ULL + (uint64_t)instr->imm.i;
+    h = h * 0x9e3779b97f4a7c15ULL + (uint64_t)instr->index;
+    if (instr->op == SSA_PHI) {
+        h = h * 0x9e3779b97f4a7c15ULL + (uint64_t)instr->block;
+    }
+    for (int i = 0; i < instr->operand_count; i++) {
+        h = h * 0x9e3779b97f4a7c15ULL + (uint64_t)instr->operands[i];
+    }
+    return (uint32_t)(h >> 32);
+}
+
+static int same_value(const SsaInstr *a, const SsaInstr *b) {
+    if (a->op != b->op || a->type != b->type || a->imm.i != b->imm.i || a->index != b->index ||
+        a->operand_count != b->operand_count || (a->op == SSA_PHI && a->block != b->block)) {
+        return 0;
+    }
+    return a->operand_count == 0 || memcmp(a->operands, b->operands, a->operand_count * sizeof(int)) == 0;
+}
+
+static int is_commutative(SsaOp op) {
+    return op == SSA_ADD || op == SSA_MUL || op == SSA_EQ || op == SSA_NE;
+}
+
+// Number a block's instructions; returns how many were entered in the table
+static int number_block(Gvn *g, int b, int *entered, SsaStats *stats) {
+    SsaFunction *f = g->f;
+    SsaBlock *block = &f->blocks[b];
+    int count = 0;
+    for (int i = 0; i < block->instr_count; i++) {
+        int value = block->instrs[i];
+        SsaInstr *instr = &f->instrs[value];
+        for (int k = 0; k < instr->operand_count; k++) {
+            int operand = instr->operands[k];
+            while (g->replace[operand] != operand) operand = g->replace[operand];
+            instr->operands[k] = operand;
+        }
+        if (!numbered(instr)) {
+            continue;
+        }
+        if (is_commutative(instr->op) && instr->operands[0] > instr->operands[1]) {
+            int swap = instr->operands[0];
+            instr->operands[0] = instr->operands[1];
+            instr->operands[1] = swap;
+        }
+
+        uint32_t h = hash_instr(instr);
+        int found = -1;
+        for (int other = g->head[h & g->mask]; other >= 0; other = g->next[other]) {
+            if (g->hash[other] == h && same_value(&f->instrs[other], instr)) {
+                found = other;
+                break;
+            }
+        }
+        if (found >= 0) {
+            if (instr->op != SSA_CONST) {
+                stats->merged++;
+            }
+            g->replace[value] = found;
+            ssa_remove_instr(f, value);
+            i--;
+            continue;
+        }
+        g->hash[value] = h;
+        g->next[value] = g->head[h & g->mask];
+        g->head[h & g->mask] = value;
+        entered[count++] = value;
+    }
+    return count;
+}
+
+static void run_gvn(SsaProgram *program, SsaFunction *f, SsaStats *stats) {
+    (void)program;
+    int count = 0;
+    int *rpo = ssa_reverse_postorder(f, &count);
+    int *idom = ssa_dominators(f, rpo, count);
+
+    // Dominator tree children, as linked lists
+    int *child = allocate(f->block_count, sizeof(int));
+    int *sibling = allocate(f->block_count, sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        child[b] = sibling[b] = -1;
+    }
+    for (int i = count - 1; i > 0; i--) {
+        int b = rpo[i];
+        sibling[b] = child[idom[b]];
+        child[idom[b]] = b;
+    }
+
+    Gvn g = {0};
+    g.f = f;
+    g.replace = identity_map(f->instr_count);
+    int buckets = 64;
+    while (buckets < f->instr_count) buckets *= 2;
+    g.mask = buckets - 1;
+    g.head = allocate(buckets, sizeof(int));
+    memset(g.head, 0xff, buckets * sizeof(int));
+    g.next = allocate(f->instr_count, sizeof(int));
+    g.hash = allocate(f->instr_count, sizeof(uint32_t));
+
+    // Depth-first over the tree; values entered in a block leave the table
+    // when its subtree is done, in reverse order of entry
+    int *entered = allocate(f->instr_count, sizeof(int));
+    int *entered_start = allocate(f->block_count + 1, sizeof(int));
+    int *stack = allocate(f->block_count + 1, sizeof(int));
+    int *next_child = allocate(f->block_count, sizeof(int));
+    int depth = 0;
+    int total = 0;
+    if (count > 0) {
+        stack[depth++] = rpo[0];
+        entered_start[0] = 0;
+        total = number_block(&g, rpo[0], entered, stats);
+        next_child[rpo[0]] = child[rpo[0]];
+    }
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        int c = next_child[b];
+        if (c >= 0) {
+            next_child[b] = sibling[c];
+            entered_start[depth] = total;
+            stack[depth++] = c;
+            total += number_block(&g, c, entered + total, stats);
+            next_child[c] = child[c];
+            continue;
+        }
+        for (int i = total - 1; i >= entered_start[depth - 1]; i--) {
+            int value = entered[i];
+            g.head[g.hash[value] & g.mask] = g.next[value];
+        }
+        total = entered_start[depth - 1];
+        depth--;
+    }
+
+    ssa_apply_replacements(f, g.replace);
+    ssa_remove_trivial_phis(f);
+
+    free(entered);
+    free(entered_start);
+    free(stack);
+    free(next_child);
+    free(g.replace);
+    free(g.head);
+    free(g.next);
+    free(g.hash);
+    free(child);
+    free(sibling);
+    free(rpo);
+    free(idom);
+}
+
+// Loop-invariant code motion.  A natural loop is the set of blocks that
+// reach a back edge's source without passing its header (the target, which
+// dominates the source).  Instructions whose operands are all defined
+// outside the loop move to the block that enters it: pure operations,
+// division by a non-zero constant, and loads of globals that nothing in
+// the loop can store to.  Inner loops are done first, so their invariants
+// can move out of the enclosing loops as well.
+
+typedef struct {
+    int header;
+    int *blocks;                // In reverse postorder
+    int block_count;
+} Loop;
+
+static int loop_size_order(const void *a, const void *b) {
+    const Loop *x = a;
+    const Loop *y = b;
+    return x->block_count != y->block_count ? x->block_count - y->block_count : x->header - y->header;
+}
+
+static int hoistable(const SsaFunction *f, const SsaInstr *instr, int has_call, const char *stored) {
+    if (instr->op == SSA_PHI || instr->op == SSA_PARAM || ssa_is_terminator(instr->op)) {
+        return 0;
+    }
+    if (instr->op == SSA_LOAD_GLOBAL) {
+        return !has_call && !stored[instr->index];
+    }
+    return ssa_is_pure(instr) || ((instr->op == SSA_DIV || instr->op == SSA_MOD) && !can_fail(f, instr));
+}
+
+static void hoist_loop(SsaProgram *program, SsaFunction *f, const Loop *loop, char *in_loop, SsaStats *stats) {
+    const SsaBlock *header = &f->blocks[loop->header];
+    for (int i = 0; i < loop->block_count; i++) {
+        in_loop[loop->blocks[i]] = 1;
+    }
+
+    // The preheader is the only way in, and leads only into the loop
+    int preheader = -1;
+    int outside = 0;
+    for (int k = 0; k < header->pred_count; k++) {
+        if (!in_loop[header->preds[k]]) {
+            preheader = header->preds[k];
+            outside++;
+        }
+    }
+
+    if (outside == 1 && f->blocks[preheader].succ_count == 1) {
+        int has_call = 0;
+        char *stored = allocate(program->global_count, 1);
+        for (int i = 0; i < loop->block_count; i++) {
+            const SsaBlock *block = &f->blocks[loop->blocks[i]];
+            for (int j = 0; j < block->instr_count; j++) {
+                const SsaInstr *instr = &f->instrs[block->instrs[j]];
+                has_call |= instr->op == SSA_CALL;
+                if (instr->op == SSA_STORE_GLOBAL) {
+                    stored[instr->index] = 1;
+                }
+            }
+        }
+
+        int changed = 1;
+        while (changed) {
+            changed = 0;
+            for (int i = 0; i < loop->block_count; i++) {
+                const SsaBlock *block = &f->blocks[loop->blocks[i]];
+                for (int j = 0; j < block->instr_count; j++) {
+                    int value = block->instrs[j];
+                    const SsaInstr *instr = &f->instrs[value];
+                    if (!hoistable(f, instr, has_call, stored)) {
+                        continue;
+                    }
+                    int invariant = 1;
+                    for (int k = 0; k < instr->operand_count && invariant; k++) {
+                        invariant = !in_loop[f->instrs[instr->operands[k]].block];
+                    }
+                    if (!invariant) {
+                        continue;
+                    }
+                    ssa_move_before_terminator(f, value, preheader);
+                    if (f->instrs[value].op != SSA_CONST) {
+                        stats->hoisted++;
+                    }
+                    changed = 1;
+                    j--;
+                }
+            }
+        }
+        free(stored);
+    }
+
+    for (int i = 0; i < loop->block_count; i++) {
+        in_loop[loop->blocks[i]] = 0;
+    }
+}
+
+static void run_licm(SsaProgram *program, SsaFunction *f, SsaStats *stats) {
+    // Each loop entry edge gets a block of its own to hoist into
+    ssa_split_critical_edges(f);
+
+    int count = 0;
+    int *rpo = ssa_reverse_postorder(f, &count);
+    int *idom = ssa_dominators(f, rpo, count);
+    int *order = allocate(f->block_count, sizeof(int));
+    for (int b = 0; b < f->block_count; b++) {
+        order[b] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        order[rpo[i]] = i;
+    }
+
+    Loop *loops = allocate(count, sizeof(Loop));
+    int loop_count = 0;
+    char *in_loop = allocate(f->block_count, 1);
+    int *work = allocate(f->block_count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        int h = rpo[i];
+        const SsaBlock *header = &f->blocks[h];
+        int work_count = 0;
+        for (int k = 0; k < header->pred_count; k++) {
+            int latch = header->preds[k];
+            if (order[latch] >= 0 && ssa_dominates(idom, h, latch) && !in_loop[latch]) {
+                in_loop[latch] = 1;
+                work[work_count++] = latch;
+            }
+        }
+        if (work_count == 0) {
+            continue;
+        }
+        in_loop[h] = 1;
+        while (work_count > 0) {
+            const SsaBlock *block = &f->blocks[work[--work_count]];
+            for (int k = 0; k < block->pred_count; k++) {
+                int pred = block->preds[k];
+                if (order[pred] >= 0 && !in_loop[pred]) {
+                    in_loop[pred] = 1;
+                    work[work_count++] = pred;
+                }
+            }
+        }
+
+        Loop *loop = &loops[loop_count++];
+        loop->header = h;
+        loop->blocks = allocate(count, sizeof(int));
+        for (int j = 0; j < count; j++) {
+            if (in_loop[rpo[j]]) {
+                loop->blocks[loop->block_count++] = rpo[j];
+                in_loop[rpo[j]] = 0;
+            }
+        }
+    }
+
+    qsort(loops, loop_count, sizeof(Loop), loop_size_order);
+    for (int i = 0; i < loop_count; i++) {
+        hoist_loop(program, f, &loops[i], in_loop, stats);
+        free(loops[i].blocks);
+    }
+
+    free(loops);
+    free(in_loop);
+    free(work);
+    free(order);
+    free(rpo);
+    free(idom);
+}
+
+// Dead code elimination: keep what has an effect (output, stores, calls,
+// possible runtime errors, control flow) and what it uses; delete the rest
+
+static void run_dce(SsaProgram *program, SsaFunction *f, SsaStats *stats) {
+    (void)program;
+    char *live = allocate(f->instr_count, 1);
+    int *work = allocate(f->instr_count, sizeof(int));
+    int work_count = 0;
+    for (int v = 0; v < f->instr_count; v++) {
+        const SsaInstr *instr = &f->instrs[v];
+        if (instr->block >= 0 && can_fail(f, instr)) {
+            live[v] = 1;
+            work[work_count++] = v;
+        }
+    }
+    while (work_count > 0) {
+        const SsaInstr *instr = &f->instrs[work[--work_count]];
+        for (int k = 0; k < instr->operand_count; k++) {
+            int operand = instr->operands[k];
+            if (!live[operand]) {
+                live[operand] = 1;
+                work[work_count++] = operand;
+            }
+        }
+    }
+    for (int v = 0; v < f->instr_count; v++) {
+        if (f->instrs[v].block >= 0 && !live[v]) {
+            if (f->instrs[v].op != SSA_CONST) {
+                stats->removed++;
+            }
+            ssa_remove_instr(f, v);
+        }
+    }
+    free(live);
+    free(work);
+}
+
+static const struct {
+    const char *name;
+    unsigned pass;
+    void (*run)(SsaProgram *program, SsaFunction *f, SsaStats *stats);
+} passes_table[] = {
+    {"sccp", SSA_PASS_SCCP, run_sccp},
+    {"gvn", SSA_PASS_GVN, run_gvn},
+    {"licm", SSA_PASS_LICM, run_licm},
+    {"dce", SSA_PASS_DCE, run_dce}
+};
+
+int ssa_parse_passes(const char *list, unsigned *passes) {
+    *passes = 0;
+    const char *start = list;
+    while (*start) {
+        size_t length = strcspn(start, ",");
+        unsigned pass = 0;
+        if (length == 3 && strncmp(start, "all", 3) == 0) {
+            pass = SSA_PASS_ALL;
+        } else if (!(length == 4 && strncmp(start, "none", 4) == 0)) {
+            for (size_t i = 0; i < sizeof(passes_table) / sizeof(passes_table[0]); i++) {
+                if (strlen(passes_table[i].name) == length &&
+                    strncmp(start, passes_table[i].name, length) == 0) {
+                    pass = passes_table[i].pass;
+                }
+            }
+            if (!pass) {
+                return -1;
+            }
+        }
+        *passes |= pass;
+        start += length;
+        if (*start == ',') {
+            start++;
+        }
+    }
+    return 0;
+}
+
+int ssa_optimize(SsaProgram *program, unsigned passes, SsaStats *stats, Writer *errors) {
+    int problems = 0;
+    for (size_t i = 0; i < sizeof(passes_table) / sizeof(passes_table[0]); i++) {
+        if (!(passes & passes_table[i].pass)) {
+            continue;
+        }
+        passes_table[i].run(program, &program->top, stats);
+        for (int j = 0; j < program->function_count; j++) {
+            passes_table[i].run(program, &program->functions[j], stats);
+        }
+        if (errors) {
+            int found = ssa_verify(program, errors);
+            if (found > 0) {
+                wr_printf(errors, "SSA verification failed after %s\n", passes_table[i].name);
+                problems += found;
+            }
+        }
+    }
+    return problems;
+}
+
+void ssa_report(Writer *out, const SsaStats *stats) {
+    wr_printf(out, "SSA: %d values folded, %d branches and %d blocks removed, %d values merged, "
+                   "%d instructions hoisted, %d dead instructions removed\n",
+              stats->folded, stats->branches, stats->blocks_removed, stats->merged,
+              stats->hoisted, stats->removed);
+}
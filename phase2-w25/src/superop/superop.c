@@ -0,0 +1,312 @@
+/* superop.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/superop.h"
+
+// Superinstructions saving less than this share of the dispatches counted
+// are not generated
+#define SUPEROP_MIN_SAVING_PERMILLE 1
+
+void superop_counts_init(VMCounts *counts, int stretches) {
+    memset(counts, 0, sizeof(*counts));
+    counts->stretches_enabled = stretches;
+    counts->next_offset = -1;
+}
+
+void superop_counts_free(VMCounts *counts) {
+    free(counts->stretches);
+    free(counts->ops);
+    memset(counts, 0, sizeof(*counts));
+}
+
+static void *grow(void *array, int *capacity, size_t item_size, int needed) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    array = realloc(array, new_capacity * item_size);
+    if (!array) {
+        fprintf(stderr, "Error: Memory allocation failed for superinstruction counts\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+static uint32_t hash_ops(const unsigned char *ops, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ ops[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot of the stretch with these opcodes, or of the empty slot for it
+static int find_stretch(const VMCounts *counts, const unsigned char *ops, int length, uint32_t hash) {
+    uint32_t mask = (uint32_t)counts->stretch_capacity - 1;
+    uint32_t slot = hash & mask;
+    for (;;) {
+        const SuperopStretch *stretch = &counts->stretches[slot];
+        if (stretch->length == 0 ||
+            (stretch->hash == hash && stretch->length == length &&
+             memcmp(counts->ops + stretch->start, ops, length) == 0)) {
+            return (int)slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void rehash_stretches(VMCounts *counts) {
+    SuperopStretch *old = counts->stretches;
+    int old_capacity = counts->stretch_capacity;
+    counts->stretch_capacity = old_capacity ? old_capacity * 2 : 1024;
+    counts->stretches = calloc(counts->stretch_capacity, sizeof(SuperopStretch));
+    if (!counts->stretches) {
+        fprintf(stderr, "Error: Memory allocation failed for superinstruction counts\n");
+        exit(1);
+    }
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].length > 0) {
+            counts->stretches[find_stretch(counts, counts->ops + old[i].start, old[i].length,
+                                           old[i].hash)] = old[i];
+        }
+    }
+    free(old);
+}
+
+// Count the stretch just executed
+static void end_stretch(VMCounts *counts) {
+    int length = counts->current_length;
+    counts->current_length = 0;
+    if (length < 2) {
+        return;
+    }
+    if (2 * (counts->stretch_count + 1) > counts->stretch_capacity) {
+        rehash_stretches(counts);
+    }
+    uint32_t hash = hash_ops(counts->current, length);
+    SuperopStretch *stretch = &counts->stretches[find_stretch(counts, counts->current, length, hash)];
+    if (stretch->length == 0) {
+        counts->ops = grow(counts->ops, &counts->ops_capacity, 1, counts->ops_length + length);
+        memcpy(counts->ops + counts->ops_length, counts->current, length);
+        stretch->hash = hash;
+        stretch->length = length;
+        stretch->start = counts->ops_length;
+        counts->ops_length += length;
+        counts->stretch_count++;
+    }
+    stretch->count++;
+}
+
+static int can_fuse(int op) {
+    return op != OP_CALL && op != OP_RETURN && op != OP_HALT;
+}
+
+static int ends_run(int op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+void superop_record(VMCounts *counts, int op, int offset, int length) {
+    if (offset != counts->next_offset || counts->current_length == SUPEROP_MAX_STRETCH) {
+        end_stretch(counts);
+    }
+    counts->next_offset = offset + length;
+    if (!can_fuse(op)) {
+        end_stretch(counts);
+        return;
+    }
+    counts->current[counts->current_length++] = (unsigned char)op;
+    if (ends_run(op)) {
+        end_stretch(counts);
+    }
+}
+
+// Choosing superinstructions
+
+// A run of opcodes, held as length << 32 | opcodes, 8 bits each
+typedef struct {
+    uint64_t key;
+    unsigned long long bound;       // Dispatches it could save at most
+} Candidate;
+
+static int run_length(uint64_t key) {
+    return (int)(key >> 32);
+}
+
+static int run_opcode(uint64_t key, int index) {
+    return (int)(key >> (8 * (run_length(key) - 1 - index))) & 0xff;
+}
+
+static uint64_t run_key(const unsigned char *ops, int length) {
+    uint64_t key = (uint64_t)length << 32;
+    for (int i = 0; i < length; i++) {
+        key |= (uint64_t)ops[i] << (8 * (length - 1 - i));
+    }
+    return key;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    const Candidate *x = a;
+    const Candidate *y = b;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const Candidate *x = a;
+    const Candidate *y = b;
+    if (x->bound != y->bound) return x->bound < y->bound ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Dispatches for a stretch when the interpreter uses the longest of the
+// 'count' chosen runs (and the candidate 'extra', if not 0) at each step,
+// as the VM's fused code does
+static int stretch_dispatches(const unsigned char *ops, int length, const uint64_t *chosen, int count,
+                              uint64_t extra) {
+    int dispatches = 0;
+    for (int at = 0; at < length; dispatches++) {
+        int step = 1;
+        for (int i = 0; i <= count; i++) {
+            uint64_t key = i < count ? chosen[i] : extra;
+            int run = run_length(key);
+            if (run > step && at + run <= length && run_key(ops + at, run) == key) {
+                step = run;
+            }
+        }
+        at += step;
+    }
+    return dispatches;
+}
+
+// Dispatches saved over every stretch
+static unsigned long long total_saving(const VMCounts *counts, const uint64_t *chosen, int count,
+                                       uint64_t extra) {
+    unsigned long long saved = 0;
+    for (int i = 0; i < counts->stretch_capacity; i++) {
+        const SuperopStretch *stretch = &counts->stretches[i];
+        if (stretch->length > 0) {
+            int dispatches = stretch_dispatches(counts->ops + stretch->start, stretch->length,
+                                                chosen, count, extra);
+            saved += stretch->count * (unsigned long long)(stretch->length - dispatches);
+        }
+    }
+    return saved;
+}
+
+static void write_name(Writer *out, uint64_t key) {
+    for (int i = 0; i < run_length(key); i++) {
+        if (i > 0) wr_char(out, '_');
+        wr_str(out, vm_opcode_name(run_opcode(key, i)));
+    }
+}
+
+// Choose superinstructions greedily by the dispatches each saves on top of
+// those already chosen.  A run can save no more than its occurrences in
+// the stretches times its length less one, so candidates are tried in
+// that order until the bound falls below the best saving found.
+int superop_write_header(Writer *out, Writer *report, VMCounts *counts, int max_count) {
+    end_stretch(counts);
+
+    Candidate *candidates = NULL;
+    int candidate_count = 0;
+    int candidate_capacity = 0;
+    for (int i = 0; i < counts->stretch_capacity; i++) {
+        const SuperopStretch *stretch = &counts->stretches[i];
+        const unsigned char *ops = counts->ops + stretch->start;
+        for (int at = 0; stretch->length > 0 && at < stretch->length; at++) {
+            for (int length = 2; length <= SUPEROP_MAX_LENGTH && at + length <= stretch->length; length++) {
+                candidates = grow(candidates, &candidate_capacity, sizeof(Candidate), candidate_count + 1);
+                candidates[candidate_count].key = run_key(ops + at, length);
+                candidates[candidate_count].bound = stretch->count * (unsigned long long)(length - 1);
+                candidate_count++;
+            }
+        }
+    }
+    // Merge occurrences of the same run
+    qsort(candidates, candidate_count, sizeof(Candidate), compare_keys);
+    int unique = 0;
+    for (int i = 0; i < candidate_count; i++) {
+        if (unique > 0 && candidates[unique - 1].key == candidates[i].key) {
+            candidates[unique - 1].bound += candidates[i].bound;
+        } else {
+            candidates[unique++] = candidates[i];
+        }
+    }
+    candidate_count = unique;
+    qsort(candidates, candidate_count, sizeof(Candidate), compare_candidates);
+
+    uint64_t *chosen = malloc((max_count + 1) * sizeof(uint64_t));
+    unsigned long long *savings = malloc((max_count + 1) * sizeof(unsigned long long));
+    if (!chosen || !savings) {
+        fprintf(stderr, "Error: Memory allocation failed for superinstruction counts\n");
+        exit(1);
+    }
+    unsigned long long minimum = counts->dispatches * SUPEROP_MIN_SAVING_PERMILLE / 1000;
+    int chosen_count = 0;
+    unsigned long long saved = 0;
+    while (chosen_count < max_count) {
+        int best = -1;
+        unsigned long long best_saving = 0;
+        for (int i = 0; i < candidate_count && candidates[i].bound > best_saving; i++) {
+            // The longest match at each step is not always the best parse, so
+            // a run can make things worse
+            unsigned long long total = total_saving(counts, chosen, chosen_count, candidates[i].key);
+            unsigned long long saving = total > saved ? total - saved : 0;
+            if (saving > best_saving) {
+                best = i;
+                best_saving = saving;
+            }
+        }
+        if (best < 0 || best_saving < minimum) {
+            break;
+        }
+        chosen[chosen_count] = candidates[best].key;
+        savings[chosen_count++] = best_saving;
+        saved += best_saving;
+        candidates[best].bound = 0;
+        qsort(candidates, candidate_count, sizeof(Candidate), compare_candidates);
+    }
+
+    wr_str(out, "/* superops.h */\n"
+                "#ifndef SUPEROPS_H\n"
+                "#define SUPEROPS_H\n\n"
+                "// Superinstructions built into the interpreter, generated by\n"
+                "// `parser --superops-train` (make superops) from a training run.\n"
+                "// X(name, instructions...) fuses a run of instructions into one\n"
+                "// dispatch; the comment gives the dispatches it saved in training.\n");
+    for (int length = SUPEROP_MAX_LENGTH; length >= 2; length--) {
+        wr_printf(out, "#define SUPEROPS_%d(X)", length);
+        for (int i = 0; i < chosen_count; i++) {
+            if (run_length(chosen[i]) != length) {
+                continue;
+            }
+            wr_str(out, " \\\n    X(");
+            write_name(out, chosen[i]);
+            for (int j = 0; j < length; j++) {
+                wr_str(out, ", ");
+                wr_str(out, vm_opcode_name(run_opcode(chosen[i], j)));
+            }
+            wr_printf(out, ") /* %llu */", savings[i]);
+        }
+        wr_char(out, '\n');
+    }
+    wr_str(out, "\n#endif /* SUPEROPS_H */\n");
+
+    wr_printf(report, "%d superinstructions save %llu of %llu dispatches in training (%.1f%%)\n",
+              chosen_count, saved, counts->dispatches,
+              counts->dispatches ? 100.0 * saved / counts->dispatches : 0.0);
+    for (int i = 0; i < chosen_count; i++) {
+        wr_printf(report, "  %12llu  ", savings[i]);
+        write_name(report, chosen[i]);
+        wr_char(report, '\n');
+    }
+    free(candidates);
+    free(chosen);
+    free(savings);
+    return chosen_count;
+}
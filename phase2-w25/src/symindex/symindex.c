@@ -0,0 +1,825 @@
+/* symindex.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/symindex.h"
+#include "../../include/trace.h"
+
+static uint32_t checksum(const unsigned char *bytes, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint64_t symindex_hash_bytes(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Whether 'count' items of 'item_size' bytes at 'offset' lie within the
+// index and are aligned for its arrays
+static int section_fits(const SymIndexHeader *header, uint32_t offset, uint32_t count, size_t item_size) {
+    return offset % 8 == 0 && offset >= sizeof(SymIndexHeader) &&
+           (uint64_t)offset + (uint64_t)count * item_size <= header->size;
+}
+
+static int open_error(SymIndex *index, const char *path, const char *reason, Writer *errors) {
+    wr_printf(errors, "%s: invalid symbol index: %s\n", path, reason);
+    symindex_close(index);
+    return -1;
+}
+
+static int sites_valid(const SymIndex *index, const SymIndexSite *sites, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (sites[i].file >= index->header->file_count || sites[i].text >= index->header->strings_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Every offset and range in the index points inside it
+static int offsets_valid(const SymIndex *index) {
+    const SymIndexHeader *header = index->header;
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        if (index->files[i].path >= header->strings_size) return 0;
+    }
+    for (uint32_t i = 0; i < header->name_count; i++) {
+        const SymIndexName *name = &index->names[i];
+        if (name->name >= header->strings_size ||
+            (uint64_t)name->first_decl + name->decl_count > header->decl_count ||
+            (uint64_t)name->first_call + name->call_count > header->call_count) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->bucket_count; i++) {
+        if (index->buckets[i] > header->name_count) return 0;
+    }
+    return sites_valid(index, index->decls, header->decl_count) &&
+           sites_valid(index, index->calls, header->call_count);
+}
+
+int symindex_open(SymIndex *index, const char *path, int verify, Writer *errors) {
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        wr_printf(errors, "Error: Could not open file %s\n", path);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(SymIndexHeader)) {
+        close(fd);
+        return open_error(index, path, "no index header", errors);
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        wr_printf(errors, "Error: Could not open file %s\n", path);
+        return -1;
+    }
+    index->base = base;
+    index->size = (size_t)st.st_size;
+
+    const unsigned char *bytes = base;
+    const SymIndexHeader *header = base;
+    index->header = header;
+    if (memcmp(header->magic, SYMINDEX_MAGIC, 4) != 0) {
+        return open_error(index, path, "no index header", errors);
+    }
+    if (header->byte_order != SYMINDEX_BYTE_ORDER) {
+        return open_error(index, path, "written on a machine with another byte order", errors);
+    }
+    if (header->version != SYMINDEX_VERSION) {
+        return open_error(index, path, "written by another version", errors);
+    }
+    if (header->size != index->size) {
+        return open_error(index, path, "size does not match the header (truncated?)", errors);
+    }
+    if (header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        !section_fits(header, header->files_offset, header->file_count, sizeof(SymIndexFile)) ||
+        !section_fits(header, header->names_offset, header->name_count, sizeof(SymIndexName)) ||
+        !section_fits(header, header->buckets_offset, header->bucket_count, sizeof(uint32_t)) ||
+        !section_fits(header, header->decls_offset, header->decl_count, sizeof(SymIndexSite)) ||
+        !section_fits(header, header->calls_offset, header->call_count, sizeof(SymIndexSite)) ||
+        !section_fits(header, header->strings_offset, header->strings_size, 1)) {
+        return open_error(index, path, "section outside the file", errors);
+    }
+    index->files = (const SymIndexFile *)(bytes + header->files_offset);
+    index->names = (const SymIndexName *)(bytes + header->names_offset);
+    index->buckets = (const uint32_t *)(bytes + header->buckets_offset);
+    index->decls = (const SymIndexSite *)(bytes + header->decls_offset);
+    index->calls = (const SymIndexSite *)(bytes + header->calls_offset);
+    index->strings = (const char *)bytes + header->strings_offset;
+    if (header->strings_size == 0 || index->strings[0] != '\0' ||
+        index->strings[header->strings_size - 1] != '\0') {
+        return open_error(index, path, "unterminated strings", errors);
+    }
+
+    if (verify) {
+        if (checksum(bytes + sizeof(SymIndexHeader), index->size - sizeof(SymIndexHeader)) != header->checksum) {
+            return open_error(index, path, "checksum mismatch", errors);
+        }
+        if (!offsets_valid(index)) {
+            return open_error(index, path, "offset outside its section", errors);
+        }
+    }
+    return 0;
+}
+
+void symindex_close(SymIndex *index) {
+    if (index->base) {
+        munmap((void *)index->base, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+const char *symindex_string(const SymIndex *index, uint32_t offset) {
+    return offset < index->header->strings_size ? index->strings + offset : "";
+}
+
+// Lookups check what they read, so an index that was opened without
+// 'verify' and is damaged gives wrong answers rather than bad reads
+const SymIndexName *symindex_find(const SymIndex *index, const char *name) {
+    const SymIndexHeader *header = index->header;
+    size_t length = strlen(name);
+    uint32_t hash = intern_hash(name, length);
+    uint32_t mask = header->bucket_count - 1;
+    for (uint32_t probe = 0, slot = hash & mask; probe <= mask; probe++, slot = (slot + 1) & mask) {
+        uint32_t entry = index->buckets[slot];
+        if (entry == 0 || entry > header->name_count) {
+            return NULL;
+        }
+        const SymIndexName *found = &index->names[entry - 1];
+        if (found->hash == hash && strcmp(symindex_string(index, found->name), name) == 0) {
+            if ((uint64_t)found->first_decl + found->decl_count > header->decl_count ||
+                (uint64_t)found->first_call + found->call_count > header->call_count) {
+                return NULL;
+            }
+            return found;
+        }
+    }
+    return NULL;
+}
+
+// Files are sorted by path, so this is a binary search
+int symindex_file_named(const SymIndex *index, const char *path) {
+    int low = 0;
+    int high = (int)index->header->file_count - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        int order = strcmp(symindex_string(index, index->files[middle].path), path);
+        if (order == 0) return middle;
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+void symindex_build_init(SymIndexBuild *build) {
+    memset(build, 0, sizeof(*build));
+}
+
+void symindex_build_free(SymIndexBuild *build) {
+    free(build->files);
+    free(build->decls);
+    free(build->calls);
+    memset(build, 0, sizeof(*build));
+}
+
+static void *grow_array(void *array, int *capacity, size_t item_size) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, (size_t)*capacity * item_size);
+    if (!array) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    return array;
+}
+
+uint32_t symindex_build_file(SymIndexBuild *build, const char *path, int64_t mtime_ns, int64_t size,
+                             uint64_t hash, uint32_t errors) {
+    if (build->file_count == build->file_capacity) {
+        build->files = grow_array(build->files, &build->file_capacity, sizeof(SymIndexBuildFile));
+    }
+    SymIndexBuildFile *file = &build->files[build->file_count];
+    file->path = intern_cstr(path);
+    file->errors = errors;
+    file->mtime_ns = mtime_ns;
+    file->size = size;
+    file->hash = hash;
+    return (uint32_t)build->file_count++;
+}
+
+static void add_decl(SymIndexBuild *build, SymIndexEntry entry) {
+    if (build->decl_count == build->decl_capacity) {
+        build->decls = grow_array(build->decls, &build->decl_capacity, sizeof(SymIndexEntry));
+    }
+    build->decls[build->decl_count++] = entry;
+}
+
+static void add_call(SymIndexBuild *build, SymIndexEntry entry) {
+    if (build->call_count == build->call_capacity) {
+        build->calls = grow_array(build->calls, &build->call_capacity, sizeof(SymIndexEntry));
+    }
+    build->calls[build->call_count++] = entry;
+}
+
+static const char *type_keyword(TokenType type) {
+    switch (type) {
+        case TOKEN_INT: return "tni";
+        case TOKEN_FLOAT_KEY: return "taolf";
+        case TOKEN_CHAR: return "rahc";
+        case TOKEN_VOID: return "diov";
+        case TOKEN_LONG: return "gnol";
+        case TOKEN_SHORT: return "trohs";
+        case TOKEN_DOUBLE: return "elbuod";
+        case TOKEN_SIGNED: return "dengis";
+        case TOKEN_UNSIGNED: return "dengisnu";
+        default: return "?";
+    }
+}
+
+// "taolf f(tni a, taolf b)", with "diov" for no parameters
+static SymbolId signature(const ASTNode *decl) {
+    char text[1024];
+    int len = snprintf(text, sizeof(text), "%s %s(", type_keyword(decl->decl_type), decl->token.lexeme);
+    if (!decl->left) {
+        len += snprintf(text + len, sizeof(text) - (size_t)len, "diov");
+    }
+    for (const ASTNode *param = decl->left; param && len < (int)sizeof(text); param = param->right) {
+        len += snprintf(text + len, sizeof(text) - (size_t)len, "%s%s %s", param == decl->left ? "" : ", ",
+                        type_keyword(param->decl_type), param->token.lexeme);
+    }
+    if (len < (int)sizeof(text)) {
+        snprintf(text + len, sizeof(text) - (size_t)len, ")");
+    }
+    return intern_cstr(text);
+}
+
+// Calls can sit anywhere in an item, so walk it with an explicit stack
+void symindex_build_item(SymIndexBuild *build, uint32_t file, const ASTNode *item) {
+    if (!item) return;
+    SymbolId caller = intern_cstr("");
+    if (item->type == AST_FUNCTION_DECL && item->token.type == TOKEN_IDENTIFIER) {
+        SymIndexEntry decl = {item->token.sym, file, item->token.line, item->token.column, signature(item)};
+        add_decl(build, decl);
+        caller = item->token.sym;
+    }
+
+    const ASTNode *small[64];
+    const ASTNode **stack = small;
+    int capacity = 64;
+    int depth = 0;
+    stack[depth++] = item;
+    while (depth > 0) {
+        const ASTNode *node = stack[--depth];
+        if (node->type == AST_FUNCTION_CALL && node->token.sym != SYMBOL_NONE) {
+            SymIndexEntry call = {node->token.sym, file, node->token.line, node->token.column, caller};
+            add_call(build, call);
+        }
+        if (depth + 2 > capacity) {
+            const ASTNode **grown = malloc(2 * (size_t)capacity * sizeof(ASTNode *));
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+                exit(1);
+            }
+            memcpy(grown, stack, (size_t)depth * sizeof(ASTNode *));
+            if (stack != small) free(stack);
+            stack = grown;
+            capacity *= 2;
+        }
+        // Right first, so the left side comes off the stack first
+        if (node->right) stack[depth++] = node->right;
+        if (node->left) stack[depth++] = node->left;
+    }
+    if (stack != small) free(stack);
+}
+
+static void reuse_sites(SymIndexBuild *build, const SymIndex *old, const SymIndexSite *sites,
+                        const SymIndexName *name, uint32_t first, uint32_t count,
+                        const int *file_map, int is_decl) {
+    SymbolId symbol = SYMBOL_NONE;
+    for (uint32_t i = first; i < first + count; i++) {
+        const SymIndexSite *site = &sites[i];
+        if (file_map[site->file] < 0) continue;
+        if (symbol == SYMBOL_NONE) {
+            symbol = intern_cstr(symindex_string(old, name->name));
+        }
+        SymIndexEntry entry = {symbol, (uint32_t)file_map[site->file], site->line, site->column,
+                               intern_cstr(symindex_string(old, site->text))};
+        if (is_decl) {
+            add_decl(build, entry);
+        } else {
+            add_call(build, entry);
+        }
+    }
+}
+
+// Walk the old index by name, so each name is interned once
+void symindex_build_reuse(SymIndexBuild *build, const SymIndex *old, const int *file_map) {
+    for (uint32_t i = 0; i < old->header->name_count; i++) {
+        const SymIndexName *name = &old->names[i];
+        reuse_sites(build, old, old->decls, name, name->first_decl, name->decl_count, file_map, 1);
+        reuse_sites(build, old, old->calls, name, name->first_call, name->call_count, file_map, 0);
+    }
+}
+
+// Order of each name, for sorting the sites (qsort takes no context)
+static _Thread_local const uint32_t *name_rank;
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(symbol_name(*(const SymbolId *)a), symbol_name(*(const SymbolId *)b));
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const SymIndexEntry *x = a;
+    const SymIndexEntry *y = b;
+    if (x->name != y->name) return name_rank[x->name] < name_rank[y->name] ? -1 : 1;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    if (x->line != y->line) return x->line < y->line ? -1 : 1;
+    if (x->column != y->column) return x->column < y->column ? -1 : 1;
+    return strcmp(symbol_name(x->text), symbol_name(y->text));
+}
+
+// Append a section 8-byte aligned and return its offset
+static uint32_t write_section(Writer *w, const void *data, size_t len) {
+    static const char padding[8] = {0};
+    wr_bytes(w, padding, (8 - w->len % 8) % 8);
+    uint32_t offset = (uint32_t)w->len;
+    if (len > 0) {
+        wr_bytes(w, data, len);
+    }
+    return offset;
+}
+
+typedef struct {
+    Writer text;
+    uint32_t *offsets;          // 1 + offset of each symbol written, 0 if not yet
+} StringTable;
+
+static uint32_t add_string(StringTable *strings, SymbolId symbol) {
+    if (!strings->offsets[symbol]) {
+        strings->offsets[symbol] = (uint32_t)strings->text.len + 1;
+        wr_bytes(&strings->text, symbol_name(symbol), symbol_length(symbol) + 1);
+    }
+    return strings->offsets[symbol] - 1;
+}
+
+static SymIndexSite *lay_out_sites(const SymIndexEntry *entries, int count, StringTable *strings) {
+    SymIndexSite *sites = calloc((size_t)count + 1, sizeof(SymIndexSite));
+    if (!sites) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        sites[i].file = entries[i].file;
+        sites[i].line = entries[i].line;
+        sites[i].column = entries[i].column;
+        sites[i].text = add_string(strings, entries[i].text);
+    }
+    return sites;
+}
+
+void symindex_build_write(SymIndexBuild *build, Writer *out) {
+    SymbolId empty = intern_cstr("");
+    uint32_t symbols = symbol_count() + 1;
+    uint32_t *rank = calloc(symbols, sizeof(uint32_t));
+    SymbolId *names = malloc(((size_t)build->decl_count + build->call_count + 1) * sizeof(SymbolId));
+    StringTable strings;
+    strings.offsets = calloc(symbols, sizeof(uint32_t));
+    if (!rank || !names || !strings.offsets) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    writer_init_memory(&strings.text);
+    wr_char(&strings.text, '\0');
+    strings.offsets[empty] = 1;
+
+    // Distinct names in order, ranked from 1
+    int name_count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        const SymIndexEntry *entries = pass ? build->calls : build->decls;
+        int count = pass ? build->call_count : build->decl_count;
+        for (int i = 0; i < count; i++) {
+            if (!rank[entries[i].name]) {
+                rank[entries[i].name] = 1;
+                names[name_count++] = entries[i].name;
+            }
+        }
+    }
+    qsort(names, (size_t)name_count, sizeof(SymbolId), compare_names);
+    for (int i = 0; i < name_count; i++) {
+        rank[names[i]] = (uint32_t)i + 1;
+    }
+    name_rank = rank;
+    if (build->decl_count > 0) qsort(build->decls, (size_t)build->decl_count, sizeof(SymIndexEntry), compare_entries);
+    if (build->call_count > 0) qsort(build->calls, (size_t)build->call_count, sizeof(SymIndexEntry), compare_entries);
+    name_rank = NULL;
+
+    // Strings go in the order the sections use them
+    SymIndexFile *files = calloc((size_t)build->file_count + 1, sizeof(SymIndexFile));
+    SymIndexName *table = calloc((size_t)name_count + 1, sizeof(SymIndexName));
+    uint32_t bucket_count = 8;
+    while (bucket_count < 2 * (uint32_t)name_count) {
+        bucket_count *= 2;
+    }
+    uint32_t *buckets = calloc(bucket_count, sizeof(uint32_t));
+    if (!files || !table || !buckets) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    for (int i = 0; i < build->file_count; i++) {
+        const SymIndexBuildFile *file = &build->files[i];
+        files[i].path = add_string(&strings, file->path);
+        files[i].errors = file->errors;
+        files[i].mtime_ns = file->mtime_ns;
+        files[i].size = file->size;
+        files[i].hash = file->hash;
+    }
+    for (int i = 0; i < name_count; i++) {
+        table[i].name = add_string(&strings, names[i]);
+        table[i].hash = intern_hash(symbol_name(names[i]), symbol_length(names[i]));
+        uint32_t slot = table[i].hash & (bucket_count - 1);
+        while (buckets[slot]) {
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        buckets[slot] = (uint32_t)i + 1;
+    }
+    for (int i = build->decl_count - 1; i >= 0; i--) {
+        SymIndexName *name = &table[rank[build->decls[i].name] - 1];
+        name->first_decl = (uint32_t)i;
+        name->decl_count++;
+        files[build->decls[i].file].decl_count++;
+    }
+    for (int i = build->call_count - 1; i >= 0; i--) {
+        SymIndexName *name = &table[rank[build->calls[i].name] - 1];
+        name->first_call = (uint32_t)i;
+        name->call_count++;
+        files[build->calls[i].file].call_count++;
+    }
+    SymIndexSite *decls = lay_out_sites(build->decls, build->decl_count, &strings);
+    SymIndexSite *calls = lay_out_sites(build->calls, build->call_count, &strings);
+
+    SymIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMINDEX_MAGIC, 4);
+    header.version = SYMINDEX_VERSION;
+    header.byte_order = SYMINDEX_BYTE_ORDER;
+    header.file_count = (uint32_t)build->file_count;
+    header.name_count = (uint32_t)name_count;
+    header.bucket_count = bucket_count;
+    header.decl_count = (uint32_t)build->decl_count;
+    header.call_count = (uint32_t)build->call_count;
+    header.strings_size = (uint32_t)strings.text.len;
+
+    size_t start = out->len;
+    wr_bytes(out, (const char *)&header, sizeof(header));
+    header.files_offset = write_section(out, files, build->file_count * sizeof(SymIndexFile)) - start;
+    header.names_offset = write_section(out, table, name_count * sizeof(SymIndexName)) - start;
+    header.buckets_offset = write_section(out, buckets, bucket_count * sizeof(uint32_t)) - start;
+    header.decls_offset = write_section(out, decls, build->decl_count * sizeof(SymIndexSite)) - start;
+    header.calls_offset = write_section(out, calls, build->call_count * sizeof(SymIndexSite)) - start;
+    header.strings_offset = write_section(out, strings.text.data, strings.text.len) - start;
+    header.size = (uint32_t)(out->len - start);
+    if (!out->failed) {
+        header.checksum = checksum((const unsigned char *)out->data + start + sizeof(header),
+                                   header.size - sizeof(header));
+        memcpy(out->data + start, &header, sizeof(header));
+    }
+
+    free(files);
+    free(table);
+    free(buckets);
+    free(decls);
+    free(calls);
+    free(names);
+    free(rank);
+    free(strings.offsets);
+    writer_free(&strings.text);
+}
+
+// Write all bytes to a file descriptor
+static int write_all(int fd, const void *data, size_t len) {
+    const char *bytes = data;
+    while (len > 0) {
+        ssize_t n = write(fd, bytes, len);
+        if (n < 0) return -1;
+        bytes += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int symindex_build_save(SymIndexBuild *build, const char *path, Writer *errors) {
+    Writer index;
+    writer_init_memory(&index);
+    symindex_build_write(build, &index);
+
+    char temporary[4096];
+    int result = -1;
+    if (!index.failed && snprintf(temporary, sizeof(temporary), "%s.tmp", path) < (int)sizeof(temporary)) {
+        int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            result = write_all(fd, index.data, index.len);
+            close(fd);
+            if (result == 0) {
+                result = rename(temporary, path);
+            }
+            if (result != 0) {
+                unlink(temporary);
+            }
+        }
+    }
+    if (result != 0) {
+        wr_printf(errors, "Error: Could not write %s\n", path);
+    }
+    writer_free(&index);
+    return result;
+}
+
+// Indexing a workspace (--symindex)
+typedef struct {
+    SymIndexBuild *build;
+    uint32_t file;
+} SymIndexTarget;
+
+static ParseItemAction index_item(ASTNode *item, void *user) {
+    SymIndexTarget *target = user;
+    symindex_build_item(target->build, target->file, item);
+    return PARSE_ITEM_RECYCLE;
+}
+
+static int64_t stat_mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// Parse one file into the build a top-level item at a time, so only the
+// largest item is resident; its diagnostics are only counted
+static void index_source(SymIndexBuild *build, const char *path, const char *source,
+                         const struct stat *st, uint64_t hash) {
+    parser_reset();
+    parser_init(source);
+    SymIndexTarget target = {build, symindex_build_file(build, path, stat_mtime_ns(st), st->st_size, hash, 0)};
+    parse_program_streaming(index_item, &target);
+    build->files[target.file].errors = (uint32_t)parser_error_count();
+    parser_release_nodes();
+}
+
+typedef struct {
+    const char *path;
+    int named;                  // Named on the command line, not just in the index
+} WorkspaceFile;
+
+static int compare_workspace_files(const void *a, const void *b) {
+    return strcmp(((const WorkspaceFile *)a)->path, ((const WorkspaceFile *)b)->path);
+}
+
+// Bring the index up to date with the files it lists and the files named.
+// A file whose mtime and size match its entry keeps its sites unread;
+// otherwise it is hashed, and parsed only if its contents changed.  Files
+// that no longer exist are dropped.
+static void update_symindex(const char *index_path, char **files, int file_count) {
+    Writer *out = output_writer();
+    uint64_t start = trace_clock();
+    SymIndex old;
+    int have_old = 0;
+    if (access(index_path, F_OK) == 0) {
+        have_old = symindex_open(&old, index_path, 1, out) == 0;
+        if (!have_old) {
+            wr_printf(out, "%s: rebuilding the index\n", index_path);
+        }
+    }
+    uint32_t old_count = have_old ? old.header->file_count : 0;
+
+    WorkspaceFile *workspace = malloc(((size_t)old_count + file_count + 1) * sizeof(WorkspaceFile));
+    int *file_map = malloc(((size_t)old_count + 1) * sizeof(int));
+    if (!workspace || !file_map) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    int count = 0;
+    for (uint32_t i = 0; i < old_count; i++) {
+        workspace[count++] = (WorkspaceFile){symindex_string(&old, old.files[i].path), 0};
+        file_map[i] = -1;
+    }
+    for (int i = 0; i < file_count; i++) {
+        workspace[count++] = (WorkspaceFile){files[i], 1};
+    }
+    qsort(workspace, (size_t)count, sizeof(WorkspaceFile), compare_workspace_files);
+
+    SymIndexBuild build;
+    symindex_build_init(&build);
+    int parsed = 0, rehashed = 0, unchanged = 0, removed = 0;
+    for (int i = 0; i < count; i++) {
+        const char *path = workspace[i].path;
+        int named = workspace[i].named;
+        while (i + 1 < count && strcmp(workspace[i + 1].path, path) == 0) {
+            named |= workspace[++i].named;
+        }
+
+        struct stat st;
+        int previous = have_old ? symindex_file_named(&old, path) : -1;
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (named) {
+                wr_printf(out, "Error: Could not open file %s\n", path);
+            } else {
+                removed++;
+            }
+            continue;
+        }
+        const SymIndexFile *entry = previous >= 0 ? &old.files[previous] : NULL;
+        if (entry && entry->mtime_ns == stat_mtime_ns(&st) && entry->size == st.st_size) {
+            file_map[previous] = (int)symindex_build_file(&build, path, entry->mtime_ns, entry->size,
+                                                          entry->hash, entry->errors);
+            unchanged++;
+            continue;
+        }
+
+        size_t len = 0;
+        char *buffer = map_file(path, &len);
+        if (!buffer) {
+            wr_printf(out, "Error: Could not open file %s\n", path);
+            continue;
+        }
+        uint64_t hash = symindex_hash_bytes(buffer, len);
+        if (entry && entry->hash == hash && entry->size == (int64_t)len) {
+            file_map[previous] = (int)symindex_build_file(&build, path, stat_mtime_ns(&st), st.st_size,
+                                                          hash, entry->errors);
+            rehashed++;
+        } else {
+            index_source(&build, path, buffer, &st, hash);
+            parsed++;
+        }
+        unmap_file(buffer, len);
+    }
+    if (have_old) {
+        symindex_build_reuse(&build, &old, file_map);
+    }
+    int functions = build.decl_count;
+    int calls = build.call_count;
+    int saved = symindex_build_save(&build, index_path, out) == 0;
+
+    symindex_build_free(&build);
+    if (have_old) {
+        symindex_close(&old);
+    }
+    free(workspace);
+    free(file_map);
+    if (saved) {
+        wr_printf(out, "%s: %d files (%d parsed, %d rehashed, %d unchanged, %d removed), "
+                  "%d functions, %d calls in %.2f ms\n",
+                  index_path, parsed + rehashed + unchanged, parsed, rehashed, unchanged, removed,
+                  functions, calls, (trace_clock() - start) / 1e6);
+    }
+}
+
+static void print_site(Writer *out, const SymIndex *index, const SymIndexSite *site) {
+    const char *path = site->file < index->header->file_count
+                           ? symindex_string(index, index->files[site->file].path) : "?";
+    wr_printf(out, "%s:%d:%d: ", path, site->line, site->column);
+}
+
+// List where a function is declared (what == 'd') or called from ('c')
+static void find_symbol(const SymIndex *index, const char *name, char what) {
+    Writer *out = output_writer();
+    const SymIndexName *found = symindex_find(index, name);
+    uint32_t count = 0;
+    if (what == 'd') {
+        count = found ? found->decl_count : 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const SymIndexSite *site = &index->decls[found->first_decl + i];
+            print_site(out, index, site);
+            wr_printf(out, "%s\n", symindex_string(index, site->text));
+        }
+        wr_printf(out, "%s: %u declarations\n", name, count);
+    } else {
+        count = found ? found->call_count : 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const SymIndexSite *site = &index->calls[found->first_call + i];
+            const char *caller = symindex_string(index, site->text);
+            print_site(out, index, site);
+            if (*caller) {
+                wr_printf(out, "%s called from %s\n", name, caller);
+            } else {
+                wr_printf(out, "%s called at the top level\n", name);
+            }
+        }
+        wr_printf(out, "%s: %u calls\n", name, count);
+    }
+}
+
+// Rebuild the index from scratch and compare it byte for byte, then time
+// a lookup of every name it holds
+static void check_symindex(const SymIndex *index, const char *index_path) {
+    Writer *out = output_writer();
+    const SymIndexHeader *header = index->header;
+    SymIndexBuild build;
+    symindex_build_init(&build);
+    const char *failed = NULL;
+    uint64_t start = trace_clock();
+    for (uint32_t i = 0; i < header->file_count && !failed; i++) {
+        const char *path = symindex_string(index, index->files[i].path);
+        struct stat st;
+        size_t len = 0;
+        char *buffer = stat(path, &st) == 0 ? map_file(path, &len) : NULL;
+        if (!buffer) {
+            failed = "(a file is gone, update the index first)";
+            break;
+        }
+        uint64_t hash = symindex_hash_bytes(buffer, len);
+        if (hash != index->files[i].hash || stat_mtime_ns(&st) != index->files[i].mtime_ns) {
+            failed = "(a file changed, update the index first)";
+        } else {
+            index_source(&build, path, buffer, &st, hash);
+        }
+        unmap_file(buffer, len);
+    }
+    double rebuild_ms = (trace_clock() - start) / 1e6;
+    if (!failed) {
+        Writer rebuilt;
+        writer_init_memory(&rebuilt);
+        symindex_build_write(&build, &rebuilt);
+        if (rebuilt.len != index->size || memcmp(rebuilt.data, index->base, rebuilt.len) != 0) {
+            failed = "(differs from a full rebuild)";
+        }
+        writer_free(&rebuilt);
+    }
+    symindex_build_free(&build);
+    if (failed) {
+        wr_printf(out, "%s: index MISMATCH %s\n", index_path, failed);
+        return;
+    }
+
+    // Every name, as a string not taken from the index, 20 rounds
+    uint32_t names = header->name_count;
+    char **copies = malloc(((size_t)names + 1) * sizeof(char *));
+    if (!copies) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol index\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < names; i++) {
+        copies[i] = strdup(symindex_string(index, index->names[i].name));
+    }
+    uint32_t found = 0;
+    start = trace_clock();
+    for (int round = 0; round < 20; round++) {
+        for (uint32_t i = 0; i < names; i++) {
+            found += symindex_find(index, copies[i]) != NULL;
+        }
+    }
+    double lookup_ns = names ? (double)(trace_clock() - start) / (20.0 * names) : 0;
+    for (uint32_t i = 0; i < names; i++) {
+        free(copies[i]);
+    }
+    free(copies);
+    if (found != 20 * names) {
+        wr_printf(out, "%s: index MISMATCH (a name is missing from the hash table)\n", index_path);
+        return;
+    }
+    wr_printf(out, "%s: index matches a full rebuild (%u files, %u names, %u declarations, %u calls); "
+              "rebuild %.2f ms, lookup %.0f ns\n",
+              index_path, header->file_count, names, header->decl_count, header->call_count,
+              rebuild_ms, lookup_ns);
+}
+
+// Update the index with the files named (all listed ones if none are), then
+// answer the lookups and the check from the updated file
+void symindex_run(const char *index_path, char **files, int file_count,
+                  const char *find_decl, const char *find_calls, int check) {
+    Writer *out = output_writer();
+    if (file_count > 0 || (!find_decl && !find_calls && !check)) {
+        update_symindex(index_path, files, file_count);
+    }
+    if (!find_decl && !find_calls && !check) {
+        return;
+    }
+    SymIndex index;
+    if (symindex_open(&index, index_path, check, out) != 0) {
+        return;
+    }
+    if (find_decl) {
+        find_symbol(&index, find_decl, 'd');
+    }
+    if (find_calls) {
+        find_symbol(&index, find_calls, 'c');
+    }
+    if (check) {
+        check_symindex(&index, index_path);
+    }
+    symindex_close(&index);
+}
@@ -0,0 +1,212 @@
+/* trace.c */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "../../include/trace.h"
+
+// Events are stored in fixed-size chunks so recording never moves data
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_DETAIL_LEN 64
+
+typedef struct {
+    const char *name;               // Span name (string literal)
+    char detail[TRACE_DETAIL_LEN];  // File path or function name
+    uint64_t start;                 // Start time in nanoseconds
+    uint64_t duration;              // Duration in nanoseconds
+    long bytes;
+    long tokens;
+    long errors;
+} TraceEvent;
+
+typedef struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    int count;
+    struct TraceChunk *next;
+} TraceChunk;
+
+// One buffer per recording thread, only ever written by its owner
+typedef struct TraceBuffer {
+    int tid;
+    char thread_name[32];
+    TraceChunk *head;
+    TraceChunk *tail;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+static const char *trace_path = NULL;
+static uint64_t trace_epoch = 0;
+
+// Lock-free list of all thread buffers (push only until trace_finish)
+static _Atomic(TraceBuffer *) all_buffers = NULL;
+static _Thread_local TraceBuffer *thread_buffer = NULL;
+
+// Monotonic time in nanoseconds
+uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Enable tracing; events are written to path by trace_finish
+int trace_init(const char *path) {
+    trace_path = path;
+    trace_epoch = trace_clock();
+    return 0;
+}
+
+int trace_enabled(void) {
+    return trace_path != NULL;
+}
+
+// Get (or create and publish) the calling thread's buffer
+static TraceBuffer *get_thread_buffer(void) {
+    if (thread_buffer) {
+        return thread_buffer;
+    }
+
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->tid = (int)syscall(SYS_gettid);
+    snprintf(buffer->thread_name, sizeof(buffer->thread_name), "thread %d", buffer->tid);
+
+    TraceBuffer *head = atomic_load_explicit(&all_buffers, memory_order_relaxed);
+    do {
+        buffer->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&all_buffers, &head, buffer,
+                                                    memory_order_release, memory_order_relaxed));
+    thread_buffer = buffer;
+    return buffer;
+}
+
+// Copy 'text' into a buffer of 'size' bytes.  A long string is cut before
+// the UTF-8 sequence that does not fit, so the trace stays valid JSON text.
+static void copy_truncated(char *dest, size_t size, const char *text) {
+    size_t len = strlen(text);
+    if (len >= size) {
+        len = size - 1;
+        // text[len] is the first byte dropped; back up to its lead byte
+        while (len > 0 && ((unsigned char)text[len] & 0xC0) == 0x80) {
+            len--;
+        }
+    }
+    memcpy(dest, text, len);
+    dest[len] = '\0';
+}
+
+// Name the calling thread in the timeline
+void trace_thread_name(const char *name) {
+    if (!trace_enabled()) return;
+
+    TraceBuffer *buffer = get_thread_buffer();
+    if (buffer) {
+        copy_truncated(buffer->thread_name, sizeof(buffer->thread_name), name);
+    }
+}
+
+// Record a completed span that started at 'start' and ends now
+void trace_span(const char *name, const char *detail, uint64_t start,
+                long bytes, long tokens, long errors) {
+    if (!trace_enabled()) return;
+
+    uint64_t end = trace_clock();
+    TraceBuffer *buffer = get_thread_buffer();
+    if (!buffer) return;
+
+    if (!buffer->tail || buffer->tail->count == TRACE_CHUNK_EVENTS) {
+        TraceChunk *chunk = malloc(sizeof(TraceChunk));
+        if (!chunk) return;
+        chunk->count = 0;
+        chunk->next = NULL;
+        if (buffer->tail) {
+            buffer->tail->next = chunk;
+        } else {
+            buffer->head = chunk;
+        }
+        buffer->tail = chunk;
+    }
+
+    TraceEvent *event = &buffer->tail->events[buffer->tail->count++];
+    event->name = name;
+    copy_truncated(event->detail, TRACE_DETAIL_LEN, detail ? detail : "");
+    event->start = start;
+    event->duration = end - start;
+    event->bytes = bytes;
+    event->tokens = tokens;
+    event->errors = errors;
+}
+
+// Write a string with JSON escaping
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Write all recorded events and release the buffers.
+// Must only be called after every recording thread has finished.
+int trace_finish(void) {
+    if (!trace_enabled()) return 0;
+
+    FILE *file = fopen(trace_path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open trace file %s\n", trace_path);
+    }
+
+    int pid = (int)getpid();
+    int first = 1;
+    if (file) fprintf(file, "{\"traceEvents\":[\n");
+
+    TraceBuffer *buffer = atomic_exchange(&all_buffers, NULL);
+    while (buffer) {
+        if (file) {
+            fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                    first ? "" : ",\n", pid, buffer->tid);
+            write_json_string(file, buffer->thread_name);
+            fprintf(file, "}}");
+            first = 0;
+        }
+
+        TraceChunk *chunk = buffer->head;
+        while (chunk) {
+            for (int i = 0; file && i < chunk->count; i++) {
+                TraceEvent *event = &chunk->events[i];
+                fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"detail\":",
+                        event->name, pid, buffer->tid,
+                        (event->start - trace_epoch) / 1000.0, event->duration / 1000.0);
+                write_json_string(file, event->detail);
+                fprintf(file, ",\"bytes\":%ld,\"tokens\":%ld,\"errors\":%ld}}",
+                        event->bytes, event->tokens, event->errors);
+            }
+            TraceChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+
+        TraceBuffer *next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    thread_buffer = NULL;
+
+    if (!file) return -1;
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+    return 0;
+}
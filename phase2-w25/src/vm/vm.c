@@ -0,0 +1,1557 @@
+/* vm.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "../../include/vm.h"
+#include "../../include/factorial.h"
+#include "../../include/jit.h"
+#include "../../include/profile.h"
+#include "../../include/superop.h"
+#include "../../include/superops.h"
+
+// Computed-goto dispatch where the compiler supports labels as values
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+// Static types of values on the operand stack
+typedef enum {
+    TYPE_INT,
+    TYPE_FLOAT
+} ValueType;
+
+// Name, operand count and stack effect of each instruction
+static const struct {
+    const char *name;
+    int operands;
+    int effect;
+} opcode_info[OP_COUNT] = {
+    [OP_CONST] = {"CONST", 1, 1},
+    [OP_LOAD] = {"LOAD", 1, 1},
+    [OP_STORE] = {"STORE", 1, -1},
+    [OP_LOAD_GLOBAL] = {"LOAD_GLOBAL", 1, 1},
+    [OP_STORE_GLOBAL] = {"STORE_GLOBAL", 1, -1},
+    [OP_POP] = {"POP", 0, -1},
+    [OP_ADD_I] = {"ADD_I", 0, -1},
+    [OP_SUB_I] = {"SUB_I", 0, -1},
+    [OP_MUL_I] = {"MUL_I", 0, -1},
+    [OP_DIV_I] = {"DIV_I", 0, -1},
+    [OP_MOD_I] = {"MOD_I", 0, -1},
+    [OP_LT_I] = {"LT_I", 0, -1},
+    [OP_GT_I] = {"GT_I", 0, -1},
+    [OP_LE_I] = {"LE_I", 0, -1},
+    [OP_GE_I] = {"GE_I", 0, -1},
+    [OP_EQ_I] = {"EQ_I", 0, -1},
+    [OP_NE_I] = {"NE_I", 0, -1},
+    [OP_ADD_F] = {"ADD_F", 0, -1},
+    [OP_SUB_F] = {"SUB_F", 0, -1},
+    [OP_MUL_F] = {"MUL_F", 0, -1},
+    [OP_DIV_F] = {"DIV_F", 0, -1},
+    [OP_LT_F] = {"LT_F", 0, -1},
+    [OP_GT_F] = {"GT_F", 0, -1},
+    [OP_LE_F] = {"LE_F", 0, -1},
+    [OP_GE_F] = {"GE_F", 0, -1},
+    [OP_EQ_F] = {"EQ_F", 0, -1},
+    [OP_NE_F] = {"NE_F", 0, -1},
+    [OP_I2F] = {"I2F", 0, 0},
+    [OP_F2I] = {"F2I", 0, 0},
+    [OP_BOOL_I] = {"BOOL_I", 0, 0},
+    [OP_BOOL_F] = {"BOOL_F", 0, 0},
+    [OP_JUMP] = {"JUMP", 1, 0},
+    [OP_JUMP_IF_FALSE] = {"JUMP_IF_FALSE", 1, -1},
+    [OP_JUMP_IF_TRUE] = {"JUMP_IF_TRUE", 1, -1},
+    [OP_CALL] = {"CALL", 2, 1},             // Less the argument count
+    [OP_RETURN] = {"RETURN", 0, -1},
+    [OP_FACTORIAL] = {"FACTORIAL", 0, 0},
+    [OP_PRINT_I] = {"PRINT_I", 0, -1},
+    [OP_PRINT_F] = {"PRINT_F", 0, -1},
+    [OP_PRINT_STR] = {"PRINT_STR", 1, 0},
+    [OP_PRINT_FACTORIAL] = {"PRINT_FACTORIAL", 0, -1},
+    [OP_STATEMENT] = {"STATEMENT", 1, 0},
+    [OP_ENTER] = {"ENTER", 1, 0},
+    [OP_HALT] = {"HALT", 0, -1}
+};
+
+// Binary operators by lexeme.  Comparisons yield an int in either form;
+// OP_COUNT marks a form that does not exist.
+static const struct {
+    const char *lexeme;
+    Opcode int_op;
+    Opcode float_op;
+} binary_ops[] = {
+    {"+", OP_ADD_I, OP_ADD_F},
+    {"-", OP_SUB_I, OP_SUB_F},
+    {"*", OP_MUL_I, OP_MUL_F},
+    {"/", OP_DIV_I, OP_DIV_F},
+    {"%", OP_MOD_I, OP_COUNT},
+    {"<", OP_LT_I, OP_LT_F},
+    {">", OP_GT_I, OP_GT_F},
+    {"<=", OP_LE_I, OP_LE_F},
+    {">=", OP_GE_I, OP_GE_F},
+    {"==", OP_EQ_I, OP_EQ_F},
+    {"!=", OP_NE_I, OP_NE_F}
+};
+
+typedef struct {
+    BytecodeProgram *program;
+    Writer *errors;
+    int error_count;
+    int flags;
+    int depth;                  // Operand stack depth at this point
+    int max_depth;
+    int line;                   // Line recorded for emitted words
+    int last_op;                // Offset of the last instruction emitted
+    int label;                  // Latest offset that a jump lands on
+    ASTNode **declarations;     // Declaration of each function
+    int declaration_capacity;
+    int *function_index;        // Function per symbol ID, -1 if none
+    uint32_t function_index_size;
+    int *constant_table;        // Constant index + 1 by hash of its bits, 0 if empty
+    int constant_table_size;
+    int in_function;
+    int function;               // Index of the function being compiled, -1 at top level
+    int statement;              // Innermost statement marked for profiling, -1 if none
+    ValueType return_type;
+} Compiler;
+
+static ValueType compile_expression(Compiler *c, ASTNode *node);
+static void compile_statement(Compiler *c, ASTNode *node);
+
+static void *grow_array(void *data, int *capacity, size_t element) {
+    int grown = *capacity ? *capacity * 2 : 64;
+    void *resized = realloc(data, grown * element);
+    if (!resized) {
+        fprintf(stderr, "Error: Memory allocation failed for bytecode\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return resized;
+}
+
+static void compile_error(Compiler *c, ASTNode *node, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(c->errors, "Compile error at line %d, column %d: %s\n",
+              node ? node->token.line : 0, node ? node->token.column : 0, message);
+    c->error_count++;
+}
+
+// Code emission
+
+static void emit_word(Compiler *c, int32_t word) {
+    BytecodeProgram *p = c->program;
+    if (p->code_length == p->code_capacity) {
+        int capacity = p->code_capacity;
+        p->code = grow_array(p->code, &p->code_capacity, sizeof(int32_t));
+        p->lines = grow_array(p->lines, &capacity, sizeof(int));
+    }
+    p->lines[p->code_length] = c->line;
+    p->code[p->code_length++] = word;
+}
+
+static void adjust_depth(Compiler *c, int effect) {
+    c->depth += effect;
+    if (c->depth > c->max_depth) {
+        c->max_depth = c->depth;
+    }
+}
+
+static void emit_op(Compiler *c, Opcode op) {
+    c->last_op = c->program->code_length;
+    emit_word(c, op);
+    adjust_depth(c, opcode_info[op].effect);
+}
+
+static void emit_op_arg(Compiler *c, Opcode op, int32_t operand) {
+    emit_op(c, op);
+    emit_word(c, operand);
+}
+
+// Emit a forward jump; returns the operand offset to patch
+static int emit_jump(Compiler *c, Opcode op) {
+    emit_op_arg(c, op, -1);
+    return c->program->code_length - 1;
+}
+
+static void patch_jump(Compiler *c, int operand) {
+    c->program->code[operand] = c->program->code_length;
+    c->label = c->program->code_length;
+}
+
+static int add_constant(Compiler *c, Value value) {
+    BytecodeProgram *p = c->program;
+    if (p->constant_count * 2 >= c->constant_table_size) {
+        // Rebuild the lookup table at twice the size
+        int size = c->constant_table_size ? c->constant_table_size * 2 : 64;
+        int *table = calloc(size, sizeof(int));
+        if (!table) {
+            fprintf(stderr, "Error: Memory allocation failed for bytecode\n");
+            exit(1);
+        }
+        for (int i = 0; i < p->constant_count; i++) {
+            uint64_t h = (uint64_t)p->constants[i].i * 0x9e3779b97f4a7c15ULL;
+            int slot = (int)(h >> 32) & (size - 1);
+            while (table[slot]) slot = (slot + 1) & (size - 1);
+            table[slot] = i + 1;
+        }
+        free(c->constant_table);
+        c->constant_table = table;
+        c->constant_table_size = size;
+    }
+
+    // Constants are deduplicated by bit pattern
+    uint64_t h = (uint64_t)value.i * 0x9e3779b97f4a7c15ULL;
+    int mask = c->constant_table_size - 1;
+    int slot = (int)(h >> 32) & mask;
+    while (c->constant_table[slot]) {
+        int index = c->constant_table[slot] - 1;
+        if (p->constants[index].i == value.i) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (p->constant_count == p->constant_capacity) {
+        p->constants = grow_array(p->constants, &p->constant_capacity, sizeof(Value));
+    }
+    p->constants[p->constant_count] = value;
+    c->constant_table[slot] = p->constant_count + 1;
+    return p->constant_count++;
+}
+
+static void emit_int(Compiler *c, long long value) {
+    emit_op_arg(c, OP_CONST, add_constant(c, (Value){.i = value}));
+}
+
+static void emit_zero(Compiler *c, ValueType type) {
+    if (type == TYPE_FLOAT) {
+        emit_op_arg(c, OP_CONST, add_constant(c, (Value){.f = 0.0}));
+    } else {
+        emit_int(c, 0);
+    }
+}
+
+static int add_string(Compiler *c, const char *text) {
+    BytecodeProgram *p = c->program;
+    int length = (int)strlen(text) + 1;
+    while (p->strings_length + length > p->strings_capacity) {
+        p->strings = grow_array(p->strings, &p->strings_capacity, 1);
+    }
+    memcpy(p->strings + p->strings_length, text, length);
+    p->strings_length += length;
+    return p->strings_length - length;
+}
+
+// Types
+
+static ValueType declared_type(TokenType type) {
+    return type == TOKEN_FLOAT_KEY || type == TOKEN_DOUBLE ? TYPE_FLOAT : TYPE_INT;
+}
+
+static void convert(Compiler *c, ValueType from, ValueType to) {
+    BytecodeProgram *p = c->program;
+    if (from == TYPE_INT && to == TYPE_FLOAT) {
+        if (p->code[c->last_op] == OP_CONST && c->last_op + 2 == p->code_length &&
+            c->label <= c->last_op) {
+            // Convert an integer constant at compile time, unless another
+            // path joins between the constant and the conversion
+            int32_t *operand = &p->code[c->last_op + 1];
+            *operand = add_constant(c, (Value){.f = (double)p->constants[*operand].i});
+            return;
+        }
+        emit_op(c, OP_I2F);
+    } else if (from == TYPE_FLOAT && to == TYPE_INT) {
+        emit_op(c, OP_F2I);
+    }
+}
+
+static int binary_index(const char *lexeme) {
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (strcmp(lexeme, binary_ops[i].lexeme) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int is_logical(ASTNode *node) {
+    return node->type == AST_BINOP &&
+           (strcmp(node->token.lexeme, "&&") == 0 || strcmp(node->token.lexeme, "||") == 0);
+}
+
+// Expressions whose int value is already 0 or 1
+static int is_boolean(ASTNode *node) {
+    if (node->type != AST_BINOP) {
+        return 0;
+    }
+    int index = binary_index(node->token.lexeme);
+    return is_logical(node) || (index >= 0 && binary_ops[index].int_op >= OP_LT_I);
+}
+
+static int function_of(Compiler *c, SymbolId sym) {
+    return sym < c->function_index_size ? c->function_index[sym] : -1;
+}
+
+// Type of an expression without compiling it
+static ValueType expression_type(Compiler *c, ASTNode *node) {
+    if (!node) {
+        return TYPE_INT;
+    }
+    switch (node->type) {
+        case AST_NUMBER:
+            return node->token.type == TOKEN_FLOAT ? TYPE_FLOAT : TYPE_INT;
+        case AST_IDENTIFIER:
+            return declared_type(node->decl_type);
+        case AST_BINOP:
+            if (is_boolean(node)) {
+                return TYPE_INT;
+            }
+            if (expression_type(c, node->left) == TYPE_FLOAT) {
+                return TYPE_FLOAT;
+            }
+            return expression_type(c, node->right);
+        case AST_FUNCTION_CALL: {
+            int index = function_of(c, node->token.sym);
+            return index >= 0 ? declared_type(c->declarations[index]->decl_type) : TYPE_INT;
+        }
+        default:
+            return TYPE_INT;
+    }
+}
+
+// Expressions
+
+static ValueType compile_load(Compiler *c, ASTNode *node) {
+    if (node->scope_depth < 0) {
+        compile_error(c, node, "Unresolved identifier '%s'", node->token.lexeme);
+        emit_int(c, 0);
+        return TYPE_INT;
+    }
+    if (node->scope_depth == 0) {
+        emit_op_arg(c, OP_LOAD_GLOBAL, node->slot);
+    } else {
+        emit_op_arg(c, OP_LOAD, node->slot);
+    }
+    return declared_type(node->decl_type);
+}
+
+// Store the value on top of the stack into the variable 'node' names
+static void compile_store(Compiler *c, ASTNode *node, ValueType type) {
+    if (node->scope_depth < 0) {
+        compile_error(c, node, "Unresolved identifier '%s'", node->token.lexeme);
+        emit_op(c, OP_POP);
+        return;
+    }
+    convert(c, type, declared_type(node->decl_type));
+    if (node->scope_depth == 0) {
+        emit_op_arg(c, OP_STORE_GLOBAL, node->slot);
+        if (node->slot >= c->program->global_count) {
+            c->program->global_count = node->slot + 1;
+        }
+    } else {
+        emit_op_arg(c, OP_STORE, node->slot);
+    }
+}
+
+// Push 0 or 1 for a condition
+static void compile_truth(Compiler *c, ASTNode *node) {
+    ValueType type = compile_expression(c, node);
+    if (type == TYPE_FLOAT) {
+        emit_op(c, OP_BOOL_F);
+    } else if (!is_boolean(node)) {
+        emit_op(c, OP_BOOL_I);
+    }
+}
+
+// Push a value whose zero-ness is the condition, for jumps
+static void compile_condition(Compiler *c, ASTNode *node) {
+    if (compile_expression(c, node) == TYPE_FLOAT) {
+        emit_op(c, OP_BOOL_F);
+    }
+}
+
+// && and || evaluate their right operand only when needed
+static ValueType compile_logical(Compiler *c, ASTNode *node) {
+    int is_and = node->token.lexeme[0] == '&';
+    compile_condition(c, node->left);
+    int short_circuit = emit_jump(c, is_and ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE);
+    compile_truth(c, node->right);
+    int end = emit_jump(c, OP_JUMP);
+    patch_jump(c, short_circuit);
+    c->depth--; // Only one of the two results is pushed
+    emit_int(c, is_and ? 0 : 1);
+    patch_jump(c, end);
+    return TYPE_INT;
+}
+
+static ValueType compile_binary(Compiler *c, ASTNode *node) {
+    if (is_logical(node)) {
+        return compile_logical(c, node);
+    }
+    int index = binary_index(node->token.lexeme);
+    if (index < 0) {
+        compile_error(c, node, "Unsupported operator '%s'", node->token.lexeme);
+        return TYPE_INT;
+    }
+
+    // The left operand is converted before the right one is pushed
+    ValueType left = compile_expression(c, node->left);
+    ValueType right_type = expression_type(c, node->right);
+    ValueType type = left == TYPE_FLOAT || right_type == TYPE_FLOAT ? TYPE_FLOAT : TYPE_INT;
+    convert(c, left, type);
+    convert(c, compile_expression(c, node->right), type);
+
+    Opcode op = type == TYPE_FLOAT ? binary_ops[index].float_op : binary_ops[index].int_op;
+    if (op == OP_COUNT) {
+        compile_error(c, node, "Operator '%s' needs integer operands", node->token.lexeme);
+        op = binary_ops[index].int_op;
+    }
+    c->line = node->token.line;    // A fault is reported at the operator
+    emit_op(c, op);
+    return op >= OP_LT_I && (op <= OP_NE_I || op >= OP_LT_F) ? TYPE_INT : type;
+}
+
+static ValueType compile_call(Compiler *c, ASTNode *node) {
+    int index = function_of(c, node->token.sym);
+    if (index < 0) {
+        compile_error(c, node, "Call to undefined function '%s'", node->token.lexeme);
+        emit_int(c, 0);
+        return TYPE_INT;
+    }
+
+    ASTNode *decl = c->declarations[index];
+    int argc = node->left ? 1 : 0;
+    if (argc > c->program->functions[index].params) {
+        compile_error(c, node, "Too many arguments to '%s'", node->token.lexeme);
+    }
+    if (argc) {
+        ValueType type = compile_expression(c, node->left);
+        convert(c, type, decl->left ? declared_type(decl->left->decl_type) : type);
+    }
+    c->line = node->token.line;
+    emit_op(c, OP_CALL);
+    emit_word(c, index);
+    emit_word(c, argc);
+    adjust_depth(c, -argc);
+    return declared_type(decl->decl_type);
+}
+
+static ValueType compile_expression(Compiler *c, ASTNode *node) {
+    if (!node) {
+        emit_int(c, 0);
+        return TYPE_INT;
+    }
+    c->line = node->token.line;
+
+    switch (node->type) {
+        case AST_NUMBER:
+            if (node->token.type == TOKEN_FLOAT) {
+                emit_op_arg(c, OP_CONST, add_constant(c, (Value){.f = node->token.float_value}));
+                return TYPE_FLOAT;
+            }
+            emit_int(c, node->token.int_value);
+            return TYPE_INT;
+        case AST_IDENTIFIER:
+            return compile_load(c, node);
+        case AST_BINOP:
+            return compile_binary(c, node);
+        case AST_FACTORIAL:
+            convert(c, compile_expression(c, node->left), TYPE_INT);
+            c->line = node->token.line;
+            emit_op(c, OP_FACTORIAL);
+            return TYPE_INT;
+        case AST_FUNCTION_CALL:
+            return compile_call(c, node);
+        case AST_STRING:
+            compile_error(c, node, "String literals can only be printed");
+            emit_int(c, 0);
+            return TYPE_INT;
+        default:
+            compile_error(c, node, "Unsupported expression");
+            emit_int(c, 0);
+            return TYPE_INT;
+    }
+}
+
+// Statements
+
+// Record a statement of 'kind' for the profiler (VM_PROFILE) and make it
+// the innermost one; entries of functions and of the top-level code have
+// no parent
+static void begin_statement(Compiler *c, ASTNode *node, int kind) {
+    BytecodeProgram *p = c->program;
+    if (p->statement_count == p->statement_capacity) {
+        p->statements = grow_array(p->statements, &p->statement_capacity, sizeof(VMStatement));
+    }
+    int enclosing = c->statement;
+    int entry = kind == AST_FUNCTION_DECL || kind == AST_PROGRAM;
+    p->statements[p->statement_count] = (VMStatement){
+        node->token.line, node->token.column, c->function, entry ? -1 : enclosing, kind};
+    c->statement = p->statement_count++;
+}
+
+static void compile_print(Compiler *c, ASTNode *node) {
+    ASTNode *value = node->left;
+    if (value && value->type == AST_STRING) {
+        emit_op_arg(c, OP_PRINT_STR, add_string(c, value->token.lexeme));
+    } else if (value && value->type == AST_FACTORIAL && (c->flags & VM_BIGINT)) {
+        convert(c, compile_expression(c, value->left), TYPE_INT);
+        c->line = value->token.line;
+        emit_op(c, OP_PRINT_FACTORIAL);
+    } else {
+        ValueType type = compile_expression(c, value);
+        emit_op(c, type == TYPE_FLOAT ? OP_PRINT_F : OP_PRINT_I);
+    }
+}
+
+static void compile_if(Compiler *c, ASTNode *node) {
+    ASTNode *then_branch = node->right;
+    ASTNode *else_branch = NULL;
+    if (then_branch && then_branch->type == AST_ELSE) {
+        else_branch = then_branch->right;
+        then_branch = then_branch->left;
+    }
+
+    compile_condition(c, node->left);
+    int skip_then = emit_jump(c, OP_JUMP_IF_FALSE);
+    compile_statement(c, then_branch);
+    if (else_branch) {
+        int skip_else = emit_jump(c, OP_JUMP);
+        patch_jump(c, skip_then);
+        compile_statement(c, else_branch);
+        patch_jump(c, skip_else);
+    } else {
+        patch_jump(c, skip_then);
+    }
+}
+
+// The condition is placed after the body, so each iteration takes a
+// single conditional jump
+static void compile_while(Compiler *c, ASTNode *node) {
+    int to_condition = emit_jump(c, OP_JUMP);
+    int body = c->program->code_length;
+    compile_statement(c, node->right);
+    patch_jump(c, to_condition);
+    if (c->flags & VM_PROFILE) {
+        emit_op_arg(c, OP_STATEMENT, c->statement);
+    }
+    compile_condition(c, node->left);
+    emit_op_arg(c, OP_JUMP_IF_TRUE, body);
+}
+
+// taeper { body } litnu (condition): run the body until the condition holds
+static void compile_repeat(Compiler *c, ASTNode *node) {
+    int body = c->program->code_length;
+    compile_statement(c, node->left);
+    if (c->flags & VM_PROFILE) {
+        emit_op_arg(c, OP_STATEMENT, c->statement);
+    }
+    compile_condition(c, node->right);
+    emit_op_arg(c, OP_JUMP_IF_FALSE, body);
+}
+
+static void compile_statement(Compiler *c, ASTNode *node) {
+    if (!node) {
+        return;
+    }
+    c->line = node->token.line;
+
+    // Loops mark their condition, which runs on each iteration
+    int enclosing = c->statement;
+    if ((c->flags & VM_PROFILE) && node->type != AST_PROGRAM && node->type != AST_BLOCK &&
+        node->type != AST_FUNCTION_DECL) {
+        begin_statement(c, node, node->type);
+        if (node->type != AST_WHILE && node->type != AST_FOR) {
+            emit_op_arg(c, OP_STATEMENT, c->statement);
+        }
+    }
+
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            for (ASTNode *link = node; link && link->type == node->type; link = link->right) {
+                compile_statement(c, link->left);
+            }
+            break;
+        case AST_VARDECL:
+            if (node->right) {
+                compile_store(c, node, compile_expression(c, node->right));
+            } else {
+                // Slots are reused between scopes, so always initialize
+                emit_zero(c, declared_type(node->decl_type));
+                compile_store(c, node, declared_type(node->decl_type));
+            }
+            break;
+        case AST_ASSIGN:
+            compile_store(c, node->left, compile_expression(c, node->right));
+            break;
+        case AST_PRINT:
+            compile_print(c, node);
+            break;
+        case AST_RETURN:
+            if (c->in_function) {
+                convert(c, compile_expression(c, node->left), c->return_type);
+                emit_op(c, OP_RETURN);
+            } else {
+                convert(c, compile_expression(c, node->left), TYPE_INT);
+                emit_op(c, OP_HALT);
+            }
+            break;
+        case AST_IF:
+            compile_if(c, node);
+            break;
+        case AST_WHILE:
+            compile_while(c, node);
+            break;
+        case AST_FOR:
+            compile_repeat(c, node);
+            break;
+        case AST_FUNCTION_DECL:
+            if (c->in_function) {
+                compile_error(c, node, "Nested function '%s' is not supported", node->token.lexeme);
+            }
+            break; // Top-level functions are compiled separately
+        default:
+            // Expression statement
+            compile_expression(c, node);
+            emit_op(c, OP_POP);
+            break;
+    }
+    c->statement = enclosing;
+}
+
+static void compile_function(Compiler *c, int index) {
+    ASTNode *decl = c->declarations[index];
+    VMFunction *function = &c->program->functions[index];
+    function->entry = c->program->code_length;
+    c->depth = c->max_depth = 0;
+    c->in_function = 1;
+    c->function = index;
+    c->return_type = declared_type(decl->decl_type);
+    if (c->flags & VM_PROFILE) {
+        begin_statement(c, decl, AST_FUNCTION_DECL);
+        emit_op_arg(c, OP_ENTER, c->statement);
+    }
+
+    compile_statement(c, decl->right);
+    c->line = decl->token.line;
+    emit_zero(c, c->return_type); // Falling off the end returns 0
+    emit_op(c, OP_RETURN);
+
+    function->max_stack = c->max_depth + 1;
+    function->frame_size = decl->slot > function->params ? decl->slot : function->params;
+}
+
+// Register every top-level function so calls can precede declarations
+static void declare_functions(Compiler *c, ASTNode *root) {
+    BytecodeProgram *p = c->program;
+    for (ASTNode *link = root; link && link->type == AST_PROGRAM; link = link->right) {
+        ASTNode *decl = link->left;
+        if (!decl || decl->type != AST_FUNCTION_DECL) {
+            continue;
+        }
+        if (decl->slot < 0) {
+            compile_error(c, decl, "Function '%s' was not resolved", decl->token.lexeme);
+            continue;
+        }
+        if (function_of(c, decl->token.sym) >= 0) {
+            compile_error(c, decl, "Duplicate function '%s'", decl->token.lexeme);
+            continue;
+        }
+
+        if (decl->token.sym >= c->function_index_size) {
+            uint32_t size = c->function_index_size ? c->function_index_size : 256;
+            while (size <= decl->token.sym) size *= 2;
+            int *resized = realloc(c->function_index, size * sizeof(int));
+            if (!resized) {
+                fprintf(stderr, "Error: Memory allocation failed for bytecode\n");
+                exit(1);
+            }
+            memset(resized + c->function_index_size, 0xff,
+                   (size - c->function_index_size) * sizeof(int));
+            c->function_index = resized;
+            c->function_index_size = size;
+        }
+        if (p->function_count == p->function_capacity) {
+            p->functions = grow_array(p->functions, &p->function_capacity, sizeof(VMFunction));
+            c->declarations = grow_array(c->declarations, &c->declaration_capacity, sizeof(ASTNode *));
+        }
+
+        int params = 0;
+        for (ASTNode *param = decl->left; param; param = param->right) {
+            params++;
+        }
+        c->function_index[decl->token.sym] = p->function_count;
+        c->declarations[p->function_count] = decl;
+        p->functions[p->function_count++] = (VMFunction){decl->token.sym, 0, params, 0, 0};
+    }
+}
+
+// Compile a parsed program.  Identifiers must have been resolved (--resolve)
+// so that every variable has a scope depth and a frame slot.
+int vm_compile(ASTNode *root, int flags, BytecodeProgram *program, Writer *errors) {
+    memset(program, 0, sizeof(*program));
+    Compiler c = {0};
+    c.program = program;
+    c.errors = errors;
+    c.flags = flags;
+    c.function = -1;
+    c.statement = -1;
+
+    if (root && root->type == AST_PROGRAM) {
+        declare_functions(&c, root);
+    }
+
+    // Top-level statements, then niam() if there is one.  When profiling,
+    // the program is an entry and the call of niam() a statement in it.
+    int profile = (flags & VM_PROFILE) && root;
+    if (profile) {
+        begin_statement(&c, root, AST_PROGRAM);
+        emit_op_arg(&c, OP_ENTER, c.statement);
+    }
+    compile_statement(&c, root);
+    int entry = function_of(&c, intern_cstr("niam"));
+    if (entry >= 0) {
+        if (profile) {
+            begin_statement(&c, c.declarations[entry], AST_FUNCTION_CALL);
+            emit_op_arg(&c, OP_STATEMENT, c.statement);
+        }
+        emit_op(&c, OP_CALL);
+        emit_word(&c, entry);
+        emit_word(&c, 0);
+    } else {
+        emit_int(&c, 0);
+    }
+    emit_op(&c, OP_HALT);
+    program->max_stack = c.max_depth + 1;
+
+    for (int i = 0; i < program->function_count; i++) {
+        compile_function(&c, i);
+    }
+
+    free(c.declarations);
+    free(c.function_index);
+    free(c.constant_table);
+    return c.error_count;
+}
+
+void vm_program_free(BytecodeProgram *program) {
+    free(program->code);
+    free(program->lines);
+    free(program->constants);
+    free(program->strings);
+    free(program->functions);
+    free(program->statements);
+    memset(program, 0, sizeof(*program));
+}
+
+// Execution
+
+// Fewest significant digits (15 to 17) that read back as the same value
+static void write_float(Writer *out, double value) {
+    char text[32];
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    wr_str(out, text);
+}
+
+// Report a runtime error and unwind to vm_run
+void vm_fail(VM *vm, int line, const char *format, ...) {
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(vm->errors, "Runtime error at line %d: %s\n", line, message);
+    longjmp(vm->failure, 1);
+}
+
+long long vm_factorial(VM *vm, long long n, int line) {
+    long long value;
+    FactorialStatus status = factorial_int64(n, &value);
+    if (status != FACTORIAL_OK) {
+        vm_fail(vm, line, "lairotcaf(%lld) %s", n, factorial_status_message(status));
+    }
+    return value;
+}
+
+void vm_print_int(VM *vm, long long value) {
+    wr_int(vm->out, value);
+    wr_char(vm->out, '\n');
+}
+
+void vm_print_string(VM *vm, const char *text) {
+    wr_str(vm->out, text);
+    wr_char(vm->out, '\n');
+}
+
+// Exact n!, past int64 if need be (--bigint)
+void vm_print_factorial(VM *vm, long long n, int line) {
+    if (n <= FACTORIAL_MAX_INT64) {
+        vm_print_int(vm, vm_factorial(vm, n, line));
+        return;
+    }
+    char *digits = factorial_decimal((unsigned long)n);
+    if (!digits) {
+        vm_fail(vm, line, "lairotcaf(%lld) is too large", n);
+    }
+    vm_print_string(vm, digits);
+    free(digits);
+}
+
+// Reserve the stack for a call of 'function' with its frame at 'base'
+static void enter_call(VM *vm, const VMFunction *function, Value *base, int line) {
+    if (vm->frame_count == VM_MAX_FRAMES ||
+        base + function->frame_size + function->max_stack > vm->stack_limit) {
+        vm_fail(vm, line, "stack overflow");
+    }
+}
+
+// Native code for a function, compiling it once it has been called often
+// enough.  NULL while it runs interpreted.
+static JitFunction hot_function(VM *vm, int function) {
+    Jit *jit = vm->jit;
+    if (jit->state[function] == JIT_PENDING && ++jit->calls[function] >= jit->call_threshold) {
+        jit_compile(jit, vm, function);
+    }
+    return vm->native_depth < JIT_MAX_NATIVE_DEPTH ? jit->native[function] : NULL;
+}
+
+static long long call_native(VM *vm, JitFunction native, Value *base, const void *resume) {
+    vm->frame_count++;
+    vm->native_depth++;
+    long long result = native(base, vm, resume);
+    vm->native_depth--;
+    vm->frame_count--;
+    return result;
+}
+
+// Count a backward branch in 'function'.  Once the function is compiled and
+// the operand stack is empty, the rest of the call runs natively from the
+// loop head at 'target'; returns 1 with the call's result in that case.
+static int enter_loop(VM *vm, int function, Value *base, Value *sp, int target, Value *result) {
+    Jit *jit = vm->jit;
+    if (jit->state[function] == JIT_PENDING && ++jit->loops[function] >= jit->loop_threshold) {
+        jit_compile(jit, vm, function);
+    }
+    if (!jit->native[function] || vm->native_depth >= JIT_MAX_NATIVE_DEPTH ||
+        sp != base + vm->program->functions[function].frame_size) {
+        return 0;
+    }
+    const void *resume = jit_resume(jit, vm->program, function, target);
+    if (!resume) {
+        return 0;
+    }
+    result->i = call_native(vm, jit->native[function], base, resume);
+    return 1;
+}
+
+// Superinstructions listed in superops.h, numbered after the instruction
+// set.  They appear only in the copy of the code the interpreter runs.
+#define SUPEROP_ENUM(name, ...) OP_##name,
+enum {
+    OP_SUPER_BASE = OP_COUNT - 1,
+    SUPEROPS_4(SUPEROP_ENUM) SUPEROPS_3(SUPEROP_ENUM) SUPEROPS_2(SUPEROP_ENUM)
+    OP_SUPER_END
+};
+
+#define SUPEROP_RUN_4(name, a, b, c, d) {OP_##name, 4, {OP_##a, OP_##b, OP_##c, OP_##d}},
+#define SUPEROP_RUN_3(name, a, b, c) {OP_##name, 3, {OP_##a, OP_##b, OP_##c}},
+#define SUPEROP_RUN_2(name, a, b) {OP_##name, 2, {OP_##a, OP_##b}},
+static const struct {
+    int op;
+    int length;
+    int parts[SUPEROP_MAX_LENGTH];
+} superops[] = {
+    // Longest first, so the longest run that matches is used
+    SUPEROPS_4(SUPEROP_RUN_4) SUPEROPS_3(SUPEROP_RUN_3) SUPEROPS_2(SUPEROP_RUN_2)
+    {OP_HALT, 0, {0}}       // Keeps the table non-empty
+};
+
+// Copy of the code in which each instruction starting a run listed in
+// superops.h is replaced by the superinstruction for the longest one.
+// Only opcode words change, so offsets and operands stay valid and a jump
+// into the middle of a run continues with the plain instructions.  NULL
+// when there are no superinstructions.
+static int32_t *fuse_code(const BytecodeProgram *program) {
+    const int32_t *code = program->code;
+    int length = program->code_length;
+    int superop_count = OP_SUPER_END - (int)OP_COUNT;
+    if (superop_count == 0) {
+        return NULL;
+    }
+    int32_t *fused = malloc(length * sizeof(int32_t));
+    if (!fused) {
+        return NULL;
+    }
+    memcpy(fused, code, length * sizeof(int32_t));
+    for (int offset = 0; offset < length; offset += 1 + opcode_info[code[offset]].operands) {
+        for (int i = 0; i < superop_count; i++) {
+            int at = offset;
+            int part = 0;
+            while (part < superops[i].length && at < length && code[at] == superops[i].parts[part]) {
+                at += 1 + opcode_info[code[at]].operands;
+                part++;
+            }
+            if (part == superops[i].length) {
+                fused[offset] = superops[i].op;
+                break;
+            }
+        }
+    }
+    return fused;
+}
+
+// Count the instruction at 'pc' for VMOptions.counts
+static void count_dispatch(VM *vm, const int32_t *code, const int32_t *pc) {
+    VMCounts *counts = vm->counts;
+    counts->dispatches++;
+    if (counts->stretches_enabled && *pc < OP_COUNT) {
+        superop_record(counts, *pc, (int)(pc - code), 1 + opcode_info[*pc].operands);
+    }
+}
+
+// What each instruction does in execute(), with 'pc' just past its opcode
+// word; a superinstruction runs those of its instructions in turn.
+// Integer arithmetic wraps around rather than being undefined.
+#define BINARY_I(expr) { long long b = (--sp)->i; long long a = sp[-1].i; sp[-1].i = (expr); }
+#define BINARY_F(expr) { double b = (--sp)->f; double a = sp[-1].f; sp[-1].f = (expr); }
+#define COMPARE_F(expr) { double b = (--sp)->f; double a = sp[-1].f; sp[-1].i = (expr); }
+
+// Taken branch to 'target'; backward branches count towards tier-up
+#define BRANCH(target) do { \
+        const int32_t *to = (target); \
+        if (jit && to < pc && function >= 0 && jit->state[function] != JIT_UNSUPPORTED && \
+            enter_loop(vm, function, base, sp, to - code, &value)) \
+            goto leave_frame; \
+        pc = to; \
+    } while (0)
+
+#define DO_CONST *sp++ = constants[*pc++]
+#define DO_LOAD *sp++ = base[*pc++]
+#define DO_STORE base[*pc++] = *--sp
+#define DO_LOAD_GLOBAL *sp++ = globals[*pc++]
+#define DO_STORE_GLOBAL globals[*pc++] = *--sp
+#define DO_POP sp--
+
+#define DO_ADD_I BINARY_I((long long)((unsigned long long)a + (unsigned long long)b))
+#define DO_SUB_I BINARY_I((long long)((unsigned long long)a - (unsigned long long)b))
+#define DO_MUL_I BINARY_I((long long)((unsigned long long)a * (unsigned long long)b))
+#define DO_DIV_I { \
+        long long b = (--sp)->i; \
+        long long a = sp[-1].i; \
+        if (b == 0) vm_fail(vm, LINE(), "division by zero"); \
+        sp[-1].i = b == -1 ? (long long)(0 - (unsigned long long)a) : a / b; \
+    }
+#define DO_MOD_I { \
+        long long b = (--sp)->i; \
+        long long a = sp[-1].i; \
+        if (b == 0) vm_fail(vm, LINE(), "division by zero"); \
+        sp[-1].i = b == -1 ? 0 : a % b; \
+    }
+#define DO_LT_I BINARY_I(a < b)
+#define DO_GT_I BINARY_I(a > b)
+#define DO_LE_I BINARY_I(a <= b)
+#define DO_GE_I BINARY_I(a >= b)
+#define DO_EQ_I BINARY_I(a == b)
+#define DO_NE_I BINARY_I(a != b)
+
+#define DO_ADD_F BINARY_F(a + b)
+#define DO_SUB_F BINARY_F(a - b)
+#define DO_MUL_F BINARY_F(a * b)
+#define DO_DIV_F BINARY_F(a / b)
+#define DO_LT_F COMPARE_F(a < b)
+#define DO_GT_F COMPARE_F(a > b)
+#define DO_LE_F COMPARE_F(a <= b)
+#define DO_GE_F COMPARE_F(a >= b)
+#define DO_EQ_F COMPARE_F(a == b)
+#define DO_NE_F COMPARE_F(a != b)
+
+#define DO_I2F sp[-1].f = (double)sp[-1].i
+#define DO_F2I sp[-1].i = (long long)sp[-1].f
+#define DO_BOOL_I sp[-1].i = sp[-1].i != 0
+#define DO_BOOL_F sp[-1].i = sp[-1].f != 0.0
+
+#define DO_JUMP pc = code + *pc
+#define DO_JUMP_IF_FALSE \
+        if ((--sp)->i) { \
+            pc++; \
+        } else { \
+            BRANCH(code + *pc); \
+        }
+#define DO_JUMP_IF_TRUE \
+        if ((--sp)->i) { \
+            BRANCH(code + *pc); \
+        } else { \
+            pc++; \
+        }
+
+#define DO_FACTORIAL sp[-1].i = vm_factorial(vm, sp[-1].i, LINE())
+#define DO_PRINT_I vm_print_int(vm, (--sp)->i)
+#define DO_PRINT_F write_float(out, (--sp)->f); wr_char(out, '\n')
+#define DO_PRINT_STR vm_print_string(vm, program->strings + *pc++)
+#define DO_PRINT_FACTORIAL vm_print_factorial(vm, (--sp)->i, LINE())
+#define DO_STATEMENT if (vm->profile) profile_statement(vm->profile, vm->frame_count, *pc); pc++
+#define DO_ENTER if (vm->profile) profile_enter(vm->profile, vm->frame_count, *pc); pc++
+
+// Interpret from 'pc' in vm->code until the frame current on entry returns
+// (or the program halts), and return its result
+static Value execute(VM *vm, const int32_t *pc, Value *base, Value *sp, int function) {
+    const BytecodeProgram *program = vm->program;
+    const int32_t *code = vm->code;
+    const Value *constants = program->constants;
+    const VMFunction *functions = program->functions;
+    Value *globals = vm->globals;
+    Writer *out = vm->out;
+    Jit *jit = vm->jit;
+    int entry_frames = vm->frame_count;
+    Value value;
+
+#define LINE() (program->lines[pc - 1 - code])
+
+#ifdef VM_COMPUTED_GOTO
+#define TARGET(op) L_##op
+#define DISPATCH() goto *table[*pc++]
+#define SUPEROP_LABEL(name, ...) [OP_##name] = &&L_##name,
+    static const void *const dispatch[OP_SUPER_END] = {
+        [OP_CONST] = &&L_CONST, [OP_LOAD] = &&L_LOAD, [OP_STORE] = &&L_STORE,
+        [OP_LOAD_GLOBAL] = &&L_LOAD_GLOBAL, [OP_STORE_GLOBAL] = &&L_STORE_GLOBAL,
+        [OP_POP] = &&L_POP,
+        [OP_ADD_I] = &&L_ADD_I, [OP_SUB_I] = &&L_SUB_I, [OP_MUL_I] = &&L_MUL_I,
+        [OP_DIV_I] = &&L_DIV_I, [OP_MOD_I] = &&L_MOD_I,
+        [OP_LT_I] = &&L_LT_I, [OP_GT_I] = &&L_GT_I, [OP_LE_I] = &&L_LE_I,
+        [OP_GE_I] = &&L_GE_I, [OP_EQ_I] = &&L_EQ_I, [OP_NE_I] = &&L_NE_I,
+        [OP_ADD_F] = &&L_ADD_F, [OP_SUB_F] = &&L_SUB_F, [OP_MUL_F] = &&L_MUL_F,
+        [OP_DIV_F] = &&L_DIV_F,
+        [OP_LT_F] = &&L_LT_F, [OP_GT_F] = &&L_GT_F, [OP_LE_F] = &&L_LE_F,
+        [OP_GE_F] = &&L_GE_F, [OP_EQ_F] = &&L_EQ_F, [OP_NE_F] = &&L_NE_F,
+        [OP_I2F] = &&L_I2F, [OP_F2I] = &&L_F2I, [OP_BOOL_I] = &&L_BOOL_I,
+        [OP_BOOL_F] = &&L_BOOL_F,
+        [OP_JUMP] = &&L_JUMP, [OP_JUMP_IF_FALSE] = &&L_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&L_JUMP_IF_TRUE,
+        [OP_CALL] = &&L_CALL, [OP_RETURN] = &&L_RETURN,
+        [OP_FACTORIAL] = &&L_FACTORIAL,
+        [OP_PRINT_I] = &&L_PRINT_I, [OP_PRINT_F] = &&L_PRINT_F,
+        [OP_PRINT_STR] = &&L_PRINT_STR, [OP_PRINT_FACTORIAL] = &&L_PRINT_FACTORIAL,
+        [OP_STATEMENT] = &&L_STATEMENT, [OP_ENTER] = &&L_ENTER,
+        [OP_HALT] = &&L_HALT,
+        SUPEROPS_4(SUPEROP_LABEL) SUPEROPS_3(SUPEROP_LABEL) SUPEROPS_2(SUPEROP_LABEL)
+    };
+    // Counting runs every dispatch through L_COUNT first
+    static const void *const counting[OP_SUPER_END] = {[0 ... OP_SUPER_END - 1] = &&L_COUNT};
+    const void *const *table = vm->counts ? counting : dispatch;
+    DISPATCH();
+L_COUNT:
+    count_dispatch(vm, code, pc - 1);
+    goto *dispatch[pc[-1]];
+#else
+#define TARGET(op) case OP_##op
+#define DISPATCH() continue
+    for (;;) {
+    if (vm->counts) count_dispatch(vm, code, pc);
+    switch (*pc++) {
+#endif
+
+#define HANDLER(op) TARGET(op): { DO_##op; } DISPATCH();
+#define SUPEROP_HANDLER_4(name, a, b, c, d) \
+    TARGET(name): { DO_##a; } pc++; { DO_##b; } pc++; { DO_##c; } pc++; { DO_##d; } DISPATCH();
+#define SUPEROP_HANDLER_3(name, a, b, c) \
+    TARGET(name): { DO_##a; } pc++; { DO_##b; } pc++; { DO_##c; } DISPATCH();
+#define SUPEROP_HANDLER_2(name, a, b) \
+    TARGET(name): { DO_##a; } pc++; { DO_##b; } DISPATCH();
+
+    HANDLER(CONST)
+    HANDLER(LOAD)
+    HANDLER(STORE)
+    HANDLER(LOAD_GLOBAL)
+    HANDLER(STORE_GLOBAL)
+    HANDLER(POP)
+
+    HANDLER(ADD_I)
+    HANDLER(SUB_I)
+    HANDLER(MUL_I)
+    HANDLER(DIV_I)
+    HANDLER(MOD_I)
+    HANDLER(LT_I)
+    HANDLER(GT_I)
+    HANDLER(LE_I)
+    HANDLER(GE_I)
+    HANDLER(EQ_I)
+    HANDLER(NE_I)
+
+    HANDLER(ADD_F)
+    HANDLER(SUB_F)
+    HANDLER(MUL_F)
+    HANDLER(DIV_F)
+    HANDLER(LT_F)
+    HANDLER(GT_F)
+    HANDLER(LE_F)
+    HANDLER(GE_F)
+    HANDLER(EQ_F)
+    HANDLER(NE_F)
+
+    HANDLER(I2F)
+    HANDLER(F2I)
+    HANDLER(BOOL_I)
+    HANDLER(BOOL_F)
+
+    HANDLER(JUMP)
+    HANDLER(JUMP_IF_FALSE)
+    HANDLER(JUMP_IF_TRUE)
+
+    TARGET(CALL): {
+        int index = pc[0];
+        const VMFunction *callee = &functions[index];
+        Value *callee_base = sp - pc[1];
+        enter_call(vm, callee, callee_base, LINE());
+        // Missing arguments and locals start at zero
+        while (sp < callee_base + callee->frame_size) {
+            (sp++)->i = 0;
+        }
+        JitFunction native = jit ? hot_function(vm, index) : NULL;
+        if (native) {
+            callee_base->i = call_native(vm, native, callee_base, NULL);
+            sp = callee_base + 1;
+            pc += 2;
+            DISPATCH();
+        }
+        vm->frames[vm->frame_count++] = (VMFrame){pc + 2, base, function};
+        base = callee_base;
+        sp = callee_base + callee->frame_size;
+        pc = code + callee->entry;
+        function = index;
+        DISPATCH();
+    }
+    TARGET(RETURN):
+        value = sp[-1];
+    leave_frame:
+        if (vm->frame_count == entry_frames) {
+            return value;
+        }
+        {
+            VMFrame frame = vm->frames[--vm->frame_count];
+            sp = base;
+            *sp++ = value;
+            base = frame.base;
+            pc = frame.return_pc;
+            function = frame.function;
+        }
+        DISPATCH();
+
+    HANDLER(FACTORIAL)
+    HANDLER(PRINT_I)
+    HANDLER(PRINT_F)
+    HANDLER(PRINT_STR)
+    HANDLER(PRINT_FACTORIAL)
+    HANDLER(STATEMENT)
+    HANDLER(ENTER)
+
+    TARGET(HALT):
+        return sp[-1];
+
+    SUPEROPS_4(SUPEROP_HANDLER_4)
+    SUPEROPS_3(SUPEROP_HANDLER_3)
+    SUPEROPS_2(SUPEROP_HANDLER_2)
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+        vm_fail(vm, LINE(), "invalid opcode %d", pc[-1]);
+    }
+    }
+#endif
+
+#undef HANDLER
+#undef SUPEROP_HANDLER_4
+#undef SUPEROP_HANDLER_3
+#undef SUPEROP_HANDLER_2
+#undef TARGET
+#undef DISPATCH
+#undef LINE
+}
+
+// Called from native code: run 'function' with its frame at 'base', the
+// first 'argc' slots of which hold the arguments
+long long vm_call(VM *vm, int function, Value *base, int argc, int line) {
+    const VMFunction *callee = &vm->program->functions[function];
+    enter_call(vm, callee, base, line);
+    for (int slot = argc; slot < callee->frame_size; slot++) {
+        base[slot].i = 0;
+    }
+    JitFunction native = hot_function(vm, function);
+    if (native) {
+        return call_native(vm, native, base, NULL);
+    }
+    return execute(vm, vm->code + callee->entry, base, base + callee->frame_size, function).i;
+}
+
+VMStatus vm_run(const BytecodeProgram *program, const VMOptions *options,
+                Writer *out, Writer *errors, long long *result) {
+    VM vm = {0};
+    vm.program = program;
+    vm.out = out;
+    vm.errors = errors;
+    vm.stack = malloc(VM_STACK_SIZE * sizeof(Value));
+    vm.stack_limit = vm.stack + VM_STACK_SIZE;
+    vm.frames = malloc(VM_MAX_FRAMES * sizeof(VMFrame));
+    vm.globals = calloc(program->global_count + 1, sizeof(Value));
+    int32_t *fused = options && options->no_fuse ? NULL : fuse_code(program);
+    vm.code = fused ? fused : program->code;
+    vm.counts = options ? options->counts : NULL;
+
+    Jit jit;
+    if (options && options->jit) {
+        if (jit_init(&jit, program, options->jit_threshold) == 0) {
+            vm.jit = &jit;
+        }
+    }
+    // The profiler's timer reads the call depth while this VM runs
+    vm.profile = options ? options->profile : NULL;
+    if (vm.profile) {
+        vm.profile->depth = &vm.frame_count;
+    }
+
+    VMStatus status = VM_OK;
+    if (!vm.stack || !vm.frames || !vm.globals) {
+        wr_str(errors, "Runtime error: out of memory\n");
+        status = VM_RUNTIME_ERROR;
+    } else if (setjmp(vm.failure)) {
+        status = VM_RUNTIME_ERROR;
+    } else if (vm.stack + program->max_stack > vm.stack_limit) {
+        vm_fail(&vm, 0, "stack overflow");
+    } else {
+        Value value = execute(&vm, vm.code, vm.stack, vm.stack, -1);
+        if (result) *result = value.i;
+    }
+
+    if (vm.profile) {
+        vm.profile->depth = NULL;
+    }
+    if (vm.jit) {
+        if (options->jit_compiled) *options->jit_compiled = jit.compiled;
+        jit_free(vm.jit);
+    }
+    free(vm.stack);
+    free(vm.frames);
+    free(vm.globals);
+    free(fused);
+    return status;
+}
+
+// Call one function once per row, with the row's values from 'columns' as
+// arguments.  Rows that stop with a runtime error get 0 and failed[row]
+// set; the message goes to 'errors'.  Returns the number of failed rows.
+size_t vm_call_rows(const BytecodeProgram *program, const VMOptions *options, int function,
+                    const long long *const *columns, size_t rows,
+                    long long *results, unsigned char *failed, Writer *errors) {
+    VM vm = {0};
+    vm.program = program;
+    vm.out = errors;
+    vm.errors = errors;
+    vm.stack = malloc(VM_STACK_SIZE * sizeof(Value));
+    vm.stack_limit = vm.stack + VM_STACK_SIZE;
+    vm.frames = malloc(VM_MAX_FRAMES * sizeof(VMFrame));
+    vm.globals = calloc(program->global_count + 1, sizeof(Value));
+    if (!vm.stack || !vm.frames || !vm.globals) {
+        fprintf(stderr, "Error: Memory allocation failed for VM\n");
+        exit(1);
+    }
+    int32_t *fused = options && options->no_fuse ? NULL : fuse_code(program);
+    vm.code = fused ? fused : program->code;
+
+    Jit jit;
+    if (options && options->jit && jit_init(&jit, program, options->jit_threshold) == 0) {
+        vm.jit = &jit;
+    }
+
+    const VMFunction *callee = &program->functions[function];
+    for (size_t row = 0; row < rows; row++) {
+        if (setjmp(vm.failure)) {
+            // Unwound from any depth, interpreted or native
+            vm.frame_count = 0;
+            vm.native_depth = 0;
+            results[row] = 0;
+            failed[row] = 1;
+            continue;
+        }
+        for (int p = 0; p < callee->params; p++) {
+            vm.stack[p].i = columns[p][row];
+        }
+        if (vm.jit) {
+            results[row] = vm_call(&vm, function, vm.stack, callee->params, 0);
+        } else {
+            enter_call(&vm, callee, vm.stack, 0);
+            for (int slot = callee->params; slot < callee->frame_size; slot++) {
+                vm.stack[slot].i = 0;
+            }
+            results[row] = execute(&vm, vm.code + callee->entry, vm.stack,
+                                   vm.stack + callee->frame_size, function).i;
+        }
+        failed[row] = 0;
+    }
+
+    if (vm.jit) {
+        if (options->jit_compiled) *options->jit_compiled = jit.compiled;
+        jit_free(vm.jit);
+    }
+    free(vm.stack);
+    free(vm.frames);
+    free(vm.globals);
+    free(fused);
+
+    size_t failures = 0;
+    for (size_t row = 0; row < rows; row++) {
+        failures += failed[row];
+    }
+    return failures;
+}
+
+// Verification of code from outside the compiler (bytecode images)
+
+static int verify_error(Writer *errors, int offset, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int verify_error(Writer *errors, int offset, const char *format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    wr_printf(errors, "Bytecode error at offset %04d: %s\n", offset, message);
+    return 1;
+}
+
+// Operand stack values an instruction consumes
+static int instruction_pops(int op, const int32_t *args) {
+    switch (op) {
+        case OP_CONST: case OP_LOAD: case OP_LOAD_GLOBAL: case OP_JUMP:
+        case OP_PRINT_STR: case OP_STATEMENT: case OP_ENTER:
+            return 0;
+        case OP_CALL:
+            return args[1];
+        default:
+            return op >= OP_ADD_I && op <= OP_NE_F ? 2 : 1;
+    }
+}
+
+// Record the stack depth on reaching 'target', queueing it the first time
+static int reach(int target, int depth, int *depths, int *work, int *count, Writer *errors) {
+    if (depths[target] < 0) {
+        depths[target] = depth;
+        work[(*count)++] = target;
+        return 0;
+    }
+    if (depths[target] != depth) {
+        return verify_error(errors, target, "reached with stack depth %d and %d", depths[target], depth);
+    }
+    return 0;
+}
+
+// Check the code in [begin, end) that runs with a frame of 'frame' slots:
+// operands in range, jumps within the region onto instructions, and the
+// same operand stack depth, within 'max_stack', on every path to each
+// instruction.  Stops at the first problem; returns 1 if there was one.
+static int verify_region(const BytecodeProgram *program, int begin, int end, int frame, int max_stack,
+                         const unsigned char *starts, int *depths, int *work, Writer *errors) {
+    const int32_t *code = program->code;
+    int count = 0;
+    depths[begin] = 0;
+    work[count++] = begin;
+    while (count > 0) {
+        int offset = work[--count];
+        int op = code[offset];
+        const int32_t *args = code + offset + 1;
+        int depth = depths[offset];
+        int next = offset + 1 + opcode_info[op].operands;
+        int target = -1;
+
+        switch (op) {
+            case OP_CONST:
+                if (args[0] < 0 || args[0] >= program->constant_count) {
+                    return verify_error(errors, offset, "constant %d out of range", args[0]);
+                }
+                break;
+            case OP_LOAD:
+            case OP_STORE:
+                if (args[0] < 0 || args[0] >= frame) {
+                    return verify_error(errors, offset, "slot %d outside a frame of %d", args[0], frame);
+                }
+                break;
+            case OP_LOAD_GLOBAL:
+            case OP_STORE_GLOBAL:
+                if (args[0] < 0 || args[0] >= program->global_count) {
+                    return verify_error(errors, offset, "global %d out of range", args[0]);
+                }
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+                target = args[0];
+                if (target < begin || target >= end || !starts[target]) {
+                    return verify_error(errors, offset, "jump to %d is not an instruction here", target);
+                }
+                break;
+            case OP_CALL:
+                if (args[0] < 0 || args[0] >= program->function_count) {
+                    return verify_error(errors, offset, "call of function %d out of range", args[0]);
+                }
+                if (args[1] < 0 || args[1] > program->functions[args[0]].params) {
+                    return verify_error(errors, offset, "call with %d arguments", args[1]);
+                }
+                break;
+            case OP_PRINT_STR:
+                if (args[0] < 0 || args[0] >= program->strings_length ||
+                    !memchr(program->strings + args[0], '\0', program->strings_length - args[0])) {
+                    return verify_error(errors, offset, "string %d out of range", args[0]);
+                }
+                break;
+            case OP_STATEMENT:
+            case OP_ENTER:
+                if (args[0] < 0 || args[0] >= program->statement_count) {
+                    return verify_error(errors, offset, "statement %d out of range", args[0]);
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (depth < instruction_pops(op, args)) {
+            return verify_error(errors, offset, "%s needs more than %d stack values",
+                                opcode_info[op].name, depth);
+        }
+        int after = op == OP_CALL ? depth - args[1] + 1 : depth + opcode_info[op].effect;
+        if (after > max_stack) {
+            return verify_error(errors, offset, "stack depth %d exceeds %d", after, max_stack);
+        }
+        if (target >= 0 && reach(target, after, depths, work, &count, errors)) {
+            return 1;
+        }
+        if (op == OP_JUMP || op == OP_RETURN || op == OP_HALT) {
+            continue;
+        }
+        if (next >= end) {
+            return verify_error(errors, offset, "code runs past the end of its function");
+        }
+        if (reach(next, after, depths, work, &count, errors)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Check that a program can run without reading or writing outside what
+// it declares: opcodes, operands, function table and stack depths.  The
+// top-level code starts at offset 0, followed by the functions in order.
+// Returns the number of problems, reported to 'errors'.
+int vm_verify(const BytecodeProgram *program, Writer *errors) {
+    int length = program->code_length;
+    if (length < 1 || program->max_stack < 1 || program->global_count < 0) {
+        return verify_error(errors, 0, "empty program or bad header values");
+    }
+    unsigned char *starts = calloc(length, 1);
+    int *depths = malloc(length * sizeof(int));
+    int *work = malloc(length * sizeof(int));
+    if (!starts || !depths || !work) {
+        fprintf(stderr, "Error: Memory allocation failed for bytecode\n");
+        exit(1);
+    }
+
+    int problems = 0;
+    for (int offset = 0; offset < length && !problems;) {
+        int32_t op = program->code[offset];
+        if (op < 0 || op >= OP_COUNT) {
+            problems += verify_error(errors, offset, "invalid opcode %d", op);
+        } else if (length - offset <= opcode_info[op].operands) {
+            problems += verify_error(errors, offset, "%s is cut off", opcode_info[op].name);
+        } else {
+            starts[offset] = 1;
+            offset += 1 + opcode_info[op].operands;
+        }
+    }
+    int previous = 0;
+    for (int i = 0; i < program->function_count && !problems; i++) {
+        const VMFunction *f = &program->functions[i];
+        if (f->entry <= previous || f->entry >= length || !starts[f->entry]) {
+            problems += verify_error(errors, f->entry, "function %d does not start after the code before it", i);
+        } else if (f->params < 0 || f->params > f->frame_size || f->max_stack < 1) {
+            problems += verify_error(errors, f->entry, "function %d has a bad frame", i);
+        }
+        previous = f->entry;
+    }
+
+    for (int i = 0; i < length; i++) {
+        depths[i] = -1;
+    }
+    for (int i = -1; i < program->function_count && !problems; i++) {
+        const VMFunction *f = i >= 0 ? &program->functions[i] : NULL;
+        int begin = f ? f->entry : 0;
+        int end = i + 1 < program->function_count ? program->functions[i + 1].entry : length;
+        problems += verify_region(program, begin, end, f ? f->frame_size : 0,
+                                  f ? f->max_stack : program->max_stack, starts, depths, work, errors);
+    }
+
+    free(starts);
+    free(depths);
+    free(work);
+    return problems;
+}
+
+const char *vm_opcode_name(int op) {
+    return op >= 0 && op < OP_COUNT ? opcode_info[op].name : "?";
+}
+
+// Listing of the top-level code and each function
+void vm_disassemble(Writer *out, const BytecodeProgram *program) {
+    int next_function = 0;
+    wr_str(out, "== top level ==\n");
+    for (int offset = 0; offset < program->code_length;) {
+        while (next_function < program->function_count &&
+               program->functions[next_function].entry == offset) {
+            const VMFunction *f = &program->functions[next_function++];
+            wr_printf(out, "== %s (params %d, frame %d, stack %d) ==\n",
+                      symbol_name(f->name), f->params, f->frame_size, f->max_stack);
+        }
+
+        int32_t op = program->code[offset];
+        const int32_t *args = program->code + offset + 1;
+        wr_printf(out, "%04d %4d  %-16s", offset, program->lines[offset], opcode_info[op].name);
+        switch (op) {
+            case OP_CONST: {
+                // Constants are untyped; small bit patterns are shown as integers
+                Value value = program->constants[args[0]];
+                if (value.i > -(1LL << 52) && value.i < (1LL << 52)) {
+                    wr_printf(out, "%d (%lld)", args[0], value.i);
+                } else {
+                    wr_printf(out, "%d (%g)", args[0], value.f);
+                }
+                break;
+            }
+            case OP_PRINT_STR:
+                wr_printf(out, "\"%s\"", program->strings + args[0]);
+                break;
+            case OP_CALL:
+                wr_printf(out, "%s %d", symbol_name(program->functions[args[0]].name), args[1]);
+                break;
+            case OP_STATEMENT:
+            case OP_ENTER:
+                wr_printf(out, "%d (%d:%d)", args[0], program->statements[args[0]].line,
+                          program->statements[args[0]].column);
+                break;
+            default:
+                for (int i = 0; i < opcode_info[op].operands; i++) {
+                    wr_printf(out, "%s%d", i ? " " : "", args[i]);
+                }
+                break;
+        }
+        wr_char(out, '\n');
+        offset += 1 + opcode_info[op].operands;
+    }
+}
@@ -0,0 +1,159 @@
+/* writer.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../../include/writer.h"
+
+// Default writer for each thread (stdout) and the current override
+static _Thread_local Writer stdout_writer;
+static _Thread_local int stdout_writer_ready = 0;
+static _Thread_local Writer *current_writer = NULL;
+
+// Spaces used for indentation, two per level
+static const char indent_spaces[] =
+    "                                                                "
+    "                                                                ";
+
+// Initialize a writer that flushes to a file descriptor
+void writer_init_fd(Writer *w, int fd) {
+    w->data = malloc(WRITER_BUFFER_SIZE);
+    w->cap = w->data ? WRITER_BUFFER_SIZE : 0;
+    w->len = 0;
+    w->fd = fd;
+    w->failed = (w->data == NULL);
+}
+
+// Initialize a writer that accumulates output in memory
+void writer_init_memory(Writer *w) {
+    w->data = malloc(WRITER_BUFFER_SIZE);
+    w->cap = w->data ? WRITER_BUFFER_SIZE : 0;
+    w->len = 0;
+    w->fd = -1;
+    w->failed = (w->data == NULL);
+}
+
+// Flush (for fd targets) and release the buffer
+void writer_free(Writer *w) {
+    writer_flush(w);
+    free(w->data);
+    w->data = NULL;
+    w->len = 0;
+    w->cap = 0;
+}
+
+// Write buffered bytes to the file descriptor with a single write(2)
+// (looping only on partial writes).  Memory writers keep their data.
+int writer_flush(Writer *w) {
+    if (w->fd < 0 || w->len == 0) {
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->fd, w->data + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    w->len = 0;
+    return w->failed ? -1 : 0;
+}
+
+// Discard buffered bytes without writing them
+void writer_reset(Writer *w) {
+    w->len = 0;
+}
+
+// Make room for 'needed' bytes: flush fd targets first, then grow the buffer
+void writer_grow(Writer *w, size_t needed) {
+    if (w->fd >= 0) {
+        writer_flush(w);
+        if (w->len + needed <= w->cap) {
+            return;
+        }
+    }
+
+    size_t cap = w->cap ? w->cap : WRITER_BUFFER_SIZE;
+    while (cap < w->len + needed) {
+        cap *= 2;
+    }
+    char *data = realloc(w->data, cap);
+    if (!data) {
+        w->failed = 1;
+        return;
+    }
+    w->data = data;
+    w->cap = cap;
+}
+
+// Formatted output for infrequent messages
+void wr_printf(Writer *w, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t space = w->cap - w->len;
+    int n = vsnprintf(w->data + w->len, space, format, args);
+    va_end(args);
+
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n >= space) {
+        wr_reserve(w, (size_t)n + 1);
+        if (w->cap - w->len < (size_t)n + 1) {
+            return;
+        }
+        va_start(args, format);
+        vsnprintf(w->data + w->len, w->cap - w->len, format, args);
+        va_end(args);
+    }
+    w->len += (size_t)n;
+}
+
+// Decimal integer formatting without stdio
+void wr_int(Writer *w, long long value) {
+    char digits[24];
+    int i = sizeof(digits);
+    unsigned long long v = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+
+    do {
+        digits[--i] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        digits[--i] = '-';
+    }
+    wr_bytes(w, digits + i, sizeof(digits) - i);
+}
+
+// Write two spaces per indentation level
+void wr_indent(Writer *w, int level) {
+    size_t n = (size_t)level * 2;
+    while (n > sizeof(indent_spaces) - 1) {
+        wr_bytes(w, indent_spaces, sizeof(indent_spaces) - 1);
+        n -= sizeof(indent_spaces) - 1;
+    }
+    wr_bytes(w, indent_spaces, n);
+}
+
+// Get the output writer for the calling thread (stdout by default)
+Writer *output_writer(void) {
+    if (current_writer) {
+        return current_writer;
+    }
+    if (!stdout_writer_ready) {
+        writer_init_fd(&stdout_writer, STDOUT_FILENO);
+        stdout_writer_ready = 1;
+    }
+    return &stdout_writer;
+}
+
+// Redirect the calling thread's output (NULL restores stdout)
+void set_output_writer(Writer *w) {
+    current_writer = w;
+}